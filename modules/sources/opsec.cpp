@@ -16,15 +16,23 @@
 #include <cstdlib>
 #include <ctime>
 #include <cstring>
+#include <cerrno>
 #include <string>
 #include <vector>
 #include <filesystem>
 #include <fstream>
+#include <sstream>
 #include <iostream>
+#include <chrono>
+#include <algorithm>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 namespace fs = std::filesystem;
 
@@ -41,6 +49,123 @@ static void ok(const std::string& m) { std::cout << GREEN << "[✓] " << RESET <
 static void err(const std::string& m) { std::cerr << RED << "[✗] " << RESET << m << "\n"; }
 static void warn(const std::string& m) { std::cout << YELLOW << "[!] " << RESET << m << "\n"; }
 
+// ============================================
+// PROCESS EXECUTION
+// ============================================
+
+// Commands are spawned from argv vectors (no intermediate /bin/sh).
+// stderr can be discarded, stdout captured, and a timeout kills the
+// child's whole process group.
+struct ProcSpec {
+    std::vector<std::string> argv;
+    bool capture = false;       // collect stdout into ProcResult::output
+    bool quiet = false;         // discard stderr
+    double timeout = 0;         // seconds, 0: none
+};
+
+struct ProcResult {
+    bool started = false;
+    int exit_code = -1;         // exit status, or 128 + signal
+    bool timed_out = false;
+    std::string output;
+    
+    bool ok() const { return started && exit_code == 0; }
+};
+
+static ProcResult run_proc(const ProcSpec& spec) {
+    ProcResult r;
+    if (spec.argv.empty()) return r;
+    std::cout.flush();
+    fflush(stdout);
+    
+    int pipefd[2] = {-1, -1};
+    if (spec.capture && pipe2(pipefd, O_CLOEXEC) != 0) return r;
+    int null = spec.quiet ? open("/dev/null", O_WRONLY | O_CLOEXEC) : -1;
+    
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawnattr_init(&attr);
+    if (pipefd[1] >= 0) posix_spawn_file_actions_adddup2(&fa, pipefd[1], STDOUT_FILENO);
+    if (null >= 0) posix_spawn_file_actions_adddup2(&fa, null, STDERR_FILENO);
+    if (spec.timeout > 0) {
+        posix_spawnattr_setpgroup(&attr, 0);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    }
+    
+    std::vector<char*> argv;
+    for (auto& a : spec.argv) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+    
+    pid_t pid;
+    int rc = posix_spawnp(&pid, argv[0], &fa, &attr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    if (pipefd[1] >= 0) close(pipefd[1]);
+    if (null >= 0) close(null);
+    if (rc != 0) {
+        if (pipefd[0] >= 0) close(pipefd[0]);
+        r.exit_code = 127;
+        return r;
+    }
+    r.started = true;
+    
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(spec.timeout);
+    int out_fd = pipefd[0];
+    int wstatus = 0;
+    char buf[8192];
+    while (true) {
+        if (out_fd < 0 && spec.timeout <= 0) {
+            while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR) {}
+            break;
+        }
+        if (waitpid(pid, &wstatus, WNOHANG) == pid) break;
+        
+        int wait_ms = 50;
+        if (spec.timeout > 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0 && !r.timed_out) {
+                kill(-pid, SIGKILL);
+                r.timed_out = true;
+            }
+            wait_ms = std::max<long>(1, std::min<long>(wait_ms, left));
+        }
+        
+        if (out_fd >= 0) {
+            pollfd p{out_fd, POLLIN, 0};
+            if (poll(&p, 1, wait_ms) > 0) {
+                ssize_t n = read(out_fd, buf, sizeof(buf));
+                if (n > 0) r.output.append(buf, n);
+                else if (n == 0 || errno != EINTR) { close(out_fd); out_fd = -1; }
+            }
+        } else {
+            poll(nullptr, 0, wait_ms);
+        }
+    }
+    if (out_fd >= 0) {
+        fcntl(out_fd, F_SETFL, O_NONBLOCK);
+        ssize_t n;
+        while ((n = read(out_fd, buf, sizeof(buf))) > 0) r.output.append(buf, n);
+        close(out_fd);
+    }
+    
+    if (WIFEXITED(wstatus)) r.exit_code = WEXITSTATUS(wstatus);
+    else if (WIFSIGNALED(wstatus)) r.exit_code = 128 + WTERMSIG(wstatus);
+    return r;
+}
+
+// Run the first command that succeeds, letting its output through
+static bool run_first(const std::vector<std::vector<std::string>>& candidates) {
+    for (auto& argv : candidates) {
+        ProcSpec spec;
+        spec.argv = argv;
+        spec.quiet = true;
+        if (run_proc(spec).ok()) return true;
+    }
+    return false;
+}
+
 // ============================================
 // SECURE FILE DELETION
 // ============================================
@@ -264,15 +389,24 @@ static int cmd_netmon(int argc, char** argv) {
     
     // Check listening ports
     std::cout << "\n" << CYAN << "Listening Ports:" << RESET << "\n";
-    system("netstat -tuln 2>/dev/null || ss -tuln 2>/dev/null");
+    run_first({{"netstat", "-tuln"}, {"ss", "-tuln"}});
     
     // Check active connections
     std::cout << "\n" << CYAN << "Active Connections:" << RESET << "\n";
-    system("netstat -tun 2>/dev/null || ss -tun 2>/dev/null");
+    run_first({{"netstat", "-tun"}, {"ss", "-tun"}});
     
-    // Check for unusual processes with network access
+    // Check for unusual processes with network access (lsof can hang on
+    // stale network mounts, so it gets a deadline)
     std::cout << "\n" << CYAN << "Processes with Network Access:" << RESET << "\n";
-    system("lsof -i 2>/dev/null | head -20");
+    ProcSpec lsof;
+    lsof.argv = {"lsof", "-i"};
+    lsof.capture = lsof.quiet = true;
+    lsof.timeout = 10;
+    ProcResult r = run_proc(lsof);
+    std::istringstream lines(r.output);
+    std::string line;
+    for (int i = 0; i < 20 && std::getline(lines, line); i++) std::cout << line << "\n";
+    if (r.timed_out) warn("lsof timed out");
     
     return 0;
 }
@@ -363,6 +497,13 @@ static int cmd_cleantmp(int argc, char** argv) {
 // ANTI-FORENSICS TOOLKIT
 // ============================================
 
+static void shred_logs() {
+    ProcSpec spec;
+    spec.argv = {"find", "/var/log", "-type", "f", "-exec", "shred", "-vfz", "-n", "3", "{}", ";"};
+    spec.quiet = true;
+    run_proc(spec);
+}
+
 static int cmd_antiforensics(int argc, char** argv) {
     std::cout << PINK << "=== Anti-Forensics Toolkit ===" << RESET << "\n\n";
     
@@ -389,7 +530,7 @@ static int cmd_antiforensics(int argc, char** argv) {
                 return 1;
             }
             status("Clearing system logs...");
-            system("find /var/log -type f -exec shred -vfz -n 3 {} \\; 2>/dev/null");
+            shred_logs();
             ok("System logs cleared");
             return 0;
         case 4:
@@ -398,7 +539,7 @@ static int cmd_antiforensics(int argc, char** argv) {
                 return 1;
             }
             status("Wiping swap space...");
-            system("swapoff -a && swapon -a");
+            if (run_first({{"swapoff", "-a"}})) run_first({{"swapon", "-a"}});
             ok("Swap wiped");
             return 0;
         case 5:
@@ -406,7 +547,7 @@ static int cmd_antiforensics(int argc, char** argv) {
             cmd_cleantmp(0, nullptr);
             if (geteuid() == 0) {
                 status("Clearing system logs...");
-                system("find /var/log -type f -exec shred -vfz -n 3 {} \\; 2>/dev/null");
+                shred_logs();
             }
             ok("Full cleanup complete");
             return 0;
@@ -7,20 +7,52 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cstdint>
+#include <cerrno>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <set>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
 #include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <iterator>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
 #include <sched.h>
 #include <fcntl.h>
+#include <linux/fs.h>
+#include <dirent.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/prctl.h>
+#include <sys/file.h>
+#include <sys/xattr.h>
+#include <sys/sysmacros.h>
+#include <dlfcn.h>
+#include <zlib.h>
 #include <pwd.h>
 
 namespace fs = std::filesystem;
@@ -51,69 +83,239 @@ static std::string ws_config() {
 // CONFIGURATION PARSER
 // ============================================
 
+// The file is read into one buffer and parsed in place: keys and values
+// are string_views into it, kept in a flat table sorted by key, so
+// lookups are binary searches and prefix queries are a contiguous range.
+// Values assigned with set() are stored by the parser; buffers never
+// move once stored, so a live entry's views stay valid. The slot of a
+// value that is overwritten or erased is reused, so repeated saves don't
+// grow the parser.
 class ConfigParser {
 public:
-    std::map<std::string, std::string> data;
+    struct Entry {
+        std::string_view key;
+        std::string_view val;
+    };
+    
+    // Entries whose key starts with a prefix, in key order
+    struct Range {
+        const Entry* first;
+        const Entry* last;
+        const Entry* begin() const { return first; }
+        const Entry* end() const { return last; }
+        bool empty() const { return first == last; }
+    };
+    
+    ConfigParser() = default;
+    ConfigParser(ConfigParser&&) = default;
+    ConfigParser& operator=(ConfigParser&&) = default;
+    
+    // Entries are views into storage_, so a copy has to own its own text
+    ConfigParser(const ConfigParser& other) { *this = other; }
+    ConfigParser& operator=(const ConfigParser& other) {
+        if (this == &other) return *this;
+        entries_.clear();
+        storage_.clear();
+        owned_.clear();
+        free_.clear();
+        for (auto& e : other.entries_) {
+            std::string_view k = store(e.key);
+            entries_.push_back(Entry{k, store(e.val)});
+        }
+        return *this;
+    }
     
     bool load(const std::string& path) {
-        if (!fs::exists(path)) return false;
-        std::ifstream f(path);
-        std::string line;
-        while (std::getline(f, line)) {
-            // Skip comments and empty lines
-            line = trim(line);
-            if (line.empty() || line[0] == '#') continue;
-            
-            size_t eq = line.find(':');
-            if (eq == std::string::npos) eq = line.find('=');
-            if (eq == std::string::npos) continue;
-            
-            std::string key = trim(line.substr(0, eq));
-            std::string val = trim(line.substr(eq + 1));
-            
-            // Remove quotes if present
-            if (val.size() >= 2 && val[0] == '"' && val.back() == '"')
-                val = val.substr(1, val.size() - 2);
-            
-            data[key] = val;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        
+        std::string buf;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) buf.reserve(st.st_size);
+        char chunk[65536];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) != 0) {
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) break;
+            buf.append(chunk, n);
         }
+        close(fd);
+        
+        storage_.push_back(std::move(buf));
+        parse(storage_.back());
         return true;
     }
     
-    void save(const std::string& path) {
+    bool save(const std::string& path) {
         fs::create_directories(fs::path(path).parent_path());
-        std::ofstream f(path);
-        for (auto& [k, v] : data) {
-            f << k << ": " << v << "\n";
+        std::string out;
+        for (auto& e : entries_) {
+            out.append(e.key);
+            out += ": ";
+            out.append(e.val);
+            out += '\n';
+        }
+        
+        // Temp file + rename so a concurrent reader never sees half a config
+        std::string tmp = path + ".tmp." + std::to_string(getpid());
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        size_t off = 0;
+        while (off < out.size()) {
+            ssize_t n = write(fd, out.data() + off, out.size() - off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            off += n;
+        }
+        bool good = off == out.size() && fdatasync(fd) == 0;
+        good = close(fd) == 0 && good;
+        if (!good || rename(tmp.c_str(), path.c_str()) != 0) {
+            unlink(tmp.c_str());
+            return false;
         }
+        return true;
+    }
+    
+    std::string get(std::string_view key, const std::string& def = "") const {
+        auto it = find(key);
+        return it != entries_.end() && it->key == key ? std::string(it->val) : def;
     }
     
-    std::string get(const std::string& key, const std::string& def = "") const {
-        auto it = data.find(key);
-        return it != data.end() ? it->second : def;
+    void set(std::string_view key, std::string_view val) {
+        auto it = find(key);
+        if (it != entries_.end() && it->key == key) {
+            if (it->val == val) return;
+            std::string_view old = it->val;
+            it->val = store(val);
+            release(old);
+            return;
+        }
+        std::string_view v = store(val);
+        entries_.insert(it, Entry{store(key), v});
     }
     
-    void set(const std::string& key, const std::string& val) {
-        data[key] = val;
+    bool has(std::string_view key) const {
+        auto it = find(key);
+        return it != entries_.end() && it->key == key;
     }
     
-    bool has(const std::string& key) const {
-        return data.find(key) != data.end();
+    Range prefix(std::string_view prefix) const {
+        auto first = find(prefix);
+        auto last = first;
+        while (last != entries_.end() && last->key.substr(0, prefix.size()) == prefix) ++last;
+        return {entries_.data() + (first - entries_.begin()), entries_.data() + (last - entries_.begin())};
     }
     
-    std::vector<std::string> get_list(const std::string& prefix) const {
-        std::vector<std::string> result;
-        for (auto& [k, v] : data) {
-            if (k.find(prefix) == 0) result.push_back(v);
+    void erase_prefix(std::string_view prefix) {
+        Range r = this->prefix(prefix);
+        auto first = entries_.begin() + (r.first - entries_.data());
+        for (auto it = first; it != first + (r.last - r.first); ++it) {
+            release(it->key);
+            release(it->val);
         }
+        entries_.erase(first, first + (r.last - r.first));
+    }
+    
+    std::vector<std::string> get_list(std::string_view prefix) const {
+        std::vector<std::string> result;
+        for (auto& e : this->prefix(prefix)) result.emplace_back(e.val);
         return result;
     }
     
+    const std::vector<Entry>& entries() const { return entries_; }
+    
 private:
-    static std::string trim(const std::string& s) {
+    std::vector<Entry> entries_;
+    std::deque<std::string> storage_;
+    std::unordered_map<const char*, size_t> owned_;    // set() strings by address → slot
+    std::vector<size_t> free_;                          // slots no entry uses
+    
+    std::string_view store(std::string_view s) {
+        size_t slot;
+        if (!free_.empty()) {
+            slot = free_.back();
+            free_.pop_back();
+            storage_[slot].assign(s.data(), s.size());
+        } else {
+            slot = storage_.size();
+            storage_.emplace_back(s);
+        }
+        owned_[storage_[slot].data()] = slot;
+        return storage_[slot];
+    }
+    
+    // Loaded text isn't owned per entry and stays put
+    void release(std::string_view s) {
+        auto it = owned_.find(s.data());
+        if (it == owned_.end()) return;
+        free_.push_back(it->second);
+        owned_.erase(it);
+    }
+    
+    std::vector<Entry>::iterator find(std::string_view key) {
+        return std::lower_bound(entries_.begin(), entries_.end(), key,
+                                [](const Entry& e, std::string_view k) { return e.key < k; });
+    }
+    std::vector<Entry>::const_iterator find(std::string_view key) const {
+        return std::lower_bound(entries_.begin(), entries_.end(), key,
+                                [](const Entry& e, std::string_view k) { return e.key < k; });
+    }
+    
+    void parse(std::string_view buf) {
+        std::vector<Entry> parsed;
+        size_t pos = 0;
+        while (pos < buf.size()) {
+            size_t eol = buf.find('\n', pos);
+            if (eol == std::string_view::npos) eol = buf.size();
+            std::string_view line = trim(buf.substr(pos, eol - pos));
+            pos = eol + 1;
+            
+            // Skip comments and empty lines
+            if (line.empty() || line[0] == '#') continue;
+            
+            size_t eq = line.find(':');
+            if (eq == std::string_view::npos) eq = line.find('=');
+            if (eq == std::string_view::npos) continue;
+            
+            std::string_view key = trim(line.substr(0, eq));
+            std::string_view val = trim(line.substr(eq + 1));
+            
+            // Remove quotes if present
+            if (val.size() >= 2 && val[0] == '"' && val.back() == '"')
+                val = val.substr(1, val.size() - 2);
+            
+            parsed.push_back({key, val});
+        }
+        
+        if (!entries_.empty()) {
+            for (auto& e : parsed) merge(e);
+            return;
+        }
+        
+        // Sort, letting the last occurrence of a key win
+        std::stable_sort(parsed.begin(), parsed.end(),
+                         [](const Entry& a, const Entry& b) { return a.key < b.key; });
+        for (size_t i = 0; i < parsed.size(); i++) {
+            if (i + 1 < parsed.size() && parsed[i + 1].key == parsed[i].key) continue;
+            entries_.push_back(parsed[i]);
+        }
+    }
+    
+    void merge(const Entry& e) {
+        auto it = find(e.key);
+        if (it != entries_.end() && it->key == e.key) {
+            std::string_view old = it->val;
+            it->val = e.val;
+            release(old);
+        } else {
+            entries_.insert(it, e);
+        }
+    }
+    
+    static std::string_view trim(std::string_view s) {
         size_t start = 0, end = s.size();
-        while (start < end && std::isspace(s[start])) start++;
-        while (end > start && std::isspace(s[end - 1])) end--;
+        while (start < end && std::isspace((unsigned char)s[start])) start++;
+        while (end > start && std::isspace((unsigned char)s[end - 1])) end--;
         return s.substr(start, end - start);
     }
 };
@@ -122,6 +324,45 @@ private:
 // WORKSPACE STRUCTURE
 // ============================================
 
+// cgroup v2 settings a workspace may carry, and the kernel defaults they
+// return to when unset
+static const std::pair<const char*, const char*> CGROUP_LIMITS[] = {
+    {"cpu.max", "max"}, {"cpu.weight", "100"}, {"memory.max", "max"},
+    {"memory.high", "max"}, {"io.weight", "default 100"}};
+
+// Default of a cgroup setting, or null if `key` isn't one
+static const char* cgroup_default(const std::string& key) {
+    for (auto& [k, def] : CGROUP_LIMITS)
+        if (key == k) return def;
+    return nullptr;
+}
+
+// Split a comma or space separated config value
+static std::vector<std::string> split_list(const std::string& s) {
+    std::vector<std::string> out;
+    std::string cur;
+    for (char c : s) {
+        if (c == ',' || std::isspace((unsigned char)c)) {
+            if (!cur.empty()) out.push_back(cur);
+            cur.clear();
+        } else {
+            cur += c;
+        }
+    }
+    if (!cur.empty()) out.push_back(cur);
+    return out;
+}
+
+// One init.N entry, with optional init.N.inputs (paths), init.N.run
+// (always/once) and init.N.after (ids of steps it needs)
+struct InitStep {
+    std::string id;
+    std::string cmd;
+    std::vector<std::string> inputs;
+    std::vector<std::string> after;
+    bool once = false;
+};
+
 struct Workspace {
     std::string name;
     std::string path;
@@ -139,13 +380,51 @@ struct Workspace {
     // Environment
     std::map<std::string, std::string> env_vars;
     std::vector<std::string> mounts;
-    std::vector<std::string> init_cmds;
+    std::vector<InitStep> init_steps;
     
     // Metadata
     std::string created;
     std::string author;
     std::vector<std::string> tags;
     
+    // Workspaces that must be built before this one (ws-build --all/--tag)
+    std::vector<std::string> depends;
+    
+    // Build output cache (opt-in)
+    bool build_cache = false;
+    std::vector<std::string> cache_inputs;
+    std::vector<std::string> cache_outputs;
+    
+    // Object cache in front of the compiler (c/cpp)
+    bool compiler_cache = true;
+    std::string ccache_size = "5G";
+    
+    // Build hosts for compiles that miss the compiler cache (worker.N)
+    std::vector<std::string> workers;
+    
+    // Shared per-language dependency caches: rw, ro or off
+    std::string dep_cache = "rw";
+    
+    // build/ (or tmpfs_path.N) in memory while entered isolated
+    bool build_tmpfs = false;
+    std::string tmpfs_size = "512M";
+    std::vector<std::string> tmpfs_paths;
+    std::vector<std::string> tmpfs_keep;
+    
+    // cgroup v2 settings (cpu.max, cpu.weight, memory.max, memory.high, io.weight)
+    std::map<std::string, std::string> limits;
+    
+    // Layers kept before the oldest snapshot is merged into the directory
+    size_t snapshot_depth = 8;
+    
+    // Percent over recent runs before ws-perf flags a regression
+    double perf_threshold = 20;
+    
+    // Byte offset of this entry's [name] section in workspaces.conf, or of
+    // its "+name" record in workspaces.journal when reg_in_journal is set
+    size_t reg_offset = 0;
+    bool reg_in_journal = false;
+    
     ConfigParser config;
     
     bool load_config() {
@@ -167,21 +446,54 @@ struct Workspace {
         author = config.get("author");
         
         // Load environment variables
-        for (auto& [k, v] : config.data) {
-            if (k.find("env.") == 0) {
-                env_vars[k.substr(4)] = v;
-            }
-        }
+        for (auto& e : config.prefix("env."))
+            env_vars[std::string(e.key.substr(4))] = std::string(e.val);
         
         // Load lists
         mounts = config.get_list("mount.");
-        init_cmds = config.get_list("init.");
         tags = config.get_list("tag.");
+        depends = config.get_list("depends.");
+        
+        build_cache = config.get("build_cache") == "true";
+        cache_inputs = config.get_list("cache_input.");
+        cache_outputs = config.get_list("cache_output.");
+        compiler_cache = config.get("compiler_cache") != "false";
+        ccache_size = config.get("ccache_size", "5G");
+        workers = config.get_list("worker.");
+        dep_cache = config.get("dep_cache", "rw");
+        build_tmpfs = config.get("build_tmpfs") == "true";
+        tmpfs_size = config.get("tmpfs_size", "512M");
+        tmpfs_paths = config.get_list("tmpfs_path.");
+        tmpfs_keep = config.get_list("tmpfs_keep.");
+        limits.clear();
+        for (auto& [key, def] : CGROUP_LIMITS)
+            if (config.has(key)) limits[key] = config.get(key);
+        snapshot_depth = std::max(1L, std::strtol(config.get("snapshot_depth", "8").c_str(), nullptr, 10));
+        perf_threshold = std::strtod(config.get("perf_threshold", "20").c_str(), nullptr);
+        
+        // Init steps, ordered by their numeric id
+        std::vector<std::pair<long, std::string>> ids;
+        for (auto& e : config.prefix("init.")) {
+            std::string id(e.key.substr(5));
+            if (id.empty() || id.find_first_not_of("0123456789") != std::string::npos) continue;
+            ids.push_back({std::atol(id.c_str()), id});
+        }
+        std::sort(ids.begin(), ids.end());
+        init_steps.clear();
+        for (auto& [n, id] : ids) {
+            InitStep step;
+            step.id = id;
+            step.cmd = config.get("init." + id);
+            step.inputs = split_list(config.get("init." + id + ".inputs"));
+            step.after = split_list(config.get("init." + id + ".after"));
+            step.once = config.get("init." + id + ".run") == "once";
+            init_steps.push_back(step);
+        }
         
         return true;
     }
     
-    void save_config() {
+    bool save_config() {
         config.set("name", name);
         config.set("display_name", display_name);
         config.set("description", description);
@@ -203,15 +515,53 @@ struct Workspace {
         }
         
         // Save lists
+        config.erase_prefix("mount.");
         for (size_t i = 0; i < mounts.size(); i++)
             config.set("mount." + std::to_string(i), mounts[i]);
-        for (size_t i = 0; i < init_cmds.size(); i++)
-            config.set("init." + std::to_string(i), init_cmds[i]);
+        for (auto& step : init_steps)
+            config.set("init." + step.id, step.cmd);
+        config.erase_prefix("tag.");
         for (size_t i = 0; i < tags.size(); i++)
             config.set("tag." + std::to_string(i), tags[i]);
+        config.erase_prefix("depends.");
+        for (size_t i = 0; i < depends.size(); i++)
+            config.set("depends." + std::to_string(i), depends[i]);
+        
+        if (build_cache || config.has("build_cache"))
+            config.set("build_cache", build_cache ? "true" : "false");
+        config.erase_prefix("cache_input.");
+        for (size_t i = 0; i < cache_inputs.size(); i++)
+            config.set("cache_input." + std::to_string(i), cache_inputs[i]);
+        config.erase_prefix("cache_output.");
+        for (size_t i = 0; i < cache_outputs.size(); i++)
+            config.set("cache_output." + std::to_string(i), cache_outputs[i]);
+        if (!compiler_cache || config.has("compiler_cache"))
+            config.set("compiler_cache", compiler_cache ? "true" : "false");
+        if (ccache_size != "5G" || config.has("ccache_size")) config.set("ccache_size", ccache_size);
+        config.erase_prefix("worker.");
+        for (size_t i = 0; i < workers.size(); i++)
+            config.set("worker." + std::to_string(i), workers[i]);
+        if (dep_cache != "rw" || config.has("dep_cache")) config.set("dep_cache", dep_cache);
+        if (build_tmpfs || config.has("build_tmpfs"))
+            config.set("build_tmpfs", build_tmpfs ? "true" : "false");
+        if (tmpfs_size != "512M" || config.has("tmpfs_size")) config.set("tmpfs_size", tmpfs_size);
+        config.erase_prefix("tmpfs_path.");
+        config.erase_prefix("tmpfs_keep.");
+        for (size_t i = 0; i < tmpfs_paths.size(); i++)
+            config.set("tmpfs_path." + std::to_string(i), tmpfs_paths[i]);
+        for (size_t i = 0; i < tmpfs_keep.size(); i++)
+            config.set("tmpfs_keep." + std::to_string(i), tmpfs_keep[i]);
+        for (auto& [k, v] : limits) config.set(k, v);
+        if (snapshot_depth != 8 || config.has("snapshot_depth"))
+            config.set("snapshot_depth", std::to_string(snapshot_depth));
+        if (perf_threshold != 20 || config.has("perf_threshold")) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%g", perf_threshold);
+            config.set("perf_threshold", buf);
+        }
         
         fs::create_directories(path + "/.ws");
-        config.save(path + "/.ws/config");
+        return config.save(path + "/.ws/config");
     }
 };
 
@@ -219,21 +569,127 @@ struct Workspace {
 // WORKSPACE MANAGEMENT
 // ============================================
 
-static std::vector<Workspace> load_workspaces() {
-    std::vector<Workspace> ws;
-    std::string cfg = ws_config();
-    if (!fs::exists(cfg)) return ws;
-    
-    std::ifstream f(cfg);
-    std::string line;
+// The registry is a snapshot (workspaces.conf) plus an append-only journal
+// (workspaces.journal) of "+name<TAB>path" and "-name" records. Writers
+// serialise on an flock of workspaces.lock, append one record with a
+// single O_APPEND write and fdatasync, and every so often compact: the
+// folded state is written as a new snapshot and an empty journal, each
+// via fsync + rename, so a crash leaves either the old or the new file.
+//
+// Readers take no lock. Both files start with "# generation N"; a reader
+// applies the journal only when its generation matches the snapshot's.
+// An older journal is already folded into the snapshot and is ignored;
+// a newer one means a compaction is halfway through, and the reader
+// tries again.
+
+static const size_t JOURNAL_MAX_RECORDS = 256;
+
+static std::string ws_journal() {
+    return home_dir() + "/.config/dreamland/workspaces.journal";
+}
+
+static std::string ws_lock() {
+    return home_dir() + "/.config/dreamland/workspaces.lock";
+}
+
+static int64_t mtime_ns(const struct stat& st) {
+    return (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+// What a reader saw: mtimes taken before reading, sizes of what was read
+struct RegistryStamp {
+    int64_t conf_mtime = 0;
+    uint64_t conf_size = 0;
+    int64_t journal_mtime = 0;
+    uint64_t journal_size = 0;
+};
+
+// Read a whole file; false if it doesn't exist
+static bool read_whole(const std::string& path, std::string& out, int64_t* mtime = nullptr) {
+    out.clear();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        if (mtime) *mtime = mtime_ns(st);
+        out.reserve(st.st_size);
+    }
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        out.append(buf, n);
+    }
+    close(fd);
+    return true;
+}
+
+static uint64_t registry_generation(const std::string& buf) {
+    static const char tag[] = "# generation ";
+    if (buf.compare(0, sizeof(tag) - 1, tag) != 0) return 0;
+    return std::strtoull(buf.c_str() + sizeof(tag) - 1, nullptr, 10);
+}
+
+// Write a file atomically: temp file, fsync, rename
+static bool write_atomic(const std::string& path, const std::string& data) {
+    std::string tmp = path + ".tmp." + std::to_string(getpid());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = write(fd, data.data() + off, data.size() - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        off += n;
+    }
+    bool good = off == data.size() && fsync(fd) == 0;
+    good = close(fd) == 0 && good;
+    if (!good || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+static void fsync_dir(const std::string& path) {
+    int fd = open(fs::path(path).parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// Exclusive flock on `path`, created if needed. Returns the fd to close
+// when done, or -1.
+static int lock_file(const std::string& path) {
+    fs::create_directories(fs::path(path).parent_path());
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    while (flock(fd, LOCK_EX) != 0) {
+        if (errno != EINTR) { close(fd); return -1; }
+    }
+    return fd;
+}
+
+// Parse the snapshot's [name] sections. reg_offset records where each one
+// starts so the index can point back into the file.
+static void parse_snapshot(const std::string& buf, std::vector<Workspace>& ws) {
     Workspace cur;
-    
-    while (std::getline(f, line)) {
+    size_t pos = 0;
+    while (pos < buf.size()) {
+        size_t nl = buf.find('\n', pos);
+        if (nl == std::string::npos) nl = buf.size();
+        std::string line = buf.substr(pos, nl - pos);
+        size_t line_off = pos;
+        pos = nl + 1;
+        
         if (line.empty() || line[0] == '#') continue;
         if (line[0] == '[' && line.back() == ']') {
             if (!cur.name.empty()) ws.push_back(cur);
             cur = Workspace();
             cur.name = line.substr(1, line.size() - 2);
+            cur.reg_offset = line_off;
             continue;
         }
         size_t eq = line.find('=');
@@ -242,27 +698,347 @@ static std::vector<Workspace> load_workspaces() {
         if (k == "path") cur.path = v;
     }
     if (!cur.name.empty()) ws.push_back(cur);
-    
-    // Load detailed config for each workspace
+}
+
+// Apply journal records on top of the snapshot. Only complete lines
+// count, so a record being appended right now is simply not seen yet.
+static void replay_journal(const std::string& buf, std::vector<Workspace>& ws) {
+    size_t pos = 0, nl;
+    while ((nl = buf.find('\n', pos)) != std::string::npos) {
+        std::string line = buf.substr(pos, nl - pos);
+        size_t line_off = pos;
+        pos = nl + 1;
+        if (line.size() < 2) continue;
+        
+        if (line[0] == '+') {
+            size_t tab = line.find('\t');
+            if (tab == std::string::npos) continue;
+            std::string name = line.substr(1, tab - 1);
+            auto it = std::find_if(ws.begin(), ws.end(), [&](const Workspace& w) { return w.name == name; });
+            if (it == ws.end()) {
+                ws.push_back(Workspace());
+                it = ws.end() - 1;
+                it->name = name;
+            }
+            it->path = line.substr(tab + 1);
+            it->reg_offset = line_off;
+            it->reg_in_journal = true;
+        } else if (line[0] == '-') {
+            std::string name = line.substr(1);
+            ws.erase(std::remove_if(ws.begin(), ws.end(), [&](const Workspace& w) { return w.name == name; }),
+                     ws.end());
+        }
+    }
+}
+
+// Current registry entries (names and paths only). Never blocks on
+// writers except after repeatedly catching a compaction mid-way.
+static std::vector<Workspace> read_registry(RegistryStamp* stamp = nullptr) {
+    for (int attempt = 0;; attempt++) {
+        RegistryStamp st;
+        std::string snap, journal;
+        read_whole(ws_config(), snap, &st.conf_mtime);
+        bool have_journal = read_whole(ws_journal(), journal, &st.journal_mtime);
+        st.conf_size = snap.size();
+        st.journal_size = journal.size();
+        
+        uint64_t sgen = registry_generation(snap);
+        uint64_t jgen = registry_generation(journal);
+        if (have_journal && jgen > sgen) {
+            if (attempt < 8) { sched_yield(); continue; }
+            // Still mid-compaction: wait for the writer to finish
+            int lfd = lock_file(ws_lock());
+            if (lfd >= 0) close(lfd);
+            if (attempt < 9) continue;
+        }
+        
+        std::vector<Workspace> ws;
+        parse_snapshot(snap, ws);
+        if (have_journal && jgen == sgen) replay_journal(journal, ws);
+        if (stamp) *stamp = st;
+        return ws;
+    }
+}
+
+// Full registry with every workspace config loaded. Only commands that
+// really need all of them (ws-list) should call this.
+static std::vector<Workspace> load_workspaces() {
+    auto ws = read_registry();
     for (auto& w : ws) {
         w.load_config();
     }
-    
     return ws;
 }
 
-static void save_workspaces(const std::vector<Workspace>& ws) {
-    fs::create_directories(fs::path(ws_config()).parent_path());
-    std::ofstream f(ws_config());
+// ============================================
+// REGISTRY INDEX
+// ============================================
+//
+// workspaces.idx is an open-addressing hash table over the registry so
+// a single name can be resolved with a handful of preads instead of a
+// full parse. Layout:
+//
+//   IndexHeader | IndexSlot[slot_count] | (IndexRecord name path)...
+//
+// The header remembers the snapshot and journal it was built from; a
+// mismatch (or a record that no longer lines up with its [name] section
+// or journal line) marks the index stale and it is rebuilt on the spot.
+
+static const uint32_t WS_INDEX_MAGIC = 0x58445357; // "WSDX"
+static const uint32_t WS_INDEX_VERSION = 3;
+
+struct IndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    int64_t conf_mtime;
+    uint64_t conf_size;
+    int64_t journal_mtime;
+    uint64_t journal_size;
+    uint32_t slot_count;
+    uint32_t entry_count;
+};
+
+struct IndexSlot {
+    uint32_t hash;
+    uint32_t rec_off;       // 0 = empty slot
+};
+
+struct IndexRecord {
+    uint64_t reg_off;       // offset of "[name]" in the snapshot or "+name" in the journal
+    uint16_t name_len;
+    uint16_t path_len;
+    uint32_t in_journal;
+};
+
+enum IndexResult { IDX_HIT, IDX_MISS, IDX_STALE };
+
+static std::string ws_index() {
+    return home_dir() + "/.config/dreamland/workspaces.idx";
+}
+
+static uint32_t fnv1a(const std::string& s) {
+    uint32_t h = 2166136261u;
+    for (unsigned char c : s) { h ^= c; h *= 16777619u; }
+    return h;
+}
+
+static bool pread_full(int fd, void* buf, size_t len, off_t off) {
+    return pread(fd, buf, len, off) == (ssize_t)len;
+}
+
+static bool build_index(const std::vector<Workspace>& ws, const RegistryStamp& stamp) {
+    uint32_t slots = 16;
+    while (slots < ws.size() * 2) slots <<= 1;
+    
+    std::vector<IndexSlot> table(slots, IndexSlot{0, 0});
+    std::string records;
+    size_t rec_base = sizeof(IndexHeader) + slots * sizeof(IndexSlot);
+    
     for (auto& w : ws) {
-        f << "[" << w.name << "]\n";
-        f << "path=" << w.path << "\n\n";
+        if (w.name.size() > UINT16_MAX || w.path.size() > UINT16_MAX) continue;
+        
+        IndexRecord rec{};
+        rec.reg_off = w.reg_offset;
+        rec.name_len = w.name.size();
+        rec.path_len = w.path.size();
+        rec.in_journal = w.reg_in_journal;
+        
+        uint32_t h = fnv1a(w.name);
+        uint32_t i = h & (slots - 1);
+        while (table[i].rec_off) i = (i + 1) & (slots - 1);
+        table[i] = IndexSlot{h, (uint32_t)(rec_base + records.size())};
+        
+        records.append((const char*)&rec, sizeof(rec));
+        records += w.name;
+        records += w.path;
+    }
+    
+    IndexHeader hdr{};
+    hdr.magic = WS_INDEX_MAGIC;
+    hdr.version = WS_INDEX_VERSION;
+    hdr.conf_mtime = stamp.conf_mtime;
+    hdr.conf_size = stamp.conf_size;
+    hdr.journal_mtime = stamp.journal_mtime;
+    hdr.journal_size = stamp.journal_size;
+    hdr.slot_count = slots;
+    hdr.entry_count = ws.size();
+    
+    // Write to a temp file and rename so readers never see a torn index
+    std::string tmp = ws_index() + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        if (!f) return false;
+        f.write((const char*)&hdr, sizeof(hdr));
+        f.write((const char*)table.data(), table.size() * sizeof(IndexSlot));
+        f.write(records.data(), records.size());
+        if (!f) { f.close(); unlink(tmp.c_str()); return false; }
     }
+    if (rename(tmp.c_str(), ws_index().c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
 }
 
-static Workspace* find_ws(std::vector<Workspace>& ws, const std::string& name) {
-    for (auto& w : ws) if (w.name == name) return &w;
-    return nullptr;
+static IndexResult index_lookup(const std::string& name, Workspace& out) {
+    struct stat conf_st, journal_st;
+    bool have_conf = stat(ws_config().c_str(), &conf_st) == 0;
+    bool have_journal = stat(ws_journal().c_str(), &journal_st) == 0;
+    if (!have_conf && !have_journal) return IDX_MISS;
+    
+    int fd = open(ws_index().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return IDX_STALE;
+    
+    IndexHeader hdr;
+    if (!pread_full(fd, &hdr, sizeof(hdr), 0) ||
+        hdr.magic != WS_INDEX_MAGIC || hdr.version != WS_INDEX_VERSION ||
+        hdr.conf_mtime != (have_conf ? mtime_ns(conf_st) : 0) ||
+        hdr.conf_size != (have_conf ? (uint64_t)conf_st.st_size : 0) ||
+        hdr.journal_mtime != (have_journal ? mtime_ns(journal_st) : 0) ||
+        hdr.journal_size != (have_journal ? (uint64_t)journal_st.st_size : 0) ||
+        hdr.slot_count == 0 || (hdr.slot_count & (hdr.slot_count - 1))) {
+        close(fd);
+        return IDX_STALE;
+    }
+    
+    uint32_t h = fnv1a(name);
+    uint32_t mask = hdr.slot_count - 1;
+    IndexResult result = IDX_MISS;
+    bool in_journal = false;
+    
+    for (uint32_t i = h & mask, n = 0; n < hdr.slot_count; i = (i + 1) & mask, n++) {
+        IndexSlot slot;
+        if (!pread_full(fd, &slot, sizeof(slot), sizeof(hdr) + i * sizeof(IndexSlot))) {
+            result = IDX_STALE;
+            break;
+        }
+        if (!slot.rec_off) break;
+        if (slot.hash != h) continue;
+        
+        IndexRecord rec;
+        if (!pread_full(fd, &rec, sizeof(rec), slot.rec_off)) { result = IDX_STALE; break; }
+        std::string rname(rec.name_len, '\0'), rpath(rec.path_len, '\0');
+        if (!pread_full(fd, &rname[0], rec.name_len, slot.rec_off + sizeof(rec)) ||
+            !pread_full(fd, &rpath[0], rec.path_len, slot.rec_off + sizeof(rec) + rec.name_len)) {
+            result = IDX_STALE;
+            break;
+        }
+        if (rname != name) continue;
+        
+        out = Workspace();
+        out.name = rname;
+        out.path = rpath;
+        out.reg_offset = rec.reg_off;
+        out.reg_in_journal = rec.in_journal;
+        in_journal = rec.in_journal;
+        result = IDX_HIT;
+        break;
+    }
+    close(fd);
+    
+    // Make sure the record still points at its own section or journal line
+    if (result == IDX_HIT) {
+        std::string expect = in_journal ? "+" + name + "\t" : "[" + name + "]";
+        std::string got(expect.size(), '\0');
+        int cfd = open((in_journal ? ws_journal() : ws_config()).c_str(), O_RDONLY | O_CLOEXEC);
+        bool match = cfd >= 0 && pread_full(cfd, &got[0], got.size(), out.reg_offset) && got == expect;
+        if (cfd >= 0) close(cfd);
+        if (!match) result = IDX_STALE;
+    }
+    return result;
+}
+
+// Resolve a workspace name to its registry entry without loading its
+// config. Rebuilds the index if it is missing or out of date.
+static bool resolve_ws(const std::string& name, Workspace& out) {
+    IndexResult r = index_lookup(name, out);
+    if (r == IDX_STALE) {
+        RegistryStamp stamp;
+        auto ws = read_registry(&stamp);
+        if (build_index(ws, stamp)) r = index_lookup(name, out);
+        if (r == IDX_STALE) {
+            // Index unwritable or changing under us; fall back to a linear scan
+            for (auto& w : ws) if (w.name == name) { out = w; return true; }
+            return false;
+        }
+    }
+    return r == IDX_HIT;
+}
+
+// Resolve and load exactly one workspace config
+static bool open_ws(const std::string& name, Workspace& out) {
+    if (!resolve_ws(name, out)) return false;
+    out.load_config();
+    return true;
+}
+
+// Fold the journal into a new snapshot. Caller holds the registry lock.
+static bool compact_registry() {
+    std::string snap;
+    read_whole(ws_config(), snap);
+    uint64_t gen = registry_generation(snap) + 1;
+    auto ws = read_registry();
+    
+    std::string buf = "# generation " + std::to_string(gen) + "\n";
+    for (auto& w : ws) {
+        buf += "[" + w.name + "]\n";
+        buf += "path=" + w.path + "\n\n";
+    }
+    // Snapshot first: until the new journal lands, the old one is simply
+    // ignored as already folded
+    if (!write_atomic(ws_config(), buf)) return false;
+    bool good = write_atomic(ws_journal(), "# generation " + std::to_string(gen) + "\n");
+    fsync_dir(ws_config());
+    return good;
+}
+
+// Append one journal record under the registry lock, compacting when the
+// journal has grown, and refresh the index
+static bool registry_append(const std::string& record) {
+    int lfd = lock_file(ws_lock());
+    if (lfd < 0) return false;
+    
+    // Start a journal for the current snapshot if there is none (or only
+    // one left over from before a crash during compaction)
+    std::string snap, journal;
+    read_whole(ws_config(), snap);
+    bool have_journal = read_whole(ws_journal(), journal);
+    std::string header = "# generation " + std::to_string(registry_generation(snap)) + "\n";
+    bool good = true;
+    if (!have_journal || registry_generation(journal) != registry_generation(snap) ||
+        journal.compare(0, header.size(), header) != 0) {
+        good = write_atomic(ws_journal(), header);
+        journal = header;
+    }
+    
+    int fd = good ? open(ws_journal().c_str(), O_WRONLY | O_APPEND | O_CLOEXEC) : -1;
+    if (fd >= 0) {
+        ssize_t n;
+        while ((n = write(fd, record.data(), record.size())) < 0 && errno == EINTR) {}
+        good = n == (ssize_t)record.size() && fdatasync(fd) == 0;
+        close(fd);
+    } else {
+        good = false;
+    }
+    
+    size_t records = std::count(journal.begin(), journal.end(), '\n');
+    if (good && (records >= JOURNAL_MAX_RECORDS || journal.size() > std::max<size_t>(snap.size(), 65536)))
+        compact_registry();
+    
+    RegistryStamp stamp;
+    auto ws = read_registry(&stamp);
+    build_index(ws, stamp);
+    close(lfd);
+    return good;
+}
+
+// Add or update a registry entry
+static bool register_ws(const Workspace& w) {
+    return registry_append("+" + w.name + "\t" + w.path + "\n");
+}
+
+static bool unregister_ws(const std::string& name) {
+    return registry_append("-" + name + "\n");
 }
 
 static void status(const std::string& m) { std::cout << BLUE << "[★] " << RESET << m << "\n"; }
@@ -270,6 +1046,28 @@ static void ok(const std::string& m) { std::cout << GREEN << "[✓] " << RESET <
 static void err(const std::string& m) { std::cerr << RED << "[✗] " << RESET << m << "\n"; }
 static void info(const std::string& m) { std::cout << CYAN << "[i] " << RESET << m << "\n"; }
 
+static double elapsed_s(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+static std::string fmt_secs(double s) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3fs", s);
+    return buf;
+}
+
+static std::string fmt_mb(uint64_t bytes) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.1f MB", bytes / 1048576.0);
+    return buf;
+}
+
+static std::string fmt_rate(uint64_t bytes, double secs) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.1f MB/s", secs > 0 ? bytes / 1048576.0 / secs : 0.0);
+    return buf;
+}
+
 // ============================================
 // LANGUAGE TEMPLATES
 // ============================================
@@ -291,7 +1089,10 @@ static std::map<std::string, LangTemplate> get_templates() {
             "make clean",
             "./build/main",
             "",
-            {"Makefile:CC=gcc\nCFLAGS=-Wall -Wextra -O2\n\nall:\n\t$(CC) $(CFLAGS) src/*.c -o build/main\n\nclean:\n\trm -rf build/*\n"}
+            {"Makefile:CC=gcc\nCFLAGS=-Wall -Wextra -O2\nOBJS=$(patsubst src/%.c,build/%.o,$(wildcard src/*.c))\n\n"
+             "all: build/main\n\nbuild/main: $(OBJS)\n\t$(CC) $(CFLAGS) $(OBJS) -o $@\n\n"
+             "build/%.o: src/%.c\n\t@mkdir -p build\n\t$(CC) $(CFLAGS) -MMD -c $< -o $@\n\n"
+             "-include $(OBJS:.o=.d)\n\nclean:\n\trm -rf build/*\n"}
         }},
         {"cpp", {
             "cpp",
@@ -299,7 +1100,10 @@ static std::map<std::string, LangTemplate> get_templates() {
             "make clean",
             "./build/main",
             "",
-            {"Makefile:CXX=g++\nCXXFLAGS=-Wall -Wextra -std=c++17 -O2\n\nall:\n\t$(CXX) $(CXXFLAGS) src/*.cpp -o build/main\n\nclean:\n\trm -rf build/*\n"}
+            {"Makefile:CXX=g++\nCXXFLAGS=-Wall -Wextra -std=c++17 -O2\nOBJS=$(patsubst src/%.cpp,build/%.o,$(wildcard src/*.cpp))\n\n"
+             "all: build/main\n\nbuild/main: $(OBJS)\n\t$(CXX) $(CXXFLAGS) $(OBJS) -o $@\n\n"
+             "build/%.o: src/%.cpp\n\t@mkdir -p build\n\t$(CXX) $(CXXFLAGS) -MMD -c $< -o $@\n\n"
+             "-include $(OBJS:.o=.d)\n\nclean:\n\trm -rf build/*\n"}
         }},
         {"rust", {
             "rust",
@@ -341,40 +1145,6611 @@ static std::map<std::string, LangTemplate> get_templates() {
 }
 
 // ============================================
-// COMMANDS
+// PROCESS EXECUTION
 // ============================================
+//
+// Commands are started with posix_spawn from an argv vector. Configured
+// command strings only go through /bin/sh when they use shell syntax, so
+// a plain "make -j8" costs one exec instead of a shell plus the command.
+// wait4() gives each child's resource usage.
 
-static int cmd_create(int argc, char** argv) {
-    if (argc < 2) {
-        std::cout << "Usage: ws-create <name> [options]\n\n";
-        std::cout << "Options:\n";
-        std::cout << "  --path <dir>         Custom path\n";
-        std::cout << "  --lang <lang>        Language (c, cpp, rust, python, go, node)\n";
-        std::cout << "  --isolated           Enable namespace isolation\n";
-        std::cout << "  --description <text> Workspace description\n";
-        std::cout << "  --author <name>      Author name\n";
-        std::cout << "  --build <cmd>        Custom build command\n";
-        std::cout << "  --run <cmd>          Custom run command\n";
-        std::cout << "  --env KEY=VALUE      Set environment variable\n";
-        return 1;
+struct ProcSpec {
+    std::vector<std::string> argv;
+    std::string cwd;                                  // empty: inherit
+    const std::vector<std::string>* env = nullptr;    // KEY=VALUE list, null: inherit
+    bool capture = false;                             // collect stdout into ProcResult::output
+    bool merge_stderr = false;                        // with capture: stderr too
+    int stdout_fd = -1;                               // redirect stdout/stderr here
+    int stderr_fd = -1;
+    std::vector<std::pair<int, int>> fds;             // extra (from, to) dup2s
+    double timeout = 0;                               // seconds, 0: none
+};
+
+struct ProcResult {
+    bool started = false;
+    int error = 0;             // errno when the spawn failed
+    int exit_code = -1;        // exit status, or 128 + signal
+    bool timed_out = false;
+    std::string output;
+    double wall_secs = 0;
+    double user_secs = 0;
+    double sys_secs = 0;
+    long max_rss_kb = 0;
+    long in_blocks = 0;        // filesystem blocks read / written
+    long out_blocks = 0;
+    
+    bool ok() const { return started && exit_code == 0; }
+};
+
+static std::vector<std::string> shell_argv(const std::string& cmd) {
+    return {"/bin/sh", "-c", cmd};
+}
+
+// argv for a configured command string: split on whitespace when it is a
+// plain word list, otherwise hand it to the shell
+static std::vector<std::string> command_argv(const std::string& cmd) {
+    static const std::set<std::string> builtins = {
+        ".", "alias", "case", "cd", "eval", "exec", "exit", "export", "for", "if", "read",
+        "return", "set", "shift", "source", "trap", "ulimit", "umask", "unset", "until", "wait", "while"};
+    if (cmd.find_first_of("|&;<>()$`\\\"'*?[]#~=%{}!\n") != std::string::npos) return shell_argv(cmd);
+    std::vector<std::string> argv;
+    std::istringstream in(cmd);
+    std::string word;
+    while (in >> word) argv.push_back(word);
+    if (argv.empty() || builtins.count(argv[0])) return shell_argv(cmd);
+    return argv;
+}
+
+static void fill_usage(ProcResult& r, const struct rusage& ru, int wstatus) {
+    r.user_secs = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    r.sys_secs = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    r.max_rss_kb = ru.ru_maxrss;
+    r.in_blocks = ru.ru_inblock;
+    r.out_blocks = ru.ru_oublock;
+    if (WIFEXITED(wstatus)) r.exit_code = WEXITSTATUS(wstatus);
+    else if (WIFSIGNALED(wstatus)) r.exit_code = 128 + WTERMSIG(wstatus);
+}
+
+// Start a child. Returns its pid, or -1 with errno set. With
+// spec.capture, *out_fd receives the read end of its stdout pipe.
+static pid_t spawn_proc(const ProcSpec& spec, int* out_fd = nullptr) {
+    if (spec.argv.empty()) { errno = EINVAL; return -1; }
+    
+    std::cout.flush();
+    fflush(stdout);
+    
+    int pipefd[2] = {-1, -1};
+    if (spec.capture && pipe2(pipefd, O_CLOEXEC) != 0) return -1;
+    
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawnattr_init(&attr);
+    
+    int out = spec.capture ? pipefd[1] : spec.stdout_fd;
+    int errfd = spec.capture && spec.merge_stderr ? pipefd[1] : spec.stderr_fd;
+    if (out >= 0) posix_spawn_file_actions_adddup2(&fa, out, STDOUT_FILENO);
+    if (errfd >= 0) posix_spawn_file_actions_adddup2(&fa, errfd, STDERR_FILENO);
+    for (auto& [from, to] : spec.fds) posix_spawn_file_actions_adddup2(&fa, from, to);
+    
+    std::string cwd_fallback;
+    if (!spec.cwd.empty()) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+        posix_spawn_file_actions_addchdir_np(&fa, spec.cwd.c_str());
+#else
+        cwd_fallback = spec.cwd;
+#endif
     }
     
-    std::string name = argv[1];
-    std::string path = ws_base() + "/" + name;
-    std::string lang = "generic";
-    std::string desc, author, build_cmd, run_cmd;
-    bool isolated = false;
-    std::map<std::string, std::string> env_vars;
+    // Children start with default signal handling and an empty mask, and
+    // get their own process group when they may need to be killed
+    sigset_t def, none;
+    sigemptyset(&def);
+    sigaddset(&def, SIGPIPE);
+    sigaddset(&def, SIGINT);
+    sigaddset(&def, SIGQUIT);
+    sigemptyset(&none);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    if (spec.timeout > 0) flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setsigdefault(&attr, &def);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, flags);
     
-    for (int i = 2; i < argc; i++) {
-        std::string arg = argv[i];
-        if (arg == "--path" && i + 1 < argc) path = argv[++i];
-        else if (arg == "--lang" && i + 1 < argc) lang = argv[++i];
+    std::vector<char*> argv, envp;
+    for (auto& a : spec.argv) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+    if (spec.env) {
+        for (auto& kv : *spec.env) envp.push_back(const_cast<char*>(kv.c_str()));
+        envp.push_back(nullptr);
+    }
+    
+    pid_t pid = -1;
+    int rc;
+    if (cwd_fallback.empty()) {
+        rc = posix_spawnp(&pid, argv[0], &fa, &attr, argv.data(), spec.env ? envp.data() : environ);
+    } else {
+        // No addchdir: spawn through the shell's cd instead
+        std::vector<std::string> sh = {"/bin/sh", "-c", "cd \"$0\" && exec \"$@\"", cwd_fallback};
+        sh.insert(sh.end(), spec.argv.begin(), spec.argv.end());
+        std::vector<char*> shv;
+        for (auto& a : sh) shv.push_back(const_cast<char*>(a.c_str()));
+        shv.push_back(nullptr);
+        rc = posix_spawn(&pid, "/bin/sh", &fa, &attr, shv.data(), spec.env ? envp.data() : environ);
+    }
+    
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    if (pipefd[1] >= 0) close(pipefd[1]);
+    if (rc != 0) {
+        if (pipefd[0] >= 0) close(pipefd[0]);
+        errno = rc;
+        return -1;
+    }
+    if (out_fd) *out_fd = pipefd[0];
+    else if (pipefd[0] >= 0) close(pipefd[0]);
+    return pid;
+}
+
+// Run a command to completion. Like system(), the caller ignores SIGINT
+// and SIGQUIT meanwhile so ^C only reaches the command.
+static ProcResult run_proc(const ProcSpec& spec) {
+    ProcResult r;
+    auto start = std::chrono::steady_clock::now();
+    
+    struct sigaction ign{}, old_int, old_quit;
+    ign.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &ign, &old_int);
+    sigaction(SIGQUIT, &ign, &old_quit);
+    
+    int out_fd = -1;
+    pid_t pid = spawn_proc(spec, spec.capture ? &out_fd : nullptr);
+    if (pid < 0) {
+        r.error = errno;
+        r.exit_code = 127;
+        sigaction(SIGINT, &old_int, nullptr);
+        sigaction(SIGQUIT, &old_quit, nullptr);
+        return r;
+    }
+    r.started = true;
+    
+    // Drain output and watch the deadline until the child exits
+    auto deadline = start + std::chrono::duration<double>(spec.timeout);
+    bool killed = false;
+    int wstatus = 0;
+    struct rusage ru{};
+    char buf[16384];
+    while (true) {
+        if (out_fd < 0 && spec.timeout <= 0) {
+            while (wait4(pid, &wstatus, 0, &ru) < 0 && errno == EINTR) {}
+            break;
+        }
+        pid_t done = wait4(pid, &wstatus, WNOHANG, &ru);
+        if (done == pid) break;
+        
+        int wait_ms = 50;
+        if (spec.timeout > 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0 && !killed) {
+                kill(-pid, SIGKILL);
+                killed = r.timed_out = true;
+            }
+            wait_ms = std::max<long>(1, std::min<long>(wait_ms, left));
+        }
+        
+        if (out_fd >= 0) {
+            pollfd p{out_fd, POLLIN, 0};
+            if (poll(&p, 1, wait_ms) > 0) {
+                ssize_t n = read(out_fd, buf, sizeof(buf));
+                if (n > 0) r.output.append(buf, n);
+                else if (n == 0 || errno != EINTR) { close(out_fd); out_fd = -1; }
+            }
+        } else {
+            poll(nullptr, 0, wait_ms);
+        }
+    }
+    if (out_fd >= 0) {
+        // Whatever is already buffered; don't wait on grandchildren
+        fcntl(out_fd, F_SETFL, O_NONBLOCK);
+        ssize_t n;
+        while ((n = read(out_fd, buf, sizeof(buf))) > 0) r.output.append(buf, n);
+        close(out_fd);
+    }
+    fill_usage(r, ru, wstatus);
+    r.wall_secs = elapsed_s(start);
+    sigaction(SIGINT, &old_int, nullptr);
+    sigaction(SIGQUIT, &old_quit, nullptr);
+    return r;
+}
+
+// One-line resource summary for a finished command
+static std::string fmt_usage(const ProcResult& r) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%.3fs (user %.3fs, sys %.3fs, peak %.1f MB)",
+             r.wall_secs, r.user_secs, r.sys_secs, r.max_rss_kb / 1024.0);
+    return buf;
+}
+
+// Run argv in dir in the foreground, adding its usage to `total`
+static int run_step(const std::vector<std::string>& argv, const std::string& dir, ProcResult& total) {
+    ProcSpec spec;
+    spec.argv = argv;
+    spec.cwd = dir;
+    ProcResult r = run_proc(spec);
+    if (!r.started) {
+        err("Cannot run " + argv[0] + ": " + strerror(r.error));
+        return r.exit_code;
+    }
+    total.started = true;
+    total.exit_code = r.exit_code;
+    total.wall_secs += r.wall_secs;
+    total.user_secs += r.user_secs;
+    total.sys_secs += r.sys_secs;
+    total.max_rss_kb = std::max(total.max_rss_kb, r.max_rss_kb);
+    total.in_blocks += r.in_blocks;
+    total.out_blocks += r.out_blocks;
+    return r.exit_code;
+}
+
+// ============================================
+// THREAD POOL
+// ============================================
+
+static unsigned worker_count() {
+    return std::min(std::max(std::thread::hardware_concurrency(), 1u), 32u);
+}
+
+// Fixed set of threads draining a FIFO of jobs. submit() blocks while
+// max_queued jobs are waiting so producers can't run ahead unbounded.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads = 0, size_t max_queued = 0) : max_queued_(max_queued) {
+        if (!threads) threads = worker_count();
+        for (unsigned i = 0; i < threads; i++)
+            threads_.emplace_back([this] { loop(); });
+    }
+    
+    ~ThreadPool() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stop_ = true;
+        }
+        work_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+    
+    unsigned size() const { return threads_.size(); }
+    
+    void submit(std::function<void()> fn) {
+        std::unique_lock<std::mutex> lock(mu_);
+        space_.wait(lock, [&] { return !max_queued_ || queue_.size() < max_queued_; });
+        queue_.push_back(std::move(fn));
+        work_.notify_one();
+    }
+    
+    // Block until every submitted job has finished
+    void wait() {
+        std::unique_lock<std::mutex> lock(mu_);
+        idle_.wait(lock, [&] { return queue_.empty() && running_ == 0; });
+    }
+
+private:
+    std::vector<std::thread> threads_;
+    std::deque<std::function<void()>> queue_;
+    std::mutex mu_;
+    std::condition_variable work_, space_, idle_;
+    size_t max_queued_;
+    size_t running_ = 0;
+    bool stop_ = false;
+    
+    void loop() {
+        std::unique_lock<std::mutex> lock(mu_);
+        while (true) {
+            work_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            auto fn = std::move(queue_.front());
+            queue_.pop_front();
+            running_++;
+            space_.notify_one();
+            
+            lock.unlock();
+            fn();
+            lock.lock();
+            
+            if (--running_ == 0 && queue_.empty()) idle_.notify_all();
+        }
+    }
+};
+
+// ============================================
+// PARALLEL TREE WALKER
+// ============================================
+//
+// Directories are the unit of work. Each worker owns a deque: it pushes
+// and pops subdirectories at the back (depth-first) and an idle worker
+// steals from the front of another's (shallow, so it tends to get a big
+// subtree). Directories are opened relative to the root fd and their
+// entries are read with getdents64 into a per-worker buffer and handled
+// by name relative to the directory fd, so nothing is allocated per file.
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static std::string join_rel(const std::string& rel, const std::string& name) {
+    return rel == "." ? name : rel + "/" + name;
+}
+
+static std::string full_path(const std::string& root, const std::string& rel) {
+    return rel == "." ? root : root + "/" + rel;
+}
+
+// Call fn(name, d_type) for every entry of an open directory except . and ..
+template <class F>
+static bool for_each_dirent(int dfd, std::vector<char>& buf, F fn) {
+    while (true) {
+        long n = syscall(SYS_getdents64, dfd, buf.data(), buf.size());
+        if (n < 0) return false;
+        if (n == 0) return true;
+        for (long off = 0; off < n; ) {
+            auto* e = (linux_dirent64*)(buf.data() + off);
+            off += e->d_reclen;
+            const char* name = e->d_name;
+            if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+            fn(name, e->d_type);
+        }
+    }
+}
+
+// Resolve DT_UNKNOWN (some filesystems never fill d_type)
+static unsigned char entry_type(int dfd, const char* name, unsigned char type) {
+    if (type != DT_UNKNOWN) return type;
+    struct stat st;
+    if (fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return DT_UNKNOWN;
+    if (S_ISDIR(st.st_mode)) return DT_DIR;
+    if (S_ISREG(st.st_mode)) return DT_REG;
+    if (S_ISLNK(st.st_mode)) return DT_LNK;
+    return DT_UNKNOWN;
+}
+
+class TreeWalker {
+public:
+    // Runs once per directory on a worker thread with the directory open.
+    // Names pushed into `descend` are walked next.
+    using DirFn = std::function<void(unsigned worker, int dfd, const std::string& rel,
+                                     std::vector<std::string>& descend)>;
+    // Runs once a directory and everything below it has been visited
+    using PostFn = std::function<void(unsigned worker, const std::string& rel)>;
+    
+    explicit TreeWalker(int root_fd)
+        : root_fd_(root_fd),
+          workers_(worker_count()) {}
+    
+    unsigned threads() const { return workers_.size(); }
+    
+    // getdents64 buffer and general scratch buffer owned by a worker
+    std::vector<char>& dents(unsigned worker) { return workers_[worker].dents; }
+    std::vector<char>& scratch(unsigned worker) { return workers_[worker].scratch; }
+    
+    void fail(const std::string& msg) {
+        std::lock_guard<std::mutex> lock(err_mu_);
+        if (errors_++ == 0) first_error_ = msg;
+    }
+    size_t errors() const { return errors_; }
+    const std::string& first_error() const { return first_error_; }
+    
+    void run(const std::string& start, DirFn on_dir, PostFn on_post = nullptr) {
+        on_dir_ = std::move(on_dir);
+        on_post_ = std::move(on_post);
+        outstanding_ = 1;
+        workers_[0].queue.push_back(new Node{start, nullptr});
+        
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < workers_.size(); i++)
+            pool.emplace_back(&TreeWalker::work, this, i);
+        work(0);
+        for (auto& t : pool) t.join();
+    }
+    
+private:
+    struct Node {
+        std::string rel;
+        Node* parent;
+        std::atomic<long> pending{1};
+        Node(std::string r, Node* p) : rel(std::move(r)), parent(p) {}
+    };
+    
+    struct Worker {
+        std::mutex mu;
+        std::deque<Node*> queue;
+        std::vector<char> dents = std::vector<char>(64 * 1024);
+        std::vector<char> scratch = std::vector<char>(256 * 1024);
+        std::vector<std::string> descend;
+    };
+    
+    int root_fd_;
+    std::vector<Worker> workers_;
+    std::atomic<size_t> outstanding_{0};
+    DirFn on_dir_;
+    PostFn on_post_;
+    std::mutex err_mu_;
+    std::atomic<size_t> errors_{0};
+    std::string first_error_;
+    
+    Node* take(unsigned id) {
+        {
+            Worker& w = workers_[id];
+            std::lock_guard<std::mutex> lock(w.mu);
+            if (!w.queue.empty()) {
+                Node* n = w.queue.back();
+                w.queue.pop_back();
+                return n;
+            }
+        }
+        for (unsigned k = 1; k < workers_.size(); k++) {
+            Worker& v = workers_[(id + k) % workers_.size()];
+            std::lock_guard<std::mutex> lock(v.mu);
+            if (!v.queue.empty()) {
+                Node* n = v.queue.front();
+                v.queue.pop_front();
+                return n;
+            }
+        }
+        return nullptr;
+    }
+    
+    void work(unsigned id) {
+        unsigned idle = 0;
+        while (true) {
+            Node* n = take(id);
+            if (!n) {
+                if (outstanding_ == 0) return;
+                if (++idle < 64) std::this_thread::yield();
+                else std::this_thread::sleep_for(std::chrono::microseconds(50));
+                continue;
+            }
+            idle = 0;
+            visit(id, n);
+        }
+    }
+    
+    void visit(unsigned id, Node* n) {
+        Worker& w = workers_[id];
+        w.descend.clear();
+        
+        int dfd = openat(root_fd_, n->rel.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dfd < 0) {
+            fail(n->rel + ": " + strerror(errno));
+        } else {
+            on_dir_(id, dfd, n->rel, w.descend);
+            close(dfd);
+        }
+        
+        for (auto& name : w.descend) {
+            Node* c = new Node{join_rel(n->rel, name), n};
+            n->pending++;
+            outstanding_++;
+            std::lock_guard<std::mutex> lock(w.mu);
+            w.queue.push_back(c);
+        }
+        finish(id, n);
+        outstanding_--;
+    }
+    
+    void finish(unsigned id, Node* n) {
+        while (n && --n->pending == 0) {
+            if (on_post_) on_post_(id, n->rel);
+            Node* parent = n->parent;
+            delete n;
+            n = parent;
+        }
+    }
+};
+
+// Remove a file or directory tree, deleting in parallel
+static bool remove_tree(const std::string& path, std::string* error = nullptr) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) return errno == ENOENT;
+    if (!S_ISDIR(st.st_mode)) return unlink(path.c_str()) == 0;
+    
+    int rfd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (rfd < 0) {
+        if (error) *error = path + ": " + strerror(errno);
+        return false;
+    }
+    
+    TreeWalker tw(rfd);
+    tw.run(".", [&](unsigned worker, int dfd, const std::string& rel, std::vector<std::string>& descend) {
+        for_each_dirent(dfd, tw.dents(worker), [&](const char* name, unsigned char type) {
+            if (entry_type(dfd, name, type) == DT_DIR) descend.push_back(name);
+            else if (unlinkat(dfd, name, 0) != 0 && errno != ENOENT)
+                tw.fail(join_rel(rel, name) + ": " + strerror(errno));
+        });
+    }, [&](unsigned, const std::string& rel) {
+        if (rel == ".") return;
+        if (unlinkat(rfd, rel.c_str(), AT_REMOVEDIR) == 0 || errno == ENOENT) return;
+        // Entries can be missed when a directory changes under getdents
+        std::error_code ec;
+        fs::remove_all(path + "/" + rel, ec);
+        if (ec) tw.fail(rel + ": " + ec.message());
+    });
+    close(rfd);
+    
+    if (tw.errors() == 0 && rmdir(path.c_str()) != 0) tw.fail(path + ": " + strerror(errno));
+    if (tw.errors() && error) *error = tw.first_error();
+    return tw.errors() == 0;
+}
+
+// Per-copy counters, shared by all walker threads
+struct CopyStats {
+    std::atomic<uint64_t> files{0};
+    std::atomic<uint64_t> reflinked{0};
+    std::atomic<uint64_t> bytes{0};         // logical size of copied files
+    std::atomic<uint64_t> holes{0};         // bytes left as holes in the copy
+    std::atomic<bool> reflink_ok{true};     // cleared after the first EOPNOTSUPP/EXDEV
+};
+
+// Copy [off, off + len) with pread/pwrite when copy_file_range can't
+static bool copy_range_rw(int in, int out, off_t off, off_t len, std::vector<char>& buf) {
+    while (len > 0) {
+        ssize_t n = pread(in, buf.data(), std::min<off_t>(len, buf.size()), off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return n == 0;
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t m = pwrite(out, buf.data() + done, n - done, off + done);
+            if (m < 0) { if (errno == EINTR) continue; return false; }
+            done += m;
+        }
+        off += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool copy_range(int in, int out, off_t off, off_t len, std::vector<char>& buf, bool& cfr_ok) {
+    while (len > 0 && cfr_ok) {
+        loff_t ioff = off, ooff = off;
+        ssize_t n = copy_file_range(in, &ioff, out, &ooff, len, 0);
+        if (n > 0) { off += n; len -= n; continue; }
+        if (n == 0) return true;
+        if (errno == EINTR) continue;
+        if (errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP && errno != EINVAL) return false;
+        cfr_ok = false;
+    }
+    return len <= 0 || copy_range_rw(in, out, off, len, buf);
+}
+
+// Copy an open file's contents: a FICLONE reflink where the filesystem
+// shares extents, otherwise an in-kernel copy_file_range of the data
+// segments only, so holes in sparse files stay holes.
+static bool copy_fd(int in, int out, off_t size, std::vector<char>& buf, CopyStats& stats) {
+    stats.files++;
+    stats.bytes += size;
+    
+    bool cloned = false;
+    if (size > 0 && stats.reflink_ok) {
+        cloned = ioctl(out, FICLONE, in) == 0;
+        if (!cloned && (errno == EOPNOTSUPP || errno == EXDEV || errno == ENOTTY))
+            stats.reflink_ok = false;
+    }
+    if (cloned) {
+        stats.reflinked++;
+        return true;
+    }
+    
+    bool good = true, cfr_ok = true;
+    off_t data = 0, copied = 0;
+    while (good && data < size) {
+        data = lseek(in, data, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) break;      // only a hole remains
+            // No SEEK_DATA support: treat the rest as data
+            good = copy_range(in, out, copied, size - copied, buf, cfr_ok);
+            copied = size;
+            break;
+        }
+        off_t hole = lseek(in, data, SEEK_HOLE);
+        if (hole < 0) hole = size;
+        good = copy_range(in, out, data, hole - data, buf, cfr_ok);
+        copied += hole - data;
+        data = hole;
+    }
+    if (good && ftruncate(out, size) != 0) good = false;
+    if (good) stats.holes += size - copied;
+    return good;
+}
+
+static bool copy_file_at(int sdir, const char* name, int ddir, std::vector<char>& buf,
+                         CopyStats& stats, std::string& error) {
+    int in = openat(sdir, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (in < 0) { error = strerror(errno); return false; }
+    
+    struct stat st;
+    fstat(in, &st);
+    int out = openat(ddir, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+    if (out < 0) { error = strerror(errno); close(in); return false; }
+    
+    bool good = copy_fd(in, out, st.st_size, buf, stats);
+    if (!good) error = strerror(errno);
+    fchmod(out, st.st_mode & 07777);
+    close(in);
+    close(out);
+    return good;
+}
+
+// Copy a directory tree in parallel. Symlinks are recreated, not followed;
+// directory modes are applied once their contents are in place. Directories
+// listed in `skip` (relative to src) are created empty.
+static bool copy_tree(const std::string& src, const std::string& dst, std::string* error = nullptr,
+                      CopyStats* stats = nullptr, const std::vector<std::string>& skip = {}) {
+    CopyStats local;
+    if (!stats) stats = &local;
+    
+    int sfd = open(src.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (sfd < 0) {
+        if (error) *error = src + ": " + strerror(errno);
+        return false;
+    }
+    if (mkdir(dst.c_str(), 0700) != 0 && errno != EEXIST) {
+        if (error) *error = dst + ": " + strerror(errno);
+        close(sfd);
+        return false;
+    }
+    int dfd_root = open(dst.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd_root < 0) {
+        if (error) *error = dst + ": " + strerror(errno);
+        close(sfd);
+        return false;
+    }
+    
+    TreeWalker tw(sfd);
+    tw.run(".", [&](unsigned worker, int dfd, const std::string& rel, std::vector<std::string>& descend) {
+        int out = openat(dfd_root, rel.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (out < 0) { tw.fail(rel + ": " + strerror(errno)); return; }
+        
+        for_each_dirent(dfd, tw.dents(worker), [&](const char* name, unsigned char type) {
+            std::string msg;
+            switch (entry_type(dfd, name, type)) {
+            case DT_DIR:
+                if (mkdirat(out, name, 0700) != 0 && errno != EEXIST)
+                    tw.fail(join_rel(rel, name) + ": " + strerror(errno));
+                else if (std::find(skip.begin(), skip.end(), join_rel(rel, name)) == skip.end())
+                    descend.push_back(name);
+                break;
+            case DT_REG:
+                if (!copy_file_at(dfd, name, out, tw.scratch(worker), *stats, msg))
+                    tw.fail(join_rel(rel, name) + ": " + msg);
+                break;
+            case DT_LNK: {
+                std::vector<char>& buf = tw.scratch(worker);
+                ssize_t n = readlinkat(dfd, name, buf.data(), buf.size() - 1);
+                if (n < 0) { tw.fail(join_rel(rel, name) + ": " + strerror(errno)); break; }
+                buf[n] = '\0';
+                if (symlinkat(buf.data(), out, name) != 0 && errno != EEXIST)
+                    tw.fail(join_rel(rel, name) + ": " + strerror(errno));
+                break;
+            }
+            default:
+                break;      // sockets, fifos and devices are not copied
+            }
+        });
+        close(out);
+    }, [&](unsigned, const std::string& rel) {
+        struct stat st;
+        if (fstatat(sfd, rel.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0)
+            fchmodat(dfd_root, rel.c_str(), st.st_mode & 07777, 0);
+    });
+    close(sfd);
+    close(dfd_root);
+    
+    if (tw.errors() && error) *error = tw.first_error();
+    return tw.errors() == 0;
+}
+
+// Make dst match src, touching only what differs: files whose size or
+// mtime changed are copied with their mtime preserved (so make sees the
+// same tree on both sides), and entries src no longer has are removed.
+static bool sync_tree(const std::string& src, const std::string& dst, std::string* error = nullptr,
+                      CopyStats* stats = nullptr) {
+    CopyStats local;
+    if (!stats) stats = &local;
+    
+    int sfd = open(src.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (sfd < 0) {
+        if (error) *error = src + ": " + strerror(errno);
+        return false;
+    }
+    if (mkdir(dst.c_str(), 0700) != 0 && errno != EEXIST) {
+        if (error) *error = dst + ": " + strerror(errno);
+        close(sfd);
+        return false;
+    }
+    int dfd_root = open(dst.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd_root < 0) {
+        if (error) *error = dst + ": " + strerror(errno);
+        close(sfd);
+        return false;
+    }
+    
+    TreeWalker tw(sfd);
+    tw.run(".", [&](unsigned worker, int dfd, const std::string& rel, std::vector<std::string>& descend) {
+        int out = openat(dfd_root, rel.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (out < 0) { tw.fail(rel + ": " + strerror(errno)); return; }
+        
+        auto drop = [&](const char* name, const struct stat& d) {
+            std::error_code ec;
+            if (S_ISDIR(d.st_mode)) fs::remove_all(full_path(dst, join_rel(rel, name)), ec);
+            else if (unlinkat(out, name, 0) != 0) ec.assign(errno, std::generic_category());
+            if (ec) tw.fail(join_rel(rel, name) + ": " + ec.message());
+        };
+        
+        std::set<std::string> seen;
+        for_each_dirent(dfd, tw.dents(worker), [&](const char* name, unsigned char) {
+            seen.insert(name);
+            struct stat s, d;
+            if (fstatat(dfd, name, &s, AT_SYMLINK_NOFOLLOW) != 0) return;
+            bool have = fstatat(out, name, &d, AT_SYMLINK_NOFOLLOW) == 0;
+            if (have && (s.st_mode & S_IFMT) != (d.st_mode & S_IFMT)) {
+                drop(name, d);
+                have = false;
+            }
+            
+            std::string msg;
+            if (S_ISDIR(s.st_mode)) {
+                if (!have && mkdirat(out, name, 0700) != 0) tw.fail(join_rel(rel, name) + ": " + strerror(errno));
+                else descend.push_back(name);
+            } else if (S_ISREG(s.st_mode)) {
+                if (have && d.st_size == s.st_size && d.st_mtim.tv_sec == s.st_mtim.tv_sec &&
+                    d.st_mtim.tv_nsec == s.st_mtim.tv_nsec)
+                    return;
+                if (!copy_file_at(dfd, name, out, tw.scratch(worker), *stats, msg)) {
+                    tw.fail(join_rel(rel, name) + ": " + msg);
+                    return;
+                }
+                struct timespec times[2] = {s.st_atim, s.st_mtim};
+                utimensat(out, name, times, AT_SYMLINK_NOFOLLOW);
+            } else if (S_ISLNK(s.st_mode)) {
+                std::vector<char>& buf = tw.scratch(worker);
+                ssize_t n = readlinkat(dfd, name, buf.data(), buf.size() - 1);
+                if (n < 0) { tw.fail(join_rel(rel, name) + ": " + strerror(errno)); return; }
+                std::string target(buf.data(), n);
+                if (have) {
+                    ssize_t m = readlinkat(out, name, buf.data(), buf.size() - 1);
+                    if (m >= 0 && std::string(buf.data(), m) == target) return;
+                    unlinkat(out, name, 0);
+                }
+                if (symlinkat(target.c_str(), out, name) != 0)
+                    tw.fail(join_rel(rel, name) + ": " + strerror(errno));
+            }
+        });
+        
+        // Drop what src no longer has
+        std::vector<std::string> gone;
+        for_each_dirent(out, tw.dents(worker), [&](const char* name, unsigned char) {
+            if (!seen.count(name)) gone.push_back(name);
+        });
+        for (auto& name : gone) {
+            struct stat d;
+            if (fstatat(out, name.c_str(), &d, AT_SYMLINK_NOFOLLOW) == 0) drop(name.c_str(), d);
+        }
+        close(out);
+    }, [&](unsigned, const std::string& rel) {
+        struct stat st;
+        if (fstatat(sfd, rel.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0)
+            fchmodat(dfd_root, rel.c_str(), st.st_mode & 07777, 0);
+    });
+    close(sfd);
+    close(dfd_root);
+    
+    if (tw.errors() && error) *error = tw.first_error();
+    return tw.errors() == 0;
+}
+
+// ============================================
+// SIZE ACCOUNTING
+// ============================================
+//
+// ws-status keeps a per-directory summary in .ws/statcache. Each entry is
+// keyed by the directory's inode and mtime; a directory whose key still
+// matches is not re-read, only its subdirectories are visited. Adding,
+// removing or renaming entries bumps a directory's mtime, but rewriting a
+// file in place does not, so --rescan forces a full walk and --watch keeps
+// the totals live through inotify.
+
+struct DirSummary {
+    uint64_t ino = 0;
+    int64_t mtime = 0;
+    uint64_t files = 0;     // regular files directly in this directory
+    uint64_t bytes = 0;
+    std::vector<std::string> subdirs;
+};
+
+struct ScanStats {
+    size_t reused = 0;
+    size_t rescanned = 0;
+};
+
+static std::string parent_rel(const std::string& rel) {
+    size_t slash = rel.rfind('/');
+    return slash == std::string::npos ? "." : rel.substr(0, slash);
+}
+
+class SizeCache {
+public:
+    std::map<std::string, DirSummary> dirs;   // keyed by path relative to the workspace
+    
+    bool load(const std::string& path) {
+        std::ifstream f(path);
+        std::string line;
+        if (!std::getline(f, line) || line != "# wsstat 1") return false;
+        
+        while (std::getline(f, line)) {
+            // ino \t mtime \t files \t bytes \t relpath
+            uint64_t fields[4];
+            size_t pos = 0;
+            bool good = true;
+            for (auto& field : fields) {
+                size_t tab = line.find('\t', pos);
+                if (tab == std::string::npos) { good = false; break; }
+                field = std::strtoull(line.c_str() + pos, nullptr, 10);
+                pos = tab + 1;
+            }
+            if (!good) continue;
+            
+            DirSummary d;
+            d.ino = fields[0];
+            d.mtime = (int64_t)fields[1];
+            d.files = fields[2];
+            d.bytes = fields[3];
+            dirs[unescape(line.substr(pos))] = d;
+        }
+        
+        // Rebuild child lists from the path hierarchy
+        for (auto& [rel, d] : dirs) {
+            if (rel == ".") continue;
+            auto p = dirs.find(parent_rel(rel));
+            if (p != dirs.end()) p->second.subdirs.push_back(rel.substr(rel.rfind('/') + 1));
+        }
+        return true;
+    }
+    
+    void save(const std::string& path) const {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::trunc);
+            if (!f) return;
+            f << "# wsstat 1\n";
+            for (auto& [rel, d] : dirs) {
+                f << d.ino << '\t' << (uint64_t)d.mtime << '\t' << d.files << '\t'
+                  << d.bytes << '\t' << escape(rel) << '\n';
+            }
+        }
+        rename(tmp.c_str(), path.c_str());
+    }
+    
+    void totals(uint64_t& files, uint64_t& bytes) const {
+        files = bytes = 0;
+        for (auto& [rel, d] : dirs) { files += d.files; bytes += d.bytes; }
+    }
+    
+    void erase_subtree(const std::string& rel) {
+        dirs.erase(rel);
+        std::string prefix = rel + "/";
+        auto it = dirs.lower_bound(prefix);
+        while (it != dirs.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+            it = dirs.erase(it);
+    }
+    
+private:
+    static std::string escape(const std::string& s) {
+        std::string out;
+        for (char c : s) {
+            if (c == '\\') out += "\\\\";
+            else if (c == '\n') out += "\\n";
+            else out += c;
+        }
+        return out;
+    }
+    
+    static std::string unescape(const std::string& s) {
+        std::string out;
+        for (size_t i = 0; i < s.size(); i++) {
+            if (s[i] == '\\' && i + 1 < s.size()) {
+                out += s[i + 1] == 'n' ? '\n' : s[i + 1];
+                i++;
+            } else out += s[i];
+        }
+        return out;
+    }
+};
+
+// Summarise one open directory's direct entries. The directory is fstat'ed
+// before reading so a change racing with the scan invalidates the entry
+// next time. The cache's own files are left out of the totals.
+static void read_dir_summary(int dfd, bool in_ws_dir, std::vector<char>& buf, DirSummary& d) {
+    struct stat st;
+    fstat(dfd, &st);
+    d = DirSummary();
+    d.ino = st.st_ino;
+    d.mtime = mtime_ns(st);
+    
+    for_each_dirent(dfd, buf, [&](const char* name, unsigned char type) {
+        if (in_ws_dir && !strncmp(name, "statcache", 9)) return;
+        if (type == DT_DIR) { d.subdirs.push_back(name); return; }
+        
+        struct stat est;
+        if (fstatat(dfd, name, &est, AT_SYMLINK_NOFOLLOW) != 0) return;
+        if (S_ISDIR(est.st_mode)) { d.subdirs.push_back(name); return; }
+        // Symlinks count as their target, like fs::is_regular_file()
+        if (S_ISLNK(est.st_mode) && fstatat(dfd, name, &est, 0) != 0) return;
+        if (S_ISREG(est.st_mode)) {
+            d.files++;
+            d.bytes += est.st_size;
+        }
+    });
+    std::sort(d.subdirs.begin(), d.subdirs.end());
+}
+
+static bool scan_dir_direct(const std::string& root, const std::string& rel, DirSummary& d) {
+    int dfd = open(full_path(root, rel).c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dfd < 0) return false;
+    std::vector<char> buf(64 * 1024);
+    read_dir_summary(dfd, rel == ".ws", buf, d);
+    close(dfd);
+    return true;
+}
+
+// Walk root/rel in parallel, reusing summaries from `old` for directories
+// whose inode and mtime still match
+static void scan_tree(const std::string& root, const std::string& rel,
+                      const SizeCache& old, SizeCache& cur, ScanStats& stats) {
+    int rfd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rfd < 0) return;
+    
+    std::mutex mu;
+    std::atomic<size_t> reused{0}, rescanned{0};
+    TreeWalker tw(rfd);
+    tw.run(rel, [&](unsigned worker, int dfd, const std::string& r, std::vector<std::string>& descend) {
+        struct stat st;
+        if (fstat(dfd, &st) != 0) return;
+        
+        DirSummary d;
+        auto it = old.dirs.find(r);
+        if (it != old.dirs.end() && it->second.ino == st.st_ino && it->second.mtime == mtime_ns(st)) {
+            d = it->second;
+            reused++;
+        } else {
+            read_dir_summary(dfd, r == ".ws", tw.dents(worker), d);
+            rescanned++;
+        }
+        descend = d.subdirs;
+        
+        std::lock_guard<std::mutex> lock(mu);
+        cur.dirs[r] = std::move(d);
+    });
+    close(rfd);
+    
+    stats.reused += reused;
+    stats.rescanned += rescanned;
+}
+
+static void print_live_totals(const SizeCache& cache) {
+    uint64_t files, bytes;
+    cache.totals(files, bytes);
+    std::cout << "\r" << CYAN << "[i] " << RESET << "Files: " << files
+              << "  Size: " << (bytes / 1024) << " KB        " << std::flush;
+}
+
+// Keep totals current until interrupted. Events are debounced and each
+// touched directory is re-read once per burst.
+static void watch_sizes(const std::string& root, SizeCache& cache, const std::string& cache_path) {
+    int ifd = inotify_init1(IN_CLOEXEC);
+    if (ifd < 0) { err("inotify unavailable: " + std::string(strerror(errno))); return; }
+    
+    const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                          IN_CLOSE_WRITE | IN_MODIFY | IN_ONLYDIR;
+    std::map<int, std::string> wd_rel;
+    bool warned = false;
+    
+    auto add_watches = [&](const std::string& top) {
+        for (auto it = cache.dirs.lower_bound(top); it != cache.dirs.end(); ++it) {
+            const std::string& rel = it->first;
+            if (top != "." && rel != top && rel.compare(0, top.size() + 1, top + "/") != 0) break;
+            int wd = inotify_add_watch(ifd, full_path(root, rel).c_str(), mask);
+            if (wd >= 0) wd_rel[wd] = rel;
+            else if (!warned) {
+                std::cerr << YELLOW << "[!] Could not watch every directory (" << strerror(errno)
+                          << "); totals may lag\n" << RESET;
+                warned = true;
+            }
+        }
+    };
+    add_watches(".");
+    
+    status("Watching " + root + " (Ctrl-C to stop)");
+    print_live_totals(cache);
+    
+    std::vector<char> buf(64 * 1024);
+    std::set<std::string> dirty;
+    bool overflow = false;
+    
+    while (true) {
+        struct pollfd pfd = {ifd, POLLIN, 0};
+        int r = poll(&pfd, 1, dirty.empty() && !overflow ? -1 : 150);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        
+        if (r > 0) {
+            ssize_t len = read(ifd, buf.data(), buf.size());
+            for (ssize_t off = 0; off < len; ) {
+                auto* ev = (struct inotify_event*)(buf.data() + off);
+                off += sizeof(struct inotify_event) + ev->len;
+                
+                if (ev->mask & IN_Q_OVERFLOW) { overflow = true; continue; }
+                if (ev->mask & IN_IGNORED) { wd_rel.erase(ev->wd); continue; }
+                
+                auto w = wd_rel.find(ev->wd);
+                if (w == wd_rel.end()) continue;
+                if (w->second == ".ws" && ev->len && !strncmp(ev->name, "statcache", 9)) continue;
+                dirty.insert(w->second);
+            }
+            continue;
+        }
+        
+        // Quiet period elapsed: fold the burst into the cache
+        if (overflow) {
+            SizeCache fresh;
+            ScanStats stats;
+            scan_tree(root, ".", SizeCache(), fresh, stats);
+            cache = fresh;
+            add_watches(".");
+            overflow = false;
+        }
+        
+        for (auto& rel : dirty) {
+            auto it = cache.dirs.find(rel);
+            if (it == cache.dirs.end()) continue;
+            
+            DirSummary d;
+            if (!scan_dir_direct(root, rel, d)) {
+                cache.erase_subtree(rel);
+                continue;
+            }
+            
+            std::vector<std::string> old_subs = it->second.subdirs;
+            cache.dirs[rel] = d;
+            
+            for (auto& sub : old_subs) {
+                if (!std::binary_search(d.subdirs.begin(), d.subdirs.end(), sub))
+                    cache.erase_subtree(join_rel(rel, sub));
+            }
+            for (auto& sub : d.subdirs) {
+                if (std::binary_search(old_subs.begin(), old_subs.end(), sub)) continue;
+                ScanStats stats;
+                scan_tree(root, join_rel(rel, sub), SizeCache(), cache, stats);
+                add_watches(join_rel(rel, sub));
+            }
+        }
+        dirty.clear();
+        
+        cache.save(cache_path);
+        print_live_totals(cache);
+    }
+    close(ifd);
+}
+
+// ============================================
+// ATTRIBUTE INDEX
+// ============================================
+//
+// workspaces.attrs lets ws-list filter, sort and page without opening any
+// workspace config. Layout:
+//
+//   AttrHeader | AttrKey[key_count] | postings | AttrRow[row_count] | strings
+//
+// Rows are sorted by name; each points at "name\0display\0lang\0path\0
+// description\0tag,tag" in the string area. Keys ("tag:<t>", "lang:<l>",
+// "isolated") are sorted and each holds an ascending list of row numbers,
+// so a filter is a binary search plus a posting-list intersection, and
+// only the rows that end up on screen are decoded.
+//
+// The header carries the registry stamp it was built against. When the
+// registry has moved on, the rows are reconciled with it: configs are read
+// only for workspaces the index doesn't have yet. ws-config patches the
+// changed row and ws-status records the size it measured; ws-list
+// --reindex rebuilds from every config after hand edits.
+
+static const uint32_t WS_ATTRS_MAGIC = 0x54415357; // "WSAT"
+static const uint32_t WS_ATTRS_VERSION = 1;
+
+struct AttrHeader {
+    uint32_t magic;
+    uint32_t version;
+    int64_t conf_mtime;
+    uint64_t conf_size;
+    int64_t journal_mtime;
+    uint64_t journal_size;
+    uint32_t row_count;
+    uint32_t key_count;
+    uint64_t rows_off;
+    uint64_t str_off;
+};
+
+struct AttrKey {
+    uint32_t str_off;
+    uint32_t str_len;
+    uint32_t post_off;      // index into the postings array
+    uint32_t post_count;
+};
+
+struct AttrRow {
+    uint64_t size;          // bytes, as of the last ws-status
+    int64_t created;
+    uint32_t str_off;
+    uint32_t str_len;
+    uint32_t isolated;
+    uint32_t reserved;
+};
+
+struct WsAttrs {
+    std::string name, display_name, lang, path, description;
+    std::vector<std::string> tags;
+    bool isolated = false;
+    uint64_t size = 0;
+    int64_t created = 0;
+};
+
+static std::string ws_attrs() {
+    return home_dir() + "/.config/dreamland/workspaces.attrs";
+}
+
+static RegistryStamp registry_stamp() {
+    RegistryStamp st;
+    struct stat s;
+    if (stat(ws_config().c_str(), &s) == 0) { st.conf_mtime = mtime_ns(s); st.conf_size = s.st_size; }
+    if (stat(ws_journal().c_str(), &s) == 0) { st.journal_mtime = mtime_ns(s); st.journal_size = s.st_size; }
+    return st;
+}
+
+static WsAttrs attrs_of(const Workspace& w, uint64_t size) {
+    WsAttrs a;
+    a.name = w.name;
+    a.display_name = w.display_name;
+    a.lang = w.lang;
+    a.path = w.path;
+    a.description = w.description;
+    a.tags = w.tags;
+    a.isolated = w.isolated;
+    a.size = size;
+    a.created = std::strtoll(w.created.c_str(), nullptr, 10);
+    return a;
+}
+
+// Size from the workspace's last ws-status scan, 0 if it never had one
+static uint64_t cached_size(const std::string& path) {
+    SizeCache c;
+    if (!c.load(path + "/.ws/statcache")) return 0;
+    uint64_t files, bytes;
+    c.totals(files, bytes);
+    return bytes;
+}
+
+// Read-only view of a loaded workspaces.attrs
+class AttrIndex {
+public:
+    bool load(const std::string& path) {
+        if (!read_whole(path, buf_) || buf_.size() < sizeof(AttrHeader)) return false;
+        memcpy(&hdr_, buf_.data(), sizeof(hdr_));
+        if (hdr_.magic != WS_ATTRS_MAGIC || hdr_.version != WS_ATTRS_VERSION) return false;
+        uint64_t keys_end = sizeof(AttrHeader) + (uint64_t)hdr_.key_count * sizeof(AttrKey);
+        return keys_end <= hdr_.rows_off && hdr_.rows_off + (uint64_t)hdr_.row_count * sizeof(AttrRow) <= hdr_.str_off &&
+               hdr_.str_off <= buf_.size();
+    }
+    
+    const AttrHeader& header() const { return hdr_; }
+    size_t rows() const { return hdr_.row_count; }
+    
+    AttrRow row(size_t i) const {
+        AttrRow r;
+        memcpy(&r, buf_.data() + hdr_.rows_off + i * sizeof(AttrRow), sizeof(r));
+        return r;
+    }
+    
+    // Ascending row numbers carrying `key`
+    std::vector<uint32_t> postings(const std::string& key) const {
+        size_t lo = 0, hi = hdr_.key_count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            AttrKey k = key_at(mid);
+            int c = str(k.str_off, k.str_len).compare(key);
+            if (c == 0) {
+                std::vector<uint32_t> out(k.post_count);
+                uint64_t off = sizeof(AttrHeader) + (uint64_t)hdr_.key_count * sizeof(AttrKey) +
+                               (uint64_t)k.post_off * sizeof(uint32_t);
+                if (off + out.size() * sizeof(uint32_t) > hdr_.rows_off) return {};
+                memcpy(out.data(), buf_.data() + off, out.size() * sizeof(uint32_t));
+                return out;
+            }
+            if (c < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        return {};
+    }
+    
+    WsAttrs decode(size_t i) const {
+        AttrRow r = row(i);
+        std::string s = str(r.str_off, r.str_len);
+        std::vector<std::string> f;
+        size_t pos = 0, nul;
+        while ((nul = s.find('\0', pos)) != std::string::npos) {
+            f.push_back(s.substr(pos, nul - pos));
+            pos = nul + 1;
+        }
+        f.push_back(s.substr(pos));
+        f.resize(6);
+        
+        WsAttrs a;
+        a.name = f[0];
+        a.display_name = f[1];
+        a.lang = f[2];
+        a.path = f[3];
+        a.description = f[4];
+        a.tags = split_list(f[5]);
+        a.isolated = r.isolated;
+        a.size = r.size;
+        a.created = r.created;
+        return a;
+    }
+
+private:
+    std::string buf_;
+    AttrHeader hdr_{};
+    
+    AttrKey key_at(size_t i) const {
+        AttrKey k;
+        memcpy(&k, buf_.data() + sizeof(AttrHeader) + i * sizeof(AttrKey), sizeof(k));
+        return k;
+    }
+    
+    std::string str(uint32_t off, uint32_t len) const {
+        if (hdr_.str_off + off + len > buf_.size()) return "";
+        return buf_.substr(hdr_.str_off + off, len);
+    }
+};
+
+static bool write_attrs(std::vector<WsAttrs> rows, const RegistryStamp& stamp) {
+    std::sort(rows.begin(), rows.end(), [](const WsAttrs& a, const WsAttrs& b) { return a.name < b.name; });
+    
+    std::string strings;
+    std::vector<AttrRow> table;
+    std::map<std::string, std::vector<uint32_t>> keys;
+    for (uint32_t i = 0; i < rows.size(); i++) {
+        const WsAttrs& a = rows[i];
+        std::string tags;
+        for (auto& t : a.tags) {
+            tags += (tags.empty() ? "" : ",") + t;
+            keys["tag:" + t].push_back(i);
+        }
+        keys["lang:" + a.lang].push_back(i);
+        if (a.isolated) keys["isolated"].push_back(i);
+        
+        std::string s = a.name + '\0' + a.display_name + '\0' + a.lang + '\0' + a.path + '\0' +
+                        a.description + '\0' + tags;
+        table.push_back(AttrRow{a.size, a.created, (uint32_t)strings.size(), (uint32_t)s.size(), a.isolated, 0});
+        strings += s;
+    }
+    
+    std::vector<AttrKey> key_table;
+    std::vector<uint32_t> postings;
+    for (auto& [key, list] : keys) {
+        key_table.push_back(AttrKey{(uint32_t)strings.size(), (uint32_t)key.size(),
+                                    (uint32_t)postings.size(), (uint32_t)list.size()});
+        strings += key;
+        postings.insert(postings.end(), list.begin(), list.end());
+    }
+    
+    AttrHeader hdr{};
+    hdr.magic = WS_ATTRS_MAGIC;
+    hdr.version = WS_ATTRS_VERSION;
+    hdr.conf_mtime = stamp.conf_mtime;
+    hdr.conf_size = stamp.conf_size;
+    hdr.journal_mtime = stamp.journal_mtime;
+    hdr.journal_size = stamp.journal_size;
+    hdr.row_count = table.size();
+    hdr.key_count = key_table.size();
+    hdr.rows_off = sizeof(hdr) + key_table.size() * sizeof(AttrKey) + postings.size() * sizeof(uint32_t);
+    hdr.str_off = hdr.rows_off + table.size() * sizeof(AttrRow);
+    
+    // Like workspaces.idx this can always be rebuilt, so no fsync
+    std::string tmp = ws_attrs() + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        if (!f) return false;
+        f.write((const char*)&hdr, sizeof(hdr));
+        f.write((const char*)key_table.data(), key_table.size() * sizeof(AttrKey));
+        f.write((const char*)postings.data(), postings.size() * sizeof(uint32_t));
+        f.write((const char*)table.data(), table.size() * sizeof(AttrRow));
+        f.write(strings.data(), strings.size());
+        if (!f) { f.close(); unlink(tmp.c_str()); return false; }
+    }
+    if (rename(tmp.c_str(), ws_attrs().c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Bring workspaces.attrs in line with the registry and return it loaded.
+// Only workspaces new to the index (or moved) have their config read,
+// unless `rebuild` asks for all of them.
+static bool open_attrs(AttrIndex& idx, bool rebuild = false) {
+    RegistryStamp now = registry_stamp();
+    if (!rebuild && idx.load(ws_attrs())) {
+        const AttrHeader& h = idx.header();
+        if (h.conf_mtime == now.conf_mtime && h.conf_size == now.conf_size &&
+            h.journal_mtime == now.journal_mtime && h.journal_size == now.journal_size)
+            return true;
+    }
+    
+    int lfd = lock_file(ws_attrs() + ".lock");
+    if (lfd < 0) return false;
+    
+    std::map<std::string, WsAttrs> old;
+    if (!rebuild && idx.load(ws_attrs()))
+        for (size_t i = 0; i < idx.rows(); i++) {
+            WsAttrs a = idx.decode(i);
+            old[a.name] = a;
+        }
+    
+    RegistryStamp stamp;
+    std::vector<WsAttrs> rows;
+    for (auto& w : read_registry(&stamp)) {
+        auto it = old.find(w.name);
+        if (it != old.end() && it->second.path == w.path) {
+            rows.push_back(it->second);
+            continue;
+        }
+        w.load_config();
+        rows.push_back(attrs_of(w, cached_size(w.path)));
+    }
+    bool good = write_attrs(rows, stamp) && idx.load(ws_attrs());
+    close(lfd);
+    return good;
+}
+
+// Replace one workspace's row after its config or size changed
+static void update_attrs(const Workspace& w, uint64_t size) {
+    AttrIndex idx;
+    if (!open_attrs(idx)) return;
+    int lfd = lock_file(ws_attrs() + ".lock");
+    if (lfd < 0) return;
+    if (idx.load(ws_attrs())) {
+        std::vector<WsAttrs> rows;
+        for (size_t i = 0; i < idx.rows(); i++) {
+            WsAttrs a = idx.decode(i);
+            if (a.name == w.name) a = attrs_of(w, size == UINT64_MAX ? a.size : size);
+            rows.push_back(a);
+        }
+        const AttrHeader& h = idx.header();
+        write_attrs(rows, RegistryStamp{h.conf_mtime, h.conf_size, h.journal_mtime, h.journal_size});
+    }
+    close(lfd);
+}
+
+// ============================================
+// GZIP CODEC
+// ============================================
+//
+// zlib does the deflate/inflate and CRC-32. ParallelGzip compresses
+// fixed-size blocks on a thread pool the way pigz does: each block is
+// primed with the previous 32 KiB as its dictionary and ends on a sync
+// flush, so the blocks are simply concatenated into one ordinary gzip
+// member. In member mode each block is instead a gzip member of its own,
+// without a dictionary, so it can be inflated on its own (see SEEKABLE
+// ARCHIVES). GzipReader inflates any gzip stream, including multi-member
+// files from other tools.
+
+// Raw deflate of in[dict_len, size) with in[0, dict_len) as history.
+// Unless last, the output ends on a sync flush: byte aligned, so the next
+// block's output can follow it directly.
+static bool deflate_block(const std::string& in, size_t dict_len, bool last, std::string& out) {
+    z_stream zs = {};
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    auto* data = (Bytef*)in.data();
+    if (dict_len) deflateSetDictionary(&zs, data, dict_len);
+    zs.next_in = data + dict_len;
+    zs.avail_in = in.size() - dict_len;
+    
+    // The bound covers the stream end; the slack covers the sync marker
+    out.resize(deflateBound(&zs, zs.avail_in) + 16);
+    size_t done = 0;
+    int rc;
+    while (true) {
+        zs.next_out = (Bytef*)&out[done];
+        zs.avail_out = out.size() - done;
+        rc = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+        done = out.size() - zs.avail_out;
+        if (zs.avail_out || rc == Z_STREAM_END || rc == Z_STREAM_ERROR) break;
+        out.resize(out.size() * 2);
+    }
+    out.resize(done);
+    deflateEnd(&zs);
+    return last ? rc == Z_STREAM_END : rc == Z_OK || rc == Z_BUF_ERROR;
+}
+
+// Streams bytes into gzip, compressing BLOCK-sized pieces on a pool.
+// Finished blocks are written to the fd strictly in order.
+class ParallelGzip {
+public:
+    static const size_t BLOCK = 1 << 20;
+    static const size_t DICT = 32768;
+    
+    // A member's offset in the file and of its first byte in the data
+    struct Member {
+        uint64_t offset, start;
+    };
+    
+    explicit ParallelGzip(int fd, unsigned threads = 0, bool members = false)
+        : fd_(fd), pool_(threads), members_(members) {
+        if (!members_) put(HEADER, sizeof(HEADER));
+        cur_.reserve(DICT + BLOCK);
+    }
+    
+    unsigned threads() const { return pool_.size(); }
+    uint64_t bytes_in() const { return in_; }
+    uint64_t bytes_out() const { return out_; }
+    bool ok() const { return ok_; }
+    
+    // Member mode only
+    const std::vector<Member>& members() const { return written_; }
+    uint64_t position() const { return in_ + cur_.size() - dict_len_; }
+    
+    void write(const void* p, size_t n) {
+        auto* c = (const unsigned char*)p;
+        while (n) {
+            size_t room = dict_len_ + BLOCK - cur_.size();
+            size_t take = std::min(room, n);
+            cur_.append((const char*)c, take);
+            c += take;
+            n -= take;
+            if (cur_.size() == dict_len_ + BLOCK) dispatch(false);
+        }
+    }
+    
+    bool finish() {
+        if (members_) {
+            flush();
+            return ok_;
+        }
+        dispatch(true);
+        drain(0);
+        put_trailer(crc_, in_);
+        return ok_;
+    }
+    
+    // Member mode: end the current member and write out everything, so
+    // what comes next starts a member at bytes_out()
+    void flush() {
+        if (!cur_.empty()) dispatch(true);
+        drain(0);
+    }
+
+private:
+    static constexpr unsigned char HEADER[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+    
+    struct Job {
+        std::string in;
+        size_t dict_len;
+        bool last;
+        std::string out;
+        uint32_t crc = 0;
+        bool good = false;
+        bool done = false;
+        std::mutex mu;
+        std::condition_variable cv;
+    };
+    
+    int fd_;
+    ThreadPool pool_;
+    bool members_;
+    std::string cur_;
+    size_t dict_len_ = 0;
+    std::deque<std::shared_ptr<Job>> inflight_;
+    std::vector<Member> written_;
+    uint64_t member_size_ = 0;
+    uint32_t crc_ = crc32(0, Z_NULL, 0);
+    uint64_t in_ = 0, out_ = 0;
+    bool ok_ = true;
+    
+    void put(const void* p, size_t n) {
+        auto* c = (const char*)p;
+        while (n && ok_) {
+            ssize_t m = ::write(fd_, c, n);
+            if (m < 0 && errno == EINTR) continue;
+            if (m <= 0) { ok_ = false; break; }
+            c += m;
+            n -= m;
+            out_ += m;
+        }
+    }
+    
+    void put_trailer(uint32_t crc, uint64_t size) {
+        unsigned char trailer[8];
+        for (int i = 0; i < 4; i++) trailer[i] = crc >> (8 * i);
+        for (int i = 0; i < 4; i++) trailer[4 + i] = size >> (8 * i);
+        put(trailer, sizeof(trailer));
+    }
+    
+    void dispatch(bool last) {
+        auto job = std::make_shared<Job>();
+        job->dict_len = dict_len_;
+        job->last = last || members_;
+        job->in = cur_;
+        in_ += cur_.size() - dict_len_;
+        
+        // Next block starts with this block's tail as its dictionary
+        dict_len_ = members_ ? 0 : std::min(DICT, cur_.size());
+        cur_.erase(0, cur_.size() - dict_len_);
+        
+        drain(pool_.size() * 2);
+        inflight_.push_back(job);
+        pool_.submit([job] {
+            job->good = deflate_block(job->in, job->dict_len, job->last, job->out);
+            job->crc = crc32(0, (const Bytef*)job->in.data() + job->dict_len, job->in.size() - job->dict_len);
+            std::lock_guard<std::mutex> lock(job->mu);
+            job->done = true;
+            job->cv.notify_all();
+        });
+    }
+    
+    // Write completed blocks until at most `keep` are outstanding
+    void drain(size_t keep) {
+        while (inflight_.size() > keep) {
+            auto job = inflight_.front();
+            {
+                std::unique_lock<std::mutex> lock(job->mu);
+                job->cv.wait(lock, [&] { return job->done; });
+            }
+            inflight_.pop_front();
+            if (!job->good) ok_ = false;
+            if (members_) {
+                uint64_t start = written_.empty() ? 0 : written_.back().start + member_size_;
+                written_.push_back({out_, start});
+                member_size_ = job->in.size();
+                put(HEADER, sizeof(HEADER));
+                put(job->out.data(), job->out.size());
+                put_trailer(job->crc, job->in.size());
+                continue;
+            }
+            put(job->out.data(), job->out.size());
+            crc_ = crc32_combine(crc_, job->crc, job->in.size() - job->dict_len);
+        }
+    }
+};
+
+// Streaming inflate of a gzip file (one or more members)
+class GzipReader {
+public:
+    using Sink = std::function<bool(const char*, size_t)>;
+    
+    explicit GzipReader(int fd) : fd_(fd), in_(256 * 1024), out_(OUTBUF) {}
+    
+    ~GzipReader() {
+        if (init_) inflateEnd(&zs_);
+    }
+    
+    GzipReader(const GzipReader&) = delete;
+    GzipReader& operator=(const GzipReader&) = delete;
+    
+    const std::string& error() const { return error_; }
+    uint64_t bytes_in() const { return consumed_; }
+    
+    // Decompress everything, handing output to sink in chunks. The sink
+    // returns false to abort.
+    bool run(const Sink& sink) {
+        if (!init_) {
+            if (inflateInit2(&zs_, 16 + MAX_WBITS) != Z_OK) return fail("out of memory");
+            init_ = true;
+        }
+        bool first = true;
+        while (true) {
+            if (!first) {
+                if (!fill(2)) break;
+                if (zs_.next_in[0] != 0x1f || zs_.next_in[1] != 0x8b) break;    // trailing padding
+                inflateReset(&zs_);
+            }
+            if (!member(sink)) return false;
+            first = false;
+        }
+        return true;
+    }
+
+private:
+    static const size_t OUTBUF = 256 * 1024;
+    
+    int fd_;
+    z_stream zs_ = {};
+    bool init_ = false;
+    std::vector<unsigned char> in_;
+    bool eof_ = false;
+    uint64_t consumed_ = 0;
+    std::vector<unsigned char> out_;
+    std::string error_;
+    
+    bool fail(const std::string& msg) {
+        if (error_.empty()) error_ = msg;
+        return false;
+    }
+    
+    // Have at least n input bytes buffered, unless the file ends first
+    bool fill(size_t n) {
+        while (zs_.avail_in < n && !eof_) {
+            if (zs_.avail_in) memmove(in_.data(), zs_.next_in, zs_.avail_in);
+            zs_.next_in = in_.data();
+            ssize_t m = read(fd_, in_.data() + zs_.avail_in, in_.size() - zs_.avail_in);
+            if (m < 0 && errno == EINTR) continue;
+            if (m <= 0) { eof_ = true; break; }
+            zs_.avail_in += m;
+            consumed_ += m;
+        }
+        return zs_.avail_in >= n;
+    }
+    
+    bool member(const Sink& sink) {
+        while (true) {
+            if (!fill(1)) return fail("unexpected end of archive");
+            zs_.next_out = out_.data();
+            zs_.avail_out = out_.size();
+            int rc = inflate(&zs_, Z_NO_FLUSH);
+            size_t n = out_.size() - zs_.avail_out;
+            if (n && !sink((const char*)out_.data(), n)) return fail("aborted");
+            if (rc == Z_STREAM_END) return true;
+            if (rc != Z_OK && !(rc == Z_BUF_ERROR && !zs_.avail_in))
+                return fail(zs_.msg ? std::string("corrupt archive: ") + zs_.msg : "corrupt archive");
+        }
+    }
+};
+
+// ============================================
+// TAR ARCHIVES
+// ============================================
+//
+// GNU-format tar streams written straight from a directory walk and
+// read back with a push parser, so neither side needs temp files or the
+// tar binary. Long names use GNU ././@LongLink records; pax headers from
+// other tools are understood on import.
+
+using ByteSink = std::function<void(const char*, size_t)>;
+
+class TarWriter {
+public:
+    using EntryHook = std::function<void(const std::string& name, char type, const struct stat& st, uint64_t size,
+                                         const std::string& link)>;
+    
+    explicit TarWriter(ByteSink sink) : sink_(std::move(sink)) {}
+    
+    uint64_t files() const { return files_; }
+    
+    // Called as each entry starts, before any of its bytes are written
+    void on_entry(EntryHook hook) { on_entry_ = std::move(hook); }
+    
+    void add_dir(const std::string& name, const struct stat& st) {
+        header(name + "/", st, '5', 0, "");
+    }
+    
+    void add_symlink(const std::string& name, const struct stat& st, const std::string& target) {
+        header(name, st, '2', 0, target);
+    }
+    
+    // Stream an open file, also handing what is read to `tee`. Exactly
+    // st.st_size bytes are archived even if the file changes underneath;
+    // returns false if it shrank.
+    bool add_file(const std::string& name, const struct stat& st, int fd, std::vector<char>& buf,
+                  const ByteSink* tee = nullptr) {
+        header(name, st, '0', st.st_size, "");
+        files_++;
+        uint64_t left = st.st_size;
+        bool complete = true;
+        while (left) {
+            ssize_t n = read(fd, buf.data(), std::min<uint64_t>(left, buf.size()));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                complete = false;
+                std::fill(buf.begin(), buf.end(), 0);
+                while (left) {
+                    size_t z = std::min<uint64_t>(left, buf.size());
+                    sink_(buf.data(), z);
+                    left -= z;
+                }
+                break;
+            }
+            sink_(buf.data(), n);
+            if (tee) (*tee)(buf.data(), n);
+            left -= n;
+        }
+        pad(st.st_size);
+        return complete;
+    }
+    
+    // A file of `size` bytes that `body` writes to the sink it is given
+    void add_data(const std::string& name, const struct stat& st, uint64_t size,
+                  const std::function<void(const ByteSink&)>& body) {
+        header(name, st, '0', size, "");
+        files_++;
+        body(sink_);
+        pad(size);
+    }
+    
+    void finish() {
+        char zero[1024] = {0};
+        sink_(zero, sizeof(zero));
+    }
+
+private:
+    ByteSink sink_;
+    EntryHook on_entry_;
+    uint64_t files_ = 0;
+    
+    void pad(uint64_t size) {
+        static const char zero[512] = {0};
+        if (size % 512) sink_(zero, 512 - size % 512);
+    }
+    
+    // Octal when it fits, GNU base-256 otherwise
+    static void number(char* field, size_t width, uint64_t v) {
+        if (v < (1ull << (3 * (width - 1)))) {
+            field[width - 1] = '\0';
+            for (size_t i = width - 1; i-- > 0; v >>= 3) field[i] = '0' + (v & 7);
+            return;
+        }
+        memset(field, 0, width);
+        field[0] = (char)0x80;
+        for (size_t i = width - 1; i > 0 && v; i--, v >>= 8) field[i] = v & 0xff;
+    }
+    
+    void raw_header(const std::string& name, const struct stat& st, char type,
+                    uint64_t size, const std::string& link) {
+        char h[512] = {0};
+        memcpy(h, name.data(), std::min<size_t>(name.size(), 100));
+        number(h + 100, 8, st.st_mode & 07777);
+        number(h + 108, 8, st.st_uid);
+        number(h + 116, 8, st.st_gid);
+        number(h + 124, 12, size);
+        number(h + 136, 12, st.st_mtime > 0 ? st.st_mtime : 0);
+        h[156] = type;
+        memcpy(h + 157, link.data(), std::min<size_t>(link.size(), 100));
+        memcpy(h + 257, "ustar  ", 8);
+        
+        memset(h + 148, ' ', 8);
+        unsigned sum = 0;
+        for (unsigned char c : h) sum += c;
+        snprintf(h + 148, 8, "%06o", sum);
+        sink_(h, sizeof(h));
+    }
+    
+    void long_record(char type, const std::string& value) {
+        struct stat st = {};
+        raw_header("././@LongLink", st, type, value.size() + 1, "");
+        sink_(value.c_str(), value.size() + 1);
+        pad(value.size() + 1);
+    }
+    
+    void header(const std::string& name, const struct stat& st, char type,
+                uint64_t size, const std::string& link) {
+        if (on_entry_) on_entry_(name, type, st, size, link);
+        if (link.size() > 100) long_record('K', link);
+        if (name.size() > 100) long_record('L', name);
+        raw_header(name, st, type, size, link);
+    }
+};
+
+// Optional hooks for tar_tree. `filter` sees each entry (its path below
+// the root, and the target of a symlink) and decides whether it goes in;
+// directories left out are still walked. The contents of archived files
+// go to `data`, followed by a call to `done`.
+struct TarHooks {
+    std::function<bool(const std::string& rel, const struct stat& st, const std::string& link)> filter;
+    ByteSink data;
+    std::function<void()> done;
+};
+
+// Archive a directory tree under `prefix/`, in sorted order. Entries whose
+// dev/ino match `skip` (the archive being written) are left out.
+static bool tar_tree(TarWriter& tar, const std::string& root, const std::string& prefix,
+                     const struct stat* skip, std::string& error, const TarHooks* hooks = nullptr) {
+    std::vector<char> buf(256 * 1024), dents(64 * 1024);
+    
+    std::function<bool(int, const std::string&)> walk = [&](int dfd, const std::string& arc) -> bool {
+        std::vector<std::string> names;
+        if (!for_each_dirent(dfd, dents, [&](const char* name, unsigned char) { names.push_back(name); })) {
+            error = arc + ": " + strerror(errno);
+            return false;
+        }
+        std::sort(names.begin(), names.end());
+        
+        for (auto& name : names) {
+            struct stat st;
+            if (fstatat(dfd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            if (skip && st.st_dev == skip->st_dev && st.st_ino == skip->st_ino) continue;
+            std::string entry = arc + "/" + name;
+            std::string link;
+            if (S_ISLNK(st.st_mode)) {
+                ssize_t n = readlinkat(dfd, name.c_str(), buf.data(), buf.size());
+                if (n < 0) continue;
+                link.assign(buf.data(), n);
+            }
+            bool wanted = !hooks || !hooks->filter || hooks->filter(entry.substr(prefix.size() + 1), st, link);
+            
+            if (S_ISDIR(st.st_mode)) {
+                int sub = openat(dfd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (sub < 0) { error = entry + ": " + strerror(errno); return false; }
+                if (wanted) tar.add_dir(entry, st);
+                bool good = walk(sub, entry);
+                close(sub);
+                if (!good) return false;
+            } else if (!wanted) {
+                continue;
+            } else if (S_ISREG(st.st_mode)) {
+                int fd = openat(dfd, name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+                if (fd < 0) { error = entry + ": " + strerror(errno); return false; }
+                if (!tar.add_file(entry, st, fd, buf, hooks && hooks->data ? &hooks->data : nullptr))
+                    std::cerr << YELLOW << "[!] File shrank while archiving: " << entry << "\n" << RESET;
+                close(fd);
+                if (hooks && hooks->done) hooks->done();
+            } else if (S_ISLNK(st.st_mode)) {
+                tar.add_symlink(entry, st, link);
+            }
+        }
+        return true;
+    };
+    
+    int rfd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rfd < 0) { error = root + ": " + strerror(errno); return false; }
+    struct stat st;
+    fstat(rfd, &st);
+    tar.add_dir(prefix, st);
+    bool good = walk(rfd, prefix);
+    close(rfd);
+    return good;
+}
+
+// Push parser that extracts a tar stream below `dest`, dropping the first
+// `strip` path components. Small files are written by a thread pool while
+// the stream keeps decoding; large ones are streamed in place.
+//
+// Nothing is created by path: each entry's directory is reached from a
+// descriptor for `dest` one component at a time with O_NOFOLLOW, and the
+// entry made with the *at() calls relative to it. A symlink laid down by
+// an earlier entry (or already in dest) therefore can't carry a later
+// entry outside dest; the archive is refused instead, as tar does.
+class TarExtractor {
+public:
+    TarExtractor(const std::string& dest, int strip, unsigned threads = 0)
+        : dest_(dest), strip_(strip), pool_(threads, worker_count() * 4) {}
+    
+    ~TarExtractor() {
+        pool_.wait();
+        if (dir_fd_ >= 0) close(dir_fd_);
+        if (buffer_dir_ >= 0) close(buffer_dir_);
+        if (stream_fd_ >= 0) close(stream_fd_);
+    }
+    
+    const std::string& error() const { return error_; }
+    uint64_t files() const { return files_; }
+    uint64_t bytes() const { return bytes_; }
+    
+    // Header fields: octal or GNU base-256 numbers, NUL-padded strings
+    static uint64_t number(const char* f, size_t width) {
+        if ((unsigned char)f[0] & 0x80) {
+            uint64_t v = 0;
+            for (size_t i = 1; i < width; i++) v = (v << 8) | (unsigned char)f[i];
+            return v;
+        }
+        uint64_t v = 0;
+        for (size_t i = 0; i < width && f[i]; i++) {
+            if (f[i] >= '0' && f[i] <= '7') v = v * 8 + (f[i] - '0');
+            else if (f[i] != ' ') break;
+        }
+        return v;
+    }
+    
+    static std::string field(const char* f, size_t width) {
+        return std::string(f, strnlen(f, width));
+    }
+    
+    bool feed(const char* p, size_t n) {
+        bytes_ += n;
+        while (n && error_.empty()) {
+            if (state_ == HEADER) {
+                size_t take = std::min(n, 512 - have_);
+                memcpy(hdr_ + have_, p, take);
+                have_ += take;
+                p += take;
+                n -= take;
+                if (have_ == 512) {
+                    have_ = 0;
+                    on_header();
+                }
+            } else if (state_ == DATA) {
+                size_t take = std::min<uint64_t>(n, left_);
+                on_data(p, take);
+                p += take;
+                n -= take;
+                left_ -= take;
+                if (!left_) end_entry();
+            } else if (state_ == PAD) {
+                size_t take = std::min<uint64_t>(n, left_);
+                p += take;
+                n -= take;
+                left_ -= take;
+                if (!left_) state_ = HEADER;
+            } else {
+                return true;        // end of archive, ignore trailing blocks
+            }
+        }
+        return error_.empty();
+    }
+    
+    bool finish() {
+        pool_.wait();
+        if (error_.empty() && state_ != DONE && (state_ != HEADER || have_ || !zero_blocks_))
+            fail("truncated archive");
+        
+        // Directory modes and times last, deepest first
+        std::sort(dirs_.begin(), dirs_.end(), [](auto& a, auto& b) { return a.path.size() > b.path.size(); });
+        for (auto& d : dirs_) {
+            chmod(d.path.c_str(), d.mode);
+            struct timespec ts[2] = {{d.mtime, 0}, {d.mtime, 0}};
+            utimensat(AT_FDCWD, d.path.c_str(), ts, AT_SYMLINK_NOFOLLOW);
+        }
+        return error_.empty();
+    }
+
+private:
+    enum State { HEADER, DATA, PAD, DONE };
+    enum Target { SKIP, LONGNAME, LONGLINK, PAX, BUFFER, STREAM };
+    static const uint64_t SMALL_FILE = 4 << 20;
+    
+    struct DirMeta {
+        std::string path;
+        mode_t mode;
+        time_t mtime;
+    };
+    
+    std::string dest_;
+    int strip_;
+    
+    State state_ = HEADER;
+    char hdr_[512];
+    size_t have_ = 0;
+    int zero_blocks_ = 0;
+    uint64_t left_ = 0, entry_size_ = 0;
+    
+    Target target_ = SKIP;
+    std::string long_name_, long_link_, pax_path_, pax_link_;
+    int64_t pax_size_ = -1;
+    std::string meta_;                          // LongLink/pax payload
+    std::shared_ptr<std::string> data_;         // small file contents
+    int stream_fd_ = -1;
+    int buffer_dir_ = -1;                       // directory of the file being buffered
+    std::string path_, leaf_;
+    mode_t mode_ = 0644;
+    time_t mtime_ = 0;
+    
+    std::vector<DirMeta> dirs_;
+    std::string dir_;                           // last directory opened, below dest
+    int dir_fd_ = -1;
+    std::mutex err_mu_;
+    std::string error_;
+    uint64_t files_ = 0, bytes_ = 0;
+    ThreadPool pool_;       // last, so jobs never outlive the members they use
+    
+    void fail(const std::string& msg) {
+        std::lock_guard<std::mutex> lock(err_mu_);
+        if (error_.empty()) error_ = msg;
+    }
+    
+    // Split an archive path into its components below dest, refusing
+    // anything that would escape it. None means "skip this entry".
+    bool resolve(const std::string& name, std::vector<std::string>& out) {
+        std::vector<std::string> parts;
+        std::stringstream ss(name);
+        std::string part;
+        while (std::getline(ss, part, '/')) {
+            if (part.empty() || part == ".") continue;
+            if (part == "..") { fail("unsafe path in archive: " + name); return false; }
+            parts.push_back(part);
+        }
+        if (name.size() && name[0] == '/') { fail("absolute path in archive: " + name); return false; }
+        out.assign(parts.begin() + std::min<size_t>(strip_, parts.size()), parts.end());
+        return true;
+    }
+    
+    std::string path_of(const std::vector<std::string>& parts) const {
+        std::string out = dest_;
+        for (auto& p : parts) out += "/" + p;
+        return out;
+    }
+    
+    // A new descriptor for the directory holding parts[0, n), made if
+    // missing, or -1 after failing. The last one is kept open, as entries
+    // mostly arrive a directory at a time.
+    int open_dir(const std::vector<std::string>& parts, size_t n) {
+        std::string key;
+        for (size_t i = 0; i < n; i++) key += "/" + parts[i];
+        if (dir_fd_ >= 0 && key == dir_) return fcntl(dir_fd_, F_DUPFD_CLOEXEC, 0);
+        
+        int fd = open(dest_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0 && errno == ENOENT) {
+            std::error_code ec;
+            fs::create_directories(dest_, ec);
+            fd = open(dest_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+        if (fd < 0) { fail(dest_ + ": " + strerror(errno)); return -1; }
+        for (size_t i = 0; i < n; i++) {
+            if (mkdirat(fd, parts[i].c_str(), 0755) != 0 && errno != EEXIST) {
+                fail(dest_ + key + ": " + strerror(errno));
+                close(fd);
+                return -1;
+            }
+            int sub = openat(fd, parts[i].c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            close(fd);
+            if (sub < 0) {
+                std::vector<std::string> upto(parts.begin(), parts.begin() + i + 1);
+                fail(errno == ELOOP || errno == ENOTDIR
+                         ? "path in archive leads through a symlink or file: " + path_of(upto)
+                         : path_of(upto) + ": " + strerror(errno));
+                return -1;
+            }
+            fd = sub;
+        }
+        if (dir_fd_ >= 0) close(dir_fd_);
+        dir_fd_ = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        dir_ = key;
+        return fd;
+    }
+    
+    void on_header() {
+        bool zero = std::all_of(hdr_, hdr_ + 512, [](char c) { return c == 0; });
+        if (zero) {
+            if (++zero_blocks_ == 2) state_ = DONE;
+            return;
+        }
+        zero_blocks_ = 0;
+        
+        unsigned sum = 0;
+        for (int i = 0; i < 512; i++) sum += (i >= 148 && i < 156) ? ' ' : (unsigned char)hdr_[i];
+        if (sum != number(hdr_ + 148, 8)) { fail("corrupt tar header"); return; }
+        
+        char type = hdr_[156];
+        entry_size_ = number(hdr_ + 124, 12);
+        std::string name = field(hdr_, 100);
+        if (!memcmp(hdr_ + 257, "ustar\0", 6) && hdr_[345])
+            name = field(hdr_ + 345, 155) + "/" + name;
+        std::string link = field(hdr_ + 157, 100);
+        mode_ = number(hdr_ + 100, 8) & 07777;
+        mtime_ = number(hdr_ + 136, 12);
+        
+        target_ = SKIP;
+        meta_.clear();
+        if (type == 'L') target_ = LONGNAME;
+        else if (type == 'K') target_ = LONGLINK;
+        else if (type == 'x') target_ = PAX;
+        else if (type == 'g') target_ = SKIP;
+        else {
+            // A real entry: apply any pending long name / pax overrides
+            if (!long_name_.empty()) name = long_name_;
+            if (!long_link_.empty()) link = long_link_;
+            if (!pax_path_.empty()) name = pax_path_;
+            if (!pax_link_.empty()) link = pax_link_;
+            if (pax_size_ >= 0) entry_size_ = pax_size_;
+            long_name_.clear();
+            long_link_.clear();
+            pax_path_.clear();
+            pax_link_.clear();
+            pax_size_ = -1;
+            begin_entry(type, name, link);
+        }
+        
+        left_ = entry_size_;
+        state_ = left_ ? DATA : HEADER;
+        if (!left_ && (target_ == BUFFER || target_ == STREAM)) end_entry();
+    }
+    
+    void begin_entry(char type, const std::string& name, const std::string& link) {
+        std::vector<std::string> parts;
+        if (!resolve(name, parts) || parts.empty()) return;
+        path_ = path_of(parts);
+        
+        if (type == '5') {
+            int fd = open_dir(parts, parts.size());
+            if (fd < 0) return;
+            close(fd);
+            dirs_.push_back({path_, mode_, mtime_});
+            return;
+        }
+        
+        // Anything already at the name is replaced, never written through
+        bool file = type == '0' || type == '\0' || type == '7';
+        if (!file && type != '1' && type != '2') return;      // devices, fifos, unknown types
+        int dfd = open_dir(parts, parts.size() - 1);
+        if (dfd < 0) return;
+        const char* leaf = parts.back().c_str();
+        
+        if (type == '2') {
+            unlinkat(dfd, leaf, 0);
+            if (symlinkat(link.c_str(), dfd, leaf) != 0) fail(path_ + ": " + strerror(errno));
+        } else if (type == '1') {
+            std::vector<std::string> target;
+            int tfd = -1;
+            if (resolve(link, target) && !target.empty()) tfd = open_dir(target, target.size() - 1);
+            if (tfd >= 0) {
+                pool_.wait();       // the target may still be queued
+                unlinkat(dfd, leaf, 0);
+                if (linkat(tfd, target.back().c_str(), dfd, leaf, 0) != 0) fail(path_ + ": " + strerror(errno));
+                close(tfd);
+            }
+        } else {
+            files_++;
+            unlinkat(dfd, leaf, 0);
+            if (entry_size_ <= SMALL_FILE) {
+                target_ = BUFFER;
+                data_ = std::make_shared<std::string>();
+                data_->reserve(entry_size_);
+                buffer_dir_ = dfd;
+                leaf_ = leaf;
+                return;         // the write job takes the descriptor
+            }
+            target_ = STREAM;
+            stream_fd_ = openat(dfd, leaf, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+            if (stream_fd_ < 0) fail(path_ + ": " + strerror(errno));
+        }
+        close(dfd);
+    }
+    
+    void on_data(const char* p, size_t n) {
+        switch (target_) {
+        case LONGNAME: case LONGLINK: case PAX:
+            meta_.append(p, n);
+            break;
+        case BUFFER:
+            data_->append(p, n);
+            break;
+        case STREAM:
+            while (n && stream_fd_ >= 0) {
+                ssize_t m = write(stream_fd_, p, n);
+                if (m < 0 && errno == EINTR) continue;
+                if (m <= 0) { fail(path_ + ": " + strerror(errno)); break; }
+                p += m;
+                n -= m;
+            }
+            break;
+        case SKIP:
+            break;
+        }
+    }
+    
+    static void set_times(int fd, time_t mtime) {
+        struct timespec ts[2] = {{mtime, 0}, {mtime, 0}};
+        futimens(fd, ts);
+    }
+    
+    void end_entry() {
+        switch (target_) {
+        case LONGNAME:
+            long_name_ = meta_.c_str();
+            break;
+        case LONGLINK:
+            long_link_ = meta_.c_str();
+            break;
+        case PAX:
+            parse_pax();
+            break;
+        case BUFFER: {
+            auto data = data_;
+            std::string path = path_, leaf = leaf_;
+            int dfd = buffer_dir_;
+            mode_t mode = mode_;
+            time_t mtime = mtime_;
+            data_.reset();
+            buffer_dir_ = -1;
+            pool_.submit([this, data, path, leaf, dfd, mode, mtime] {
+                int fd = openat(dfd, leaf.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+                close(dfd);
+                if (fd < 0) { fail(path + ": " + strerror(errno)); return; }
+                const char* p = data->data();
+                size_t n = data->size();
+                while (n) {
+                    ssize_t m = write(fd, p, n);
+                    if (m < 0 && errno == EINTR) continue;
+                    if (m <= 0) { fail(path + ": " + strerror(errno)); break; }
+                    p += m;
+                    n -= m;
+                }
+                fchmod(fd, mode);
+                set_times(fd, mtime);
+                close(fd);
+            });
+            break;
+        }
+        case STREAM:
+            if (stream_fd_ >= 0) {
+                fchmod(stream_fd_, mode_);
+                set_times(stream_fd_, mtime_);
+                close(stream_fd_);
+                stream_fd_ = -1;
+            }
+            break;
+        case SKIP:
+            break;
+        }
+        target_ = SKIP;
+        left_ = (512 - entry_size_ % 512) % 512;
+        state_ = left_ ? PAD : HEADER;
+    }
+    
+    // "<len> <key>=<value>\n" records
+    void parse_pax() {
+        size_t pos = 0;
+        while (pos < meta_.size()) {
+            size_t sp = meta_.find(' ', pos);
+            if (sp == std::string::npos) break;
+            size_t len = std::strtoull(meta_.c_str() + pos, nullptr, 10);
+            if (!len || pos + len > meta_.size()) break;
+            std::string rec = meta_.substr(sp + 1, pos + len - sp - 2);
+            pos += len;
+            size_t eq = rec.find('=');
+            if (eq == std::string::npos) continue;
+            std::string key = rec.substr(0, eq), val = rec.substr(eq + 1);
+            if (key == "path") pax_path_ = val;
+            else if (key == "linkpath") pax_link_ = val;
+            else if (key == "size") pax_size_ = std::strtoll(val.c_str(), nullptr, 10);
+        }
+    }
+};
+
+// ============================================
+// SHA-256
+// ============================================
+
+class Sha256 {
+public:
+    Sha256() { reset(); }
+    
+    void reset() {
+        static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                         0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(h_, init, sizeof(h_));
+        len_ = 0;
+        fill_ = 0;
+    }
+    
+    void update(const void* data, size_t n) {
+        auto* p = (const unsigned char*)data;
+        len_ += n;
+        if (fill_) {
+            size_t take = std::min(n, 64 - fill_);
+            memcpy(buf_ + fill_, p, take);
+            fill_ += take;
+            p += take;
+            n -= take;
+            if (fill_ < 64) return;
+            block(buf_);
+            fill_ = 0;
+        }
+        for (; n >= 64; p += 64, n -= 64) block(p);
+        memcpy(buf_, p, n);
+        fill_ = n;
+    }
+    
+    void update(const std::string& s) { update(s.data(), s.size()); }
+    
+    std::string hex() {
+        uint64_t bits = len_ * 8;
+        unsigned char pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (fill_ != 56) update(&pad, 1);
+        unsigned char be[8];
+        for (int i = 0; i < 8; i++) be[i] = bits >> (56 - 8 * i);
+        update(be, 8);
+        
+        static const char* digits = "0123456789abcdef";
+        std::string out;
+        for (uint32_t v : h_)
+            for (int s = 28; s >= 0; s -= 4) out += digits[(v >> s) & 15];
+        reset();
+        return out;
+    }
+    
+    static std::string of(const std::string& s) {
+        Sha256 h;
+        h.update(s);
+        return h.hex();
+    }
+
+private:
+    uint32_t h_[8];
+    uint64_t len_;
+    unsigned char buf_[64];
+    size_t fill_;
+    
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+    
+    void block(const unsigned char* p) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t)p[4 * i] << 24 | p[4 * i + 1] << 16 | p[4 * i + 2] << 8 | p[4 * i + 3];
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        
+        uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        h_[0] += a; h_[1] += b; h_[2] += c; h_[3] += d;
+        h_[4] += e; h_[5] += f; h_[6] += g; h_[7] += h;
+    }
+};
+
+static bool hash_fd(int fd, std::vector<char>& buf, std::string& digest) {
+    Sha256 h;
+    while (true) {
+        ssize_t n = read(fd, buf.data(), buf.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        if (n == 0) break;
+        h.update(buf.data(), n);
+    }
+    digest = h.hex();
+    return true;
+}
+
+// ============================================
+// DELTA ARCHIVES
+// ============================================
+//
+// Every ws-export records a manifest of what it archived: type, mode,
+// mtime and size of each entry, and for files of DELTA_MIN_FILE and up,
+// block signatures and a digest (SHA-256 of the signatures, so a large
+// export isn't held up by hashing every byte twice). It is stored as the
+// archive's last entry, .ws-manifest (outside the workspace directory, so
+// imports skip it), and next to the archive as <archive>.manifest.
+//
+// ws-export --base <archive or manifest> writes a delta instead. Files
+// whose size, mtime and mode match the base are taken as unchanged
+// without being read. New and changed entries go in whole, except large
+// files with signatures on record: those become patches, the rsync way,
+// by sliding a rolling checksum over the new file to find blocks the old
+// one already has.
+//
+//   .ws-delta/               first entry, marks a delta archive
+//   <prefix>/...             new and changed entries
+//   .ws-delta/patch/<path>   "WSDP1", u32 block size, then ops: 'C' u64
+//                            first block + u32 count copied from the old
+//                            file, or 'L' u32 length + literal bytes
+//   .ws-delta/control        "base <id>", "target <id>", "prefix <dir>",
+//                            "-\t<path>" removals and
+//                            "p\t<old digest>\t<new digest>\t<sha256>\t<path>"
+//                            patches, with the SHA-256 of the patched file
+//   .ws-manifest             the manifest after this delta
+//
+// A manifest's id is the SHA-256 of its text. ws-import stages a delta
+// inside .ws, checks that its base is the manifest of the archive (or
+// delta) before it and that it only removes what that lists, checks
+// every file to be patched against its old digest, checks each result
+// against the SHA-256 of its actual bytes (the digests only cover block
+// signatures, which a block collision could fool), and only then moves
+// anything into place, without following symlinks in the workspace.
+//
+//   # wsmanifest 1
+//   type \t mode \t mtime \t size \t digest \t block \t signatures \t link \t path
+
+static const uint64_t DELTA_MIN_FILE = 1 << 20;
+
+struct BlockSig {
+    uint32_t weak;
+    uint64_t strong;
+};
+
+struct ManifestEntry {
+    char type = 'f';                // f(ile), d(irectory) or l(ink)
+    mode_t mode = 0;
+    int64_t mtime = 0;              // ns
+    uint64_t size = 0;
+    std::string digest;
+    std::string link;
+    uint32_t block = 0;             // signature block size, 0 for none
+    std::vector<BlockSig> sigs;
+};
+
+// By path below the workspace root
+using Manifest = std::map<std::string, ManifestEntry>;
+
+struct DeltaStats {
+    uint64_t changed = 0;           // entries archived, whole or patched
+    uint64_t patched = 0;
+    uint64_t removed = 0;
+    uint64_t tree_bytes = 0;        // all files in the workspace
+    uint64_t sent_bytes = 0;        // file bytes archived, whole or as literals
+    uint64_t reused_bytes = 0;      // bytes patches take from the old files
+};
+
+// About sqrt(size), 4K to 128K
+static uint32_t delta_block(uint64_t size) {
+    uint32_t b = 4096;
+    while (b < (128u << 10) && (uint64_t)b * b < size) b <<= 1;
+    return b;
+}
+
+// rsync's rolling checksum: sliding it one byte costs two additions
+struct RollSum {
+    uint32_t a = 0, b = 0, len = 0;
+    
+    void init(const unsigned char* p, size_t n) {
+        a = b = 0;
+        len = n;
+        for (size_t i = 0; i < n; i++) {
+            a += p[i];
+            b += (uint32_t)(n - i) * p[i];
+        }
+    }
+    
+    void roll(unsigned char out, unsigned char in) {
+        a += in - out;
+        b += a - len * out;
+    }
+    
+    uint32_t digest() const { return (a & 0xffff) | (b << 16); }
+};
+
+// Confirms a weak match, cheaply, as it runs on every block exported. It
+// isn't cryptographic: two blocks can collide, so ws-import checks each
+// patched file against a SHA-256 of its bytes taken when the patch was
+// written.
+static uint64_t strong_sum(const void* data, size_t n) {
+    auto* p = (const unsigned char*)data;
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ n;
+    auto mix = [&](uint64_t v) {
+        h = (h ^ v) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    };
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        mix(v);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, n);
+    mix(tail);
+    return h * 0xc4ceb9fe1a85ec53ull;
+}
+
+// Block signatures and digest of a large file, fed in order
+struct FileDigest {
+    uint32_t block;
+    std::string pending;
+    std::vector<BlockSig> sigs;
+    
+    explicit FileDigest(uint64_t size) : block(delta_block(size)) {}
+    
+    void update(const char* p, size_t n) {
+        while (n) {
+            size_t take = std::min<size_t>(n, block - pending.size());
+            pending.append(p, take);
+            p += take;
+            n -= take;
+            if (pending.size() == block) flush();
+        }
+    }
+    
+    void flush() {
+        RollSum r;
+        r.init((const unsigned char*)pending.data(), pending.size());
+        sigs.push_back({r.digest(), strong_sum(pending.data(), pending.size())});
+        pending.clear();
+    }
+    
+    void finish(ManifestEntry& e) {
+        if (!pending.empty()) flush();
+        Sha256 h;
+        for (auto& s : sigs) {
+            h.update(&s.weak, sizeof(s.weak));
+            h.update(&s.strong, sizeof(s.strong));
+        }
+        e.digest = h.hex();
+        e.block = block;
+        e.sigs = std::move(sigs);
+    }
+};
+
+static std::string manifest_text(const Manifest& m) {
+    std::string out = "# wsmanifest 1\n";
+    char buf[64];
+    for (auto& [path, e] : m) {
+        snprintf(buf, sizeof(buf), "%c\t%o\t%lld\t%llu\t", e.type, (unsigned)e.mode, (long long)e.mtime,
+                 (unsigned long long)e.size);
+        out += buf + e.digest + '\t' + std::to_string(e.block) + '\t';
+        for (auto& s : e.sigs) {
+            snprintf(buf, sizeof(buf), "%08x%016llx", s.weak, (unsigned long long)s.strong);
+            out += buf;
+        }
+        out += '\t' + e.link + '\t' + path + '\n';
+    }
+    return out;
+}
+
+static bool parse_manifest(const std::string& text, Manifest& m) {
+    std::istringstream in(text);
+    std::string line;
+    if (!std::getline(in, line) || line != "# wsmanifest 1") return false;
+    while (std::getline(in, line)) {
+        std::vector<std::string> parts;
+        size_t pos = 0, tab;
+        while (parts.size() < 8 && (tab = line.find('\t', pos)) != std::string::npos) {
+            parts.push_back(line.substr(pos, tab - pos));
+            pos = tab + 1;
+        }
+        if (parts.size() != 8 || parts[0].size() != 1) return false;
+        ManifestEntry e;
+        e.type = parts[0][0];
+        e.mode = std::strtoul(parts[1].c_str(), nullptr, 8);
+        e.mtime = std::strtoll(parts[2].c_str(), nullptr, 10);
+        e.size = std::strtoull(parts[3].c_str(), nullptr, 10);
+        e.digest = parts[4];
+        e.block = std::strtoul(parts[5].c_str(), nullptr, 10);
+        for (size_t i = 0; i + 24 <= parts[6].size(); i += 24)
+            e.sigs.push_back({(uint32_t)std::strtoul(parts[6].substr(i, 8).c_str(), nullptr, 16),
+                              std::strtoull(parts[6].substr(i + 8, 16).c_str(), nullptr, 16)});
+        e.link = parts[7];
+        m[line.substr(pos)] = std::move(e);
+    }
+    return true;
+}
+
+// Read a tar or tar.gz archive, from byte `from` on, up to the entry
+// `want` and return its contents, or with `want` empty, the name of the
+// first entry
+static bool tar_find(const std::string& archive, const std::string& want, std::string& out, uint64_t from = 0) {
+    int fd = open(archive.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    unsigned char magic[2] = {0, 0};
+    bool gzipped = pread(fd, magic, 2, from) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+    lseek(fd, from, SEEK_SET);
+    
+    char hdr[512];
+    size_t have = 0;
+    uint64_t data_left = 0, pad_left = 0;
+    int capture = 0;            // 1: a long name, 2: the entry wanted
+    std::string long_name;
+    bool found = false;
+    out.clear();
+    
+    auto feed = [&](const char* p, size_t n) -> bool {
+        while (n) {
+            if (data_left || pad_left) {
+                size_t take = std::min<uint64_t>(n, data_left ? data_left : pad_left);
+                if (data_left) {
+                    if (capture == 1) long_name.append(p, take);
+                    else if (capture == 2) out.append(p, take);
+                    data_left -= take;
+                    if (!data_left && capture == 2) { found = true; return false; }
+                } else {
+                    pad_left -= take;
+                }
+                p += take;
+                n -= take;
+                continue;
+            }
+            size_t take = std::min(n, sizeof(hdr) - have);
+            memcpy(hdr + have, p, take);
+            have += take;
+            p += take;
+            n -= take;
+            if (have < sizeof(hdr)) continue;
+            have = 0;
+            if (std::all_of(hdr, hdr + 512, [](char c) { return c == 0; })) return false;
+            
+            uint64_t size = TarExtractor::number(hdr + 124, 12);
+            std::string name = TarExtractor::field(hdr, 100);
+            if (hdr[156] != 'L' && !long_name.empty()) {
+                name = long_name.c_str();
+                long_name.clear();
+            }
+            if (want.empty() && hdr[156] != 'L') { out = name; found = true; return false; }
+            capture = hdr[156] == 'L' ? 1 : name == want ? 2 : 0;
+            if (capture == 2 && !size) { found = true; return false; }
+            data_left = size;
+            pad_left = (512 - size % 512) % 512;
+        }
+        return true;
+    };
+    
+    if (gzipped) {
+        GzipReader gz(fd);
+        gz.run(feed);
+    } else {
+        std::vector<char> buf(256 * 1024);
+        ssize_t n;
+        while ((n = read(fd, buf.data(), buf.size())) > 0 && feed(buf.data(), n)) {}
+    }
+    close(fd);
+    return found;
+}
+
+static bool is_delta_archive(const std::string& archive) {
+    std::string first;
+    return tar_find(archive, "", first) && first == ".ws-delta/";
+}
+
+// A manifest file, the .manifest next to an archive, or the manifest
+// inside the archive (which means reading all of it)
+static bool load_manifest(const std::string& path, Manifest& m, std::string& id, std::string& error) {
+    char head[16] = {0};
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { error = path + ": " + strerror(errno); return false; }
+    bool plain = pread(fd, head, sizeof(head) - 1, 0) > 0 && !strncmp(head, "# wsmanifest 1\n", 15);
+    close(fd);
+    
+    std::string text;
+    if (plain) read_whole(path, text);
+    else if (!read_whole(path + ".manifest", text)) {
+        info("No " + path + ".manifest, reading the manifest from the archive");
+        tar_find(path, ".ws-manifest", text);
+    }
+    if (!parse_manifest(text, m)) { error = "no usable manifest for " + path; return false; }
+    id = Sha256::of(text);
+    return true;
+}
+
+static void put_le(std::string& out, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) out += (char)(v >> (8 * i));
+}
+
+static uint64_t get_le(const char* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = bytes; i-- > 0; ) v = (v << 8) | (unsigned char)p[i];
+    return v;
+}
+
+// Archive `rel` as a patch against the old version described by `old`,
+// setting `sha` to the SHA-256 of the file. False, with nothing written,
+// when a patch would save little.
+static bool write_patch(TarWriter& tar, const std::string& path, const std::string& rel, const struct stat& st,
+                        const ManifestEntry& old, ManifestEntry& e, std::string& sha, DeltaStats& stats) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    uint64_t size = st.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    const unsigned char* data = (const unsigned char*)map;
+    
+    // Old blocks by weak sum, with a bitmap to turn most positions away
+    // before the binary search. A short last block can't match a full
+    // window, so it is left out.
+    const uint32_t B = old.block;
+    std::vector<std::pair<uint32_t, uint32_t>> index;
+    std::vector<uint64_t> seen(1 << 10);
+    for (uint32_t i = 0; i < old.sigs.size(); i++) {
+        if ((uint64_t)(i + 1) * B > old.size) break;
+        index.push_back({old.sigs[i].weak, i});
+        seen[(old.sigs[i].weak >> 16) >> 6] |= 1ull << ((old.sigs[i].weak >> 16) & 63);
+    }
+    std::sort(index.begin(), index.end());
+    
+    struct Op {
+        bool copy;
+        uint64_t start;     // first block, or offset in the new file
+        uint64_t count;     // blocks, or bytes
+    };
+    std::vector<Op> ops;
+    uint64_t literal = 0, lit_start = 0, pos = 0;
+    auto flush_literal = [&](uint64_t end) {
+        for (uint64_t at = lit_start; at < end; ) {
+            uint64_t n = std::min<uint64_t>(end - at, 1u << 30);
+            ops.push_back({false, at, n});
+            literal += n;
+            at += n;
+        }
+    };
+    
+    RollSum r;
+    if (size >= B) r.init(data, B);
+    while (pos + B <= size) {
+        uint32_t weak = r.digest();
+        uint32_t hi = weak >> 16;
+        int64_t match = -1;
+        if (seen[hi >> 6] & (1ull << (hi & 63))) {
+            auto it = std::lower_bound(index.begin(), index.end(), std::make_pair(weak, 0u));
+            uint64_t strong = 0;
+            for (; it != index.end() && it->first == weak && match < 0; ++it) {
+                if (!strong) strong = strong_sum(data + pos, B);
+                if (old.sigs[it->second].strong == strong) match = it->second;
+            }
+        }
+        if (match >= 0) {
+            flush_literal(pos);
+            if (!ops.empty() && ops.back().copy && ops.back().start + ops.back().count == (uint64_t)match &&
+                ops.back().count < UINT32_MAX)
+                ops.back().count++;
+            else
+                ops.push_back({true, (uint64_t)match, 1});
+            pos += B;
+            lit_start = pos;
+            if (pos + B <= size) r.init(data + pos, B);
+            continue;
+        }
+        if (pos + B < size) r.roll(data[pos], data[pos + B]);
+        pos++;
+    }
+    flush_literal(size);
+    
+    uint64_t patch_size = 9;
+    for (auto& op : ops) patch_size += op.copy ? 13 : 5 + op.count;
+    if (patch_size > size / 10 * 9) {
+        munmap(map, size);
+        return false;
+    }
+    
+    struct stat pst = st;
+    pst.st_mode = S_IFREG | 0644;
+    tar.add_data(".ws-delta/patch/" + rel, pst, patch_size, [&](const ByteSink& sink) {
+        std::string head = "WSDP1";
+        put_le(head, B, 4);
+        sink(head.data(), head.size());
+        for (auto& op : ops) {
+            std::string h(1, op.copy ? 'C' : 'L');
+            if (op.copy) {
+                put_le(h, op.start, 8);
+                put_le(h, op.count, 4);
+                sink(h.data(), h.size());
+            } else {
+                put_le(h, op.count, 4);
+                sink(h.data(), h.size());
+                sink((const char*)data + op.start, op.count);
+            }
+        }
+    });
+    
+    FileDigest digest(size);
+    digest.update((const char*)data, size);
+    digest.finish(e);
+    Sha256 h;
+    h.update(data, size);
+    sha = h.hex();
+    munmap(map, size);
+    stats.sent_bytes += literal;
+    stats.reused_bytes += size - literal;
+    return true;
+}
+
+// Archive a workspace under prefix/ and record its manifest in `out`.
+// Against a base manifest only what changed goes in, as a delta.
+static bool export_tree(TarWriter& tar, const Workspace& w, const std::string& prefix, const struct stat* skip,
+                        const Manifest* base, const std::string& base_id, Manifest& out, DeltaStats& stats,
+                        std::string& error) {
+    struct stat root;
+    if (stat(w.path.c_str(), &root) != 0) { error = w.path + ": " + strerror(errno); return false; }
+    if (base) tar.add_dir(".ws-delta", root);
+    
+    std::string patches, sha;
+    std::unique_ptr<FileDigest> digest;
+    ManifestEntry* current = nullptr;
+    TarHooks hooks;
+    hooks.filter = [&](const std::string& rel, const struct stat& st, const std::string& link) {
+        ManifestEntry e;
+        e.mode = st.st_mode & 07777;
+        e.mtime = mtime_ns(st);
+        const ManifestEntry* old = nullptr;
+        if (base) {
+            auto it = base->find(rel);
+            if (it != base->end()) old = &it->second;
+        }
+        
+        if (S_ISDIR(st.st_mode)) {
+            e.type = 'd';
+            out[rel] = e;
+            return !old || old->type != 'd' || old->mode != e.mode || old->mtime != e.mtime;
+        }
+        if (S_ISLNK(st.st_mode)) {
+            e.type = 'l';
+            e.link = link;
+            out[rel] = e;
+            return !old || old->type != 'l' || old->link != link;
+        }
+        if (!S_ISREG(st.st_mode)) return false;
+        
+        e.size = st.st_size;
+        stats.tree_bytes += e.size;
+        if (old && old->type == 'f' && old->size == e.size && old->mtime == e.mtime && old->mode == e.mode) {
+            out[rel] = *old;
+            return false;
+        }
+        stats.changed++;
+        if (old && old->type == 'f' && !old->sigs.empty() && e.size >= DELTA_MIN_FILE &&
+            write_patch(tar, w.path + "/" + rel, rel, st, *old, e, sha, stats)) {
+            patches += "p\t" + old->digest + "\t" + e.digest + "\t" + sha + "\t" + rel + "\n";
+            stats.patched++;
+            out[rel] = std::move(e);
+            return false;
+        }
+        stats.sent_bytes += e.size;
+        current = &(out[rel] = std::move(e));
+        digest.reset(current->size >= DELTA_MIN_FILE ? new FileDigest(current->size) : nullptr);
+        return true;
+    };
+    hooks.data = [&](const char* p, size_t n) {
+        if (digest) digest->update(p, n);
+    };
+    hooks.done = [&]() {
+        if (digest) digest->finish(*current);
+    };
+    if (!tar_tree(tar, w.path, prefix, skip, error, &hooks)) return false;
+    
+    std::string text = manifest_text(out);
+    if (base) {
+        std::string control = "base " + base_id + "\ntarget " + Sha256::of(text) + "\nprefix " + prefix + "\n";
+        for (auto& [rel, e] : *base) {
+            if (out.count(rel)) continue;
+            control += "-\t" + rel + "\n";
+            stats.removed++;
+        }
+        control += patches;
+        tar.add_data(".ws-delta/control", root, control.size(),
+                     [&](const ByteSink& sink) { sink(control.data(), control.size()); });
+    }
+    struct stat mst = root;
+    mst.st_mode = S_IFREG | 0644;
+    tar.add_data(".ws-manifest", mst, text.size(), [&](const ByteSink& sink) { sink(text.data(), text.size()); });
+    return true;
+}
+
+// Paths from a delta must stay inside the workspace
+static bool safe_rel(const std::string& rel) {
+    if (rel.empty() || rel[0] == '/') return false;
+    std::stringstream ss(rel);
+    std::string part;
+    while (std::getline(ss, part, '/'))
+        if (part == "..") return false;
+    return true;
+}
+
+// A descriptor for the directory `rel` below the directory `root_fd`,
+// reached one component at a time with O_NOFOLLOW (and made on the way if
+// `create`), or -1 with errno set. A symlink or file anywhere on the way
+// is refused, so what a delta or archive laid down earlier can't carry a
+// later path outside the workspace.
+static int open_rel_dir(int root_fd, const std::string& rel, bool create) {
+    int fd = fcntl(root_fd, F_DUPFD_CLOEXEC, 0);
+    std::stringstream ss(rel);
+    std::string part;
+    while (fd >= 0 && std::getline(ss, part, '/')) {
+        if (part.empty() || part == ".") continue;
+        if (part == "..") {
+            close(fd);
+            errno = EINVAL;
+            return -1;
+        }
+        if (create && mkdirat(fd, part.c_str(), 0755) != 0 && errno != EEXIST) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        int sub = openat(fd, part.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        fd = sub;
+    }
+    return fd;
+}
+
+// Why open_rel_dir() failed, for `rel`
+static std::string rel_dir_error(const std::string& rel) {
+    if (errno == ELOOP || errno == ENOTDIR) return "path leads through a symlink or file: " + rel;
+    if (errno == EINVAL) return "path leads outside the workspace: " + rel;
+    return rel + ": " + strerror(errno);
+}
+
+static std::string leaf_rel(const std::string& rel) {
+    return rel.substr(rel.rfind('/') + 1);
+}
+
+static bool send_all(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= w;
+    }
+    return true;
+}
+
+// Rebuild `dst` from the old file and a patch. The old file must match
+// the delta's base; the result must match both the target's digest and
+// the SHA-256 recorded for it. The old file is `old_name` in `old_dir`.
+static bool apply_patch(int old_dir, const std::string& old_name, const std::string& patch_path,
+                        const std::string& dst, const std::string& old_digest, const ManifestEntry& target,
+                        const std::string& sha, uint64_t& reused, std::string& error) {
+    std::string patch;
+    if (!read_whole(patch_path, patch) || patch.size() < 9 || patch.compare(0, 5, "WSDP1") != 0) {
+        error = "bad patch";
+        return false;
+    }
+    int in = openat(old_dir, old_name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (in < 0) { error = "missing from the workspace"; return false; }
+    
+    std::vector<char> buf(256 * 1024);
+    struct stat st;
+    fstat(in, &st);
+    FileDigest old(st.st_size);
+    ManifestEntry check;
+    ssize_t n;
+    while ((n = read(in, buf.data(), buf.size())) > 0) old.update(buf.data(), n);
+    old.finish(check);
+    if (check.digest != old_digest) {
+        close(in);
+        error = "differs from the delta's base (apply the deltas in order)";
+        return false;
+    }
+    
+    int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) { close(in); error = strerror(errno); return false; }
+    uint64_t B = get_le(patch.data() + 5, 4);
+    FileDigest result(target.size);
+    Sha256 bytes;
+    bool good = B > 0;
+    size_t pos = 9;
+    while (good && pos < patch.size()) {
+        char op = patch[pos++];
+        if (op == 'C' && pos + 12 <= patch.size()) {
+            uint64_t first = get_le(patch.data() + pos, 8), count = get_le(patch.data() + pos + 8, 4);
+            pos += 12;
+            for (uint64_t off = first * B, left = count * B; good && left; ) {
+                ssize_t got = pread(in, buf.data(), std::min<uint64_t>(left, buf.size()), off);
+                good = got == (ssize_t)std::min<uint64_t>(left, buf.size()) && send_all(out, buf.data(), got);
+                result.update(buf.data(), std::max<ssize_t>(got, 0));
+                bytes.update(buf.data(), std::max<ssize_t>(got, 0));
+                off += got;
+                left -= std::max<ssize_t>(got, 0);
+            }
+            reused += count * B;
+        } else if (op == 'L' && pos + 4 <= patch.size()) {
+            uint64_t len = get_le(patch.data() + pos, 4);
+            pos += 4;
+            good = pos + len <= patch.size() && send_all(out, patch.data() + pos, len);
+            if (good) {
+                result.update(patch.data() + pos, len);
+                bytes.update(patch.data() + pos, len);
+            }
+            pos += len;
+        } else {
+            good = false;
+        }
+    }
+    close(in);
+    good = close(out) == 0 && good;
+    if (!good) { error = "bad patch"; return false; }
+    result.finish(check);
+    if (check.digest != target.digest || bytes.hex() != sha) {
+        error = "patched file doesn't match the delta";
+        return false;
+    }
+    return true;
+}
+
+// Move a staged tree into place over the directory `dst_fd` (`rel` below
+// the workspace), entry by entry, never following what's already there.
+// A directory being replaced by a file is swapped into the staging tree,
+// which the caller removes. Directory modes and times are left to the
+// caller.
+static bool merge_into(const std::string& src, int dst_fd, const std::string& rel, uint64_t& files,
+                       std::string& error) {
+    std::error_code ec;
+    std::vector<std::string> names;
+    for (auto& entry : fs::directory_iterator(src, ec)) names.push_back(entry.path().filename());
+    if (ec) { error = src + ": " + ec.message(); return false; }
+    
+    for (auto& name : names) {
+        std::string from = src + "/" + name, to = join_rel(rel, name);
+        struct stat st, cur;
+        if (lstat(from.c_str(), &st) != 0) continue;
+        bool exists = fstatat(dst_fd, name.c_str(), &cur, AT_SYMLINK_NOFOLLOW) == 0;
+        if (S_ISDIR(st.st_mode)) {
+            if (exists && !S_ISDIR(cur.st_mode)) unlinkat(dst_fd, name.c_str(), 0);
+            if (!exists || !S_ISDIR(cur.st_mode)) mkdirat(dst_fd, name.c_str(), 0755);
+            int sub = openat(dst_fd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (sub < 0) { error = rel_dir_error(to); return false; }
+            bool good = merge_into(from, sub, to, files, error);
+            close(sub);
+            if (!good) return false;
+            continue;
+        }
+        bool moved = exists && S_ISDIR(cur.st_mode)
+                         ? renameat2(AT_FDCWD, from.c_str(), dst_fd, name.c_str(), RENAME_EXCHANGE) == 0
+                         : renameat(AT_FDCWD, from.c_str(), dst_fd, name.c_str()) == 0;
+        if (!moved) { error = to + ": " + strerror(errno); return false; }
+        files++;
+    }
+    return true;
+}
+
+// Feed a tar or tar.gz archive to an extractor
+static bool extract_archive(const std::string& archive, TarExtractor& tar, uint64_t& archive_bytes,
+                            std::string& error) {
+    int fd = open(archive.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { error = archive + ": " + strerror(errno); return false; }
+    
+    // Plain tar is accepted as well as tar.gz
+    unsigned char magic[2] = {0, 0};
+    bool gzipped = pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+    bool good;
+    if (gzipped) {
+        GzipReader gz(fd);
+        good = gz.run([&](const char* p, size_t n) { return tar.feed(p, n); });
+        archive_bytes = gz.bytes_in();
+        if (!good) error = gz.error();
+    } else {
+        std::vector<char> buf(256 * 1024);
+        ssize_t n;
+        good = true;
+        while (good && (n = read(fd, buf.data(), buf.size())) > 0) {
+            good = tar.feed(buf.data(), n);
+            archive_bytes += n;
+        }
+    }
+    close(fd);
+    good = tar.finish() && good;
+    if (!tar.error().empty()) error = tar.error();
+    return good;
+}
+
+struct DeltaResult {
+    std::string base, target;       // manifest ids
+    uint64_t files = 0, patched = 0, removed = 0;
+    uint64_t reused = 0;            // bytes patches took from the old files
+    uint64_t archive_bytes = 0;
+    uint64_t tree_bytes = 0;        // files in the workspace afterwards
+};
+
+// Apply a delta archive to a workspace whose contents are described by
+// `base` (with id `base_id`), which becomes the delta's manifest after it.
+// Everything in the workspace is reached through open_rel_dir(), as an
+// earlier delta or the base archive may have left symlinks in it.
+static bool apply_delta(const Workspace& w, const std::string& archive, Manifest& base, std::string& base_id,
+                        DeltaResult& res, std::string& error) {
+    std::string staging = w.path + "/.ws/delta.tmp";
+    remove_tree(staging);
+    fs::create_directories(staging);
+    struct Cleanup {
+        const std::string& dir;
+        ~Cleanup() { remove_tree(dir); }
+    } cleanup{staging};
+    
+    {
+        TarExtractor tar(staging, 0);
+        if (!extract_archive(archive, tar, res.archive_bytes, error)) return false;
+    }
+    
+    std::string control, text;
+    Manifest target;
+    if (!read_whole(staging + "/.ws-delta/control", control) || !read_whole(staging + "/.ws-manifest", text) ||
+        !parse_manifest(text, target)) {
+        error = "not a delta archive";
+        return false;
+    }
+    for (auto& [rel, e] : target)
+        if (e.type == 'f') res.tree_bytes += e.size;
+    
+    std::istringstream in(control);
+    std::string line, prefix;
+    std::vector<std::string> removals;
+    struct Patch {
+        std::string old_digest, new_digest, sha, rel;
+    };
+    std::vector<Patch> patches;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 5, "base ") == 0) res.base = line.substr(5);
+        else if (line.compare(0, 7, "target ") == 0) res.target = line.substr(7);
+        else if (line.compare(0, 7, "prefix ") == 0) prefix = line.substr(7);
+        else if (line.compare(0, 2, "-\t") == 0) removals.push_back(line.substr(2));
+        else if (line.compare(0, 2, "p\t") == 0) {
+            std::vector<std::string> f;
+            size_t pos = 2, tab;
+            while (f.size() < 3 && (tab = line.find('\t', pos)) != std::string::npos) {
+                f.push_back(line.substr(pos, tab - pos));
+                pos = tab + 1;
+            }
+            if (f.size() != 3 || f[2].size() != 64) { error = "bad control record: " + line; return false; }
+            patches.push_back({f[0], f[1], f[2], line.substr(pos)});
+        }
+    }
+    if (res.target != Sha256::of(text) || prefix.empty() || prefix.find('/') != std::string::npos) {
+        error = "damaged delta archive";
+        return false;
+    }
+    // Removals are only taken on the base's word, so it must be the base
+    if (res.base != base_id) {
+        error = "made against a different archive than the one before it (apply the deltas in order)";
+        return false;
+    }
+    if (fs::exists(staging + "/" + prefix + "/.ws")) { error = "bad path: .ws"; return false; }
+    
+    int root = open(w.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root < 0) { error = w.path + ": " + strerror(errno); return false; }
+    struct CloseRoot {
+        int fd;
+        ~CloseRoot() { close(fd); }
+    } close_root{root};
+    
+    // Build every patched file before anything is moved
+    std::string built = staging + "/.ws-delta/new";
+    for (auto& [old_digest, new_digest, sha, rel] : patches) {
+        auto it = target.find(rel);
+        if (!safe_rel(rel) || it == target.end() || it->second.digest != new_digest) {
+            error = "bad patch record: " + rel;
+            return false;
+        }
+        int dfd = open_rel_dir(root, parent_rel(rel), false);
+        if (dfd < 0) { error = rel_dir_error(rel); return false; }
+        std::string dst = built + "/" + rel;
+        fs::create_directories(fs::path(dst).parent_path());
+        bool good = apply_patch(dfd, leaf_rel(rel), staging + "/.ws-delta/patch/" + rel, dst, old_digest,
+                                it->second, sha, res.reused, error);
+        close(dfd);
+        if (!good) {
+            error = rel + ": " + error;
+            return false;
+        }
+        chmod(dst.c_str(), it->second.mode);
+        struct timespec ts[2];
+        ts[0].tv_sec = ts[1].tv_sec = it->second.mtime / 1000000000;
+        ts[0].tv_nsec = ts[1].tv_nsec = it->second.mtime % 1000000000;
+        utimensat(AT_FDCWD, dst.c_str(), ts, 0);
+    }
+    
+    // Removed entries are moved into the staging tree, which goes with it
+    std::string trash = staging + "/.ws-delta/removed";
+    fs::create_directories(trash);
+    int trash_fd = open(trash.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (trash_fd < 0) { error = trash + ": " + strerror(errno); return false; }
+    for (auto& rel : removals) {
+        if (!safe_rel(rel) || !base.count(rel)) {
+            close(trash_fd);
+            error = "bad removal: " + rel;
+            return false;
+        }
+        int dfd = open_rel_dir(root, parent_rel(rel), false);
+        bool gone = dfd < 0 && errno == ENOENT;
+        if (dfd >= 0) {
+            gone = renameat(dfd, leaf_rel(rel).c_str(), trash_fd, std::to_string(res.removed).c_str()) == 0 ||
+                   errno == ENOENT;
+            close(dfd);
+        }
+        if (!gone) {
+            error = dfd < 0 ? rel_dir_error(rel) : rel + ": " + strerror(errno);
+            close(trash_fd);
+            return false;
+        }
+        res.removed++;
+    }
+    close(trash_fd);
+    
+    if (fs::exists(staging + "/" + prefix) && !merge_into(staging + "/" + prefix, root, ".", res.files, error))
+        return false;
+    for (auto& p : patches) {
+        int dfd = open_rel_dir(root, parent_rel(p.rel), false);
+        if (dfd < 0) { error = rel_dir_error(p.rel); return false; }
+        bool moved = renameat(AT_FDCWD, (built + "/" + p.rel).c_str(), dfd, leaf_rel(p.rel).c_str()) == 0;
+        close(dfd);
+        if (!moved) {
+            error = p.rel + ": " + strerror(errno);
+            return false;
+        }
+        res.patched++;
+    }
+    
+    // Directory times last, as everything above touched them. Only real
+    // directories: open_rel_dir() won't open a symlink in place of one.
+    for (auto& [rel, e] : target) {
+        if (e.type != 'd') continue;
+        int dfd = open_rel_dir(root, rel, false);
+        if (dfd < 0) {
+            if (errno == ENOENT) continue;
+            error = rel_dir_error(rel);
+            return false;
+        }
+        fchmod(dfd, e.mode);
+        struct timespec ts[2];
+        ts[0].tv_sec = ts[1].tv_sec = e.mtime / 1000000000;
+        ts[0].tv_nsec = ts[1].tv_nsec = e.mtime % 1000000000;
+        futimens(dfd, ts);
+        close(dfd);
+    }
+    base = std::move(target);
+    base_id = res.target;
+    return true;
+}
+
+// ============================================
+// SEEKABLE ARCHIVES
+// ============================================
+//
+// ws-export --seekable writes an archive that is still an ordinary
+// tar.gz, but made of independently compressed members (ParallelGzip's
+// member mode) with an index of every entry at the end, so ws-import can
+// treat it like a directory instead of a tape: list it without inflating
+// anything, extract chosen paths, split the work across cores, and leave
+// files in the archive until the workspace is first used.
+//
+// The index is a tar entry, .ws-index, in a member of its own. The last
+// INDEX_TRAILER bytes of the file are an empty gzip member whose extra
+// field (subfield "WS", the way bgzip uses "BC") holds the offset of the
+// index member, so gzip and tar read past it like any other member.
+//
+//   # wsindex 1
+//   prefix <dir>
+//   m \t offset \t start                                    per member
+//   type \t mode \t mtime \t size \t start \t length \t link \t name
+//
+// `start` is a position in the uncompressed tar stream and `length`
+// covers the entry's whole record: long-name headers, data and padding.
+//
+// A lazy import records what it left behind in .ws/lazy ("archive
+// <path>", then "have <path>" for each part already extracted); the
+// first command that needs the tree extracts the rest.
+
+static const size_t INDEX_TRAILER = 42;
+
+struct IndexEntry {
+    char type = 'f';                // f(ile), d(irectory) or l(ink)
+    mode_t mode = 0;
+    int64_t mtime = 0;              // s
+    uint64_t size = 0;
+    uint64_t start = 0, length = 0;
+    std::string link, name;         // name as archived
+};
+
+struct ArchiveIndex {
+    std::string prefix;
+    std::vector<ParallelGzip::Member> members;
+    std::vector<IndexEntry> entries;
+    
+    // Path below the workspace root, or empty for entries outside it
+    std::string rel(const IndexEntry& e) const {
+        if (e.name.compare(0, prefix.size() + 1, prefix + "/") != 0) return "";
+        std::string r = e.name.substr(prefix.size() + 1);
+        if (!r.empty() && r.back() == '/') r.pop_back();
+        return r;
+    }
+    
+    // The member holding stream position `pos`
+    size_t member_of(uint64_t pos) const {
+        auto it = std::upper_bound(members.begin(), members.end(), pos,
+                                   [](uint64_t p, const ParallelGzip::Member& m) { return p < m.start; });
+        return it == members.begin() ? 0 : it - members.begin() - 1;
+    }
+};
+
+// Notes each entry as the TarWriter starts it, and at the end writes the
+// index and trailer. The gzip stream must be in member mode.
+class IndexWriter {
+public:
+    IndexWriter(TarWriter& tar, ParallelGzip& gz, const std::string& prefix) : tar_(tar), gz_(gz) {
+        index_.prefix = prefix;
+        tar_.on_entry([this](const std::string& name, char type, const struct stat& st, uint64_t size,
+                             const std::string& link) {
+            close_entry();
+            IndexEntry e;
+            e.type = type == '5' ? 'd' : type == '2' ? 'l' : 'f';
+            e.mode = st.st_mode & 07777;
+            e.mtime = st.st_mtime;
+            e.size = size;
+            e.start = gz_.position();
+            e.link = link;
+            e.name = name;
+            index_.entries.push_back(std::move(e));
+        });
+    }
+    
+    size_t members() const { return index_.members.size(); }
+    
+    // Instead of tar.finish(): the index goes in its own member, then the
+    // end of the tar stream
+    void finish(const struct stat& st) {
+        close_entry();
+        tar_.on_entry(nullptr);
+        gz_.flush();
+        index_.members = gz_.members();
+        offset_ = gz_.bytes_out();
+        
+        std::string text = "# wsindex 1\nprefix " + index_.prefix + "\n";
+        char buf[64];
+        for (auto& m : index_.members) {
+            snprintf(buf, sizeof(buf), "m\t%llu\t%llu\n", (unsigned long long)m.offset,
+                     (unsigned long long)m.start);
+            text += buf;
+        }
+        for (auto& e : index_.entries) {
+            snprintf(buf, sizeof(buf), "%c\t%o\t%lld\t%llu\t%llu\t%llu\t", e.type, (unsigned)e.mode,
+                     (long long)e.mtime, (unsigned long long)e.size, (unsigned long long)e.start,
+                     (unsigned long long)e.length);
+            text += buf + e.link + '\t' + e.name + '\n';
+        }
+        struct stat ist = st;
+        ist.st_mode = S_IFREG | 0644;
+        tar_.add_data(".ws-index", ist, text.size(), [&](const ByteSink& sink) { sink(text.data(), text.size()); });
+        tar_.finish();
+    }
+    
+    // After gz.finish(): the empty member pointing at the index
+    bool trailer(int fd) const {
+        std::string t("\x1f\x8b\x08\x04\0\0\0\0\0\xff", 10);
+        put_le(t, 20, 2);
+        t += "WS";
+        put_le(t, 16, 2);
+        put_le(t, offset_, 8);
+        t += "wsindex1";
+        t += std::string("\x03\0\0\0\0\0\0\0\0\0", 10);
+        return send_all(fd, t.data(), t.size());
+    }
+
+private:
+    TarWriter& tar_;
+    ParallelGzip& gz_;
+    ArchiveIndex index_;
+    uint64_t offset_ = 0;
+    
+    void close_entry() {
+        if (!index_.entries.empty() && !index_.entries.back().length)
+            index_.entries.back().length = gz_.position() - index_.entries.back().start;
+    }
+};
+
+// Read the index of a seekable archive. False for any other archive.
+static bool load_index(const std::string& archive, ArchiveIndex& idx) {
+    int fd = open(archive.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    char t[INDEX_TRAILER];
+    bool found = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(t) &&
+                 pread(fd, t, sizeof(t), st.st_size - sizeof(t)) == (ssize_t)sizeof(t);
+    close(fd);
+    if (!found || memcmp(t, "\x1f\x8b\x08\x04", 4) != 0 || memcmp(t + 12, "WS\x10\0", 4) != 0 ||
+        memcmp(t + 24, "wsindex1", 8) != 0)
+        return false;
+    
+    std::string text;
+    if (!tar_find(archive, ".ws-index", text, get_le(t + 16, 8))) return false;
+    std::istringstream in(text);
+    std::string line;
+    if (!std::getline(in, line) || line != "# wsindex 1") return false;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 7, "prefix ") == 0) {
+            idx.prefix = line.substr(7);
+            continue;
+        }
+        std::vector<std::string> parts;
+        size_t pos = 0, tab;
+        while (parts.size() < 7 && (tab = line.find('\t', pos)) != std::string::npos) {
+            parts.push_back(line.substr(pos, tab - pos));
+            pos = tab + 1;
+        }
+        parts.push_back(line.substr(pos));
+        if (parts[0] == "m" && parts.size() == 3) {
+            idx.members.push_back({std::strtoull(parts[1].c_str(), nullptr, 10),
+                                   std::strtoull(parts[2].c_str(), nullptr, 10)});
+            continue;
+        }
+        if (parts.size() != 8 || parts[0].size() != 1) return false;
+        IndexEntry e;
+        e.type = parts[0][0];
+        e.mode = std::strtoul(parts[1].c_str(), nullptr, 8);
+        e.mtime = std::strtoll(parts[2].c_str(), nullptr, 10);
+        e.size = std::strtoull(parts[3].c_str(), nullptr, 10);
+        e.start = std::strtoull(parts[4].c_str(), nullptr, 10);
+        e.length = std::strtoull(parts[5].c_str(), nullptr, 10);
+        e.link = parts[6];
+        e.name = parts[7];
+        idx.entries.push_back(std::move(e));
+    }
+    return !idx.members.empty() && !idx.prefix.empty();
+}
+
+// Whether rel is one of `paths` or below one
+static bool under_any(const std::string& rel, const std::vector<std::string>& paths) {
+    for (auto& p : paths) {
+        if (p.empty() || rel == p) return true;
+        if (rel.size() > p.size() && rel.compare(0, p.size(), p) == 0 && rel[p.size()] == '/') return true;
+    }
+    return false;
+}
+
+// Directories go first and get their times last, as extracting into them
+// changes their mtime. Both passes go through open_rel_dir(), so a symlink
+// from the archive can't take either outside dest: making a directory
+// through one fails, and only real directories get modes and times.
+static bool index_dirs(const ArchiveIndex& idx, const std::string& dest, bool times, std::string& error) {
+    int root = open(dest.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root < 0) { error = dest + ": " + strerror(errno); return false; }
+    for (auto& e : idx.entries) {
+        std::string rel = idx.rel(e);
+        if (e.type != 'd' || rel.empty()) continue;
+        int dfd = open_rel_dir(root, rel, !times);
+        if (dfd < 0) {
+            if (times) continue;
+            error = rel_dir_error(rel);
+            close(root);
+            return false;
+        }
+        if (times) {
+            fchmod(dfd, e.mode);
+            struct timespec ts[2] = {{(time_t)e.mtime, 0}, {(time_t)e.mtime, 0}};
+            futimens(dfd, ts);
+        }
+        close(dfd);
+    }
+    close(root);
+    return true;
+}
+
+struct ExtractStats {
+    uint64_t files = 0;
+    uint64_t bytes = 0;             // file contents written
+    uint64_t inflated = 0;          // compressed bytes read
+    unsigned threads = 0;
+};
+
+// Extract the entries picked (positions in idx.entries, in order) below
+// dest. They are split into runs of about equal size, one per worker;
+// a run inflates from the member holding its first entry, skipping over
+// what it doesn't want, and seeks ahead when the next entry is more than
+// a member away.
+static bool extract_indexed(const std::string& archive, const ArchiveIndex& idx, const std::vector<size_t>& pick,
+                            const std::string& dest, ExtractStats& stats, std::string& error) {
+    uint64_t total = 0;
+    for (size_t i : pick) total += idx.entries[i].length;
+    stats.threads = std::max<size_t>(1, std::min<size_t>(worker_count(), pick.size()));
+    
+    std::vector<std::pair<size_t, size_t>> runs;
+    uint64_t share = total / stats.threads + 1;
+    for (size_t begin = 0; begin < pick.size(); ) {
+        size_t end = begin;
+        uint64_t run = 0;
+        while (end < pick.size() && (run < share || runs.size() + 1 == stats.threads))
+            run += idx.entries[pick[end++]].length;
+        runs.push_back({begin, end});
+        begin = end;
+    }
+    
+    std::mutex mu;
+    ThreadPool pool(runs.size());
+    for (auto& r : runs) {
+        pool.submit([&, r] {
+            TarExtractor tar(dest, 1, 1);
+            int fd = open(archive.c_str(), O_RDONLY | O_CLOEXEC);
+            std::string failure = fd < 0 ? archive + ": " + strerror(errno) : "";
+            uint64_t inflated = 0, bytes = 0;
+            
+            size_t i = r.first;
+            while (failure.empty() && i < r.second) {
+                const auto& m = idx.members[idx.member_of(idx.entries[pick[i]].start)];
+                lseek(fd, m.offset, SEEK_SET);
+                uint64_t pos = m.start;
+                bool seek = false;
+                GzipReader gz(fd);
+                gz.run([&](const char* p, size_t n) {
+                    while (n && i < r.second) {
+                        const IndexEntry& e = idx.entries[pick[i]];
+                        if (pos < e.start) {
+                            if (idx.member_of(e.start) > idx.member_of(pos) + 1) {
+                                seek = true;
+                                return false;
+                            }
+                            size_t skip = std::min<uint64_t>(n, e.start - pos);
+                            p += skip;
+                            n -= skip;
+                            pos += skip;
+                            continue;
+                        }
+                        size_t take = std::min<uint64_t>(n, e.start + e.length - pos);
+                        if (!tar.feed(p, take)) return false;
+                        p += take;
+                        n -= take;
+                        pos += take;
+                        if (pos == e.start + e.length) {
+                            bytes += e.size;
+                            i++;
+                        }
+                    }
+                    return i < r.second;
+                });
+                inflated += gz.bytes_in();
+                if (!seek && i < r.second)
+                    failure = !tar.error().empty() ? tar.error() : !gz.error().empty() ? gz.error()
+                                                                                         : "truncated archive";
+            }
+            if (fd >= 0) close(fd);
+            
+            static const char end[1024] = {0};
+            if (failure.empty() && !(tar.feed(end, sizeof(end)) && tar.finish())) failure = tar.error();
+            std::lock_guard<std::mutex> lock(mu);
+            if (error.empty()) error = failure;
+            stats.files += tar.files();
+            stats.bytes += bytes;
+            stats.inflated += inflated;
+        });
+    }
+    pool.wait();
+    return error.empty();
+}
+
+struct LazyState {
+    std::string archive;
+    std::vector<std::string> have;
+};
+
+static bool read_lazy(const Workspace& w, LazyState& s) {
+    std::string text;
+    if (!read_whole(w.path + "/.ws/lazy", text)) return false;
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 8, "archive ") == 0) s.archive = line.substr(8);
+        else if (line.compare(0, 5, "have ") == 0) s.have.push_back(line.substr(5));
+    }
+    return !s.archive.empty();
+}
+
+static bool write_lazy(const Workspace& w, const LazyState& s) {
+    std::string text = "archive " + s.archive + "\n";
+    for (auto& p : s.have) text += "have " + p + "\n";
+    return write_atomic(w.path + "/.ws/lazy", text);
+}
+
+// Entries a lazy import hasn't extracted yet, of those below `paths`
+// (all with none). Files created in the meantime are left alone.
+static std::vector<size_t> lazy_pending(const Workspace& w, const LazyState& s, const ArchiveIndex& idx,
+                                        const std::vector<std::string>& paths) {
+    std::vector<size_t> pick;
+    for (size_t i = 0; i < idx.entries.size(); i++) {
+        const IndexEntry& e = idx.entries[i];
+        std::string rel = idx.rel(e);
+        struct stat st;
+        if (e.type == 'd' || rel.empty() || under_any(rel, s.have)) continue;
+        if (!paths.empty() && !under_any(rel, paths)) continue;
+        if (lstat((w.path + "/" + rel).c_str(), &st) == 0) continue;
+        pick.push_back(i);
+    }
+    return pick;
+}
+
+// Fetch what a lazy import left in its archive: everything, or only
+// `paths`. Commands that use the tree call this first; it costs one
+// stat for a workspace that isn't lazy.
+static bool hydrate(const Workspace& w, const std::vector<std::string>& paths = {}) {
+    struct stat st;
+    if (stat((w.path + "/.ws/lazy").c_str(), &st) != 0) return true;
+    
+    int lfd = lock_file(w.path + "/.ws/lazy.lock");
+    LazyState s;
+    if (!read_lazy(w, s)) {
+        if (lfd >= 0) close(lfd);
+        return true;
+    }
+    ArchiveIndex idx;
+    if (!load_index(s.archive, idx)) {
+        err("Cannot hydrate " + w.name + ": " + s.archive + " is missing or has no index");
+        if (lfd >= 0) close(lfd);
+        return false;
+    }
+    
+    auto t0 = std::chrono::steady_clock::now();
+    auto pick = lazy_pending(w, s, idx, paths);
+    status("Hydrating " + w.name + " from " + s.archive);
+    ExtractStats stats;
+    std::string error;
+    bool good = extract_indexed(s.archive, idx, pick, w.path, stats, error);
+    if (good) {
+        index_dirs(idx, w.path, true, error);
+        if (paths.empty()) {
+            unlink((w.path + "/.ws/lazy").c_str());
+            unlink((w.path + "/.ws/lazy.lock").c_str());
+        } else {
+            s.have.insert(s.have.end(), paths.begin(), paths.end());
+            write_lazy(w, s);
+        }
+    }
+    if (lfd >= 0) close(lfd);
+    if (!good) { err("Hydrating failed: " + error); return false; }
+    
+    double secs = elapsed_s(t0);
+    info(std::to_string(stats.files) + " files, " + fmt_mb(stats.bytes) + " in " + fmt_secs(secs) + " (" +
+         fmt_rate(stats.bytes, secs) + ", " + std::to_string(stats.threads) + " threads)");
+    return true;
+}
+
+// ============================================
+// BUILD CACHE
+// ============================================
+//
+// With build_cache enabled, ws-build derives a key from the declared
+// inputs (cache_input.N, default: the whole tree minus .ws, .git and the
+// outputs), build_cmd, env_vars and the toolchain's version string. The
+// outputs (cache_output.N, default build/ or the language's usual output
+// dir) of a successful build are stored by content under
+// ~/.cache/dreamland/buildcache and restored on the next matching key
+// instead of running the build.
+//
+//   objects/ab/<sha256>    file contents
+//   actions/<key>          manifest of the outputs for one key
+//
+// .ws/inputcache remembers per-file digests by mtime/size/inode so
+// unchanged inputs are not re-read; .ws/buildcache.stats holds counters.
+
+static std::string build_cache_dir() {
+    return home_dir() + "/.cache/dreamland/buildcache";
+}
+
+static std::vector<std::string> cache_outputs(const Workspace& w) {
+    if (!w.cache_outputs.empty()) return w.cache_outputs;
+    if (w.lang == "rust") return {"target"};
+    if (w.lang == "node") return {"dist"};
+    return {"build"};
+}
+
+static std::string toolchain_version(const Workspace& w) {
+    std::string cmd = w.config.get("toolchain_cmd");
+    if (cmd.empty()) {
+        static const std::map<std::string, std::string> defaults = {
+            {"c", "cc --version"}, {"cpp", "c++ --version"}, {"rust", "rustc --version"},
+            {"go", "go version"}, {"node", "node --version"}, {"python", "python3 --version"}};
+        auto it = defaults.find(w.lang);
+        if (it == defaults.end()) return "";
+        cmd = it->second;
+    }
+    ProcSpec spec;
+    spec.argv = command_argv(cmd);
+    spec.capture = spec.merge_stderr = true;
+    spec.timeout = 30;
+    return run_proc(spec).output;
+}
+
+static bool path_under(const std::string& path, const std::string& dir) {
+    return dir == "." || path == dir || path.compare(0, dir.size() + 1, dir + "/") == 0;
+}
+
+struct BuildCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    double saved_secs = 0;
+    
+    void load(const std::string& path) {
+        ConfigParser c;
+        if (!c.load(path)) return;
+        hits = std::strtoull(c.get("hits", "0").c_str(), nullptr, 10);
+        misses = std::strtoull(c.get("misses", "0").c_str(), nullptr, 10);
+        saved_secs = std::strtod(c.get("saved_secs", "0").c_str(), nullptr);
+    }
+    
+    void save(const std::string& path) const {
+        ConfigParser c;
+        c.set("hits", std::to_string(hits));
+        c.set("misses", std::to_string(misses));
+        c.set("saved_secs", std::to_string(saved_secs));
+        c.save(path);
+    }
+};
+
+struct InputDigest {
+    int64_t mtime;
+    uint64_t size;
+    uint64_t ino;
+    std::string digest;
+};
+
+// Digest of the files under `inputs` (relative to root) minus `excluded`.
+// Files are hashed in parallel; files whose mtime/size/inode match the
+// digest cache at cache_path reuse their recorded digest.
+static std::string hash_paths(const std::string& root, const std::vector<std::string>& inputs,
+                              const std::vector<std::string>& excluded, const std::string& cache_path) {
+    auto included = [&](const std::string& rel) {
+        for (auto& x : excluded) if (path_under(rel, x)) return false;
+        for (auto& i : inputs) if (path_under(rel, i)) return true;
+        return false;
+    };
+    auto leads_to_input = [&](const std::string& rel) {
+        for (auto& i : inputs) if (path_under(i, rel)) return true;
+        return false;
+    };
+    
+    std::map<std::string, InputDigest> old, cur;
+    {
+        std::ifstream f(cache_path);
+        std::string line;
+        if (std::getline(f, line) && line == "# wsinputs 1") {
+            while (std::getline(f, line)) {
+                // mtime \t size \t ino \t digest \t relpath
+                std::vector<std::string> parts;
+                size_t pos = 0;
+                for (int i = 0; i < 4; i++) {
+                    size_t tab = line.find('\t', pos);
+                    if (tab == std::string::npos) break;
+                    parts.push_back(line.substr(pos, tab - pos));
+                    pos = tab + 1;
+                }
+                if (parts.size() != 4) continue;
+                old[line.substr(pos)] = {(int64_t)std::strtoll(parts[0].c_str(), nullptr, 10),
+                                         std::strtoull(parts[1].c_str(), nullptr, 10),
+                                         std::strtoull(parts[2].c_str(), nullptr, 10), parts[3]};
+            }
+        }
+    }
+    
+    std::vector<std::pair<std::string, std::string>> entries;    // relpath, "mode digest"
+    std::mutex mu;
+    int rfd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rfd < 0) return "";
+    
+    TreeWalker tw(rfd);
+    tw.run(".", [&](unsigned worker, int dfd, const std::string& rel, std::vector<std::string>& descend) {
+        for_each_dirent(dfd, tw.dents(worker), [&](const char* name, unsigned char) {
+            std::string path = join_rel(rel, name);
+            struct stat st;
+            if (fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+            
+            if (S_ISDIR(st.st_mode)) {
+                bool skip = false;
+                for (auto& x : excluded) if (path_under(path, x)) skip = true;
+                if (!skip && (included(path) || leads_to_input(path))) descend.push_back(name);
+                return;
+            }
+            if (!included(path)) return;
+            
+            std::string value;
+            InputDigest d{mtime_ns(st), (uint64_t)st.st_size, (uint64_t)st.st_ino, ""};
+            if (S_ISLNK(st.st_mode)) {
+                std::vector<char>& buf = tw.scratch(worker);
+                ssize_t n = readlinkat(dfd, name, buf.data(), buf.size());
+                if (n < 0) return;
+                value = "l " + Sha256::of(std::string(buf.data(), n));
+            } else if (S_ISREG(st.st_mode)) {
+                auto it = old.find(path);
+                if (it != old.end() && it->second.mtime == d.mtime && it->second.size == d.size &&
+                    it->second.ino == d.ino) {
+                    d.digest = it->second.digest;
+                } else {
+                    int fd = openat(dfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+                    if (fd < 0 || !hash_fd(fd, tw.scratch(worker), d.digest)) {
+                        if (fd >= 0) close(fd);
+                        tw.fail(path + ": " + strerror(errno));
+                        return;
+                    }
+                    close(fd);
+                }
+                value = std::string(st.st_mode & 0111 ? "x " : "f ") + d.digest;
+            } else {
+                return;
+            }
+            
+            std::lock_guard<std::mutex> lock(mu);
+            entries.push_back({path, value});
+            if (!d.digest.empty()) cur[path] = d;
+        });
+    });
+    close(rfd);
+    if (tw.errors()) return "";
+    
+    std::sort(entries.begin(), entries.end());
+    Sha256 tree;
+    for (auto& [path, value] : entries) {
+        tree.update(path);
+        tree.update("\0", 1);
+        tree.update(value);
+        tree.update("\n", 1);
+    }
+    
+    std::ofstream f(cache_path + ".tmp", std::ios::trunc);
+    if (f) {
+        f << "# wsinputs 1\n";
+        for (auto& [path, d] : cur)
+            f << d.mtime << '\t' << d.size << '\t' << d.ino << '\t' << d.digest << '\t' << path << '\n';
+        f.close();
+        rename((cache_path + ".tmp").c_str(), cache_path.c_str());
+    }
+    return tree.hex();
+}
+
+// Digest of the build inputs: cache_input.N, or the whole tree minus the
+// outputs, .ws and .git
+static std::string hash_inputs(const Workspace& w, const std::vector<std::string>& outputs) {
+    std::vector<std::string> inputs = w.cache_inputs;
+    if (inputs.empty()) inputs.push_back(".");
+    std::vector<std::string> excluded = outputs;
+    excluded.push_back(".ws");
+    excluded.push_back(".git");
+    return hash_paths(w.path, inputs, excluded, w.path + "/.ws/inputcache");
+}
+
+static std::string build_cache_key(const Workspace& w, const std::vector<std::string>& outputs) {
+    std::string tree = hash_inputs(w, outputs);
+    if (tree.empty()) return "";
+    
+    Sha256 h;
+    h.update("wsbuild 1\n");
+    h.update("lang=" + w.lang + "\n");
+    h.update("build_cmd=" + w.build_cmd + "\n");
+    for (auto& [k, v] : w.env_vars) h.update("env." + k + "=" + v + "\n");
+    for (auto& o : outputs) h.update("output=" + o + "\n");
+    h.update("toolchain=" + toolchain_version(w) + "\n");
+    h.update("tree=" + tree + "\n");
+    return h.hex();
+}
+
+static std::string object_path(const std::string& digest) {
+    return build_cache_dir() + "/objects/" + digest.substr(0, 2) + "/" + digest;
+}
+
+// Put a file into the object store (if not already there) and return
+// its digest
+static bool store_object(int dfd, const char* name, std::vector<char>& buf, CopyStats& stats,
+                         std::string& digest) {
+    int in = openat(dfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (in < 0) return false;
+    struct stat st;
+    fstat(in, &st);
+    if (!hash_fd(in, buf, digest)) { close(in); return false; }
+    
+    std::string obj = object_path(digest);
+    if (access(obj.c_str(), F_OK) == 0) { close(in); return true; }
+    
+    std::error_code ec;
+    fs::create_directories(fs::path(obj).parent_path(), ec);
+    std::string tmp = obj + ".tmp." + std::to_string(getpid()) + "." +
+                      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0444);
+    bool good = out >= 0 && copy_fd(in, out, st.st_size, buf, stats);
+    if (out >= 0) close(out);
+    close(in);
+    good = good && rename(tmp.c_str(), obj.c_str()) == 0;
+    if (!good) unlink(tmp.c_str());
+    return good;
+}
+
+// Snapshot the outputs into the store and write the manifest for `key`
+static bool build_cache_store(const Workspace& w, const std::string& key,
+                              const std::vector<std::string>& outputs, double build_secs) {
+    std::vector<std::string> manifest;
+    std::mutex mu;
+    CopyStats stats;
+    bool good = true;
+    
+    for (auto& out : outputs) {
+        std::string root = w.path + "/" + out;
+        int rfd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (rfd < 0) continue;
+        
+        TreeWalker tw(rfd);
+        tw.run(".", [&](unsigned worker, int dfd, const std::string& rel, std::vector<std::string>& descend) {
+            struct stat st;
+            fstat(dfd, &st);
+            char mode[8];
+            snprintf(mode, sizeof(mode), "%04o", st.st_mode & 07777);
+            std::vector<std::string> lines = {"d\t" + std::string(mode) + "\t-\t" + full_path(out, rel)};
+            
+            for_each_dirent(dfd, tw.dents(worker), [&](const char* name, unsigned char type) {
+                std::string path = join_rel(out, join_rel(rel, name));
+                type = entry_type(dfd, name, type);
+                if (type == DT_DIR) {
+                    descend.push_back(name);
+                } else if (type == DT_REG) {
+                    struct stat fst;
+                    std::string digest;
+                    if (fstatat(dfd, name, &fst, AT_SYMLINK_NOFOLLOW) != 0 ||
+                        !store_object(dfd, name, tw.scratch(worker), stats, digest)) {
+                        tw.fail(path);
+                        return;
+                    }
+                    snprintf(mode, sizeof(mode), "%04o", fst.st_mode & 07777);
+                    lines.push_back("f\t" + std::string(mode) + "\t" + digest + "\t" + path);
+                } else if (type == DT_LNK) {
+                    std::vector<char>& buf = tw.scratch(worker);
+                    ssize_t n = readlinkat(dfd, name, buf.data(), buf.size());
+                    if (n >= 0) lines.push_back("l\t0777\t" + std::string(buf.data(), n) + "\t" + path);
+                }
+            });
+            
+            std::lock_guard<std::mutex> lock(mu);
+            manifest.insert(manifest.end(), lines.begin(), lines.end());
+        });
+        close(rfd);
+        if (tw.errors()) good = false;
+    }
+    if (!good) return false;
+    
+    // Parents sort before children, so the manifest restores in order
+    std::sort(manifest.begin(), manifest.end(), [](const std::string& a, const std::string& b) {
+        return a.substr(a.rfind('\t') + 1) < b.substr(b.rfind('\t') + 1);
+    });
+    
+    std::string action = build_cache_dir() + "/actions/" + key;
+    std::error_code ec;
+    fs::create_directories(fs::path(action).parent_path(), ec);
+    {
+        std::ofstream f(action + ".tmp", std::ios::trunc);
+        f << "# wsaction 1\n";
+        f << "build_secs\t" << build_secs << "\n";
+        for (auto& line : manifest) f << line << "\n";
+        if (!f) return false;
+    }
+    return rename((action + ".tmp").c_str(), action.c_str()) == 0;
+}
+
+// Replace the outputs with the cached ones for `key`. Returns false on a
+// miss (or a damaged entry), leaving the outputs as they were. Each output
+// is rebuilt in a sibling directory first and only swapped in once every
+// one of them has been copied in full.
+static bool build_cache_restore(const Workspace& w, const std::string& key,
+                                const std::vector<std::string>& outputs, double& build_secs) {
+    std::ifstream f(build_cache_dir() + "/actions/" + key);
+    std::string line;
+    if (!std::getline(f, line) || line != "# wsaction 1") return false;
+    
+    struct Entry { char type; mode_t mode; std::string data, path; };
+    std::vector<Entry> entries;
+    build_secs = 0;
+    while (std::getline(f, line)) {
+        std::vector<std::string> parts;
+        size_t pos = 0, tab;
+        while ((tab = line.find('\t', pos)) != std::string::npos && parts.size() < 3) {
+            parts.push_back(line.substr(pos, tab - pos));
+            pos = tab + 1;
+        }
+        parts.push_back(line.substr(pos));
+        if (parts.size() == 2 && parts[0] == "build_secs") { build_secs = std::strtod(parts[1].c_str(), nullptr); continue; }
+        if (parts.size() != 4 || parts[0].size() != 1) continue;
+        entries.push_back({parts[0][0], (mode_t)std::strtoul(parts[1].c_str(), nullptr, 8), parts[2], parts[3]});
+    }
+    
+    // Every object must still be present before touching the tree
+    for (auto& e : entries)
+        if (e.type == 'f' && access(object_path(e.data).c_str(), R_OK) != 0) return false;
+    
+    // Restore each output next to itself as .<name>.restore.<pid>
+    std::vector<std::string> dsts, staged;
+    for (auto& out : outputs) {
+        std::string dst = w.path + "/" + out;
+        size_t slash = dst.rfind('/');
+        dsts.push_back(dst);
+        staged.push_back(dst.substr(0, slash + 1) + "." + dst.substr(slash + 1) + ".restore." +
+                         std::to_string(getpid()));
+        remove_tree(staged.back());
+    }
+    auto cleanup = [&] {
+        for (auto& s : staged) remove_tree(s);
+    };
+    auto staged_path = [&](const std::string& path) -> std::string {
+        for (size_t i = 0; i < outputs.size(); i++)
+            if (path_under(path, outputs[i])) return staged[i] + path.substr(outputs[i].size());
+        return "";
+    };
+    
+    CopyStats stats;
+    std::vector<char> buf(256 * 1024);
+    std::vector<std::pair<std::string, mode_t>> dirs;
+    for (auto& e : entries) {
+        std::string dst = staged_path(e.path);
+        if (dst.empty()) continue;
+        if (e.type == 'd') {
+            std::error_code ec;
+            if (std::find(outputs.begin(), outputs.end(), e.path) != outputs.end())
+                fs::create_directories(fs::path(dst).parent_path(), ec);
+            if (mkdir(dst.c_str(), 0700) != 0 && errno != EEXIST) { cleanup(); return false; }
+            dirs.push_back({dst, e.mode});
+        } else if (e.type == 'l') {
+            if (symlink(e.data.c_str(), dst.c_str()) != 0) { cleanup(); return false; }
+        } else if (e.type == 'f') {
+            int in = open(object_path(e.data).c_str(), O_RDONLY | O_CLOEXEC);
+            int outfd = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+            struct stat st;
+            bool good = in >= 0 && outfd >= 0 && fstat(in, &st) == 0 &&
+                        copy_fd(in, outfd, st.st_size, buf, stats);
+            if (outfd >= 0) { fchmod(outfd, e.mode); close(outfd); }
+            if (in >= 0) close(in);
+            if (!good) { cleanup(); return false; }
+        }
+    }
+    for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) chmod(it->first.c_str(), it->second);
+    
+    // Swap them in. An output the cache doesn't have is moved aside, as the
+    // build that was cached didn't leave one. On a failure the outputs
+    // already swapped are swapped back.
+    auto swap = [&](size_t i) {
+        struct stat st;
+        bool have_dst = lstat(dsts[i].c_str(), &st) == 0;
+        bool have_staged = lstat(staged[i].c_str(), &st) == 0;
+        if (have_dst && have_staged) return renameat2(AT_FDCWD, staged[i].c_str(), AT_FDCWD, dsts[i].c_str(),
+                                                      RENAME_EXCHANGE) == 0;
+        if (have_dst) return rename(dsts[i].c_str(), staged[i].c_str()) == 0;
+        if (have_staged) return rename(staged[i].c_str(), dsts[i].c_str()) == 0;
+        return true;
+    };
+    for (size_t i = 0; i < outputs.size(); i++) {
+        if (swap(i)) continue;
+        while (i--) swap(i);
+        cleanup();
+        return false;
+    }
+    cleanup();
+    return true;
+}
+
+// ============================================
+// DEDUPLICATION
+// ============================================
+//
+// ws-dedup hashes regular files across workspaces and shares the storage
+// of identical ones. Files are first grouped by device and size, so only
+// sizes that occur more than once get read, and those are hashed in
+// parallel. Duplicates are then shared with FIDEDUPERANGE, where the
+// kernel compares the bytes itself and shares extents only when they
+// match, so a file edited since it was hashed is left alone. Where the
+// filesystem can't do that (ext4, tmpfs, ...), read-only files (no write
+// bits) with the same owner and mode are hardlinked instead. Writable
+// files are never hardlinked: an edit in one workspace would show up in
+// the others.
+//
+// ~/.local/share/dreamland/dedup/index keeps one record per hashed file:
+//
+//   mtime \t size \t dev \t ino \t digest \t shared \t path
+//
+// Unchanged files (same mtime, size, device and inode) reuse their digest
+// on the next run, and `shared` marks files already sharing with their
+// group. ws-gc drops records for files that are gone, have changed, or
+// no longer belong to a registered workspace.
+
+struct DedupFile {
+    std::string path;
+    uint64_t dev = 0, ino = 0, size = 0;
+    int64_t mtime = 0;
+    mode_t mode = 0;
+    uid_t uid = 0;
+    gid_t gid = 0;
+    uint64_t nlink = 0;
+    std::string digest;
+    bool shared = false;
+};
+
+static std::string dedup_dir() {
+    return home_dir() + "/.local/share/dreamland/dedup";
+}
+
+static std::map<std::string, DedupFile> load_dedup_index() {
+    std::map<std::string, DedupFile> index;
+    std::ifstream f(dedup_dir() + "/index");
+    std::string line;
+    if (!std::getline(f, line) || line != "# wsdedup 1") return index;
+    while (std::getline(f, line)) {
+        std::vector<std::string> parts;
+        size_t pos = 0, tab;
+        while (parts.size() < 6 && (tab = line.find('\t', pos)) != std::string::npos) {
+            parts.push_back(line.substr(pos, tab - pos));
+            pos = tab + 1;
+        }
+        if (parts.size() != 6) continue;
+        DedupFile d;
+        d.path = line.substr(pos);
+        d.mtime = std::strtoll(parts[0].c_str(), nullptr, 10);
+        d.size = std::strtoull(parts[1].c_str(), nullptr, 10);
+        d.dev = std::strtoull(parts[2].c_str(), nullptr, 10);
+        d.ino = std::strtoull(parts[3].c_str(), nullptr, 10);
+        d.digest = parts[4];
+        d.shared = parts[5] == "1";
+        index[d.path] = d;
+    }
+    return index;
+}
+
+static bool save_dedup_index(const std::map<std::string, DedupFile>& index) {
+    std::string out = "# wsdedup 1\n";
+    for (auto& [path, d] : index)
+        out += std::to_string(d.mtime) + '\t' + std::to_string(d.size) + '\t' + std::to_string(d.dev) + '\t' +
+               std::to_string(d.ino) + '\t' + d.digest + '\t' + (d.shared ? "1" : "0") + '\t' + path + '\n';
+    return write_atomic(dedup_dir() + "/index", out);
+}
+
+static bool same_file_state(const DedupFile& a, const DedupFile& b) {
+    return a.mtime == b.mtime && a.size == b.size && a.dev == b.dev && a.ino == b.ino;
+}
+
+static void stat_into(const struct stat& st, DedupFile& d) {
+    d.dev = st.st_dev;
+    d.ino = st.st_ino;
+    d.size = st.st_size;
+    d.mtime = mtime_ns(st);
+    d.mode = st.st_mode & 07777;
+    d.uid = st.st_uid;
+    d.gid = st.st_gid;
+    d.nlink = st.st_nlink;
+}
+
+// Regular files of at least min_size under a workspace, minus .ws
+static void collect_files(const std::string& root, uint64_t min_size, std::vector<DedupFile>& out,
+                          std::mutex& mu) {
+    int rfd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rfd < 0) return;
+    TreeWalker tw(rfd);
+    tw.run(".", [&](unsigned worker, int dfd, const std::string& rel, std::vector<std::string>& descend) {
+        std::vector<DedupFile> found;
+        for_each_dirent(dfd, tw.dents(worker), [&](const char* name, unsigned char type) {
+            type = entry_type(dfd, name, type);
+            if (type == DT_DIR) {
+                if (rel != "." || strcmp(name, ".ws") != 0) descend.push_back(name);
+                return;
+            }
+            struct stat st;
+            if (type != DT_REG || fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+                !S_ISREG(st.st_mode) || (uint64_t)st.st_size < min_size)
+                return;
+            DedupFile d;
+            d.path = full_path(root, join_rel(rel, name));
+            stat_into(st, d);
+            found.push_back(std::move(d));
+        });
+        std::lock_guard<std::mutex> lock(mu);
+        for (auto& d : found) out.push_back(std::move(d));
+    });
+    close(rfd);
+}
+
+// Share src's extents with dst where the kernel confirms the bytes are
+// equal. Returns the bytes shared, or -1 with errno set when the
+// filesystem can't.
+static int64_t dedupe_range(int src, int dst, uint64_t size) {
+    const uint64_t chunk = 16ULL << 20;
+    std::vector<char> buf(sizeof(struct file_dedupe_range) + sizeof(struct file_dedupe_range_info));
+    auto* r = (struct file_dedupe_range*)buf.data();
+    int64_t done = 0;
+    for (uint64_t off = 0; off < size; off += chunk) {
+        memset(buf.data(), 0, buf.size());
+        r->src_offset = off;
+        r->src_length = std::min(chunk, size - off);
+        r->dest_count = 1;
+        r->info[0].dest_fd = dst;
+        r->info[0].dest_offset = off;
+        if (ioctl(src, FIDEDUPERANGE, r) != 0) return done ? done : -1;
+        if (r->info[0].status < 0) {
+            errno = -r->info[0].status;
+            return done ? done : -1;
+        }
+        if (r->info[0].status == FILE_DEDUPE_RANGE_DIFFERS) break;
+        done += r->info[0].bytes_deduped;
+    }
+    return done;
+}
+
+// Replace dup with a hardlink to leader, provided neither changed since
+// they were hashed
+static bool hardlink_over(const DedupFile& leader, const DedupFile& dup) {
+    struct stat st;
+    DedupFile now;
+    if (stat(leader.path.c_str(), &st) != 0) return false;
+    stat_into(st, now);
+    if (!same_file_state(now, leader)) return false;
+    if (stat(dup.path.c_str(), &st) != 0) return false;
+    stat_into(st, now);
+    if (!same_file_state(now, dup)) return false;
+    
+    std::string tmp = fs::path(dup.path).parent_path().string() + "/.ws-dedup." + std::to_string(getpid());
+    if (link(leader.path.c_str(), tmp.c_str()) != 0) return false;
+    if (rename(tmp.c_str(), dup.path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// ============================================
+// DISTRIBUTED COMPILES
+// ============================================
+//
+// c and cpp workspaces with worker.N entries hand the compiles that miss
+// the compiler cache to other machines. ws-cc sends the preprocessed
+// source and the flags that matter past preprocessing; the worker
+// compiles it with its own copy of the compiler and sends back the
+// object and diagnostics. The dependency file is written locally, by the
+// preprocessing run the cache makes anyway.
+//
+//   worker.0 = ssh:build1#8            ssh to build1, 8 jobs at a time
+//   worker.1 = ssh:me@build2:2222      4 jobs (the default)
+//   worker.2 = unix:/path/worker.sock  a ws-worker on this machine
+//
+// Over ssh the worker side is ~/.cache/dreamland/ccache/bin/ws-cc --serve,
+// which running ws-worker once sets up; unix: talks to a running
+// ws-worker. Workers need the same compiler versions as the client.
+//
+// Slots are flock()ed files in ~/.cache/dreamland/dist, so the ws-cc
+// processes of a parallel make share them with no coordinator. With no
+// free slot, or a worker that can't be reached (then skipped for
+// DIST_RETRY seconds), the compile runs locally. So does one that fails
+// remotely, so real errors are always the local compiler's.
+//
+//   request  "wsdist 1", then "compiler NAME", "lang c|c++", "cwd DIR"
+//            (with -g), "arg A"..., and "input N" + N bytes
+//   reply    "wsdist 1 EXIT", "diag N" + N bytes, "object N" + N bytes
+//
+// dist/stats keeps throughput per worker, one line each:
+//
+//   <worker> <jobs> <failed> <bytes sent> <bytes received> <seconds>
+
+static const int DIST_RETRY = 30;
+static const double DIST_TIMEOUT = 600;
+
+static std::string dist_dir() {
+    return home_dir() + "/.cache/dreamland/dist";
+}
+
+struct DistWorker {
+    std::string spec;           // without the #N
+    std::string transport;      // "ssh" or "unix"
+    std::string address;
+    int slots = 4;
+};
+
+static bool parse_worker(const std::string& s, DistWorker& w) {
+    w.spec = s;
+    size_t hash = s.rfind('#');
+    if (hash != std::string::npos) {
+        w.slots = std::atoi(s.c_str() + hash + 1);
+        w.spec = s.substr(0, hash);
+        if (w.slots < 1 || s.find_first_not_of("0123456789", hash + 1) != std::string::npos) return false;
+    }
+    size_t colon = w.spec.find(':');
+    if (colon == std::string::npos) return false;
+    w.transport = w.spec.substr(0, colon);
+    w.address = w.spec.substr(colon + 1);
+    return !w.address.empty() && (w.transport == "ssh" || (w.transport == "unix" && w.address[0] == '/'));
+}
+
+static std::vector<DistWorker> env_workers() {
+    std::vector<DistWorker> out;
+    const char* env = getenv("WS_WORKERS");
+    for (auto& s : split_list(env ? env : "")) {
+        DistWorker w;
+        if (parse_worker(s, w)) out.push_back(w);
+    }
+    return out;
+}
+
+struct DistJob {
+    std::string compiler;                  // looked up on the worker's PATH
+    std::string lang;                      // "c" or "c++"
+    std::vector<std::string> args;
+    std::string cwd;                       // for debug info, empty without -g
+    const std::string* input = nullptr;    // preprocessed source
+};
+
+struct DistReply {
+    int exit_code = -1;
+    std::string diag;
+    std::string object;
+};
+
+struct DistStats {
+    uint64_t jobs = 0;
+    uint64_t failed = 0;       // unreachable, or the remote compile failed
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    double secs = 0;
+};
+
+// Read the per-worker counters under the stats lock and, with `fn`,
+// update them
+static std::map<std::string, DistStats> dist_stats(
+    const std::function<void(std::map<std::string, DistStats>&)>& fn = nullptr) {
+    std::map<std::string, DistStats> all;
+    int fd = lock_file(dist_dir() + "/stats");
+    if (fd < 0) return all;
+    
+    std::string buf;
+    char chunk[4096];
+    ssize_t n;
+    off_t off = 0;
+    while ((n = pread(fd, chunk, sizeof(chunk), off)) > 0) {
+        buf.append(chunk, n);
+        off += n;
+    }
+    std::istringstream in(buf);
+    std::string line;
+    while (std::getline(in, line)) {
+        char name[512];
+        unsigned long long v[4];
+        double secs;
+        if (sscanf(line.c_str(), "%511s %llu %llu %llu %llu %lf", name, &v[0], &v[1], &v[2], &v[3], &secs) == 6)
+            all[name] = {v[0], v[1], v[2], v[3], secs};
+    }
+    
+    if (fn) {
+        fn(all);
+        std::string out;
+        for (auto& [name, s] : all) {
+            char row[640];
+            snprintf(row, sizeof(row), "%s %llu %llu %llu %llu %.3f\n", name.c_str(), (unsigned long long)s.jobs,
+                     (unsigned long long)s.failed, (unsigned long long)s.sent, (unsigned long long)s.received,
+                     s.secs);
+            out += row;
+        }
+        if (pwrite(fd, out.data(), out.size(), 0) != (ssize_t)out.size() || ftruncate(fd, out.size()) != 0)
+            std::cerr << YELLOW << "[!] ws-cc: cannot update worker stats" << RESET << "\n";
+    }
+    close(fd);
+    return all;
+}
+
+// Buffered reads that give up after `timeout` seconds of silence
+struct DistReader {
+    int fd;
+    double timeout;
+    std::string buf;
+    size_t pos = 0;
+    
+    DistReader(int fd, double timeout) : fd(fd), timeout(timeout) {}
+    
+    bool fill() {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int r;
+        while ((r = poll(&pfd, 1, (int)(timeout * 1000))) < 0 && errno == EINTR) {}
+        if (r <= 0) return false;
+        char chunk[65536];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) < 0 && errno == EINTR) {}
+        if (n <= 0) return false;
+        if (pos > 0) { buf.erase(0, pos); pos = 0; }
+        buf.append(chunk, n);
+        return true;
+    }
+    
+    bool line(std::string& out) {
+        size_t nl;
+        while ((nl = buf.find('\n', pos)) == std::string::npos)
+            if (buf.size() - pos > 65536 || !fill()) return false;
+        out = buf.substr(pos, nl - pos);
+        pos = nl + 1;
+        return true;
+    }
+    
+    bool bytes(size_t n, std::string& out) {
+        while (buf.size() - pos < n)
+            if (!fill()) return false;
+        out = buf.substr(pos, n);
+        pos += n;
+        return true;
+    }
+    
+    // "<key> N" followed by N bytes
+    bool blob(const char* key, std::string& out) {
+        std::string l;
+        size_t klen = strlen(key);
+        if (!line(l) || l.compare(0, klen, key) != 0 || l.size() <= klen || l[klen] != ' ') return false;
+        return bytes(std::strtoull(l.c_str() + klen + 1, nullptr, 10), out);
+    }
+};
+
+// First `name` on PATH that isn't a ws-cc link
+static std::string dist_compiler(const std::string& name) {
+    if (name.empty() || name.find('/') != std::string::npos) return "";
+    const char* path = getenv("PATH");
+    std::istringstream dirs(path ? path : "/usr/bin:/bin");
+    std::string dir;
+    std::error_code ec;
+    while (std::getline(dirs, dir, ':')) {
+        std::string cand = (dir.empty() ? "." : dir) + "/" + name;
+        if (access(cand.c_str(), X_OK) != 0) continue;
+        if (fs::canonical(cand, ec).filename() == "ws-cc") continue;
+        return cand;
+    }
+    return "";
+}
+
+// Worker side: compile one job in a scratch directory
+static DistReply dist_run(const DistJob& job) {
+    DistReply r;
+    std::string real = dist_compiler(job.compiler);
+    if (real.empty() || (job.lang != "c" && job.lang != "c++")) {
+        r.exit_code = 127;
+        r.diag = "ws-worker: no " + job.compiler + " (" + job.lang + ") on this host\n";
+        return r;
+    }
+    char tmpl[] = "/tmp/ws-dist.XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        r.exit_code = 1;
+        r.diag = std::string("ws-worker: ") + strerror(errno) + "\n";
+        return r;
+    }
+    std::string dir = tmpl;
+    std::string in = dir + (job.lang == "c" ? "/in.i" : "/in.ii");
+    
+    ProcSpec spec;
+    spec.argv = {real};
+    spec.argv.insert(spec.argv.end(), job.args.begin(), job.args.end());
+    if (!job.cwd.empty()) spec.argv.push_back("-fdebug-prefix-map=" + dir + "=" + job.cwd);
+    for (const char* a : {"-x", job.lang == "c" ? "cpp-output" : "c++-cpp-output", "-c", in.c_str(), "-o", "out.o"})
+        spec.argv.push_back(a);
+    spec.cwd = dir;
+    spec.capture = spec.merge_stderr = true;
+    
+    int fd = open(in.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool written = fd >= 0 && send_all(fd, job.input->data(), job.input->size());
+    if (fd >= 0) close(fd);
+    ProcResult p;
+    if (written) p = run_proc(spec);
+    r.exit_code = p.started ? p.exit_code : 127;
+    r.diag = written ? p.output : "ws-worker: cannot write " + in + "\n";
+    if (r.exit_code == 0 && !read_whole(dir + "/out.o", r.object)) {
+        r.exit_code = 1;
+        r.diag += "ws-worker: no object produced\n";
+    }
+    remove_tree(dir);
+    return r;
+}
+
+// Worker side: read a request from `in`, reply on `out`
+static int dist_serve(int in, int out) {
+    DistReader rd{in, 60};
+    DistJob job;
+    std::string line, input;
+    if (!rd.line(line) || line != "wsdist 1") return 2;
+    while (rd.line(line)) {
+        size_t sp = line.find(' ');
+        std::string key = line.substr(0, sp);
+        std::string val = sp == std::string::npos ? "" : line.substr(sp + 1);
+        if (key == "compiler") job.compiler = val;
+        else if (key == "lang") job.lang = val;
+        else if (key == "cwd") job.cwd = val;
+        else if (key == "arg") job.args.push_back(val);
+        else if (key == "input") {
+            if (!rd.bytes(std::strtoull(val.c_str(), nullptr, 10), input)) return 2;
+            job.input = &input;
+            break;
+        }
+    }
+    if (!job.input) return 2;
+    
+    DistReply r = dist_run(job);
+    std::string head = "wsdist 1 " + std::to_string(r.exit_code) + "\ndiag " + std::to_string(r.diag.size()) + "\n";
+    std::string obj = "object " + std::to_string(r.object.size()) + "\n";
+    bool sent = send_all(out, head.data(), head.size()) && send_all(out, r.diag.data(), r.diag.size()) &&
+                send_all(out, obj.data(), obj.size()) && send_all(out, r.object.data(), r.object.size());
+    return sent ? 0 : 2;
+}
+
+struct DistConn {
+    int in = -1;
+    int out = -1;
+    pid_t pid = 0;
+    
+    ~DistConn() {
+        if (out >= 0 && out != in) close(out);
+        if (in >= 0) close(in);
+        if (pid > 0) {
+            kill(pid, SIGTERM);
+            waitpid(pid, nullptr, 0);
+        }
+    }
+};
+
+static bool dist_connect(const DistWorker& w, DistConn& c) {
+    if (w.transport == "unix") {
+        sockaddr_un addr{};
+        if (w.address.size() >= sizeof(addr.sun_path)) return false;
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, w.address.c_str(), w.address.size() + 1);
+        c.in = c.out = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        return c.in >= 0 && connect(c.in, (sockaddr*)&addr, sizeof(addr)) == 0;
+    }
+    
+    // ssh:[user@]host[:port]
+    std::string host = w.address, port;
+    size_t colon = host.rfind(':');
+    if (colon != std::string::npos && host.find_first_not_of("0123456789", colon + 1) == std::string::npos) {
+        port = host.substr(colon + 1);
+        host.resize(colon);
+    }
+    std::vector<std::string> argv = {"ssh", "-o", "BatchMode=yes", "-o", "ConnectTimeout=5"};
+    if (!port.empty()) argv.insert(argv.end(), {"-p", port});
+    argv.insert(argv.end(), {host, ".cache/dreamland/ccache/bin/ws-cc --serve"});
+    
+    int to[2], from[2];
+    if (pipe2(to, O_CLOEXEC) != 0) return false;
+    if (pipe2(from, O_CLOEXEC) != 0) { close(to[0]); close(to[1]); return false; }
+    c.pid = fork();
+    if (c.pid == 0) {
+        dup2(to[0], STDIN_FILENO);
+        dup2(from[1], STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) dup2(null, STDERR_FILENO);
+        std::vector<char*> v;
+        for (auto& a : argv) v.push_back(const_cast<char*>(a.c_str()));
+        v.push_back(nullptr);
+        execvp("ssh", v.data());
+        _exit(255);
+    }
+    close(to[0]);
+    close(from[1]);
+    c.out = to[1];
+    c.in = from[0];
+    return c.pid > 0;
+}
+
+// Take a free slot, trying the workers from a different one in each
+// process. Returns the locked slot's fd, or -1 when all are busy or down.
+static int dist_slot(const std::vector<DistWorker>& workers, size_t& which) {
+    size_t start = getpid() % workers.size();
+    for (size_t n = 0; n < workers.size(); n++) {
+        size_t i = (start + n) % workers.size();
+        std::string base = dist_dir() + "/" + Sha256::of(workers[i].spec).substr(0, 16);
+        struct stat st;
+        if (stat((base + ".down").c_str(), &st) == 0 && time(nullptr) - st.st_mtime < DIST_RETRY) continue;
+        for (int k = 0; k < workers[i].slots; k++) {
+            int fd = open((base + "." + std::to_string(k)).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0) continue;
+            if (flock(fd, LOCK_EX | LOCK_NB) == 0) { which = i; return fd; }
+            close(fd);
+        }
+    }
+    return -1;
+}
+
+// Compile on a worker. False when none took the job or it failed there;
+// the caller then compiles locally.
+static bool dist_compile(const DistJob& job, DistReply& reply) {
+    auto workers = env_workers();
+    if (workers.empty()) return false;
+    std::error_code ec;
+    fs::create_directories(dist_dir(), ec);
+    size_t which = 0;
+    int slot = dist_slot(workers, which);
+    if (slot < 0) return false;
+    const DistWorker& w = workers[which];
+    auto start = std::chrono::steady_clock::now();
+    
+    std::string head = "wsdist 1\ncompiler " + job.compiler + "\nlang " + job.lang + "\n";
+    if (!job.cwd.empty()) head += "cwd " + job.cwd + "\n";
+    for (auto& a : job.args) head += "arg " + a + "\n";
+    head += "input " + std::to_string(job.input->size()) + "\n";
+    
+    // A worker hanging up must not kill the compile
+    struct sigaction ign{}, old_pipe;
+    ign.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ign, &old_pipe);
+    bool reached = false, got = false;
+    {
+        DistConn conn;
+        reached = dist_connect(w, conn) && send_all(conn.out, head.data(), head.size()) &&
+                  send_all(conn.out, job.input->data(), job.input->size());
+        if (conn.out != conn.in) { close(conn.out); conn.out = -1; }
+        
+        DistReader rd{conn.in, DIST_TIMEOUT};
+        std::string line;
+        got = reached && rd.line(line) && line.compare(0, 9, "wsdist 1 ") == 0 && rd.blob("diag", reply.diag) &&
+              rd.blob("object", reply.object);
+        if (got) reply.exit_code = std::atoi(line.c_str() + 9);
+    }
+    sigaction(SIGPIPE, &old_pipe, nullptr);
+    double secs = elapsed_s(start);
+    
+    if (!got) {
+        std::string down = dist_dir() + "/" + Sha256::of(w.spec).substr(0, 16) + ".down";
+        int fd = open(down.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd >= 0) close(fd);
+    }
+    bool good = got && reply.exit_code == 0;
+    dist_stats([&](std::map<std::string, DistStats>& all) {
+        DistStats& s = all[w.spec];
+        s.jobs++;
+        if (!good) s.failed++;
+        if (!got) return;
+        s.sent += head.size() + job.input->size();
+        s.received += reply.diag.size() + reply.object.size();
+        s.secs += secs;
+    });
+    close(slot);
+    return good;
+}
+
+// ============================================
+// COMPILER CACHE
+// ============================================
+//
+// c and cpp workspaces compile through a cache. ws-build and shells inside
+// the workspace get ~/.cache/dreamland/ccache/bin at the front of PATH,
+// where cc, gcc, c++, g++, clang and clang++ (those that exist further
+// along PATH) link to ws-cc: a small launcher, built on first use, that
+// loads this module and calls ws_cc_main. `ws-cc <compiler> args...`
+// works too, for a CC/CXX set by hand.
+//
+// A compile of one source file with -c is keyed by the real compiler
+// (path, size, mtime), the arguments other than the output names, the
+// working directory when debug info is on, and the preprocessed source.
+// On a hit the stored object, dependency file and diagnostics are put in
+// place without running the compiler; links and anything else unusual go
+// straight to the compiler.
+//
+//   ab/<key>.o, .d, .err   one entry
+//   stats                  "hits misses uncacheable bytes files"
+//
+// Each hit refreshes the .o's mtime; once the store grows past
+// ccache_size (default 5G) the least recently used entries are removed
+// down to 90% of it.
+
+static std::string ccache_dir() {
+    return home_dir() + "/.cache/dreamland/ccache";
+}
+
+static const char* CCACHE_COMPILERS[] = {"cc", "gcc", "c++", "g++", "clang", "clang++"};
+
+// "5G", "512M", "64K" or plain bytes; 0 when malformed
+static uint64_t parse_size(const std::string& s) {
+    char* end = nullptr;
+    double n = std::strtod(s.c_str(), &end);
+    if (end == s.c_str() || n < 0) return 0;
+    std::string unit = end;
+    uint64_t mult = 1;
+    if (unit == "K" || unit == "k") mult = 1ULL << 10;
+    else if (unit == "M" || unit == "m") mult = 1ULL << 20;
+    else if (unit == "G" || unit == "g") mult = 1ULL << 30;
+    else if (!unit.empty()) return 0;
+    return (uint64_t)(n * mult);
+}
+
+struct CompilerCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t uncacheable = 0;    // links, multi-file compiles, -E, ...
+    uint64_t bytes = 0;
+    uint64_t files = 0;
+};
+
+// Read the counters under the stats lock and, with `fn`, update them
+static CompilerCacheStats ccache_stats(const std::function<void(CompilerCacheStats&)>& fn = nullptr) {
+    CompilerCacheStats s;
+    int fd = lock_file(ccache_dir() + "/stats");
+    if (fd < 0) return s;
+    
+    char buf[256];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    buf[std::max<ssize_t>(n, 0)] = 0;
+    unsigned long long v[5] = {0, 0, 0, 0, 0};
+    sscanf(buf, "%llu %llu %llu %llu %llu", &v[0], &v[1], &v[2], &v[3], &v[4]);
+    s = {v[0], v[1], v[2], v[3], v[4]};
+    
+    if (fn) {
+        fn(s);
+        int len = snprintf(buf, sizeof(buf), "%llu %llu %llu %llu %llu\n",
+                           (unsigned long long)s.hits, (unsigned long long)s.misses,
+                           (unsigned long long)s.uncacheable, (unsigned long long)s.bytes,
+                           (unsigned long long)s.files);
+        if (pwrite(fd, buf, len, 0) != len || ftruncate(fd, len) != 0)
+            std::cerr << YELLOW << "[!] ws-cc: cannot update stats" << RESET << "\n";
+    }
+    close(fd);
+    return s;
+}
+
+// Drop the least recently used entries until the store is under 90% of
+// max. Skipped when another process is already at it.
+static void ccache_evict(uint64_t max) {
+    std::string dir = ccache_dir();
+    int lfd = open((dir + "/evict.lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lfd < 0) return;
+    if (flock(lfd, LOCK_EX | LOCK_NB) != 0) { close(lfd); return; }
+    
+    struct Entry { int64_t used = 0; uint64_t bytes = 0; std::vector<std::string> files; };
+    std::map<std::string, Entry> entries;
+    uint64_t total = 0;
+    std::error_code ec;
+    for (auto& shard : fs::directory_iterator(dir, ec)) {
+        std::string sname = shard.path().filename();
+        if (sname.size() != 2 || !shard.is_directory(ec)) continue;
+        for (auto& f : fs::directory_iterator(shard.path(), ec)) {
+            std::string name = f.path().filename();
+            struct stat st;
+            if (lstat(f.path().c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            // Leftovers of an interrupted store
+            if (name.find(".tmp.") != std::string::npos) {
+                if (time(nullptr) - st.st_mtime > 3600) unlink(f.path().c_str());
+                continue;
+            }
+            Entry& e = entries[sname + "/" + name.substr(0, name.find('.'))];
+            e.bytes += st.st_size;
+            e.files.push_back(f.path());
+            if (name.size() > 2 && name.compare(name.size() - 2, 2, ".o") == 0) e.used = mtime_ns(st);
+            total += st.st_size;
+        }
+    }
+    
+    std::vector<const Entry*> order;
+    for (auto& [key, e] : entries) order.push_back(&e);
+    std::sort(order.begin(), order.end(), [](const Entry* a, const Entry* b) { return a->used < b->used; });
+    
+    uint64_t target = max / 10 * 9;
+    size_t removed = 0;
+    for (const Entry* e : order) {
+        if (total <= target) break;
+        for (auto& f : e->files) unlink(f.c_str());
+        total -= e->bytes;
+        removed++;
+    }
+    ccache_stats([&](CompilerCacheStats& s) {
+        s.bytes = total;
+        s.files = entries.size() - removed;
+    });
+    close(lfd);
+}
+
+// First `name` on PATH other than the launcher
+static std::string find_real_compiler(const std::string& name) {
+    std::error_code ec;
+    fs::path launcher = fs::canonical(ccache_dir() + "/bin/ws-cc", ec);
+    const char* path = getenv("PATH");
+    std::istringstream dirs(path ? path : "/usr/bin:/bin");
+    std::string dir;
+    while (std::getline(dirs, dir, ':')) {
+        std::string cand = (dir.empty() ? "." : dir) + "/" + name;
+        if (access(cand.c_str(), X_OK) != 0) continue;
+        if (!launcher.empty() && fs::canonical(cand, ec) == launcher) continue;
+        return cand;
+    }
+    return "";
+}
+
+static bool is_c_source(const std::string& arg) {
+    static const std::set<std::string> exts = {"c", "cc", "cp", "cpp", "cxx", "c++", "C", "CPP", "i", "ii"};
+    size_t dot = arg.rfind('.');
+    return dot != std::string::npos && arg.find('/', dot) == std::string::npos &&
+           exts.count(arg.substr(dot + 1));
+}
+
+struct CompileArgs {
+    bool cacheable = false;
+    std::string source;
+    std::string output;
+    std::string depfile;                 // with -MD/-MMD
+    bool debug = false;
+    std::vector<std::string> hashed;     // what shapes the object
+    std::vector<std::string> cpp;        // the same compile as an -E run
+    std::vector<std::string> deps;       // -MD/-MMD/-MP/-MT/-MQ as given
+    std::vector<std::string> remote;     // flags still needed on preprocessed input
+    std::string lang;                    // from -x, or "" to go by the name
+};
+
+static CompileArgs parse_compile(const std::vector<std::string>& args) {
+    // Options taking the next argument as their value
+    static const std::set<std::string> with_value = {
+        "-I", "-D", "-U", "-include", "-imacros", "-isystem", "-iquote", "-idirafter", "-iprefix",
+        "-iwithprefix", "-iwithprefixbefore", "-isysroot", "--sysroot", "-x", "-Xpreprocessor",
+        "-Xclang", "-target", "--param", "-arch", "-aux-info"};
+    // Options whose results aren't just the object file
+    static const std::set<std::string> refused = {
+        "-", "-E", "-S", "-M", "-MM", "-fsyntax-only", "--coverage", "-ftest-coverage"};
+    static const std::vector<std::string> refused_prefixes = {"-save-temps", "-fprofile-", "-fdump-", "-Wp,"};
+    // Done with once the source is preprocessed
+    static const std::set<std::string> cpp_only = {
+        "-I", "-D", "-U", "-include", "-imacros", "-isystem", "-iquote", "-idirafter", "-iprefix",
+        "-iwithprefix", "-iwithprefixbefore", "-isysroot", "-x", "-Xpreprocessor"};
+    static const std::vector<std::string> cpp_only_prefixes = {"-I", "-D", "-U", "-i", "-nostdinc", "-undef"};
+    
+    CompileArgs c;
+    bool compile = false, deps = false;
+    std::vector<std::string> sources;
+    for (size_t i = 0; i < args.size(); i++) {
+        const std::string& a = args[i];
+        if (a.empty() || a[0] == '@' || refused.count(a)) return c;
+        for (auto& r : refused_prefixes)
+            if (a.compare(0, r.size(), r) == 0) return c;
+        
+        if (a == "-c") { compile = true; continue; }
+        if (a == "-MD" || a == "-MMD") { deps = true; c.hashed.push_back(a); c.deps.push_back(a); continue; }
+        if (a == "-MP") { c.hashed.push_back(a); c.deps.push_back(a); continue; }
+        if (a.compare(0, 2, "-o") == 0 || a.compare(0, 3, "-MF") == 0 ||
+            a.compare(0, 3, "-MT") == 0 || a.compare(0, 3, "-MQ") == 0) {
+            size_t opt = a[1] == 'o' ? 2 : 3;
+            std::string val = a.substr(opt);
+            if (val.empty()) {
+                if (i + 1 >= args.size()) return c;
+                val = args[++i];
+            }
+            if (opt == 2) c.output = val;
+            else if (a[2] == 'F') c.depfile = val;
+            else {
+                // Targets named in the .d
+                c.hashed.push_back(a.substr(0, opt) + val);
+                c.deps.insert(c.deps.end(), {a.substr(0, opt), val});
+            }
+            continue;
+        }
+        if (with_value.count(a)) {
+            if (i + 1 >= args.size()) return c;
+            c.hashed.insert(c.hashed.end(), {a, args[i + 1]});
+            c.cpp.insert(c.cpp.end(), {a, args[i + 1]});
+            if (a == "-x") c.lang = args[i + 1];
+            if (!cpp_only.count(a)) c.remote.insert(c.remote.end(), {a, args[i + 1]});
+            i++;
+            continue;
+        }
+        if (a[0] == '-') {
+            if (a.compare(0, 2, "-g") == 0 && a != "-g0") c.debug = true;
+            c.hashed.push_back(a);
+            c.cpp.push_back(a);
+            if (std::none_of(cpp_only_prefixes.begin(), cpp_only_prefixes.end(),
+                             [&](const std::string& p) { return a.compare(0, p.size(), p) == 0; }))
+                c.remote.push_back(a);
+            continue;
+        }
+        // Objects, libraries: this is (also) a link
+        if (!is_c_source(a)) return c;
+        sources.push_back(a);
+    }
+    if (!compile || sources.size() != 1) return c;
+    
+    c.source = sources[0];
+    if (c.output.empty()) {
+        std::string base = fs::path(c.source).filename();
+        c.output = base.substr(0, base.rfind('.')) + ".o";
+    }
+    if (!deps) c.depfile.clear();
+    else if (c.depfile.empty()) {
+        size_t dot = c.output.rfind('.');
+        size_t slash = c.output.rfind('/');
+        bool ext = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+        c.depfile = (ext ? c.output.substr(0, dot) : c.output) + ".d";
+    }
+    c.cpp.push_back("-E");
+    c.cpp.push_back(c.source);
+    c.cacheable = true;
+    return c;
+}
+
+// Copy src over dst through a temporary, so readers never see half a file
+static bool ccache_copy(const std::string& src, const std::string& dst, uint64_t* bytes = nullptr) {
+    int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+    struct stat st;
+    fstat(in, &st);
+    std::string tmp = dst + ".tmp." + std::to_string(getpid());
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    std::vector<char> buf(64 * 1024);
+    CopyStats stats;
+    bool good = out >= 0 && copy_fd(in, out, st.st_size, buf, stats);
+    if (out >= 0) close(out);
+    close(in);
+    good = good && rename(tmp.c_str(), dst.c_str()) == 0;
+    if (!good) unlink(tmp.c_str());
+    if (good && bytes) *bytes += st.st_size;
+    return good;
+}
+
+static int compiler_cache_main(int argc, char** argv) {
+    std::string name = fs::path(argv[0]).filename();
+    int first = 1;
+    if (name == "ws-cc" && argc == 2 && !strcmp(argv[1], "--serve")) return dist_serve(STDIN_FILENO, STDOUT_FILENO);
+    if (name == "ws-cc") {
+        if (argc < 2) {
+            std::cerr << "Usage: ws-cc <compiler> [args...]\n";
+            return 2;
+        }
+        name = argv[1];
+        first = 2;
+    }
+    std::string real = name.find('/') != std::string::npos ? name : find_real_compiler(name);
+    if (real.empty()) {
+        std::cerr << "ws-cc: " << name << ": not found on PATH\n";
+        return 127;
+    }
+    std::vector<std::string> args(argv + first, argv + argc);
+    std::vector<std::string> cmd = {real};
+    cmd.insert(cmd.end(), args.begin(), args.end());
+    
+    auto exec_real = [&]() {
+        std::vector<char*> v;
+        for (auto& a : cmd) v.push_back(const_cast<char*>(a.c_str()));
+        v.push_back(nullptr);
+        execv(real.c_str(), v.data());
+        std::cerr << "ws-cc: " << real << ": " << strerror(errno) << "\n";
+        return 127;
+    };
+    
+    CompileArgs c = parse_compile(args);
+    struct stat cst;
+    if (!c.cacheable || stat(real.c_str(), &cst) != 0) {
+        ccache_stats([](CompilerCacheStats& s) { s.uncacheable++; });
+        return exec_real();
+    }
+    
+    // What a worker would compile, if there are any
+    DistJob job;
+    job.compiler = fs::path(real).filename();
+    job.lang = c.lang;
+    if (job.lang.empty()) {
+        std::string ext = fs::path(c.source).extension();
+        bool cxx = name.size() > 2 && name.compare(name.size() - 2, 2, "++") == 0;
+        job.lang = cxx || (ext != ".c" && ext != ".i") ? "c++" : "c";
+    }
+    job.args = c.remote;
+    bool dist = (job.lang == "c" || job.lang == "c++") && !env_workers().empty() &&
+                std::none_of(args.begin(), args.end(), [](const std::string& a) { return a.find('\n') != std::string::npos; });
+    
+    // Preprocess; if that fails, the real compile reports why. When the
+    // object may come from a worker, the dependency file is written here.
+    ProcSpec pre;
+    pre.argv = {real};
+    pre.argv.insert(pre.argv.end(), c.cpp.begin(), c.cpp.end());
+    if (dist && !c.depfile.empty()) {
+        pre.argv.insert(pre.argv.end(), c.deps.begin(), c.deps.end());
+        if (std::none_of(c.deps.begin(), c.deps.end(), [](const std::string& a) { return a == "-MT" || a == "-MQ"; }))
+            pre.argv.insert(pre.argv.end(), {"-MT", c.output});
+        pre.argv.insert(pre.argv.end(), {"-MF", c.depfile});
+    }
+    pre.capture = true;
+    pre.stderr_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    ProcResult p = run_proc(pre);
+    if (pre.stderr_fd >= 0) close(pre.stderr_fd);
+    if (!p.ok()) {
+        ccache_stats([](CompilerCacheStats& s) { s.uncacheable++; });
+        return exec_real();
+    }
+    
+    std::error_code ec;
+    Sha256 h;
+    h.update("wscc 1\n");
+    h.update("compiler=" + fs::canonical(real, ec).string() + " " + std::to_string(cst.st_size) +
+             " " + std::to_string(mtime_ns(cst)) + "\n");
+    for (auto& a : c.hashed) h.update(a.c_str(), a.size() + 1);
+    if (c.debug) h.update("cwd=" + fs::current_path(ec).string() + "\n");
+    if (!c.depfile.empty()) h.update("output=" + c.output + "\n");
+    h.update(p.output);
+    std::string key = h.hex();
+    
+    std::string dir = ccache_dir() + "/" + key.substr(0, 2);
+    std::string entry = dir + "/" + key;
+    
+    if (access((entry + ".o").c_str(), R_OK) == 0 &&
+        (c.depfile.empty() || ccache_copy(entry + ".d", c.depfile)) &&
+        ccache_copy(entry + ".o", c.output)) {
+        std::string diag;
+        if (read_whole(entry + ".err", diag)) std::cerr << diag;
+        utimensat(AT_FDCWD, (entry + ".o").c_str(), nullptr, 0);
+        ccache_stats([](CompilerCacheStats& s) { s.hits++; });
+        return 0;
+    }
+    
+    // Miss: compile on a worker or here, keeping the diagnostics to
+    // replay on later hits
+    fs::create_directories(dir, ec);
+    std::string err_tmp = entry + ".err.tmp." + std::to_string(getpid());
+    ProcSpec spec;
+    spec.argv = cmd;
+    spec.stderr_fd = open(err_tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    ProcResult r;
+    DistReply reply;
+    if (c.debug) job.cwd = fs::current_path(ec).string();
+    job.input = &p.output;
+    if (dist && spec.stderr_fd >= 0 && dist_compile(job, reply)) {
+        std::string tmp = c.output + ".tmp." + std::to_string(getpid());
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        bool written = fd >= 0 && send_all(fd, reply.object.data(), reply.object.size());
+        if (fd >= 0) written = close(fd) == 0 && written;
+        if (written && rename(tmp.c_str(), c.output.c_str()) == 0 &&
+            send_all(spec.stderr_fd, reply.diag.data(), reply.diag.size())) {
+            r.started = true;
+            r.exit_code = 0;
+        } else {
+            unlink(tmp.c_str());
+        }
+    }
+    if (!r.started) r = run_proc(spec);
+    if (spec.stderr_fd >= 0) close(spec.stderr_fd);
+    std::string diag;
+    read_whole(err_tmp, diag);
+    std::cerr << diag;
+    if (!r.started) {
+        unlink(err_tmp.c_str());
+        return exec_real();
+    }
+    
+    uint64_t added = 0;
+    bool stored = false;
+    if (r.ok() && spec.stderr_fd >= 0) {
+        // The .o goes last: its presence marks a complete entry
+        stored = diag.empty() ? unlink((entry + ".err").c_str()) == 0 || errno == ENOENT
+                              : rename(err_tmp.c_str(), (entry + ".err").c_str()) == 0;
+        added += diag.size();
+        if (stored && !c.depfile.empty()) stored = ccache_copy(c.depfile, entry + ".d", &added);
+        if (stored) stored = ccache_copy(c.output, entry + ".o", &added);
+    }
+    unlink(err_tmp.c_str());
+    
+    uint64_t max = parse_size(getenv("WS_CCACHE_SIZE") ? getenv("WS_CCACHE_SIZE") : "5G");
+    CompilerCacheStats now = ccache_stats([&](CompilerCacheStats& s) {
+        s.misses++;
+        if (stored) {
+            s.bytes += added;
+            s.files++;
+        }
+    });
+    if (stored && max && now.bytes > max) ccache_evict(max);
+    return r.exit_code;
+}
+
+// C source of the launcher: loads the module and hands over to ws_cc_main
+static std::string launcher_source(const std::string& module) {
+    std::string quoted;
+    for (char ch : module) {
+        if (ch == '"' || ch == '\\') quoted += '\\';
+        quoted += ch;
+    }
+    return "#include <dlfcn.h>\n"
+           "#include <stdio.h>\n"
+           "\n"
+           "int main(int argc, char** argv) {\n"
+           "    void* h = dlopen(\"" + quoted + "\", RTLD_NOW | RTLD_LOCAL);\n"
+           "    int (*fn)(int, char**) = h ? (int (*)(int, char**))dlsym(h, \"ws_cc_main\") : 0;\n"
+           "    if (!fn) {\n"
+           "        fprintf(stderr, \"ws-cc: %s\\n\", dlerror());\n"
+           "        return 127;\n"
+           "    }\n"
+           "    return fn(argc, argv);\n"
+           "}\n";
+}
+
+// The bin directory with an up-to-date launcher and links for the
+// compilers on PATH, or "" when the launcher can't be built
+static std::string ccache_bin() {
+    std::string bin = ccache_dir() + "/bin";
+    Dl_info dl;
+    std::error_code ec;
+    if (!dladdr((void*)&compiler_cache_main, &dl) || !dl.dli_fname) return "";
+    std::string src = launcher_source(fs::canonical(dl.dli_fname, ec).string());
+    if (ec) return "";
+    
+    std::string old;
+    if (!read_whole(bin + "/ws-cc.c", old) || old != src || access((bin + "/ws-cc").c_str(), X_OK) != 0) {
+        int lfd = lock_file(bin + "/lock");
+        if (lfd < 0) return "";
+        if (!read_whole(bin + "/ws-cc.c", old) || old != src || access((bin + "/ws-cc").c_str(), X_OK) != 0) {
+            std::string cc;
+            for (const char* name : {"cc", "gcc", "clang"})
+                if (cc.empty()) cc = find_real_compiler(name);
+            std::string tmp = bin + "/ws-cc.tmp." + std::to_string(getpid());
+            ProcSpec spec;
+            spec.argv = {cc, "-O2", "-o", tmp, "-x", "c", bin + "/ws-cc.c.tmp", "-ldl"};
+            spec.capture = spec.merge_stderr = true;
+            ProcResult r;
+            if (!cc.empty() && write_atomic(bin + "/ws-cc.c.tmp", src)) r = run_proc(spec);
+            if (!r.ok() || rename(tmp.c_str(), (bin + "/ws-cc").c_str()) != 0 ||
+                rename((bin + "/ws-cc.c.tmp").c_str(), (bin + "/ws-cc.c").c_str()) != 0) {
+                std::cerr << YELLOW << "[!] Compiler cache disabled: cannot build the ws-cc launcher"
+                          << RESET << "\n" << r.output;
+                unlink(tmp.c_str());
+                close(lfd);
+                return "";
+            }
+        }
+        close(lfd);
+    }
+    
+    // Links only for compilers that exist, so `command -v clang` keeps
+    // telling the truth
+    for (const char* name : CCACHE_COMPILERS) {
+        std::string link = bin + "/" + name;
+        struct stat st;
+        bool present = lstat(link.c_str(), &st) == 0;
+        bool wanted = !find_real_compiler(name).empty();
+        if (wanted && !present) symlink("ws-cc", link.c_str());
+        else if (!wanted && present) unlink(link.c_str());
+    }
+    return bin;
+}
+
+// PATH, store size and workers for commands that should compile through
+// the cache
+static std::vector<std::string> compiler_cache_env(const Workspace& w) {
+    if (!w.compiler_cache || (w.lang != "c" && w.lang != "cpp")) return {};
+    std::string bin = ccache_bin();
+    if (bin.empty()) return {};
+    std::string path = getenv("PATH") ? getenv("PATH") : "/usr/local/bin:/usr/bin:/bin";
+    if (path.compare(0, bin.size() + 1, bin + ":") != 0) path = bin + ":" + path;
+    std::string workers;
+    for (auto& s : w.workers) workers += (workers.empty() ? "" : " ") + s;
+    return {"PATH=" + path, "WS_CCACHE_SIZE=" + w.ccache_size, "WS_WORKERS=" + workers};
+}
+
+// ============================================
+// SHARED MOUNTS
+// ============================================
+//
+// mount.N entries are "source:target[:ro]". The source is an absolute
+// path (or ~/...), the target is absolute or relative to the workspace
+// root; both get bind-mounted when an isolated workspace is entered.
+//
+// Dependency caches are shared between every workspace of a language and
+// live in ~/.cache/dreamland/deps/<cache>. Builds and shells find them
+// through the tool's own variable; in an isolated workspace they are also
+// mounted over the tool's default location, so cargo and anything that
+// ignores the variable see them too. dep_cache picks the policy: rw
+// (default), ro (use what is there, never write; only enforced when
+// isolated) or off. Concurrent writers are left to the tools' own locks
+// (cargo, go, npm and pip all take one); every user additionally holds
+// <cache>.lock shared, so ws-deps clean never pulls a cache out from
+// under a running build or shell.
+
+struct DepCache {
+    const char* name;
+    const char* lang;
+    const char* home_rel;       // default location, relative to $HOME
+    const char* env;            // variable pointing the tool elsewhere
+};
+
+static const DepCache DEP_CACHES[] = {
+    {"cargo-registry", "rust", ".cargo/registry", nullptr},
+    {"cargo-git", "rust", ".cargo/git", nullptr},
+    {"npm", "node", ".npm", "npm_config_cache"},
+    {"pip", "python", ".cache/pip", "PIP_CACHE_DIR"},
+    {"go-mod", "go", "go/pkg/mod", "GOMODCACHE"},
+    {"go-build", "go", ".cache/go-build", "GOCACHE"},
+};
+
+static std::string deps_dir() {
+    return home_dir() + "/.cache/dreamland/deps";
+}
+
+static std::vector<const DepCache*> dep_caches(const Workspace& w) {
+    std::vector<const DepCache*> out;
+    if (w.dep_cache == "off") return out;
+    for (auto& c : DEP_CACHES)
+        if (w.lang == c.lang) out.push_back(&c);
+    return out;
+}
+
+// Take a cache's lock: shared for users (left open across exec so the
+// shell keeps holding it), exclusive and non-blocking for ws-deps clean
+static int lock_dep_cache(const DepCache& c, bool shared) {
+    std::string path = deps_dir() + "/" + c.name + ".lock";
+    std::error_code ec;
+    fs::create_directories(deps_dir() + "/" + c.name, ec);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | (shared ? 0 : O_CLOEXEC), 0644);
+    if (fd < 0) return -1;
+    while (flock(fd, shared ? LOCK_SH : LOCK_EX | LOCK_NB) != 0) {
+        if (errno != EINTR) { close(fd); return -1; }
+    }
+    return fd;
+}
+
+static std::vector<int> lock_dep_caches(const Workspace& w, bool inherit = true) {
+    std::vector<int> fds;
+    for (auto* c : dep_caches(w)) {
+        int fd = lock_dep_cache(*c, true);
+        if (fd < 0) continue;
+        if (!inherit) fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fds.push_back(fd);
+    }
+    return fds;
+}
+
+static std::vector<std::string> dep_cache_env(const Workspace& w) {
+    std::vector<std::string> env;
+    for (auto* c : dep_caches(w))
+        if (c->env) env.push_back(std::string(c->env) + "=" + deps_dir() + "/" + c->name);
+    return env;
+}
+
+// Bind src over dst, read-only if asked. The target is created to match
+// the source when missing.
+static bool bind_path(const std::string& src, const std::string& dst, bool ro, std::string& error) {
+    struct stat st;
+    if (stat(src.c_str(), &st) != 0) { error = src + ": " + strerror(errno); return false; }
+    std::error_code ec;
+    if (S_ISDIR(st.st_mode)) fs::create_directories(dst, ec);
+    else if (access(dst.c_str(), F_OK) != 0) {
+        fs::create_directories(fs::path(dst).parent_path(), ec);
+        int fd = open(dst.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd >= 0) close(fd);
+    }
+    if (mount(src.c_str(), dst.c_str(), nullptr, MS_BIND | MS_REC, nullptr) != 0) {
+        error = dst + ": " + strerror(errno);
+        return false;
+    }
+    if (ro && mount(nullptr, dst.c_str(), nullptr, MS_REMOUNT | MS_BIND | MS_RDONLY, nullptr) != 0) {
+        error = dst + ": cannot make read-only: " + strerror(errno);
+        umount2(dst.c_str(), MNT_DETACH);
+        return false;
+    }
+    return true;
+}
+
+// Apply mount.N and the dependency caches. Must run inside a private
+// mount namespace, after the layers and tmpfs are in place so targets
+// inside the workspace land on top of them.
+static void mount_shared(const Workspace& w) {
+    std::string error;
+    for (auto& spec : w.mounts) {
+        std::vector<std::string> parts;
+        for (size_t start = 0; start <= spec.size(); ) {
+            size_t colon = spec.find(':', start);
+            if (colon == std::string::npos) colon = spec.size();
+            parts.push_back(spec.substr(start, colon - start));
+            start = colon + 1;
+        }
+        bool ro = parts.size() == 3 && parts[2] == "ro";
+        if (parts.size() < 2 || parts.size() > 3 || parts[0].empty() || parts[1].empty() ||
+            (parts.size() == 3 && parts[2] != "ro" && parts[2] != "rw")) {
+            std::cerr << YELLOW << "[!] Bad mount (want source:target[:ro]): " << spec << RESET << "\n";
+            continue;
+        }
+        std::string src = parts[0], dst = parts[1];
+        if (src.compare(0, 2, "~/") == 0) src = home_dir() + src.substr(1);
+        if (dst.compare(0, 2, "~/") == 0) dst = home_dir() + dst.substr(1);
+        if (src[0] != '/') {
+            std::cerr << YELLOW << "[!] Mount source must be absolute: " << spec << RESET << "\n";
+            continue;
+        }
+        if (dst[0] != '/') dst = w.path + "/" + dst;
+        if (!bind_path(src, dst, ro, error))
+            std::cerr << YELLOW << "[!] Cannot mount " << spec << ": " << error << RESET << "\n";
+    }
+    
+    bool ro = w.dep_cache == "ro";
+    std::vector<std::string> names;
+    for (auto* c : dep_caches(w)) {
+        std::string dir = deps_dir() + "/" + c->name;
+        std::string dst = home_dir() + "/" + c->home_rel;
+        std::error_code ec;
+        fs::create_directories(dir, ec);
+        // The cache itself goes read-only first so the variable can't be
+        // used to get around the policy
+        if ((ro && !bind_path(dir, dir, true, error)) || !bind_path(dir, dst, ro, error)) {
+            std::cerr << YELLOW << "[!] Cannot mount dependency cache " << c->name << ": " << error << RESET << "\n";
+            continue;
+        }
+        names.push_back(c->name);
+    }
+    if (!names.empty()) {
+        std::string list;
+        for (auto& n : names) list += (list.empty() ? "" : ", ") + n;
+        info("Dependency caches: " + list + (ro ? " (read-only)" : ""));
+    }
+}
+
+// ============================================
+// INIT STEPS
+// ============================================
+//
+// init.N commands run through /bin/sh when a workspace is entered. Each
+// step starts from the environment left by the steps it runs after; what
+// it sets or unsets is captured with `env -0` at the end of its script
+// and handed on to its dependents and to the workspace shell.
+//
+// A step with run: once is skipped while its command, its inputs and the
+// environment it starts from are unchanged, and its cached delta is used
+// instead. Without any init.N.after the steps keep their strictly
+// sequential order; with one, each step only waits for the steps it
+// names and the rest run concurrently.
+//
+// .ws/init/cache holds NUL-separated records: id, key, count, then count
+// delta entries ("K=V" sets K, a bare "K" unsets it).
+
+// Environment a shell inside the workspace starts with
+static std::vector<std::string> workspace_env(const Workspace& w) {
+    std::vector<std::string> env = {"WS_NAME=" + w.name, "WS_PATH=" + w.path, "WS_LANG=" + w.lang};
+    if (w.isolated) env.push_back("WS_ISOLATED=1");
+    for (auto& [k, v] : w.env_vars) env.push_back(k + "=" + v);
+    for (auto& kv : compiler_cache_env(w)) env.push_back(kv);
+    for (auto& kv : dep_cache_env(w)) env.push_back(kv);
+    env.push_back("PS1=(" + w.display_name + ") \\W $ ");
+    return env;
+}
+
+// Apply "K=V" entries; a bare "K" unsets K
+static void apply_env(const std::vector<std::string>& env) {
+    for (auto& kv : env) {
+        size_t eq = kv.find('=');
+        if (eq != std::string::npos) setenv(kv.substr(0, eq).c_str(), kv.c_str() + eq + 1, 1);
+        else unsetenv(kv.c_str());
+    }
+}
+
+static bool write_all(int fd, const std::string& s) {
+    size_t off = 0;
+    while (off < s.size()) {
+        ssize_t n = write(fd, s.data() + off, s.size() - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        off += n;
+    }
+    return true;
+}
+
+static std::string read_all(int fd) {
+    std::string out;
+    char buf[4096];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        out.append(buf, n);
+    }
+    return out;
+}
+
+static std::vector<std::string> split_nul(const std::string& s) {
+    std::vector<std::string> out;
+    size_t pos = 0, end;
+    while ((end = s.find('\0', pos)) != std::string::npos) {
+        out.push_back(s.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return out;
+}
+
+using EnvMap = std::map<std::string, std::string>;
+
+static EnvMap current_env() {
+    EnvMap env;
+    for (char** e = environ; *e; e++) {
+        const char* eq = strchr(*e, '=');
+        if (eq) env[std::string(*e, eq - *e)] = eq + 1;
+    }
+    return env;
+}
+
+static void apply_delta(EnvMap& env, const std::vector<std::string>& delta) {
+    for (auto& kv : delta) {
+        size_t eq = kv.find('=');
+        if (eq == std::string::npos) env.erase(kv);
+        else env[kv.substr(0, eq)] = kv.substr(eq + 1);
+    }
+}
+
+static std::vector<std::string> env_delta(const EnvMap& before, const EnvMap& after) {
+    static const std::set<std::string> ignored = {"PWD", "OLDPWD", "SHLVL", "_"};
+    std::vector<std::string> delta;
+    for (auto& [k, v] : after) {
+        if (ignored.count(k)) continue;
+        auto it = before.find(k);
+        if (it == before.end() || it->second != v) delta.push_back(k + "=" + v);
+    }
+    for (auto& [k, v] : before)
+        if (!ignored.count(k) && !after.count(k)) delta.push_back(k);
+    return delta;
+}
+
+struct InitRun {
+    std::vector<size_t> deps;
+    std::vector<size_t> dependents;
+    size_t waiting = 0;
+    std::string key;
+    std::vector<std::string> delta;
+    bool done = false;
+    bool ok = false;
+    bool cached = false;
+    EnvMap start_env;
+    std::string dump;
+};
+
+// Run the workspace's init steps and return the environment changes they
+// made, relative to the current environment
+static std::vector<std::string> run_init(const Workspace& w) {
+    const std::vector<InitStep>& steps = w.init_steps;
+    if (steps.empty()) return {};
+    
+    auto t0 = std::chrono::steady_clock::now();
+    std::string dir = w.path + "/.ws/init";
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    
+    std::map<std::string, size_t> by_id;
+    bool explicit_deps = false;
+    for (size_t i = 0; i < steps.size(); i++) {
+        by_id[steps[i].id] = i;
+        if (!steps[i].after.empty()) explicit_deps = true;
+    }
+    
+    std::vector<InitRun> runs(steps.size());
+    for (size_t i = 0; i < steps.size(); i++) {
+        if (!explicit_deps) {
+            if (i > 0) runs[i].deps.push_back(i - 1);
+        } else {
+            for (auto& id : steps[i].after) {
+                auto it = by_id.find(id);
+                if (it == by_id.end() || it->second == i) {
+                    std::cerr << YELLOW << "[!] init." << steps[i].id << ": unknown step in after: " << id
+                              << "\n" << RESET;
+                    continue;
+                }
+                runs[i].deps.push_back(it->second);
+            }
+        }
+    }
+    
+    // Topological order; on a cycle fall back to running everything in order
+    std::vector<size_t> order, pending(steps.size());
+    for (size_t i = 0; i < steps.size(); i++)
+        for (size_t d : runs[i].deps) runs[d].dependents.push_back(i);
+    for (size_t i = 0; i < steps.size(); i++) {
+        pending[i] = runs[i].deps.size();
+        if (pending[i] == 0) order.push_back(i);
+    }
+    for (size_t k = 0; k < order.size(); k++)
+        for (size_t d : runs[order[k]].dependents)
+            if (--pending[d] == 0) order.push_back(d);
+    if (order.size() != steps.size()) {
+        std::cerr << YELLOW << "[!] init steps depend on each other in a cycle, running them in order\n" << RESET;
+        order.clear();
+        for (size_t i = 0; i < steps.size(); i++) {
+            runs[i].deps.clear();
+            runs[i].dependents.clear();
+            if (i > 0) runs[i].deps.push_back(i - 1);
+            if (i + 1 < steps.size()) runs[i].dependents.push_back(i + 1);
+            order.push_back(i);
+        }
+    }
+    std::vector<size_t> rank(steps.size());
+    for (size_t k = 0; k < order.size(); k++) rank[order[k]] = k;
+    
+    // Cached keys and deltas from earlier entries
+    std::map<std::string, std::pair<std::string, std::vector<std::string>>> cache;
+    {
+        std::ifstream f(dir + "/cache", std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+        std::vector<std::string> fields = split_nul(data);
+        for (size_t i = 0; i + 2 < fields.size();) {
+            size_t n = std::strtoul(fields[i + 2].c_str(), nullptr, 10);
+            if (i + 3 + n > fields.size()) break;
+            cache[fields[i]] = {fields[i + 1],
+                                std::vector<std::string>(fields.begin() + i + 3, fields.begin() + i + 3 + n)};
+            i += 3 + n;
+        }
+    }
+    
+    EnvMap base = current_env();
+    
+    // Environment a step starts from: base plus the deltas of everything
+    // it (transitively) runs after, in dependency order
+    auto start_env = [&](size_t i) {
+        std::set<size_t> seen;
+        std::vector<size_t> stack(runs[i].deps.begin(), runs[i].deps.end());
+        while (!stack.empty()) {
+            size_t d = stack.back();
+            stack.pop_back();
+            if (!seen.insert(d).second) continue;
+            stack.insert(stack.end(), runs[d].deps.begin(), runs[d].deps.end());
+        }
+        std::vector<size_t> anc(seen.begin(), seen.end());
+        std::sort(anc.begin(), anc.end(), [&](size_t a, size_t b) { return rank[a] < rank[b]; });
+        EnvMap env = base;
+        for (size_t d : anc) apply_delta(env, runs[d].delta);
+        return env;
+    };
+    
+    size_t ran = 0, cached = 0, failed = 0;
+    std::vector<size_t> ready;
+    std::map<pid_t, size_t> running;
+    for (size_t i = 0; i < steps.size(); i++) {
+        runs[i].waiting = runs[i].deps.size();
+        if (runs[i].waiting == 0) ready.push_back(i);
+    }
+    unsigned jobs = std::max(4u, worker_count());    // steps are mostly waiting on I/O
+    
+    auto finish = [&](size_t i) {
+        runs[i].done = true;
+        for (size_t d : runs[i].dependents)
+            if (--runs[d].waiting == 0) ready.push_back(d);
+    };
+    
+    while (!ready.empty() || !running.empty()) {
+        while (running.size() < jobs && !ready.empty()) {
+            size_t i = ready.front();
+            ready.erase(ready.begin());
+            const InitStep& step = steps[i];
+            InitRun& r = runs[i];
+            r.start_env = start_env(i);
+            
+            if (step.once) {
+                Sha256 h;
+                h.update("wsinit 1\n" + step.cmd + "\n");
+                h.update(hash_paths(w.path, step.inputs, {".ws", ".git"}, dir + "/" + step.id + ".inputs"));
+                for (auto& kv : workspace_env(w)) h.update(kv + '\0');
+                for (auto& kv : env_delta(base, r.start_env)) h.update(kv + '\0');
+                r.key = h.hex();
+                
+                auto it = cache.find(step.id);
+                if (it != cache.end() && it->second.first == r.key) {
+                    r.delta = it->second.second;
+                    r.ok = r.cached = true;
+                    cached++;
+                    finish(i);
+                    continue;
+                }
+            }
+            
+            r.dump = dir + "/" + step.id + ".env";
+            int fd = open(r.dump.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+            if (fd == 3) {
+                // dup2 onto itself would keep close-on-exec
+                fd = fcntl(3, F_DUPFD_CLOEXEC, 4);
+                close(3);
+            }
+            
+            ProcSpec spec;
+            spec.argv = shell_argv(step.cmd + "\n__ws_rc=$?\nenv -0 >&3\nexit $__ws_rc\n");
+            spec.cwd = w.path;
+            std::vector<std::string> env;
+            for (auto& [k, v] : r.start_env) env.push_back(k + "=" + v);
+            spec.env = &env;
+            spec.fds.push_back({fd, 3});
+            pid_t pid = fd < 0 ? -1 : spawn_proc(spec);
+            if (fd >= 0) close(fd);
+            if (pid < 0) {
+                std::cerr << YELLOW << "[!] init." << step.id << ": could not start: " << strerror(errno)
+                          << "\n" << RESET;
+                failed++;
+                finish(i);
+                continue;
+            }
+            running[pid] = i;
+        }
+        if (running.empty()) break;
+        
+        int wstatus;
+        pid_t pid = waitpid(-1, &wstatus, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        auto it = running.find(pid);
+        if (it == running.end()) continue;
+        size_t i = it->second;
+        running.erase(it);
+        InitRun& r = runs[i];
+        ran++;
+        
+        if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0) {
+            std::ifstream f(r.dump, std::ios::binary);
+            std::string data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+            EnvMap after;
+            for (auto& kv : split_nul(data)) {
+                size_t eq = kv.find('=');
+                if (eq != std::string::npos) after[kv.substr(0, eq)] = kv.substr(eq + 1);
+            }
+            if (!after.empty()) r.delta = env_delta(r.start_env, after);
+            r.ok = true;
+        } else {
+            std::cerr << YELLOW << "[!] init." << steps[i].id << " failed: " << steps[i].cmd << "\n" << RESET;
+            failed++;
+        }
+        unlink(r.dump.c_str());
+        finish(i);
+    }
+    
+    // Remember successful run-once steps
+    std::string out;
+    for (size_t i = 0; i < steps.size(); i++) {
+        if (!steps[i].once || !runs[i].ok) continue;
+        out += steps[i].id + '\0' + runs[i].key + '\0' + std::to_string(runs[i].delta.size()) + '\0';
+        for (auto& kv : runs[i].delta) out += kv + '\0';
+    }
+    {
+        std::ofstream f(dir + "/cache.tmp", std::ios::binary | std::ios::trunc);
+        f << out;
+    }
+    rename((dir + "/cache.tmp").c_str(), (dir + "/cache").c_str());
+    
+    // Net effect of every step, applied in dependency order
+    EnvMap final_env = base;
+    for (size_t i : order) apply_delta(final_env, runs[i].delta);
+    
+    std::string summary = "Init: " + std::to_string(ran) + " ran, " + std::to_string(cached) + " cached";
+    if (failed) summary += ", " + std::to_string(failed) + " failed";
+    info(summary + " (" + fmt_secs(elapsed_s(t0)) + ")");
+    return env_delta(base, final_env);
+}
+
+// ============================================
+// RESOURCE CONTROL
+// ============================================
+//
+// Build, run, test and enter place their processes in a per-workspace
+// cgroup v2, <root>/dreamland/<name>, so a workspace's cpu.max,
+// cpu.weight, memory.max, memory.high and io.weight (from .ws/config)
+// apply to everything it starts. <root> is WS_CGROUP_ROOT when set,
+// otherwise the highest cgroup above ours that we may write to: the
+// whole hierarchy for root, the delegated user@UID.service subtree under
+// systemd. Without a usable cgroup2 mount everything runs as before.
+
+// Mount point of the cgroup2 hierarchy, or "" if there is none
+static std::string cgroup_mount() {
+    std::ifstream f("/proc/self/mountinfo");
+    std::string line;
+    while (std::getline(f, line)) {
+        // ... <mount point> <options> [optional fields] - <fstype> <source> ...
+        size_t dash = line.find(" - ");
+        if (dash == std::string::npos || line.compare(dash + 3, 8, "cgroup2 ") != 0) continue;
+        std::istringstream in(line);
+        std::string id, parent, dev, root, point;
+        in >> id >> parent >> dev >> root >> point;
+        return point;
+    }
+    return "";
+}
+
+// The directory dreamland's cgroups go under, created on first use.
+// Empty when cgroups can't be used.
+static std::string cgroup_root() {
+    static std::string root;
+    static bool resolved = false;
+    if (resolved) return root;
+    resolved = true;
+    
+    std::string base;
+    if (const char* env = getenv("WS_CGROUP_ROOT")) {
+        base = env;
+    } else {
+        std::string mnt = cgroup_mount();
+        if (mnt.empty()) return root;
+        std::ifstream f("/proc/self/cgroup");
+        std::string line, own;
+        while (std::getline(f, line))
+            if (line.compare(0, 3, "0::") == 0) own = line.substr(3);
+        if (own.empty()) return root;
+        
+        // Climb while we still own the parent: that is our delegation
+        std::string dir = mnt + (own == "/" ? "" : own);
+        while (dir.size() > mnt.size()) {
+            std::string up = fs::path(dir).parent_path();
+            struct stat st;
+            if (access(up.c_str(), W_OK) != 0 || stat(up.c_str(), &st) != 0 ||
+                (getuid() != 0 && st.st_uid != getuid()))
+                break;
+            dir = up;
+        }
+        if (access(dir.c_str(), W_OK) != 0) return root;
+        base = dir;
+    }
+    
+    std::string dir = base + "/dreamland";
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) return root;
+    
+    // Hand the controllers down: our root may need them enabled first.
+    // Each is tried on its own so a missing one doesn't block the rest.
+    for (const char* c : {"+cpu", "+memory", "+io"}) {
+        int fd = open((base + "/cgroup.subtree_control").c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd >= 0) { write(fd, c, strlen(c)); close(fd); }
+        fd = open((dir + "/cgroup.subtree_control").c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd >= 0) { write(fd, c, strlen(c)); close(fd); }
+    }
+    root = dir;
+    return root;
+}
+
+static bool write_file(const std::string& path, const std::string& value) {
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool good = write(fd, value.data(), value.size()) == (ssize_t)value.size();
+    close(fd);
+    return good;
+}
+
+static std::string workspace_cgroup_path(const std::string& name) {
+    std::string root = cgroup_root();
+    return root.empty() ? "" : root + "/" + name;
+}
+
+// Move the calling process into the workspace's cgroup, creating it and
+// applying its limits. Children started afterwards inherit it.
+static bool enter_cgroup(const Workspace& w) {
+    std::string cg = workspace_cgroup_path(w.name);
+    if (cg.empty()) {
+        if (!w.limits.empty())
+            std::cerr << YELLOW << "[!] No writable cgroup v2 hierarchy, resource limits not applied" << RESET << "\n";
+        return false;
+    }
+    if (mkdir(cg.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    
+    for (auto& [key, def] : CGROUP_LIMITS) {
+        auto it = w.limits.find(key);
+        std::string value = it != w.limits.end() ? it->second : def;
+        if (!write_file(cg + "/" + key, value) && it != w.limits.end())
+            std::cerr << YELLOW << "[!] Cannot set " << key << "=" << value << ": "
+                      << (errno == ENOENT ? "controller not available" : strerror(errno)) << RESET << "\n";
+    }
+    return write_file(cg + "/cgroup.procs", "0");
+}
+
+// Join an existing workspace cgroup without touching its limits
+static bool join_cgroup(const std::string& name) {
+    std::string cg = workspace_cgroup_path(name);
+    return !cg.empty() && write_file(cg + "/cgroup.procs", "0");
+}
+
+// "cpu 1.2%  memory 0.0%  io 3.4%": share of the last 10s in which some
+// task of the cgroup was stalled on each resource
+static std::string cgroup_pressure(const std::string& cg) {
+    std::string out;
+    for (const char* res : {"cpu", "memory", "io"}) {
+        std::ifstream f(cg + "/" + res + ".pressure");
+        std::string kind, avg10;
+        if (!(f >> kind >> avg10) || kind != "some" || avg10.compare(0, 6, "avg10=") != 0) continue;
+        out += (out.empty() ? "" : "  ") + std::string(res) + " " + avg10.substr(6) + "%";
+    }
+    return out;
+}
+
+// ============================================
+// BUILD TMPFS
+// ============================================
+//
+// With build_tmpfs set, an isolated workspace gets build/ (or the
+// tmpfs_path.N list) on a tmpfs of tmpfs_size inside its mount namespace.
+// The on-disk directory is first bind-mounted to a private spot under the
+// namespace's /tmp, then the tmpfs goes on top and is seeded from it.
+// When the session ends the tmpfs is synced back to disk: everything, or
+// only the tmpfs_keep.N paths when some are listed.
+
+struct TmpfsMount {
+    std::string rel;        // relative to the workspace root
+    std::string disk;       // the on-disk directory, bind-mounted aside
+};
+
+static std::vector<std::string> tmpfs_paths(const Workspace& w) {
+    return w.tmpfs_paths.empty() ? std::vector<std::string>{"build"} : w.tmpfs_paths;
+}
+
+// Mount the tmpfs paths. Must run inside a private mount namespace, after
+// /tmp got its own tmpfs.
+static std::vector<TmpfsMount> mount_build_tmpfs(const Workspace& w) {
+    std::vector<TmpfsMount> mounts;
+    std::string opts = "size=" + w.tmpfs_size + ",mode=755";
+    auto start = std::chrono::steady_clock::now();
+    CopyStats stats;
+    
+    if (w.tmpfs_size.empty() || w.tmpfs_size.find_first_not_of("0123456789kKmMgG%") != std::string::npos) {
+        std::cerr << YELLOW << "[!] Bad tmpfs_size: " << w.tmpfs_size << RESET << "\n";
+        return mounts;
+    }
+    
+    for (auto& rel : tmpfs_paths(w)) {
+        if (rel.empty() || rel[0] == '/' || rel == ".." || rel.find("../") != std::string::npos) {
+            std::cerr << YELLOW << "[!] tmpfs_path must stay inside the workspace: " << rel << RESET << "\n";
+            continue;
+        }
+        std::string target = w.path + "/" + rel;
+        std::string disk = "/tmp/.ws-disk/" + std::to_string(mounts.size());
+        std::error_code ec;
+        fs::create_directories(target, ec);
+        fs::create_directories(disk, ec);
+        
+        if (mount(target.c_str(), disk.c_str(), nullptr, MS_BIND, nullptr) != 0) {
+            std::cerr << YELLOW << "[!] Cannot keep " << rel << " on disk: " << strerror(errno) << RESET << "\n";
+            continue;
+        }
+        if (mount("tmpfs", target.c_str(), "tmpfs", MS_NOSUID | MS_NODEV, opts.c_str()) != 0) {
+            std::cerr << YELLOW << "[!] Cannot mount tmpfs on " << rel << ": " << strerror(errno) << RESET << "\n";
+            umount2(disk.c_str(), MNT_DETACH);
+            continue;
+        }
+        std::string error;
+        if (!sync_tree(disk, target, &error, &stats)) {
+            std::cerr << YELLOW << "[!] Seeding " << rel << " failed, leaving it on disk: " << error << RESET << "\n";
+            umount2(target.c_str(), MNT_DETACH);
+            umount2(disk.c_str(), MNT_DETACH);
+            continue;
+        }
+        mounts.push_back({rel, disk});
+    }
+    
+    if (!mounts.empty()) {
+        std::string list;
+        for (auto& m : mounts) list += (list.empty() ? "" : ", ") + m.rel;
+        info("In memory: " + list + " (" + fmt_mb(stats.bytes) + " loaded in " + fmt_secs(elapsed_s(start)) + ")");
+    }
+    return mounts;
+}
+
+// Copy one path (file, directory or symlink) from the tmpfs back to disk
+static bool write_back_path(const std::string& src, const std::string& dst, CopyStats& stats, std::string& error) {
+    struct stat st;
+    std::error_code ec;
+    if (lstat(src.c_str(), &st) != 0) {
+        // Gone from the tmpfs: gone from disk too
+        fs::remove_all(dst, ec);
+        return true;
+    }
+    if (S_ISDIR(st.st_mode)) return sync_tree(src, dst, &error, &stats);
+    
+    fs::create_directories(fs::path(dst).parent_path(), ec);
+    fs::remove_all(dst, ec);
+    fs::copy(src, dst, fs::copy_options::copy_symlinks, ec);
+    if (ec) { error = dst + ": " + ec.message(); return false; }
+    if (S_ISREG(st.st_mode)) {
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        utimensat(AT_FDCWD, dst.c_str(), times, 0);
+        stats.files++;
+        stats.bytes += st.st_size;
+    }
+    return true;
+}
+
+// Sync the tmpfs paths back to disk
+static void write_back_tmpfs(const Workspace& w, const std::vector<TmpfsMount>& mounts) {
+    if (mounts.empty()) return;
+    auto start = std::chrono::steady_clock::now();
+    CopyStats stats;
+    size_t failed = 0;
+    
+    for (auto& m : mounts) {
+        std::vector<std::string> keep;
+        for (auto& k : w.tmpfs_keep)
+            if (path_under(k, m.rel)) keep.push_back(k);
+        if (w.tmpfs_keep.empty()) keep.push_back(m.rel);
+        
+        for (auto& k : keep) {
+            std::string error;
+            std::string sub = k.substr(m.rel.size());
+            if (!write_back_path(w.path + "/" + k, m.disk + sub, stats, error)) {
+                err("Write-back of " + k + " failed: " + error);
+                failed++;
+            }
+        }
+    }
+    if (!failed)
+        info("Wrote back " + std::to_string(stats.files.load()) + " files (" + fmt_mb(stats.bytes) + ") in " +
+             fmt_secs(elapsed_s(start)));
+}
+
+// ============================================
+// SNAPSHOTS
+// ============================================
+//
+// Once ws-snapshot has been used on an isolated workspace, sessions see
+// its directory through an overlayfs: the workspace directory is the
+// bottom layer, each snapshot adds a frozen layer, and the session
+// writes into `upper`. Layers live outside the tree, in
+// ~/.local/share/dreamland/layers/<name>/:
+//
+//   snapshots    "<id> <epoch> <layer|-> <label>" per line, oldest first
+//   L<id>/       layer frozen by snapshot <id>
+//   upper/       changes since the last snapshot
+//   work/        overlayfs scratch
+//   lock         sessions hold it shared; snapshot/rollback take it exclusive
+//
+// A snapshot renames upper/ to L<id>/ and starts an empty one; a rollback
+// deletes the layers above the target. When there are more than
+// snapshot_depth layers the oldest is folded into the workspace directory
+// itself (its layer becomes "-"), which keeps the overlay shallow
+// without losing any restore point but the ones beneath it.
+
+struct Snapshot {
+    uint64_t id = 0;
+    int64_t when = 0;
+    std::string layer;      // "-" once folded into the workspace directory
+    std::string label;
+};
+
+static std::string layers_dir(const Workspace& w) {
+    return home_dir() + "/.local/share/dreamland/layers/" + w.name;
+}
+
+static bool snapshots_enabled(const Workspace& w) {
+    return fs::exists(layers_dir(w) + "/snapshots");
+}
+
+static std::vector<Snapshot> load_snapshots(const Workspace& w) {
+    std::vector<Snapshot> snaps;
+    std::string buf;
+    read_whole(layers_dir(w) + "/snapshots", buf);
+    std::istringstream in(buf);
+    std::string line;
+    while (std::getline(in, line)) {
+        Snapshot s;
+        std::istringstream ls(line);
+        if (!(ls >> s.id >> s.when >> s.layer)) continue;
+        std::getline(ls >> std::ws, s.label);
+        snaps.push_back(s);
+    }
+    return snaps;
+}
+
+static bool save_snapshots(const Workspace& w, const std::vector<Snapshot>& snaps) {
+    std::string buf;
+    for (auto& s : snaps)
+        buf += std::to_string(s.id) + " " + std::to_string(s.when) + " " + s.layer + " " + s.label + "\n";
+    return write_atomic(layers_dir(w) + "/snapshots", buf);
+}
+
+// Lock the layer stack. Sessions take it shared and leave it open across
+// exec so it is held for as long as the shell (or anything it started)
+// lives; snapshot and rollback need it exclusively.
+static int lock_layers(const Workspace& w, bool shared) {
+    std::string path = layers_dir(w) + "/lock";
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | (shared ? 0 : O_CLOEXEC), 0644);
+    if (fd < 0) return -1;
+    while (flock(fd, shared ? LOCK_SH : LOCK_EX | LOCK_NB) != 0) {
+        if (errno != EINTR) { close(fd); return -1; }
+    }
+    return fd;
+}
+
+// Mount the layer stack over the workspace directory. Must run inside a
+// private mount namespace.
+static bool mount_layers(const Workspace& w) {
+    std::string dir = layers_dir(w);
+    std::string lower;
+    auto snaps = load_snapshots(w);
+    for (auto it = snaps.rbegin(); it != snaps.rend(); ++it)
+        if (it->layer != "-") lower += dir + "/" + it->layer + ":";
+    lower += w.path;
+    
+    std::error_code ec;
+    fs::create_directories(dir + "/upper", ec);
+    fs::create_directories(dir + "/work", ec);
+    
+    // Keep every layer self-contained so one can be folded or dropped on its own
+    std::string opts = "lowerdir=" + lower + ",upperdir=" + dir + "/upper,workdir=" + dir + "/work";
+    if (mount("overlay", w.path.c_str(), "overlay", 0, (opts + ",redirect_dir=off,index=off,metacopy=off").c_str()) == 0 ||
+        mount("overlay", w.path.c_str(), "overlay", 0, opts.c_str()) == 0)
+        return true;
+    std::cerr << YELLOW << "[!] Cannot mount snapshot layers: " << strerror(errno)
+              << " (changes go straight to disk)" << RESET << "\n";
+    return false;
+}
+
+static bool is_whiteout(const struct stat& st) {
+    return S_ISCHR(st.st_mode) && st.st_rdev == makedev(0, 0);
+}
+
+static bool is_opaque(const std::string& path) {
+    char v = 0;
+    return getxattr(path.c_str(), "trusted.overlay.opaque", &v, 1) == 1 && v == 'y';
+}
+
+// Move src over dst, copying when they are on different filesystems
+static bool move_entry(const std::string& src, const std::string& dst, std::string& error) {
+    std::error_code ec;
+    struct stat st;
+    if (lstat(dst.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) fs::remove_all(dst, ec);
+    if (rename(src.c_str(), dst.c_str()) == 0) return true;
+    if (errno != EXDEV) { error = dst + ": " + strerror(errno); return false; }
+    
+    if (lstat(src.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        if (!sync_tree(src, dst, &error)) return false;
+    } else {
+        fs::remove(dst, ec);
+        fs::copy(src, dst, fs::copy_options::copy_symlinks, ec);
+        if (ec) { error = dst + ": " + ec.message(); return false; }
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        utimensat(AT_FDCWD, dst.c_str(), times, AT_SYMLINK_NOFOLLOW);
+    }
+    return true;
+}
+
+// Apply an overlayfs layer to the directory beneath it: whiteouts delete,
+// opaque or replaced directories swap in whole, everything else moves
+// over what was there
+static bool fold_layer(const std::string& layer, const std::string& base, std::string& error) {
+    std::error_code ec;
+    for (auto& entry : fs::directory_iterator(layer, ec)) {
+        std::string name = entry.path().filename();
+        std::string src = layer + "/" + name, dst = base + "/" + name;
+        struct stat st, dst_st;
+        if (lstat(src.c_str(), &st) != 0) continue;
+        bool have = lstat(dst.c_str(), &dst_st) == 0;
+        
+        if (is_whiteout(st)) {
+            fs::remove_all(dst, ec);
+        } else if (S_ISDIR(st.st_mode) && have && S_ISDIR(dst_st.st_mode) && !is_opaque(src)) {
+            if (!fold_layer(src, dst, error)) return false;
+            chmod(dst.c_str(), st.st_mode & 07777);
+        } else {
+            if (have) fs::remove_all(dst, ec);
+            if (S_ISDIR(st.st_mode)) removexattr(src.c_str(), "trusted.overlay.opaque");
+            if (!move_entry(src, dst, error)) return false;
+        }
+    }
+    if (ec) { error = layer + ": " + ec.message(); return false; }
+    return true;
+}
+
+static uint64_t tree_bytes(const std::string& dir, uint64_t* files = nullptr) {
+    uint64_t bytes = 0;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(dir, ec); it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (ec) break;
+        struct stat st;
+        if (lstat(it->path().c_str(), &st) != 0 || S_ISDIR(st.st_mode)) continue;
+        bytes += st.st_size;
+        if (files) (*files)++;
+    }
+    return bytes;
+}
+
+// ============================================
+// WORKSPACE AGENT
+// ============================================
+//
+// ws-agent keeps recently entered workspaces warm. For an isolated
+// workspace a parked "holder" process owns a prepared mount namespace in
+// which the init commands already ran; the environment is resolved up
+// front for every workspace. While the agent runs, ws-enter asks it over
+// a unix socket and only has to setns() into the namespace and exec the
+// shell. Entries unused for --idle seconds, or beyond --max entries, are
+// evicted; an entry is re-prepared when its .ws/config changes. A holder
+// is only stopped once no shell is left in its namespace, and attached
+// shells hold the layers and dependency cache locks themselves.
+//
+// Protocol: one request line ("ENTER <name>", "EVICT <name>", "STATUS",
+// "STOP"), answered with NUL-separated fields and then EOF.
+
+static std::string agent_socket() {
+    return home_dir() + "/.cache/dreamland/agent.sock";
+}
+
+struct WarmEntry {
+    Workspace w;
+    int64_t cfg_mtime = 0;
+    pid_t holder = 0;                // owns the namespace, 0 if not isolated
+    bool tmpfs = false;              // holder keeps build_tmpfs paths to write back
+    std::vector<std::string> env;
+    std::chrono::steady_clock::time_point last_used;
+    double prepare_secs = 0;
+    uint64_t attaches = 0;
+};
+
+static int64_t config_mtime(const Workspace& w) {
+    struct stat st;
+    return stat((w.path + "/.ws/config").c_str(), &st) == 0 ? mtime_ns(st) : 0;
+}
+
+// Run the init commands once and, for isolated workspaces, leave a holder
+// process parked inside the new mount namespace
+static bool warm_entry(WarmEntry& e, std::string& error) {
+    auto start = std::chrono::steady_clock::now();
+    e.env = workspace_env(e.w);
+    e.cfg_mtime = config_mtime(e.w);
+    e.holder = 0;
+    
+    int pfd[2];
+    if (pipe2(pfd, O_CLOEXEC) != 0) { error = strerror(errno); return false; }
+    
+    // With build_tmpfs the holder writes back on SIGTERM, so that is
+    // also what it gets if the agent dies
+    bool tmpfs = e.w.isolated && e.w.build_tmpfs;
+    sigset_t term;
+    sigemptyset(&term);
+    sigaddset(&term, SIGTERM);
+    
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(pfd[0]);
+        if (tmpfs) sigprocmask(SIG_BLOCK, &term, nullptr);
+        prctl(PR_SET_PDEATHSIG, tmpfs ? SIGTERM : SIGKILL);
+        
+        // Don't hold the agent's sockets open for as long as we're parked
+        long max_fd = std::min(sysconf(_SC_OPEN_MAX), 65536L);
+        for (int fd = 3; fd < max_fd; fd++)
+            if (fd != pfd[1]) close(fd);
+        
+        enter_cgroup(e.w);
+        char ready = 'n';
+        std::vector<TmpfsMount> mounts;
+        if (e.w.isolated && unshare(CLONE_NEWNS) == 0) {
+            mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL);
+            mount("tmpfs", "/tmp", "tmpfs", 0, "size=256M");
+            if (snapshots_enabled(e.w) && lock_layers(e.w, true) >= 0) mount_layers(e.w);
+            if (tmpfs) mounts = mount_build_tmpfs(e.w);
+            lock_dep_caches(e.w);
+            mount_shared(e.w);
+            ready = 'y';
+        }
+        chdir(e.w.path.c_str());
+        apply_env(e.env);
+        
+        // Report readiness followed by the init steps' environment delta
+        std::string msg(1, ready);
+        for (auto& kv : run_init(e.w)) msg += kv + '\0';
+        write_all(pfd[1], msg);
+        close(pfd[1]);
+        if (ready != 'y') _exit(0);
+        if (mounts.empty()) while (true) pause();
+        
+        int sig;
+        sigwait(&term, &sig);
+        write_back_tmpfs(e.w, mounts);
+        std::cout.flush();
+        _exit(0);
+    }
+    close(pfd[1]);
+    if (pid < 0) { close(pfd[0]); error = strerror(errno); return false; }
+    
+    std::string msg = read_all(pfd[0]);
+    close(pfd[0]);
+    if (msg.empty()) {
+        waitpid(pid, nullptr, 0);
+        error = "init commands did not finish";
+        return false;
+    }
+    std::vector<std::string> delta = split_nul(msg.substr(1));
+    e.env.insert(e.env.end(), delta.begin(), delta.end());
+    
+    char ready = msg[0];
+    if (ready == 'y') e.holder = pid;
+    else waitpid(pid, nullptr, 0);
+    e.tmpfs = ready == 'y' && tmpfs;
+    
+    e.prepare_secs = elapsed_s(start);
+    return true;
+}
+
+// True while any process besides the holder is inside its namespace
+static bool namespace_in_use(pid_t holder) {
+    char link[64], ns[64], other[64];
+    snprintf(link, sizeof(link), "/proc/%d/ns/mnt", holder);
+    ssize_t n = readlink(link, ns, sizeof(ns));
+    if (n <= 0) return false;
+    
+    DIR* d = opendir("/proc");
+    if (!d) return false;
+    bool used = false;
+    while (dirent* de = readdir(d)) {
+        pid_t pid = std::atoi(de->d_name);
+        if (pid <= 0 || pid == holder) continue;
+        snprintf(link, sizeof(link), "/proc/%d/ns/mnt", pid);
+        ssize_t m = readlink(link, other, sizeof(other));
+        if (m == n && memcmp(ns, other, n) == 0) { used = true; break; }
+    }
+    closedir(d);
+    return used;
+}
+
+// Stop an entry's holder. One whose namespace still has shells in it is
+// left running (false) unless forced, so the tmpfs and layers under them
+// stay in place.
+static bool evict_entry(WarmEntry& e, bool force = false) {
+    if (e.holder > 0) {
+        if (!force && namespace_in_use(e.holder)) return false;
+        // A tmpfs holder writes back before exiting
+        kill(e.holder, e.tmpfs ? SIGTERM : SIGKILL);
+        waitpid(e.holder, nullptr, 0);
+        e.holder = 0;
+    }
+    return true;
+}
+
+static int agent_connect() {
+    std::string path = agent_socket();
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) return -1;
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) { close(fd); return -1; }
+    return fd;
+}
+
+// Send one request and return the reply fields, or false if no agent
+static bool agent_request(const std::string& req, std::vector<std::string>& reply) {
+    int fd = agent_connect();
+    if (fd < 0) return false;
+    bool sent = write_all(fd, req + "\n");
+    shutdown(fd, SHUT_WR);
+    std::string data = sent ? read_all(fd) : "";
+    close(fd);
+    reply = split_nul(data);
+    return sent && !reply.empty();
+}
+
+static void agent_serve(int lfd, int idle_secs, size_t max_entries) {
+    std::map<std::string, WarmEntry> entries;
+    std::vector<WarmEntry> retired;         // evicted while shells were still inside
+    signal(SIGPIPE, SIG_IGN);
+    
+    // Drop an entry; its holder lingers in `retired` until the last shell leaves
+    auto drop = [&](std::map<std::string, WarmEntry>::iterator it) {
+        bool gone = evict_entry(it->second);
+        if (!gone) retired.push_back(std::move(it->second));
+        entries.erase(it);
+        return gone;
+    };
+    
+    while (true) {
+        pollfd p{lfd, POLLIN, 0};
+        int r = poll(&p, 1, 1000);
+        
+        for (auto it = retired.begin(); it != retired.end();)
+            it = evict_entry(*it) ? retired.erase(it) : it + 1;
+        
+        // Drop entries whose holder died and entries idle for too long
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = entries.begin(); it != entries.end();) {
+            WarmEntry& e = it->second;
+            bool dead = e.holder > 0 && waitpid(e.holder, nullptr, WNOHANG) == e.holder;
+            if (dead) e.holder = 0;
+            bool idle = now - e.last_used > std::chrono::seconds(idle_secs);
+            // A namespace stays while a shell still uses it
+            if (idle && namespace_in_use(e.holder)) idle = false;
+            if (dead || idle) {
+                std::cout << "evict " << it->first << (dead ? " (holder exited)" : " (idle)") << std::endl;
+                drop(it++);
+            } else {
+                ++it;
+            }
+        }
+        if (r <= 0) continue;
+        
+        int c = accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (c < 0) continue;
+        
+        ucred cred{};
+        socklen_t len = sizeof(cred);
+        if (getsockopt(c, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || cred.uid != getuid()) {
+            close(c);
+            continue;
+        }
+        timeval tv{2, 0};
+        setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        
+        std::string req = read_all(c);
+        while (!req.empty() && (req.back() == '\n' || req.back() == '\r')) req.pop_back();
+        std::string reply;
+        
+        if (req == "STOP") {
+            write_all(c, std::string("OK") + '\0');
+            close(c);
+            break;
+        } else if (req == "STATUS") {
+            reply = std::string("OK") + '\0';
+            for (auto& [name, e] : entries) {
+                long idle = std::chrono::duration_cast<std::chrono::seconds>(now - e.last_used).count();
+                reply += name + '\0' + std::to_string(e.holder) + '\0' + std::to_string(idle) + '\0' +
+                         std::to_string(e.attaches) + '\0' + fmt_secs(e.prepare_secs) + '\0';
+            }
+        } else if (req.compare(0, 6, "EVICT ") == 0) {
+            std::string name = req.substr(6);
+            bool gone = true;
+            auto it = entries.find(name);
+            if (it != entries.end()) {
+                std::cout << "evict " << it->first << " (requested)" << std::endl;
+                gone = drop(it);
+            }
+            for (auto& e : retired)
+                if (e.w.name == name) gone = false;
+            reply = gone ? std::string("OK") + '\0'
+                         : std::string("ERR") + '\0' + "Shells entered through ws-agent are still open" + '\0';
+        } else if (req.compare(0, 6, "ENTER ") == 0) {
+            std::string name = req.substr(6);
+            Workspace w;
+            auto it = entries.find(name);
+            
+            if (it != entries.end() && config_mtime(it->second.w) != it->second.cfg_mtime) {
+                drop(it);
+                it = entries.end();
+            }
+            
+            std::string state = "warm";
+            std::string error;
+            if (it == entries.end()) {
+                state = "cold";
+                if (!open_ws(name, w)) error = "Workspace not found: " + name;
+                else if (!fs::exists(w.path)) error = "Path missing: " + w.path;
+                else if (!hydrate(w)) error = "Cannot hydrate " + name;
+                
+                // Make room by evicting the least recently used entry
+                while (error.empty() && !entries.empty() && entries.size() >= max_entries) {
+                    auto lru = entries.begin();
+                    for (auto e = entries.begin(); e != entries.end(); ++e)
+                        if (e->second.last_used < lru->second.last_used) lru = e;
+                    std::cout << "evict " << lru->first << " (full)" << std::endl;
+                    drop(lru);
+                }
+                
+                if (error.empty()) {
+                    WarmEntry e;
+                    e.w = w;
+                    if (warm_entry(e, error)) {
+                        std::cout << "prepared " << name << " in " << fmt_secs(e.prepare_secs) << std::endl;
+                        it = entries.emplace(name, std::move(e)).first;
+                    }
+                }
+            }
+            
+            if (it == entries.end()) {
+                reply = std::string("ERR") + '\0' + error + '\0';
+            } else {
+                WarmEntry& e = it->second;
+                e.last_used = std::chrono::steady_clock::now();
+                e.attaches++;
+                reply = std::string("OK") + '\0' + std::to_string(e.holder) + '\0' + e.w.path + '\0' +
+                        (e.w.isolated ? "1" : "0") + '\0' + e.w.display_name + '\0' + state + '\0';
+                for (auto& kv : e.env) reply += kv + '\0';
+            }
+        } else {
+            reply = std::string("ERR") + '\0' + "Unknown request" + '\0';
+        }
+        
+        write_all(c, reply);
+        close(c);
+    }
+    
+    for (auto& [name, e] : entries) evict_entry(e, true);
+    for (auto& e : retired) evict_entry(e, true);
+}
+
+// Enter a workspace through the agent. Returns -1 when no agent is
+// running so the caller can prepare the workspace itself.
+static int agent_enter(const std::string& name) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> reply;
+    if (!agent_request("ENTER " + name, reply)) return -1;
+    if (reply[0] != "OK" || reply.size() < 6) {
+        err(reply.size() > 1 ? reply[1] : "Agent error");
+        return 1;
+    }
+    
+    pid_t holder = std::atoi(reply[1].c_str());
+    std::string path = reply[2];
+    bool isolated = reply[3] == "1";
+    std::string display_name = reply[4];
+    std::vector<std::string> env(reply.begin() + 6, reply.end());
+    
+    status("Entering workspace: " + display_name + " (" + reply[5] + ")");
+    
+    auto attach = [&]() {
+        Workspace w;
+        bool have_ws = open_ws(name, w);
+        if (holder > 0) {
+            int ns = open(("/proc/" + std::to_string(holder) + "/ns/mnt").c_str(), O_RDONLY | O_CLOEXEC);
+            bool joined = ns >= 0 && setns(ns, CLONE_NEWNS) == 0;
+            if (!joined)
+                std::cerr << YELLOW << "[!] Could not join the prepared namespace, entering normally\n" << RESET;
+            if (ns >= 0) close(ns);
+            // Like a directly entered session, the shell holds the layer
+            // stack itself (open across exec), so snapshot and rollback
+            // wait for it and not just for the holder
+            if (joined && have_ws && snapshots_enabled(w)) lock_layers(w, true);
+        } else if (isolated) {
+            std::cerr << YELLOW << "[!] Isolation requires privileges, entering normally\n" << RESET;
+        }
+        // ...and the dependency caches, which ws-deps clean must not pull away
+        if (have_ws) lock_dep_caches(w);
+        // The holder already set the cgroup up with the workspace's limits
+        join_cgroup(name);
+        chdir(path.c_str());
+        apply_env(env);
+        
+        const char* shell = getenv("SHELL");
+        if (!shell) shell = "/bin/sh";
+        
+        char ms[32];
+        snprintf(ms, sizeof(ms), "%.1f ms", elapsed_s(start) * 1000);
+        ok(std::string("Workspace ready in ") + ms + ". Type 'exit' to leave.");
+        std::cout.flush();
+        execlp(shell, shell, nullptr);
+    };
+    
+    if (!isolated) {
+        attach();
+        return 127;
+    }
+    
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        attach();
+        _exit(127);
+    } else if (pid < 0) {
+        err("Fork failed");
+        return 1;
+    }
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    ok("Left workspace: " + name);
+    return WEXITSTATUS(wstatus);
+}
+
+// ============================================
+// PERFORMANCE HISTORY
+// ============================================
+//
+// Every build, run and test appends one line to .ws/perf.log:
+//
+//   <epoch> <kind> <exit> <wall> <user> <sys> <max_rss_kb> <in_blocks> <out_blocks>
+//
+// A run regresses when its wall time or peak RSS exceeds the median of
+// the previous successful runs of the same kind by more than
+// perf_threshold percent (default 20).
+
+static const size_t PERF_KEEP = 1000;       // records kept after trimming
+static const size_t PERF_BASELINE = 10;     // runs the baseline is taken over
+
+struct PerfRecord {
+    int64_t when = 0;
+    std::string kind;
+    int exit_code = 0;
+    double wall = 0, user = 0, sys = 0;
+    long rss_kb = 0, in_blocks = 0, out_blocks = 0;
+};
+
+static std::vector<PerfRecord> load_perf(const Workspace& w) {
+    std::vector<PerfRecord> records;
+    std::string buf;
+    if (!read_whole(w.path + "/.ws/perf.log", buf)) return records;
+    std::istringstream in(buf);
+    std::string line;
+    while (std::getline(in, line)) {
+        PerfRecord r;
+        std::istringstream ls(line);
+        if (ls >> r.when >> r.kind >> r.exit_code >> r.wall >> r.user >> r.sys >> r.rss_kb >> r.in_blocks >> r.out_blocks)
+            records.push_back(r);
+    }
+    return records;
+}
+
+static double median(std::vector<double> v) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+// Median wall time and RSS of up to PERF_BASELINE successful runs of
+// `kind` before records[end]. False if there are none.
+static bool perf_baseline(const std::vector<PerfRecord>& records, size_t end, const std::string& kind,
+                          double& wall, double& rss_kb) {
+    std::vector<double> walls, rss;
+    for (size_t i = end; i-- > 0 && walls.size() < PERF_BASELINE;) {
+        if (records[i].kind != kind || records[i].exit_code != 0) continue;
+        walls.push_back(records[i].wall);
+        rss.push_back(records[i].rss_kb);
+    }
+    if (walls.empty()) return false;
+    wall = median(walls);
+    rss_kb = median(rss);
+    return true;
+}
+
+// Describe how records[i] regresses against its baseline, or "" if it doesn't
+static std::string perf_regression(const std::vector<PerfRecord>& records, size_t i, double threshold) {
+    const PerfRecord& r = records[i];
+    double wall, rss;
+    if (r.exit_code != 0 || !perf_baseline(records, i, r.kind, wall, rss)) return "";
+    std::string what;
+    char buf[64];
+    // Ignore sub-50ms jitter on commands that are fast anyway
+    if (r.wall > wall * (1 + threshold / 100) && r.wall - wall > 0.05) {
+        snprintf(buf, sizeof(buf), "wall +%.0f%%", (r.wall / wall - 1) * 100);
+        what = buf;
+    }
+    if (rss > 0 && r.rss_kb > rss * (1 + threshold / 100)) {
+        snprintf(buf, sizeof(buf), "rss +%.0f%%", (r.rss_kb / rss - 1) * 100);
+        what += (what.empty() ? "" : ", ") + std::string(buf);
+    }
+    return what;
+}
+
+// Append a finished command's usage to the history and warn if it regressed
+static void perf_record(const Workspace& w, const std::string& kind, const ProcResult& usage) {
+    if (!usage.started) return;
+    std::string path = w.path + "/.ws/perf.log";
+    int lfd = lock_file(w.path + "/.ws/perf.lock");
+    if (lfd < 0) return;
+    
+    char line[256];
+    snprintf(line, sizeof(line), "%lld %s %d %.3f %.3f %.3f %ld %ld %ld\n",
+             (long long)time(nullptr), kind.c_str(), usage.exit_code, usage.wall_secs,
+             usage.user_secs, usage.sys_secs, usage.max_rss_kb, usage.in_blocks, usage.out_blocks);
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        write_all(fd, line);
+        close(fd);
+    }
+    
+    auto records = load_perf(w);
+    if (records.size() > 2 * PERF_KEEP) {
+        std::string keep;
+        for (size_t i = records.size() - PERF_KEEP; i < records.size(); i++) {
+            auto& r = records[i];
+            snprintf(line, sizeof(line), "%lld %s %d %.3f %.3f %.3f %ld %ld %ld\n", (long long)r.when,
+                     r.kind.c_str(), r.exit_code, r.wall, r.user, r.sys, r.rss_kb, r.in_blocks, r.out_blocks);
+            keep += line;
+        }
+        write_atomic(path, keep);
+    }
+    close(lfd);
+    
+    if (!records.empty()) {
+        std::string what = perf_regression(records, records.size() - 1, w.perf_threshold);
+        if (!what.empty())
+            std::cerr << YELLOW << "[!] " << kind << " regressed: " << what
+                      << " against recent runs (ws-perf " << w.name << ")" << RESET << "\n";
+    }
+}
+
+// Unicode sparkline of a series
+static std::string sparkline(const std::vector<double>& v) {
+    static const char* bars[] = {"▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"};
+    if (v.empty()) return "";
+    double lo = *std::min_element(v.begin(), v.end()), hi = *std::max_element(v.begin(), v.end());
+    std::string out;
+    for (double x : v) out += bars[hi > lo ? (int)((x - lo) / (hi - lo) * 7 + 0.5) : 0];
+    return out;
+}
+
+// ============================================
+// COMMANDS
+// ============================================
+
+static int cmd_create(int argc, char** argv) {
+    if (argc < 2) {
+        std::cout << "Usage: ws-create <name> [options]\n\n";
+        std::cout << "Options:\n";
+        std::cout << "  --path <dir>         Custom path\n";
+        std::cout << "  --lang <lang>        Language (c, cpp, rust, python, go, node)\n";
+        std::cout << "  --isolated           Enable namespace isolation\n";
+        std::cout << "  --description <text> Workspace description\n";
+        std::cout << "  --author <name>      Author name\n";
+        std::cout << "  --build <cmd>        Custom build command\n";
+        std::cout << "  --run <cmd>          Custom run command\n";
+        std::cout << "  --env KEY=VALUE      Set environment variable\n";
+        std::cout << "  --tag <tag>          Tag the workspace (repeatable)\n";
+        return 1;
+    }
+    
+    std::string name = argv[1];
+    std::string path = ws_base() + "/" + name;
+    std::string lang = "generic";
+    std::string desc, author, build_cmd, run_cmd;
+    bool isolated = false;
+    std::map<std::string, std::string> env_vars;
+    std::vector<std::string> tags;
+    
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--path" && i + 1 < argc) path = argv[++i];
+        else if (arg == "--lang" && i + 1 < argc) lang = argv[++i];
         else if (arg == "--isolated") isolated = true;
         else if (arg == "--description" && i + 1 < argc) desc = argv[++i];
         else if (arg == "--author" && i + 1 < argc) author = argv[++i];
         else if (arg == "--build" && i + 1 < argc) build_cmd = argv[++i];
         else if (arg == "--run" && i + 1 < argc) run_cmd = argv[++i];
+        else if (arg == "--tag" && i + 1 < argc) tags.push_back(argv[++i]);
         else if (arg == "--env" && i + 1 < argc) {
             std::string env = argv[++i];
             size_t eq = env.find('=');
@@ -384,546 +7759,2490 @@ static int cmd_create(int argc, char** argv) {
         }
     }
     
-    auto ws = load_workspaces();
-    if (find_ws(ws, name)) { err("Workspace '" + name + "' already exists"); return 1; }
-    
-    status("Creating workspace: " + name);
+    Workspace existing;
+    if (resolve_ws(name, existing)) { err("Workspace '" + name + "' already exists"); return 1; }
+    
+    status("Creating workspace: " + name);
+    
+    // Create directory structure
+    fs::create_directories(path);
+    fs::create_directories(path + "/src");
+    fs::create_directories(path + "/build");
+    fs::create_directories(path + "/tests");
+    fs::create_directories(path + "/.ws");
+    
+    // Apply language template
+    auto templates = get_templates();
+    if (templates.count(lang)) {
+        auto& tpl = templates[lang];
+        for (auto& f : tpl.files) {
+            size_t colon = f.find(':');
+            std::string fname = f.substr(0, colon);
+            std::string content = f.substr(colon + 1);
+            
+            // Replace PROJECT placeholder
+            size_t pos = 0;
+            while ((pos = content.find("PROJECT", pos)) != std::string::npos) {
+                content.replace(pos, 7, name);
+                pos += name.length();
+            }
+            
+            std::ofstream out(path + "/" + fname);
+            out << content;
+        }
+        
+        if (build_cmd.empty()) build_cmd = tpl.build_cmd;
+        if (run_cmd.empty()) run_cmd = tpl.run_cmd;
+    }
+    
+    // Create workspace object
+    Workspace w;
+    w.name = name;
+    w.path = path;
+    w.lang = lang;
+    w.display_name = name;
+    w.description = desc;
+    w.author = author.empty() ? getenv("USER") : author;
+    w.isolated = isolated;
+    w.build_cmd = build_cmd;
+    w.run_cmd = run_cmd;
+    w.env_vars = env_vars;
+    w.tags = tags;
+    w.created = std::to_string(time(nullptr));
+    
+    // Apply template commands if available
+    if (templates.count(lang)) {
+        auto& tpl = templates[lang];
+        if (w.build_cmd.empty()) w.build_cmd = tpl.build_cmd;
+        w.clean_cmd = tpl.clean_cmd;
+        if (w.run_cmd.empty()) w.run_cmd = tpl.run_cmd;
+        w.test_cmd = tpl.test_cmd;
+    }
+    
+    // Save config
+    w.save_config();
+    
+    // Save to workspace list
+    register_ws(w);
+    
+    ok("Workspace created: " + path);
+    info("Language: " + lang);
+    if (isolated) info("Isolation: enabled");
+    if (!build_cmd.empty()) info("Build: " + build_cmd);
+    std::cout << "\n" << CYAN << "Enter with: ws-enter " << name << RESET << "\n";
+    
+    return 0;
+}
+
+static std::string json_str(const std::string& s) {
+    std::string out = "\"";
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') { out += '\\'; out += c; }
+        else if (c == '\n') out += "\\n";
+        else if (c == '\t') out += "\\t";
+        else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        else out += c;
+    }
+    return out + "\"";
+}
+
+static int cmd_list(int argc, char** argv) {
+    std::vector<std::string> tags;
+    std::string lang, sort = "name";
+    int isolated = -1;
+    size_t limit = 0, offset = 0;
+    bool json = false, reindex = false;
+    
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--tag" && i + 1 < argc) tags.push_back(argv[++i]);
+        else if (arg == "--lang" && i + 1 < argc) lang = argv[++i];
+        else if (arg == "--isolated") isolated = 1;
+        else if (arg == "--not-isolated") isolated = 0;
+        else if (arg == "--sort" && i + 1 < argc) sort = argv[++i];
+        else if (arg == "--limit" && i + 1 < argc) limit = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--offset" && i + 1 < argc) offset = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--json") json = true;
+        else if (arg == "--reindex") reindex = true;
+        else {
+            std::cout << "Usage: ws-list [--tag T]... [--lang L] [--isolated | --not-isolated]\n"
+                      << "               [--sort name|size|created] [--limit N] [--offset N] [--json] [--reindex]\n";
+            return 1;
+        }
+    }
+    if (sort != "name" && sort != "size" && sort != "created") { err("Unknown sort: " + sort); return 1; }
+    
+    AttrIndex idx;
+    if (!open_attrs(idx, reindex)) { err("Cannot update " + ws_attrs()); return 1; }
+    
+    // Intersect the posting lists, shortest first
+    std::vector<std::vector<uint32_t>> lists;
+    for (auto& t : tags) lists.push_back(idx.postings("tag:" + t));
+    if (!lang.empty()) lists.push_back(idx.postings("lang:" + lang));
+    if (isolated == 1) lists.push_back(idx.postings("isolated"));
+    std::sort(lists.begin(), lists.end(), [](auto& a, auto& b) { return a.size() < b.size(); });
+    
+    std::vector<uint32_t> match;
+    if (lists.empty()) {
+        match.resize(idx.rows());
+        for (uint32_t i = 0; i < match.size(); i++) match[i] = i;
+    } else {
+        match = lists[0];
+        for (size_t l = 1; l < lists.size() && !match.empty(); l++) {
+            std::vector<uint32_t> both;
+            std::set_intersection(match.begin(), match.end(), lists[l].begin(), lists[l].end(),
+                                  std::back_inserter(both));
+            match.swap(both);
+        }
+    }
+    if (isolated == 0) {
+        std::vector<uint32_t> iso = idx.postings("isolated"), rest;
+        std::set_difference(match.begin(), match.end(), iso.begin(), iso.end(), std::back_inserter(rest));
+        match.swap(rest);
+    }
+    
+    // Largest / newest first; rows are already in name order
+    if (sort != "name") {
+        std::vector<std::pair<int64_t, uint32_t>> keyed;
+        for (uint32_t i : match) {
+            AttrRow r = idx.row(i);
+            keyed.push_back({sort == "size" ? (int64_t)r.size : r.created, i});
+        }
+        std::stable_sort(keyed.begin(), keyed.end(), [](auto& a, auto& b) { return a.first > b.first; });
+        for (size_t i = 0; i < keyed.size(); i++) match[i] = keyed[i].second;
+    }
+    
+    size_t begin = std::min(offset, match.size());
+    size_t end = limit ? std::min(match.size(), begin + limit) : match.size();
+    
+    // One object per line, written as each row is decoded
+    if (json) {
+        for (size_t i = begin; i < end; i++) {
+            WsAttrs a = idx.decode(match[i]);
+            std::string tag_list;
+            for (auto& t : a.tags) tag_list += (tag_list.empty() ? "" : ",") + json_str(t);
+            std::cout << "{\"name\":" << json_str(a.name) << ",\"display_name\":" << json_str(a.display_name)
+                      << ",\"lang\":" << json_str(a.lang) << ",\"path\":" << json_str(a.path)
+                      << ",\"description\":" << json_str(a.description) << ",\"tags\":[" << tag_list
+                      << "],\"isolated\":" << (a.isolated ? "true" : "false") << ",\"size\":" << a.size
+                      << ",\"created\":" << a.created << "}\n";
+        }
+        return 0;
+    }
+    
+    std::cout << PINK << "Workspaces (" << match.size() << "):" << RESET;
+    if (begin > 0 || end < match.size())
+        std::cout << " showing " << (end > begin ? begin + 1 : begin) << "-" << end;
+    std::cout << "\n";
+    
+    if (idx.rows() == 0) {
+        std::cout << "  None. Create with: " << CYAN << "ws-create <name>" << RESET << "\n";
+        return 0;
+    }
+    if (match.empty()) std::cout << "  No workspaces match.\n";
+    
+    for (size_t i = begin; i < end; i++) {
+        WsAttrs a = idx.decode(match[i]);
+        std::cout << "\n  " << PINK << "● " << a.display_name << RESET;
+        if (a.isolated) std::cout << " " << YELLOW << "[isolated]" << RESET;
+        std::cout << "\n";
+        
+        if (!a.description.empty())
+            std::cout << "    " << a.description << "\n";
+        std::cout << "    " << CYAN << a.lang << RESET << " • " << a.path;
+        if (sort == "size") std::cout << " • " << (a.size ? fmt_mb(a.size) : "size unknown");
+        std::cout << "\n";
+        
+        if (!a.tags.empty()) {
+            std::cout << "    Tags: ";
+            for (auto& t : a.tags) std::cout << MAGENTA << "#" << t << " " << RESET;
+            std::cout << "\n";
+        }
+    }
+    
+    return 0;
+}
+
+static int cmd_enter(int argc, char** argv) {
+    if (argc < 2) { std::cout << "Usage: ws-enter <name>\n"; return 1; }
+    
+    std::string name = argv[1];
+    
+    // Attach to a prepared workspace when ws-agent is running
+    int rc = agent_enter(name);
+    if (rc >= 0) return rc;
+    
+    Workspace w;
+    if (!open_ws(name, w)) { err("Workspace not found: " + name); return 1; }
+    
+    if (!fs::exists(w.path)) { err("Path missing: " + w.path); return 1; }
+    if (!hydrate(w)) return 1;
+    
+    status("Entering workspace: " + w.display_name);
+    
+    if (w.isolated) {
+        status("Setting up isolation...");
+        std::cout.flush();
+        
+        pid_t pid = fork();
+        if (pid == 0) {
+            enter_cgroup(w);
+            std::vector<TmpfsMount> tmpfs;
+            if (unshare(CLONE_NEWNS) == -1) {
+                std::cerr << YELLOW << "[!] Isolation requires privileges, entering normally\n" << RESET;
+            } else {
+                mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL);
+                mount("tmpfs", "/tmp", "tmpfs", 0, "size=256M");
+                // The layers lock stays open across exec, held by the shell
+                if (snapshots_enabled(w) && lock_layers(w, true) >= 0) mount_layers(w);
+                if (w.build_tmpfs) tmpfs = mount_build_tmpfs(w);
+                mount_shared(w);
+            }
+            lock_dep_caches(w);
+            
+            chdir(w.path.c_str());
+            
+            // Environment variables and custom prompt
+            apply_env(workspace_env(w));
+            
+            // Run init steps and keep the environment they set up
+            apply_env(run_init(w));
+            
+            const char* shell = getenv("SHELL");
+            if (!shell) shell = "/bin/sh";
+            
+            ok("Workspace ready. Type 'exit' to leave.");
+            std::cout.flush();
+            if (tmpfs.empty()) {
+                execlp(shell, shell, nullptr);
+                _exit(127);
+            }
+            
+            // Stay in the namespace to write the tmpfs back once the shell
+            // is gone, however it ends
+            pid_t sh = fork();
+            if (sh == 0) {
+                execlp(shell, shell, nullptr);
+                _exit(127);
+            }
+            signal(SIGINT, SIG_IGN);
+            signal(SIGQUIT, SIG_IGN);
+            signal(SIGHUP, SIG_IGN);
+            int sh_status = 0;
+            while (sh > 0 && waitpid(sh, &sh_status, 0) < 0 && errno == EINTR) {}
+            write_back_tmpfs(w, tmpfs);
+            std::cout.flush();
+            _exit(sh > 0 && WIFEXITED(sh_status) ? WEXITSTATUS(sh_status) : 1);
+        } else if (pid > 0) {
+            int status;
+            waitpid(pid, &status, 0);
+            ok("Left workspace: " + name);
+            return WEXITSTATUS(status);
+        } else {
+            err("Fork failed");
+            return 1;
+        }
+    } else {
+        if (w.build_tmpfs)
+            std::cerr << YELLOW << "[!] build_tmpfs needs an isolated workspace, keeping build/ on disk\n" << RESET;
+        if (!w.mounts.empty())
+            std::cerr << YELLOW << "[!] mount.N entries need an isolated workspace, skipping them\n" << RESET;
+        if (w.dep_cache == "ro" && !dep_caches(w).empty())
+            std::cerr << YELLOW << "[!] dep_cache ro is only enforced in isolated workspaces\n" << RESET;
+        chdir(w.path.c_str());
+        enter_cgroup(w);
+        lock_dep_caches(w);
+        
+        apply_env(workspace_env(w));
+        apply_env(run_init(w));
+        
+        const char* shell = getenv("SHELL");
+        if (!shell) shell = "/bin/sh";
+        
+        ok("Entered workspace. Type 'exit' to leave.");
+        std::cout.flush();
+        execlp(shell, shell, nullptr);
+    }
+    
+    return 0;
+}
+
+static int cmd_agent(int argc, char** argv) {
+    std::string action = argc >= 2 ? argv[1] : "status";
+    
+    if (action == "start") {
+        int idle_secs = 900;
+        size_t max_entries = 8;
+        for (int i = 2; i + 1 < argc; i += 2) {
+            std::string arg = argv[i];
+            if (arg == "--idle") idle_secs = std::max(1, std::atoi(argv[i + 1]));
+            else if (arg == "--max") max_entries = std::max(1, std::atoi(argv[i + 1]));
+        }
+        
+        std::vector<std::string> reply;
+        if (agent_request("STATUS", reply)) { info("Agent already running"); return 0; }
+        
+        std::string path = agent_socket();
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path)) { err("Socket path too long: " + path); return 1; }
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        
+        fs::create_directories(fs::path(path).parent_path());
+        unlink(path.c_str());
+        int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        mode_t old_mask = umask(077);
+        bool bound = lfd >= 0 && bind(lfd, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(lfd, 16) == 0;
+        umask(old_mask);
+        if (!bound) {
+            err("Cannot listen on " + path + ": " + strerror(errno));
+            if (lfd >= 0) close(lfd);
+            return 1;
+        }
+        
+        std::cout.flush();
+        pid_t pid = fork();
+        if (pid == 0) {
+            setsid();
+            std::string log = home_dir() + "/.cache/dreamland/agent.log";
+            int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+            int null = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if (null >= 0) dup2(null, STDIN_FILENO);
+            if (fd >= 0) { dup2(fd, STDOUT_FILENO); dup2(fd, STDERR_FILENO); }
+            agent_serve(lfd, idle_secs, max_entries);
+            unlink(path.c_str());
+            _exit(0);
+        }
+        close(lfd);
+        if (pid < 0) { err("Fork failed"); return 1; }
+        ok("Agent started (pid " + std::to_string(pid) + ", idle " + std::to_string(idle_secs) +
+           "s, max " + std::to_string(max_entries) + ")");
+        return 0;
+    }
+    
+    if (action == "stop") {
+        std::vector<std::string> reply;
+        if (!agent_request("STOP", reply)) { info("Agent not running"); return 0; }
+        ok("Agent stopped");
+        return 0;
+    }
+    
+    if (action == "status") {
+        std::vector<std::string> reply;
+        if (!agent_request("STATUS", reply)) { info("Agent not running"); return 0; }
+        std::cout << PINK << "Warm workspaces" << RESET << "\n";
+        if (reply.size() < 6) std::cout << "  (none)\n";
+        for (size_t i = 1; i + 4 < reply.size(); i += 5) {
+            std::cout << "  " << CYAN << reply[i] << RESET
+                      << "  ns: " << (reply[i + 1] == "0" ? "-" : "pid " + reply[i + 1])
+                      << "  idle: " << reply[i + 2] << "s"
+                      << "  attaches: " << reply[i + 3]
+                      << "  prepared in " << reply[i + 4] << "\n";
+        }
+        return 0;
+    }
+    
+    std::cout << "Usage: ws-agent start [--idle SECS] [--max N] | stop | status\n";
+    return 1;
+}
+
+static int cmd_delete(int argc, char** argv) {
+    if (argc < 2) { std::cout << "Usage: ws-delete <name> [--force]\n"; return 1; }
+    
+    std::string name = argv[1];
+    bool force = argc > 2 && std::string(argv[2]) == "--force";
+    
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
+    
+    if (!force) {
+        std::cout << "Delete workspace '" << w.display_name << "' and all files? [y/N]: ";
+        std::string ans; std::getline(std::cin, ans);
+        if (ans != "y" && ans != "Y") { std::cout << "Cancelled\n"; return 0; }
+    }
+    
+    status("Deleting: " + w.display_name);
+    std::string error;
+    if (!remove_tree(w.path, &error)) { err("Delete failed: " + error); return 1; }
+    remove_tree(layers_dir(w));
+    
+    if (!unregister_ws(name)) { err("Failed to update registry"); return 1; }
+    
+    ok("Deleted: " + name);
+    return 0;
+}
+
+// Run the configured or auto-detected build in the current directory
+static int run_build(const Workspace& w) {
+    ProcResult usage;
+    int rc;
+    
+    // Compile through the compiler cache and fetch through the shared
+    // dependency caches for the length of the build
+    std::vector<std::string> cc_env = compiler_cache_env(w);
+    std::vector<std::string> env = cc_env;
+    for (auto& kv : dep_cache_env(w)) env.push_back(kv);
+    EnvMap saved = current_env();
+    
+    // With workers, make runs enough jobs to keep them busy too
+    std::map<std::string, DistStats> dist_before;
+    if (!cc_env.empty() && !w.workers.empty()) {
+        unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+        for (auto& spec : w.workers) {
+            DistWorker dw;
+            if (parse_worker(spec, dw)) jobs += dw.slots;
+        }
+        std::string flags = saved.count("MAKEFLAGS") ? saved["MAKEFLAGS"] : "";
+        if (flags.find("-j") == std::string::npos && flags.find("jobserver") == std::string::npos)
+            env.push_back("MAKEFLAGS=" + flags + (flags.empty() ? "" : " ") + "-j" + std::to_string(jobs));
+        dist_before = dist_stats();
+    }
+    apply_env(env);
+    CompilerCacheStats cc_before;
+    if (!cc_env.empty()) cc_before = ccache_stats();
+    struct Restore {
+        const std::vector<std::string>& env;
+        const EnvMap& saved;
+        std::vector<int> locks;
+        ~Restore() {
+            for (auto& kv : env) {
+                std::string k = kv.substr(0, kv.find('='));
+                auto it = saved.find(k);
+                if (it != saved.end()) setenv(k.c_str(), it->second.c_str(), 1);
+                else unsetenv(k.c_str());
+            }
+            for (int fd : locks) close(fd);
+        }
+    } restore{env, saved, lock_dep_caches(w, false)};
+    
+    if (!w.build_cmd.empty()) {
+        info("Running: " + w.build_cmd);
+        rc = run_step(command_argv(w.build_cmd), w.path, usage);
+    }
+    // Auto-detect build system
+    else if (fs::exists("Makefile")) rc = run_step({"make"}, w.path, usage);
+    else if (fs::exists("CMakeLists.txt")) {
+        fs::create_directories("build");
+        rc = run_step({"cmake", ".."}, w.path + "/build", usage);
+        if (rc == 0) rc = run_step({"make"}, w.path + "/build", usage);
+    } else if (fs::exists("Cargo.toml")) rc = run_step({"cargo", "build"}, w.path, usage);
+    else if (fs::exists("package.json")) rc = run_step({"npm", "run", "build"}, w.path, usage);
+    else if (fs::exists("setup.py")) rc = run_step({"pip", "install", "-e", "."}, w.path, usage);
+    else {
+        err("No build command configured and no build system detected");
+        info("Set build command: ws-config " + w.name + " build_cmd \"your command\"");
+        return 1;
+    }
+    
+    if (usage.started) info(std::string(rc == 0 ? "Build finished in " : "Build failed after ") + fmt_usage(usage));
+    if (!cc_env.empty()) {
+        CompilerCacheStats now = ccache_stats();
+        uint64_t hits = now.hits - cc_before.hits, misses = now.misses - cc_before.misses;
+        if (hits + misses) {
+            char line[128];
+            snprintf(line, sizeof(line), "Compiler cache: %llu hits, %llu misses (%.0f%%)",
+                     (unsigned long long)hits, (unsigned long long)misses, 100.0 * hits / (hits + misses));
+            info(line);
+        }
+        if (misses && !w.workers.empty()) {
+            uint64_t remote = 0;
+            std::string list;
+            for (auto& [spec, s] : dist_stats()) {
+                const DistStats& old = dist_before[spec];
+                uint64_t jobs = s.jobs - old.jobs, failed = s.failed - old.failed;
+                if (!jobs) continue;
+                remote += jobs - failed;
+                list += (list.empty() ? "" : ", ") + spec + " " + std::to_string(jobs - failed);
+                if (failed) list += " (" + std::to_string(failed) + " failed)";
+            }
+            info("Distributed " + std::to_string(remote) + " of " + std::to_string(misses) + " compiles" +
+                 (list.empty() ? " (no worker free or reachable)" : ": " + list));
+        }
+    }
+    perf_record(w, "build", usage);
+    return rc;
+}
+
+// Build one workspace, going through the output cache when enabled
+static int build_workspace(const Workspace& w, bool use_cache) {
+    chdir(w.path.c_str());
+    enter_cgroup(w);
+    
+    if (!w.build_cache || !use_cache) return run_build(w);
+    
+    std::vector<std::string> outputs = cache_outputs(w);
+    std::string stats_path = w.path + "/.ws/buildcache.stats";
+    BuildCacheStats cstats;
+    cstats.load(stats_path);
+    
+    auto start = std::chrono::steady_clock::now();
+    std::string key = build_cache_key(w, outputs);
+    if (key.empty()) {
+        info("Build cache: could not hash inputs, building without it");
+        return run_build(w);
+    }
+    
+    double build_secs = 0;
+    if (build_cache_restore(w, key, outputs, build_secs)) {
+        double took = elapsed_s(start);
+        cstats.hits++;
+        if (build_secs > took) cstats.saved_secs += build_secs - took;
+        cstats.save(stats_path);
+        ok("Build cache hit (" + key.substr(0, 12) + "), restored in " + fmt_secs(took));
+        return 0;
+    }
+    
+    info("Build cache miss (" + key.substr(0, 12) + ")");
+    auto build_start = std::chrono::steady_clock::now();
+    int rc = run_build(w);
+    build_secs = elapsed_s(build_start);
+    cstats.misses++;
+    cstats.save(stats_path);
+    if (rc != 0) return rc;
+    
+    if (!build_cache_store(w, key, outputs, build_secs))
+        info("Build cache: could not store outputs");
+    return 0;
+}
+
+struct BuildNode {
+    enum State { PENDING, RUNNING, DONE, FAILED, SKIPPED };
+    
+    Workspace w;
+    std::vector<size_t> deps;
+    std::vector<size_t> dependents;
+    size_t waiting = 0;         // unfinished deps
+    size_t height = 0;          // longest chain of dependents, for priority
+    State state = PENDING;
+    pid_t pid = 0;
+    double start = 0, secs = 0;
+};
+
+// Build the selected workspaces and everything they depend on. Builds run
+// as child processes, at most `jobs` at a time, each writing to its own
+// .ws/build.log. Ready builds with the longest chain of dependents go
+// first so the critical path starts as early as possible.
+static int build_many(const std::string& tag, unsigned jobs, bool use_cache) {
+    std::vector<Workspace> all = load_workspaces();
+    std::map<std::string, size_t> by_name;
+    for (size_t i = 0; i < all.size(); i++) by_name[all[i].name] = i;
+    
+    // Selected workspaces plus their transitive dependencies
+    std::vector<BuildNode> nodes;
+    std::map<std::string, size_t> index;
+    std::vector<std::string> stack;
+    for (auto& w : all)
+        if (tag.empty() || std::find(w.tags.begin(), w.tags.end(), tag) != w.tags.end())
+            stack.push_back(w.name);
+    if (stack.empty()) {
+        err(tag.empty() ? "No workspaces to build" : "No workspaces tagged: " + tag);
+        return 1;
+    }
+    while (!stack.empty()) {
+        std::string name = stack.back();
+        stack.pop_back();
+        if (index.count(name)) continue;
+        index[name] = nodes.size();
+        nodes.push_back(BuildNode{});
+        nodes.back().w = all[by_name[name]];
+        for (auto& dep : nodes.back().w.depends) {
+            if (!by_name.count(dep)) { err(name + " depends on unknown workspace: " + dep); return 1; }
+            stack.push_back(dep);
+        }
+    }
+    for (size_t i = 0; i < nodes.size(); i++) {
+        for (auto& dep : nodes[i].w.depends) {
+            size_t d = index[dep];
+            if (std::find(nodes[i].deps.begin(), nodes[i].deps.end(), d) != nodes[i].deps.end()) continue;
+            nodes[i].deps.push_back(d);
+            nodes[d].dependents.push_back(i);
+        }
+        nodes[i].waiting = nodes[i].deps.size();
+    }
+    
+    // Topological order; anything left over is on a cycle
+    std::vector<size_t> order, pending(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        pending[i] = nodes[i].waiting;
+        if (pending[i] == 0) order.push_back(i);
+    }
+    for (size_t k = 0; k < order.size(); k++)
+        for (size_t d : nodes[order[k]].dependents)
+            if (--pending[d] == 0) order.push_back(d);
+    if (order.size() != nodes.size()) {
+        std::string cycle;
+        for (size_t i = 0; i < nodes.size(); i++)
+            if (pending[i]) cycle += (cycle.empty() ? "" : ", ") + nodes[i].w.name;
+        err("Dependency cycle between: " + cycle);
+        return 1;
+    }
+    for (auto it = order.rbegin(); it != order.rend(); ++it)
+        for (size_t d : nodes[*it].dependents)
+            nodes[*it].height = std::max(nodes[*it].height, nodes[d].height + 1);
+    
+    jobs = std::max(1u, std::min<unsigned>(jobs, nodes.size()));
+    status("Building " + std::to_string(nodes.size()) + " workspaces, " + std::to_string(jobs) + " at a time");
+    
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<size_t> ready;
+    for (size_t i = 0; i < nodes.size(); i++)
+        if (nodes[i].waiting == 0) ready.push_back(i);
+    std::map<pid_t, size_t> running;
+    
+    std::function<void(size_t)> skip = [&](size_t i) {
+        for (size_t d : nodes[i].dependents) {
+            if (nodes[d].state != BuildNode::PENDING) continue;
+            nodes[d].state = BuildNode::SKIPPED;
+            err(nodes[d].w.name + " skipped (" + nodes[i].w.name + " failed)");
+            skip(d);
+        }
+    };
+    
+    while (!ready.empty() || !running.empty()) {
+        while (running.size() < jobs && !ready.empty()) {
+            auto best = std::max_element(ready.begin(), ready.end(), [&](size_t a, size_t b) {
+                return nodes[a].height < nodes[b].height;
+            });
+            size_t i = *best;
+            ready.erase(best);
+            BuildNode& n = nodes[i];
+            
+            std::string log = n.w.path + "/.ws/build.log";
+            std::error_code ec;
+            fs::create_directories(n.w.path + "/.ws", ec);
+            int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                err(n.w.name + ": cannot open " + log + ": " + strerror(errno));
+                n.state = BuildNode::FAILED;
+                skip(i);
+                continue;
+            }
+            
+            std::cout.flush();
+            std::cerr.flush();
+            pid_t pid = fork();
+            if (pid == 0) {
+                dup2(fd, STDOUT_FILENO);
+                dup2(fd, STDERR_FILENO);
+                std::cout << std::unitbuf;
+                int rc = build_workspace(n.w, use_cache);
+                std::cout.flush();
+                std::cerr.flush();
+                _exit(rc == 0 ? 0 : 1);
+            }
+            close(fd);
+            if (pid < 0) {
+                err(n.w.name + ": fork failed: " + strerror(errno));
+                n.state = BuildNode::FAILED;
+                skip(i);
+                continue;
+            }
+            
+            n.state = BuildNode::RUNNING;
+            n.pid = pid;
+            n.start = elapsed_s(t0);
+            running[pid] = i;
+            info("Started: " + n.w.name);
+        }
+        if (running.empty()) break;
+        
+        int wstatus;
+        pid_t pid = waitpid(-1, &wstatus, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        auto it = running.find(pid);
+        if (it == running.end()) continue;
+        size_t i = it->second;
+        running.erase(it);
+        BuildNode& n = nodes[i];
+        n.secs = elapsed_s(t0) - n.start;
+        
+        if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0) {
+            n.state = BuildNode::DONE;
+            ok(n.w.name + " (" + fmt_secs(n.secs) + ")");
+            for (size_t d : n.dependents)
+                if (--nodes[d].waiting == 0 && nodes[d].state == BuildNode::PENDING) ready.push_back(d);
+        } else {
+            n.state = BuildNode::FAILED;
+            err(n.w.name + " failed (" + fmt_secs(n.secs) + "), see " + n.w.path + "/.ws/build.log");
+            skip(i);
+        }
+    }
+    double wall = elapsed_s(t0);
+    
+    // Critical path: walk back from the last build to finish through the
+    // dependency that finished last
+    size_t done = 0, failed = 0, skipped = 0;
+    double serial = 0;
+    long last = -1;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].state == BuildNode::DONE) done++;
+        else if (nodes[i].state == BuildNode::FAILED) failed++;
+        else if (nodes[i].state == BuildNode::SKIPPED) skipped++;
+        if (nodes[i].state != BuildNode::DONE && nodes[i].state != BuildNode::FAILED) continue;
+        serial += nodes[i].secs;
+        if (last < 0 || nodes[i].start + nodes[i].secs > nodes[last].start + nodes[last].secs) last = i;
+    }
+    std::vector<size_t> path;
+    for (long i = last; i >= 0;) {
+        path.push_back(i);
+        long next = -1;
+        for (size_t d : nodes[i].deps)
+            if (next < 0 || nodes[d].start + nodes[d].secs > nodes[next].start + nodes[next].secs) next = d;
+        i = next;
+    }
+    
+    std::cout << "\n" << PINK << "Build summary" << RESET << "\n";
+    std::cout << "  Built: " << done << "  Failed: " << failed << "  Skipped: " << skipped << "\n";
+    std::cout << "  Wall:  " << fmt_secs(wall) << " (" << fmt_secs(serial) << " of builds)\n";
+    if (!path.empty()) {
+        double len = 0;
+        std::string chain;
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            len += nodes[*it].secs;
+            chain += (chain.empty() ? "" : " → ") + nodes[*it].w.name + " " + fmt_secs(nodes[*it].secs);
+        }
+        std::cout << "  Critical path (" << fmt_secs(len) << "): " << chain << "\n";
+    }
+    return failed || skipped ? 1 : 0;
+}
+
+static int cmd_build(int argc, char** argv) {
+    std::string name, tag;
+    bool use_cache = true, all = false;
+    unsigned jobs = worker_count();
+    
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--no-cache") use_cache = false;
+        else if (arg == "--all") all = true;
+        else if (arg == "--tag" && i + 1 < argc) tag = argv[++i];
+        else if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) jobs = std::atoi(argv[++i]);
+        else if (name.empty()) name = arg;
+    }
+    
+    if (all || !tag.empty()) return build_many(tag, jobs, use_cache);
+    
+    if (name.empty()) {
+        const char* env = getenv("WS_NAME");
+        if (env) name = env;
+    }
+    
+    if (name.empty()) { err("No workspace. Use ws-build <name> or enter one first."); return 1; }
+    
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
+    if (!hydrate(w)) return 1;
+    
+    status("Building: " + w.display_name);
+    return build_workspace(w, use_cache);
+}
+
+static int cmd_run(int argc, char** argv) {
+    std::string name;
+    if (argc >= 2) name = argv[1];
+    else {
+        const char* env = getenv("WS_NAME");
+        if (env) name = env;
+    }
+    
+    if (name.empty()) { err("No workspace active"); return 1; }
+    
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
+    if (!hydrate(w)) return 1;
+    
+    if (w.run_cmd.empty()) {
+        err("No run command configured");
+        info("Set run command: ws-config " + name + " run_cmd \"your command\"");
+        return 1;
+    }
+    
+    status("Running: " + w.display_name);
+    enter_cgroup(w);
+    ProcResult usage;
+    int rc = run_step(command_argv(w.run_cmd), w.path, usage);
+    perf_record(w, "run", usage);
+    return rc;
+}
+
+static int cmd_status(int argc, char** argv) {
+    std::string name;
+    bool rescan = false, watch = false;
+    
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--rescan") rescan = true;
+        else if (arg == "--watch") watch = true;
+        else if (name.empty()) name = arg;
+    }
+    if (name.empty()) {
+        const char* env = getenv("WS_NAME");
+        if (env) name = env;
+    }
+    
+    if (name.empty()) { cmd_list(0, nullptr); return 0; }
+    
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
+    
+    std::cout << PINK << "╭─ " << w.display_name << RESET << "\n";
+    std::cout << "│\n";
+    
+    if (!w.description.empty())
+        std::cout << "│ " << w.description << "\n│\n";
+    
+    std::cout << "│ Path:     " << w.path << "\n";
+    std::cout << "│ Language: " << w.lang << "\n";
+    std::cout << "│ Author:   " << w.author << "\n";
+    std::cout << "│ Isolated: " << (w.isolated ? "yes" : "no") << "\n";
+    
+    if (!w.build_cmd.empty()) std::cout << "│ Build:    " << w.build_cmd << "\n";
+    if (!w.run_cmd.empty()) std::cout << "│ Run:      " << w.run_cmd << "\n";
+    if (!w.test_cmd.empty()) std::cout << "│ Test:     " << w.test_cmd << "\n";
+    
+    if (!w.env_vars.empty()) {
+        std::cout << "│\n│ Environment:\n";
+        for (auto& [k, v] : w.env_vars)
+            std::cout << "│   " << CYAN << k << RESET << "=" << v << "\n";
+    }
+    
+    SizeCache cache;
+    std::string cache_path = w.path + "/.ws/statcache";
+    if (fs::exists(w.path)) {
+        SizeCache old;
+        if (!rescan) old.load(cache_path);
+        
+        ScanStats stats;
+        scan_tree(w.path, ".", old, cache, stats);
+        if (fs::exists(w.path + "/.ws")) cache.save(cache_path);
+        
+        uint64_t files, size;
+        cache.totals(files, size);
+        update_attrs(w, size);
+        std::cout << "│\n";
+        std::cout << "│ Files:    " << files << "\n";
+        std::cout << "│ Size:     " << (size / 1024) << " KB\n";
+        std::cout << "│ Scanned:  " << stats.rescanned << "/" << (stats.rescanned + stats.reused) << " dirs\n";
+    }
+    
+    if (w.build_cache) {
+        BuildCacheStats cstats;
+        cstats.load(w.path + "/.ws/buildcache.stats");
+        uint64_t total = cstats.hits + cstats.misses;
+        char line[128];
+        snprintf(line, sizeof(line), "%llu hits, %llu misses (%.0f%%), %s saved",
+                 (unsigned long long)cstats.hits, (unsigned long long)cstats.misses,
+                 total ? 100.0 * cstats.hits / total : 0.0, fmt_secs(cstats.saved_secs).c_str());
+        std::cout << "│ Cache:    " << line << "\n";
+    }
+    
+    if (w.compiler_cache && (w.lang == "c" || w.lang == "cpp") && fs::exists(ccache_dir() + "/stats")) {
+        CompilerCacheStats cc = ccache_stats();
+        uint64_t total = cc.hits + cc.misses;
+        char line[160];
+        snprintf(line, sizeof(line), "%llu hits, %llu misses (%.0f%%), %llu not cacheable, %s of %s",
+                 (unsigned long long)cc.hits, (unsigned long long)cc.misses,
+                 total ? 100.0 * cc.hits / total : 0.0, (unsigned long long)cc.uncacheable,
+                 fmt_mb(cc.bytes).c_str(), w.ccache_size.c_str());
+        std::cout << "│ CC cache: " << line << "\n";
+        
+        auto dist = w.workers.empty() ? std::map<std::string, DistStats>() : dist_stats();
+        for (auto& spec : w.workers) {
+            DistWorker dw;
+            parse_worker(spec, dw);
+            const DistStats& ds = dist[dw.spec];
+            char wline[256];
+            snprintf(wline, sizeof(wline), "%s, %d jobs at a time: %llu compiles, %llu failed", dw.spec.c_str(),
+                     dw.slots, (unsigned long long)ds.jobs, (unsigned long long)ds.failed);
+            std::string extra;
+            if (ds.jobs > ds.failed && ds.secs > 0) {
+                char tp[96];
+                snprintf(tp, sizeof(tp), ", %s per compile, %s/s", fmt_secs(ds.secs / (ds.jobs - ds.failed)).c_str(),
+                         fmt_mb((uint64_t)((ds.sent + ds.received) / ds.secs)).c_str());
+                extra = tp;
+            }
+            std::cout << "│ Worker:   " << wline << extra << "\n";
+        }
+    }
+    
+    auto deps = dep_caches(w);
+    if (!deps.empty()) {
+        std::string list;
+        for (auto* c : deps) list += (list.empty() ? "" : ", ") + std::string(c->name);
+        std::cout << "│ Deps:     " << list << " (" << w.dep_cache << ")\n";
+    }
+    for (auto& m : w.mounts)
+        std::cout << "│ Mount:    " << m << (w.isolated ? "" : " (isolated only)") << "\n";
+    
+    LazyState lazy;
+    if (read_lazy(w, lazy)) {
+        ArchiveIndex idx;
+        if (!load_index(lazy.archive, idx)) {
+            std::cout << "│ Lazy:     " << lazy.archive << " is missing\n";
+        } else {
+            auto pending = lazy_pending(w, lazy, idx, {});
+            uint64_t bytes = 0;
+            for (size_t i : pending) bytes += idx.entries[i].size;
+            std::cout << "│ Lazy:     " << pending.size() << " files (" << fmt_mb(bytes) << ") still in "
+                      << lazy.archive << "\n";
+        }
+    }
+    
+    if (!w.limits.empty()) {
+        std::string list;
+        for (auto& [k, v] : w.limits) list += (list.empty() ? "" : ", ") + k + " " + v;
+        std::cout << "│ Limits:   " << list << "\n";
+    }
+    std::string cg = workspace_cgroup_path(w.name);
+    if (!cg.empty() && fs::exists(cg)) {
+        std::string pressure = cgroup_pressure(cg);
+        if (!pressure.empty()) std::cout << "│ Pressure: " << pressure << " (stalled, last 10s)\n";
+        std::string current;
+        std::ifstream mem(cg + "/memory.current");
+        if (mem >> current) std::cout << "│ Memory:   " << fmt_mb(std::strtoull(current.c_str(), nullptr, 10)) << " in use\n";
+    }
+    
+    std::cout << "╰─\n";
+    
+    if (watch && fs::exists(w.path)) watch_sizes(w.path, cache, cache_path);
+    return 0;
+}
+
+static int cmd_config(int argc, char** argv) {
+    if (argc < 3) {
+        std::cout << "Usage: ws-config <name> <key> [value]\n\n";
+        std::cout << "Config keys:\n";
+        std::cout << "  display_name       Display name\n";
+        std::cout << "  description        Description\n";
+        std::cout << "  build_cmd          Build command\n";
+        std::cout << "  run_cmd            Run command\n";
+        std::cout << "  test_cmd           Test command\n";
+        std::cout << "  clean_cmd          Clean command\n";
+        std::cout << "  env.KEY            Environment variable\n";
+        std::cout << "  tags               Comma-separated tags (ws-list --tag, ws-build --tag)\n";
+        std::cout << "  depends            Comma-separated workspaces built first by ws-build --all/--tag\n";
+        std::cout << "  isolated           Enable/disable isolation (true/false)\n";
+        std::cout << "  build_cache        Cache build outputs by input hash (true/false)\n";
+        std::cout << "  cache_inputs       Paths hashed for the build cache (default: whole tree)\n";
+        std::cout << "  cache_outputs      Paths the build cache stores (default: build)\n";
+        std::cout << "  compiler_cache     Cache c/cpp object files by preprocessed source (true/false)\n";
+        std::cout << "  ccache_size        Size of the shared compiler cache (default 5G)\n";
+        std::cout << "  workers            Build hosts for c/cpp compiles: ssh:[user@]host[:port][#jobs],\n";
+        std::cout << "                     unix:/path/to/worker.sock[#jobs] (see ws-worker)\n";
+        std::cout << "  dep_cache          Shared cargo/npm/pip/go caches: rw, ro or off (default rw)\n";
+        std::cout << "  mounts             Comma-separated source:target[:ro] bind mounts (isolated only)\n";
+        std::cout << "  build_tmpfs        Keep build/ in memory when entered isolated (true/false)\n";
+        std::cout << "  tmpfs_size         Size of each in-memory directory (e.g. 2G)\n";
+        std::cout << "  tmpfs_paths        Directories to keep in memory (default: build)\n";
+        std::cout << "  tmpfs_keep         Paths written back on exit (default: all)\n";
+        std::cout << "  cpu.max            CPU quota per period, e.g. \"200000 100000\" for 2 CPUs\n";
+        std::cout << "  cpu.weight         CPU share against other workspaces (1-10000, default 100)\n";
+        std::cout << "  memory.max         Hard memory limit (e.g. 4G)\n";
+        std::cout << "  memory.high        Memory throttling threshold\n";
+        std::cout << "  io.weight          I/O share (1-10000, default 100)\n";
+        std::cout << "  snapshot_depth     Snapshot layers kept before the oldest is merged\n";
+        std::cout << "  perf_threshold     Percent slower/larger than recent runs that ws-perf flags\n";
+        return 1;
+    }
+    
+    std::string name = argv[1];
+    std::string key = argv[2];
     
-    // Create directory structure
-    fs::create_directories(path);
-    fs::create_directories(path + "/src");
-    fs::create_directories(path + "/build");
-    fs::create_directories(path + "/tests");
-    fs::create_directories(path + "/.ws");
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
     
-    // Apply language template
-    auto templates = get_templates();
-    if (templates.count(lang)) {
-        auto& tpl = templates[lang];
-        for (auto& f : tpl.files) {
-            size_t colon = f.find(':');
-            std::string fname = f.substr(0, colon);
-            std::string content = f.substr(colon + 1);
-            
-            // Replace PROJECT placeholder
-            size_t pos = 0;
-            while ((pos = content.find("PROJECT", pos)) != std::string::npos) {
-                content.replace(pos, 7, name);
-                pos += name.length();
-            }
-            
-            std::ofstream out(path + "/" + fname);
-            out << content;
+    if (argc == 3) {
+        // Get value
+        std::string val;
+        if (key == "display_name") val = w.display_name;
+        else if (key == "description") val = w.description;
+        else if (key == "build_cmd") val = w.build_cmd;
+        else if (key == "run_cmd") val = w.run_cmd;
+        else if (key == "test_cmd") val = w.test_cmd;
+        else if (key == "clean_cmd") val = w.clean_cmd;
+        else if (key == "isolated") val = w.isolated ? "true" : "false";
+        else if (key == "build_cache") val = w.build_cache ? "true" : "false";
+        else if (key == "compiler_cache") val = w.compiler_cache ? "true" : "false";
+        else if (key == "ccache_size") val = w.ccache_size;
+        else if (key == "dep_cache") val = w.dep_cache;
+        else if (key == "build_tmpfs") val = w.build_tmpfs ? "true" : "false";
+        else if (key == "tmpfs_size") val = w.tmpfs_size;
+        else if (key == "snapshot_depth") val = std::to_string(w.snapshot_depth);
+        else if (cgroup_default(key)) val = w.limits.count(key) ? w.limits[key] : cgroup_default(key);
+        else if (key == "tmpfs_paths" || key == "tmpfs_keep" || key == "tags" || key == "mounts" ||
+                 key == "workers" || key == "depends" || key == "cache_inputs" || key == "cache_outputs") {
+            for (auto& p : key == "tmpfs_paths" ? w.tmpfs_paths : key == "tags" ? w.tags :
+                           key == "mounts" ? w.mounts : key == "workers" ? w.workers :
+                           key == "depends" ? w.depends : key == "cache_inputs" ? w.cache_inputs :
+                           key == "cache_outputs" ? w.cache_outputs : w.tmpfs_keep)
+                val += (val.empty() ? "" : ",") + p;
+        }
+        else if (key == "perf_threshold") {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%g", w.perf_threshold);
+            val = buf;
+        }
+        else if (key.find("env.") == 0) {
+            std::string env_key = key.substr(4);
+            if (w.env_vars.count(env_key)) val = w.env_vars[env_key];
+            else { err("Environment variable not set: " + env_key); return 1; }
         }
+        else { err("Unknown key: " + key); return 1; }
         
-        if (build_cmd.empty()) build_cmd = tpl.build_cmd;
-        if (run_cmd.empty()) run_cmd = tpl.run_cmd;
+        std::cout << key << " = " << val << "\n";
+        return 0;
     }
     
-    // Create workspace object
-    Workspace w;
-    w.name = name;
-    w.path = path;
-    w.lang = lang;
-    w.display_name = name;
-    w.description = desc;
-    w.author = author.empty() ? getenv("USER") : author;
-    w.isolated = isolated;
-    w.build_cmd = build_cmd;
-    w.run_cmd = run_cmd;
-    w.env_vars = env_vars;
-    w.created = std::to_string(time(nullptr));
+    // Set value. Writers of one workspace config take its lock and re-read
+    // under it, so concurrent ws-config calls never drop each other's keys.
+    std::string value = argv[3];
+    int lfd = lock_file(w.path + "/.ws/config.lock");
+    if (lfd < 0) { err("Cannot lock config: " + w.path); return 1; }
+    Workspace fresh;
+    fresh.name = w.name;
+    fresh.path = w.path;
+    fresh.load_config();
+    w = std::move(fresh);
     
-    // Apply template commands if available
-    if (templates.count(lang)) {
-        auto& tpl = templates[lang];
-        if (w.build_cmd.empty()) w.build_cmd = tpl.build_cmd;
-        w.clean_cmd = tpl.clean_cmd;
-        if (w.run_cmd.empty()) w.run_cmd = tpl.run_cmd;
-        w.test_cmd = tpl.test_cmd;
+    if (key == "display_name") w.display_name = value;
+    else if (key == "description") w.description = value;
+    else if (key == "build_cmd") w.build_cmd = value;
+    else if (key == "run_cmd") w.run_cmd = value;
+    else if (key == "test_cmd") w.test_cmd = value;
+    else if (key == "clean_cmd") w.clean_cmd = value;
+    else if (key == "isolated") w.isolated = (value == "true" || value == "1");
+    else if (key == "build_cache") w.build_cache = (value == "true" || value == "1");
+    else if (key == "compiler_cache") w.compiler_cache = (value == "true" || value == "1");
+    else if (key == "ccache_size") {
+        if (!parse_size(value)) { close(lfd); err("Bad size: " + value + " (e.g. 5G, 512M)"); return 1; }
+        w.ccache_size = value;
     }
+    else if (key == "dep_cache") {
+        if (value != "rw" && value != "ro" && value != "off") { close(lfd); err("dep_cache is rw, ro or off"); return 1; }
+        w.dep_cache = value;
+    }
+    else if (key == "build_tmpfs") w.build_tmpfs = (value == "true" || value == "1");
+    else if (key == "tmpfs_size") w.tmpfs_size = value;
+    else if (cgroup_default(key)) w.limits[key] = value;
+    else if (key == "snapshot_depth") w.snapshot_depth = std::max(1, std::atoi(value.c_str()));
+    else if (key == "tmpfs_paths") w.tmpfs_paths = split_list(value);
+    else if (key == "tmpfs_keep") w.tmpfs_keep = split_list(value);
+    else if (key == "tags") w.tags = split_list(value);
+    else if (key == "mounts") w.mounts = split_list(value);
+    else if (key == "cache_inputs") w.cache_inputs = split_list(value);
+    else if (key == "cache_outputs") w.cache_outputs = split_list(value);
+    else if (key == "depends") {
+        w.depends = split_list(value);
+        for (auto& dep : w.depends) {
+            Workspace other;
+            if (dep == w.name || !open_ws(dep, other)) { close(lfd); err("Bad dependency: " + dep); return 1; }
+        }
+    }
+    else if (key == "workers") {
+        w.workers = split_list(value);
+        for (auto& spec : w.workers) {
+            DistWorker dw;
+            if (!parse_worker(spec, dw)) { close(lfd); err("Bad worker: " + spec + " (ssh:host[#jobs] or unix:/path[#jobs])"); return 1; }
+        }
+    }
+    else if (key == "perf_threshold") w.perf_threshold = std::strtod(value.c_str(), nullptr);
+    else if (key.find("env.") == 0) {
+        std::string env_key = key.substr(4);
+        w.env_vars[env_key] = value;
+    }
+    else { close(lfd); err("Unknown key: " + key); return 1; }
     
-    // Save config
-    w.save_config();
-    
-    // Save to workspace list
-    ws.push_back(w);
-    save_workspaces(ws);
-    
-    ok("Workspace created: " + path);
-    info("Language: " + lang);
-    if (isolated) info("Isolation: enabled");
-    if (!build_cmd.empty()) info("Build: " + build_cmd);
-    std::cout << "\n" << CYAN << "Enter with: ws-enter " << name << RESET << "\n";
+    bool saved = w.save_config();
+    close(lfd);
+    if (!saved) { err("Failed to write config"); return 1; }
+    update_attrs(w, UINT64_MAX);
+    ok("Updated " + key);
     
     return 0;
 }
 
-static int cmd_list(int, char**) {
-    auto ws = load_workspaces();
-    std::cout << PINK << "Workspaces (" << ws.size() << "):\n" << RESET;
+static int cmd_clean(int argc, char** argv) {
+    std::string name;
+    if (argc >= 2) name = argv[1];
+    else {
+        const char* env = getenv("WS_NAME");
+        if (env) name = env;
+    }
     
-    if (ws.empty()) {
-        std::cout << "  None. Create with: " << CYAN << "ws-create <name>" << RESET << "\n";
+    if (name.empty()) { err("No workspace active"); return 1; }
+    
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
+    
+    status("Cleaning: " + w.display_name);
+    chdir(w.path.c_str());
+    
+    if (!w.clean_cmd.empty()) {
+        ProcResult usage;
+        return run_step(command_argv(w.clean_cmd), w.path, usage);
+    }
+    
+    // Default clean
+    if (fs::exists("build")) {
+        std::string error;
+        if (!remove_tree(w.path + "/build", &error)) { err("Clean failed: " + error); return 1; }
+        fs::create_directories("build");
+        ok("Cleaned build directory");
         return 0;
     }
     
-    for (auto& w : ws) {
-        std::cout << "\n  " << PINK << "● " << w.display_name << RESET;
-        if (w.isolated) std::cout << " " << YELLOW << "[isolated]" << RESET;
-        std::cout << "\n";
-        
-        if (!w.description.empty())
-            std::cout << "    " << w.description << "\n";
-        std::cout << "    " << CYAN << w.lang << RESET << " • " << w.path << "\n";
-        
-        if (!w.tags.empty()) {
-            std::cout << "    Tags: ";
-            for (auto& t : w.tags) std::cout << MAGENTA << "#" << t << " " << RESET;
-            std::cout << "\n";
-        }
+    err("No clean command configured");
+    return 1;
+}
+
+// Test shard history: "<count>.<index>" -> smoothed seconds, so a changed
+// --split starts fresh rather than misreading old pieces
+struct ShardHistory {
+    ConfigParser data;
+    
+    double get(size_t count, size_t index) const {
+        return std::strtod(data.get(std::to_string(count) + "." + std::to_string(index), "0").c_str(), nullptr);
     }
     
-    return 0;
+    void record(size_t count, size_t index, double secs) {
+        double old = get(count, index);
+        double v = old > 0 ? 0.5 * old + 0.5 * secs : secs;
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.3f", v);
+        data.set(std::to_string(count) + "." + std::to_string(index), buf);
+    }
+};
+
+struct TestShard {
+    size_t index = 0;
+    double estimate = 0;
+    int slot = -1;
+    double start = 0;
+    ProcResult r;
+};
+
+// Print the last `lines` lines of a file, indented
+static void print_tail(const std::string& path, size_t lines) {
+    std::string buf;
+    if (!read_whole(path, buf)) return;
+    size_t pos = buf.size();
+    if (pos && buf[pos - 1] == '\n') pos--;
+    for (size_t n = 0; n < lines && pos != std::string::npos && pos > 0; n++)
+        pos = buf.rfind('\n', pos - 1);
+    std::istringstream in(pos == std::string::npos ? buf : buf.substr(pos + 1));
+    std::string line;
+    while (std::getline(in, line)) std::cout << "    " << line << "\n";
 }
 
-static int cmd_enter(int argc, char** argv) {
-    if (argc < 2) { std::cout << "Usage: ws-enter <name>\n"; return 1; }
+// Run test_cmd as `split` pieces, `slots` at a time. Each piece sees
+// WS_SHARD_INDEX/WS_SHARD_COUNT and writes to .ws/test-shards/<i>.log.
+// Pieces are dispatched longest-first by their recorded durations, so a
+// slow piece starts early and short ones fill in behind it.
+static int test_sharded(const Workspace& w, size_t slots, size_t split) {
+    split = std::max(split, slots);
+    std::string dir = w.path + "/.ws/test-shards";
+    std::string history_path = w.path + "/.ws/test-shards.history";
+    std::error_code ec;
+    fs::create_directories(dir, ec);
     
-    std::string name = argv[1];
-    auto ws = load_workspaces();
-    Workspace* w = find_ws(ws, name);
-    if (!w) { err("Workspace not found: " + name); return 1; }
+    ShardHistory history;
+    history.data.load(history_path);
     
-    if (!fs::exists(w->path)) { err("Path missing: " + w->path); return 1; }
+    std::vector<TestShard> shards(split);
+    double known = 0;
+    size_t known_count = 0;
+    for (size_t i = 0; i < split; i++) {
+        shards[i].index = i;
+        shards[i].estimate = history.get(split, i);
+        if (shards[i].estimate > 0) { known += shards[i].estimate; known_count++; }
+    }
+    // Pieces never timed count as average so they neither jump nor trail the queue
+    for (auto& s : shards)
+        if (s.estimate <= 0 && known_count) s.estimate = known / known_count;
+    std::vector<size_t> queue(split);
+    for (size_t i = 0; i < split; i++) queue[i] = i;
+    std::stable_sort(queue.begin(), queue.end(), [&](size_t a, size_t b) {
+        return shards[a].estimate > shards[b].estimate;
+    });
     
-    status("Entering workspace: " + w->display_name);
+    status("Testing: " + w.display_name + " (" + std::to_string(split) + " shards, " +
+           std::to_string(slots) + " at a time)");
+    if (known_count) {
+        // Greedy makespan the history predicts for this order
+        std::vector<double> load(slots, 0);
+        for (size_t i : queue) *std::min_element(load.begin(), load.end()) += shards[i].estimate;
+        info("Expected: " + fmt_secs(*std::max_element(load.begin(), load.end())));
+    }
     
-    if (w->isolated) {
-        status("Setting up isolation...");
-        
-        pid_t pid = fork();
-        if (pid == 0) {
-            if (unshare(CLONE_NEWNS) == -1) {
-                std::cerr << YELLOW << "[!] Isolation requires privileges, entering normally\n" << RESET;
-            } else {
-                mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL);
-                mount("tmpfs", "/tmp", "tmpfs", 0, "size=256M");
-            }
-            
-            chdir(w->path.c_str());
-            
-            // Set environment variables
-            setenv("WS_NAME", w->name.c_str(), 1);
-            setenv("WS_PATH", w->path.c_str(), 1);
-            setenv("WS_LANG", w->lang.c_str(), 1);
-            setenv("WS_ISOLATED", "1", 1);
+    EnvMap base = current_env();
+    base["WS_SHARD_COUNT"] = std::to_string(split);
+    
+    struct sigaction ign{}, old_int, old_quit;
+    ign.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &ign, &old_int);
+    sigaction(SIGQUIT, &ign, &old_quit);
+    
+    auto t0 = std::chrono::steady_clock::now();
+    std::map<pid_t, size_t> running;
+    std::vector<bool> busy(slots, false);
+    size_t next = 0;
+    
+    while (next < queue.size() || !running.empty()) {
+        while (running.size() < slots && next < queue.size()) {
+            TestShard& s = shards[queue[next++]];
+            s.slot = std::find(busy.begin(), busy.end(), false) - busy.begin();
             
-            for (auto& [k, v] : w->env_vars) {
-                setenv(k.c_str(), v.c_str(), 1);
+            std::string log = dir + "/" + std::to_string(s.index) + ".log";
+            int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                err("Shard " + std::to_string(s.index) + ": cannot open " + log + ": " + strerror(errno));
+                continue;
             }
+            EnvMap env = base;
+            env["WS_SHARD_INDEX"] = std::to_string(s.index);
+            std::vector<std::string> envv;
+            for (auto& [k, v] : env) envv.push_back(k + "=" + v);
             
-            // Custom prompt
-            std::string prompt = "(" + w->display_name + ") \\W $ ";
-            setenv("PS1", prompt.c_str(), 1);
-            
-            // Run init commands
-            for (auto& cmd : w->init_cmds) {
-                system(cmd.c_str());
+            ProcSpec spec;
+            spec.argv = command_argv(w.test_cmd);
+            spec.cwd = w.path;
+            spec.env = &envv;
+            spec.stdout_fd = fd;
+            spec.stderr_fd = fd;
+            pid_t pid = spawn_proc(spec);
+            close(fd);
+            if (pid < 0) {
+                s.r.error = errno;
+                err("Shard " + std::to_string(s.index) + ": cannot run " + spec.argv[0] + ": " + strerror(errno));
+                continue;
             }
-            
-            const char* shell = getenv("SHELL");
-            if (!shell) shell = "/bin/sh";
-            
-            ok("Workspace ready. Type 'exit' to leave.");
-            execlp(shell, shell, nullptr);
-            _exit(127);
-        } else if (pid > 0) {
-            int status;
-            waitpid(pid, &status, 0);
-            ok("Left workspace: " + name);
-            return WEXITSTATUS(status);
-        } else {
-            err("Fork failed");
-            return 1;
-        }
-    } else {
-        chdir(w->path.c_str());
-        
-        setenv("WS_NAME", w->name.c_str(), 1);
-        setenv("WS_PATH", w->path.c_str(), 1);
-        setenv("WS_LANG", w->lang.c_str(), 1);
-        
-        for (auto& [k, v] : w->env_vars) {
-            setenv(k.c_str(), v.c_str(), 1);
+            s.r.started = true;
+            s.start = elapsed_s(t0);
+            busy[s.slot] = true;
+            running[pid] = s.index;
         }
+        if (running.empty()) break;
         
-        std::string prompt = "(" + w->display_name + ") \\W $ ";
-        setenv("PS1", prompt.c_str(), 1);
-        
-        for (auto& cmd : w->init_cmds) {
-            system(cmd.c_str());
+        int wstatus = 0;
+        struct rusage ru{};
+        pid_t pid = wait4(-1, &wstatus, 0, &ru);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
         }
+        auto it = running.find(pid);
+        if (it == running.end()) continue;
+        TestShard& s = shards[it->second];
+        running.erase(it);
+        busy[s.slot] = false;
+        fill_usage(s.r, ru, wstatus);
+        s.r.wall_secs = elapsed_s(t0) - s.start;
         
-        const char* shell = getenv("SHELL");
-        if (!shell) shell = "/bin/sh";
-        
-        ok("Entered workspace. Type 'exit' to leave.");
-        execlp(shell, shell, nullptr);
+        std::string label = "Shard " + std::to_string(s.index) + " (" + fmt_secs(s.r.wall_secs) + ")";
+        if (s.r.ok()) ok(label);
+        else err(label + " failed with exit code " + std::to_string(s.r.exit_code));
     }
+    double wall = elapsed_s(t0);
+    sigaction(SIGINT, &old_int, nullptr);
+    sigaction(SIGQUIT, &old_quit, nullptr);
     
-    return 0;
+    // Only successful pieces teach the balancer; a crash says little about length
+    size_t passed = 0, failed = 0;
+    double serial = 0;
+    ProcResult total;
+    for (auto& s : shards) {
+        if (s.r.ok()) { passed++; history.record(split, s.index, s.r.wall_secs); }
+        else failed++;
+        serial += s.r.wall_secs;
+        total.started |= s.r.started;
+        total.user_secs += s.r.user_secs;
+        total.sys_secs += s.r.sys_secs;
+        total.max_rss_kb = std::max(total.max_rss_kb, s.r.max_rss_kb);
+        total.in_blocks += s.r.in_blocks;
+        total.out_blocks += s.r.out_blocks;
+    }
+    history.data.save(history_path);
+    total.wall_secs = wall;
+    total.exit_code = failed ? 1 : 0;
+    
+    std::cout << "\n" << PINK << "Test summary" << RESET << "\n";
+    std::cout << "  Passed: " << passed << "/" << split << "  Failed: " << failed << "\n";
+    char buf[160];
+    snprintf(buf, sizeof(buf), "  Wall:   %s (%s of tests, user %.2fs, sys %.2fs)\n",
+             fmt_secs(wall).c_str(), fmt_secs(serial).c_str(), total.user_secs, total.sys_secs);
+    std::cout << buf;
+    if (serial > 0) {
+        snprintf(buf, sizeof(buf), "  Balance: %.0f%% (ideal %s)\n",
+                 100.0 * (serial / slots) / std::max(wall, 1e-9), fmt_secs(serial / slots).c_str());
+        std::cout << buf;
+    }
+    for (auto& s : shards) {
+        if (s.r.ok()) continue;
+        std::string log = dir + "/" + std::to_string(s.index) + ".log";
+        std::cout << "\n" << RED << "Shard " << s.index << " failed" << RESET << " (" << log << "):\n";
+        print_tail(log, 20);
+    }
+    perf_record(w, "test", total);
+    return failed ? 1 : 0;
 }
 
-static int cmd_delete(int argc, char** argv) {
-    if (argc < 2) { std::cout << "Usage: ws-delete <name> [--force]\n"; return 1; }
+static int cmd_test(int argc, char** argv) {
+    std::string name;
+    size_t shards = 0, split = 0;
     
-    std::string name = argv[1];
-    bool force = argc > 2 && std::string(argv[2]) == "--force";
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--shards" && i + 1 < argc) shards = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--split" && i + 1 < argc) split = std::max(1, std::atoi(argv[++i]));
+        else if (name.empty()) name = arg;
+    }
+    if (name.empty()) {
+        const char* env = getenv("WS_NAME");
+        if (env) name = env;
+    }
+    
+    if (name.empty()) { err("No workspace active"); return 1; }
     
-    auto ws = load_workspaces();
-    Workspace* w = find_ws(ws, name);
-    if (!w) { err("Not found: " + name); return 1; }
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
+    if (!hydrate(w)) return 1;
     
-    if (!force) {
-        std::cout << "Delete workspace '" << w->display_name << "' and all files? [y/N]: ";
-        std::string ans; std::getline(std::cin, ans);
-        if (ans != "y" && ans != "Y") { std::cout << "Cancelled\n"; return 0; }
+    if (w.test_cmd.empty()) {
+        err("No test command configured");
+        info("Set test command: ws-config " + name + " test_cmd \"your command\"");
+        return 1;
     }
     
-    status("Deleting: " + w->display_name);
-    if (fs::exists(w->path)) fs::remove_all(w->path);
+    enter_cgroup(w);
+    if (shards) return test_sharded(w, shards, split ? split : shards * 4);
     
-    ws.erase(std::remove_if(ws.begin(), ws.end(), [&](auto& x) { return x.name == name; }), ws.end());
-    save_workspaces(ws);
+    status("Testing: " + w.display_name);
+    ProcResult usage;
+    int rc = run_step(command_argv(w.test_cmd), w.path, usage);
+    perf_record(w, "test", usage);
+    return rc;
+}
+
+// ws-watch: inotify on the workspace tree minus the build outputs, .ws and
+// .git. A burst of saves becomes one cycle once the tree has been quiet for
+// the debounce interval (or 2s after the first event, for editors that
+// never stop writing). A cycle builds, then tests, each phase a forked
+// child in its own process group; an edit arriving mid-cycle kills it and
+// a fresh cycle starts after the next quiet period. Latency is counted
+// from the earliest save the reported result is the first to include.
+
+static volatile sig_atomic_t watch_stop = 0;
+
+static void watch_on_signal(int) { watch_stop = 1; }
+
+// Editor swap and backup files
+static bool watch_ignored(const char* name) {
+    size_t n = strlen(name);
+    if (n == 0 || !strcmp(name, "4913") || !strncmp(name, ".#", 2) || name[n - 1] == '~') return true;
+    return n > 4 && (!strcmp(name + n - 4, ".swp") || !strcmp(name + n - 4, ".swx"));
+}
+
+struct TreeWatch {
+    static const uint32_t MASK = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                 IN_ONLYDIR | IN_EXCL_UNLINK;
     
-    ok("Deleted: " + name);
-    return 0;
+    int fd = -1;
+    std::string root;
+    std::vector<std::string> excluded;
+    std::map<int, std::string> wd_rel;
+    bool warned = false;
+    
+    bool skipped(const std::string& rel) const {
+        for (auto& x : excluded) if (rel != "." && path_under(rel, x)) return true;
+        return false;
+    }
+    
+    // Watch rel and the directories below it
+    void add(const std::string& rel) {
+        if (skipped(rel)) return;
+        int wd = inotify_add_watch(fd, full_path(root, rel).c_str(), MASK);
+        if (wd < 0) {
+            if (!warned)
+                std::cerr << YELLOW << "[!] Could not watch every directory (" << strerror(errno)
+                          << "); some edits may go unnoticed" << RESET << "\n";
+            warned = true;
+            return;
+        }
+        wd_rel[wd] = rel;
+        
+        int dfd = open(full_path(root, rel).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dfd < 0) return;
+        std::vector<char> buf(32 * 1024);
+        std::vector<std::string> subdirs;
+        for_each_dirent(dfd, buf, [&](const char* name, unsigned char type) {
+            if (entry_type(dfd, name, type) == DT_DIR) subdirs.push_back(name);
+        });
+        close(dfd);
+        for (auto& sub : subdirs) add(join_rel(rel, sub));
+    }
+    
+    // Drain pending events into `changed`; "*" when the queue overflowed
+    void read_events(std::set<std::string>& changed) {
+        std::vector<char> buf(64 * 1024);
+        ssize_t len;
+        while ((len = read(fd, buf.data(), buf.size())) > 0) {
+            for (ssize_t off = 0; off < len; ) {
+                auto* ev = (struct inotify_event*)(buf.data() + off);
+                off += sizeof(struct inotify_event) + ev->len;
+                
+                if (ev->mask & IN_Q_OVERFLOW) { changed.insert("*"); continue; }
+                if (ev->mask & IN_IGNORED) { wd_rel.erase(ev->wd); continue; }
+                auto it = wd_rel.find(ev->wd);
+                if (it == wd_rel.end() || !ev->len || watch_ignored(ev->name)) continue;
+                
+                std::string rel = join_rel(it->second, ev->name);
+                if (skipped(rel)) continue;
+                if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO))) add(rel);
+                changed.insert(rel);
+            }
+        }
+    }
+};
+
+// One phase of a watch cycle, forked into its own process group
+static pid_t watch_spawn(const Workspace& w, bool test) {
+    std::cout.flush();
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0) {
+        if (pid > 0) setpgid(pid, pid);
+        return pid;
+    }
+    
+    setpgid(0, 0);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    int rc;
+    if (!test) {
+        rc = build_workspace(w, true);
+    } else {
+        status("Testing: " + w.display_name);
+        ProcResult usage;
+        rc = run_step(command_argv(w.test_cmd), w.path, usage);
+        perf_record(w, "test", usage);
+    }
+    std::cout.flush();
+    std::cerr.flush();
+    _exit(rc);
 }
 
-static int cmd_build(int argc, char** argv) {
+// Stop a running phase: SIGTERM to its group, SIGKILL if it lingers
+static void watch_cancel(pid_t pid) {
+    kill(-pid, SIGTERM);
+    for (int i = 0; i < 100; i++) {
+        if (waitpid(pid, nullptr, WNOHANG) == pid) return;
+        poll(nullptr, 0, 10);
+    }
+    kill(-pid, SIGKILL);
+    while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {}
+}
+
+static int cmd_watch(int argc, char** argv) {
     std::string name;
-    if (argc >= 2) name = argv[1];
-    else {
+    int debounce_ms = 150;
+    bool run_tests = true;
+    
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--debounce" && i + 1 < argc) debounce_ms = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--no-test") run_tests = false;
+        else if (name.empty()) name = arg;
+    }
+    if (name.empty()) {
         const char* env = getenv("WS_NAME");
         if (env) name = env;
     }
     
-    if (name.empty()) { err("No workspace. Use ws-build <name> or enter one first."); return 1; }
+    if (name.empty()) { std::cout << "Usage: ws-watch <name> [--debounce MS] [--no-test]\n"; return 1; }
+    
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
+    if (!hydrate(w)) return 1;
+    if (w.test_cmd.empty()) run_tests = false;
+    
+    TreeWatch tw;
+    tw.fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (tw.fd < 0) { err("inotify unavailable: " + std::string(strerror(errno))); return 1; }
+    tw.root = w.path;
+    tw.excluded = cache_outputs(w);
+    tw.excluded.push_back(".ws");
+    tw.excluded.push_back(".git");
+    tw.add(".");
+    
+    struct sigaction sa{}, old_int, old_term;
+    sa.sa_handler = watch_on_signal;
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+    watch_stop = 0;
+    
+    status("Watching " + w.display_name + (run_tests ? " (build + test" : " (build") + ", Ctrl-C to stop)");
     
-    auto ws = load_workspaces();
-    Workspace* w = find_ws(ws, name);
-    if (!w) { err("Not found: " + name); return 1; }
+    using Clock = std::chrono::steady_clock;
+    auto secs = [](Clock::time_point a, Clock::time_point b) { return std::chrono::duration<double>(b - a).count(); };
+    std::set<std::string> changed;
+    Clock::time_point first_change, last_change, unserved_since, phase_start;
+    bool pending = false, unserved = false;
+    pid_t child = -1;
+    bool testing = false;
+    double build_secs = 0;
+    int cycle = 0;
     
-    status("Building: " + w->display_name);
-    chdir(w->path.c_str());
+    auto finish = [&](bool good, const std::string& what) {
+        char line[256];
+        snprintf(line, sizeof(line), "Cycle %d: %s · %s from save to result", cycle, what.c_str(),
+                 fmt_secs(secs(unserved_since, Clock::now())).c_str());
+        if (good) ok(line);
+        else err(line);
+        std::cout.flush();
+        child = -1;
+        unserved = false;
+    };
     
-    if (!w->build_cmd.empty()) {
-        info("Running: " + w->build_cmd);
-        return system(w->build_cmd.c_str());
+    while (!watch_stop) {
+        int timeout = -1;
+        if (child > 0) timeout = 50;
+        if (pending) {
+            auto due = std::min(last_change + std::chrono::milliseconds(debounce_ms),
+                                first_change + std::chrono::seconds(2));
+            long left = std::chrono::duration_cast<std::chrono::milliseconds>(due - Clock::now()).count();
+            timeout = timeout < 0 ? std::max(0L, left) : std::min<long>(timeout, std::max(0L, left));
+        }
+        
+        struct pollfd pfd = {tw.fd, POLLIN, 0};
+        int r = poll(&pfd, 1, timeout);
+        if (r < 0 && errno != EINTR) break;
+        
+        if (r > 0) {
+            size_t before = changed.size();
+            tw.read_events(changed);
+            if (changed.size() != before || changed.count("*")) {
+                auto now = Clock::now();
+                if (!pending) first_change = now;
+                if (!unserved) unserved_since = now;
+                pending = unserved = true;
+                last_change = now;
+                if (child > 0) {
+                    watch_cancel(child);
+                    child = -1;
+                    info(std::string("Change during the ") + (testing ? "tests" : "build") + ", restarting");
+                }
+            }
+        }
+        
+        if (child > 0) {
+            int wstatus;
+            if (waitpid(child, &wstatus, WNOHANG) == child) {
+                int rc = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+                double took = secs(phase_start, Clock::now());
+                if (!testing) {
+                    build_secs = took;
+                    if (rc != 0) finish(false, "build failed after " + fmt_secs(took));
+                    else if (!run_tests) finish(true, "build " + fmt_secs(took));
+                    else {
+                        testing = true;
+                        phase_start = Clock::now();
+                        child = watch_spawn(w, true);
+                        if (child < 0) finish(false, "cannot start the tests: " + std::string(strerror(errno)));
+                    }
+                } else if (rc != 0) {
+                    finish(false, "build " + fmt_secs(build_secs) + ", tests failed after " + fmt_secs(took));
+                } else {
+                    finish(true, "build " + fmt_secs(build_secs) + ", tests " + fmt_secs(took));
+                }
+            }
+        }
+        
+        if (pending && child <= 0) {
+            auto now = Clock::now();
+            if (now < last_change + std::chrono::milliseconds(debounce_ms) &&
+                now < first_change + std::chrono::seconds(2))
+                continue;
+            
+            std::string list;
+            size_t shown = 0;
+            for (auto& rel : changed) {
+                if (shown++ == 3) break;
+                list += (list.empty() ? "" : ", ") + (rel == "*" ? std::string("(event queue overflowed)") : rel);
+            }
+            if (changed.size() > 3) list += " (+" + std::to_string(changed.size() - 3) + " more)";
+            std::cout << "\n";
+            info("Cycle " + std::to_string(++cycle) + ": " + list);
+            changed.clear();
+            pending = false;
+            
+            testing = false;
+            phase_start = Clock::now();
+            child = watch_spawn(w, false);
+            if (child < 0) {
+                err("fork: " + std::string(strerror(errno)));
+                break;
+            }
+        }
     }
     
-    // Auto-detect build system
-    if (fs::exists("Makefile")) return system("make");
-    else if (fs::exists("CMakeLists.txt")) {
-        fs::create_directories("build");
-        return system("cd build && cmake .. && make");
-    } else if (fs::exists("Cargo.toml")) return system("cargo build");
-    else if (fs::exists("package.json")) return system("npm run build");
-    else if (fs::exists("setup.py")) return system("pip install -e .");
-    else {
-        err("No build command configured and no build system detected");
-        info("Set build command: ws-config " + name + " build_cmd \"your command\"");
-        return 1;
-    }
+    if (child > 0) watch_cancel(child);
+    sigaction(SIGINT, &old_int, nullptr);
+    sigaction(SIGTERM, &old_term, nullptr);
+    close(tw.fd);
+    std::cout << "\n";
+    info("Stopped watching after " + std::to_string(cycle) + " cycle" + (cycle == 1 ? "" : "s"));
+    return 0;
 }
 
-static int cmd_run(int argc, char** argv) {
-    std::string name;
-    if (argc >= 2) name = argv[1];
-    else {
-        const char* env = getenv("WS_NAME");
-        if (env) name = env;
+// Serve compiles for other machines' ws-build (see DISTRIBUTED COMPILES)
+static int cmd_worker(int argc, char** argv) {
+    std::string path = dist_dir() + "/worker.sock";
+    int jobs = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) path = argv[++i];
+        else if (arg == "-j" && i + 1 < argc) jobs = std::max(1, std::atoi(argv[++i]));
+        else {
+            std::cout << "Usage: ws-worker [--socket PATH] [-j N]\n";
+            return 1;
+        }
     }
     
-    if (name.empty()) { err("No workspace active"); return 1; }
-    
-    auto ws = load_workspaces();
-    Workspace* w = find_ws(ws, name);
-    if (!w) { err("Not found: " + name); return 1; }
+    // ssh clients start the launcher directly, so make sure it's there
+    std::string bin = ccache_bin();
+    if (bin.empty()) std::cerr << YELLOW << "[!] No ws-cc launcher, ssh clients can't use this host" << RESET << "\n";
     
-    if (w->run_cmd.empty()) {
-        err("No run command configured");
-        info("Set run command: ws-config " + name + " run_cmd \"your command\"");
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) { err("Socket path too long: " + path); return 1; }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    unlink(path.c_str());
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t old_mask = umask(077);
+    bool bound = lfd >= 0 && bind(lfd, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(lfd, 64) == 0;
+    umask(old_mask);
+    if (!bound) {
+        err("Cannot listen on " + path + ": " + strerror(errno));
+        if (lfd >= 0) close(lfd);
         return 1;
     }
     
-    status("Running: " + w->display_name);
-    chdir(w->path.c_str());
-    return system(w->run_cmd.c_str());
+    struct sigaction sa{}, old_int, old_term;
+    sa.sa_handler = watch_on_signal;
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+    watch_stop = 0;
+    
+    status("Serving compiles on unix:" + path + " with " + std::to_string(jobs) + " jobs (Ctrl-C to stop)");
+    if (!bin.empty()) info("ssh clients can use this host too: worker ssh:<host>#" + std::to_string(jobs));
+    std::cout.flush();
+    
+    // At most `jobs` compiles at once; further connections wait in the backlog
+    size_t active = 0;
+    uint64_t served = 0, failed = 0;
+    auto reap = [&](bool block) {
+        int st;
+        pid_t pid;
+        while (active > 0 && (pid = waitpid(-1, &st, block ? 0 : WNOHANG)) > 0) {
+            active--;
+            served++;
+            if (!WIFEXITED(st) || WEXITSTATUS(st) != 0) failed++;
+            block = false;
+        }
+    };
+    while (!watch_stop) {
+        reap(active >= (size_t)jobs);
+        if (active >= (size_t)jobs) continue;
+        struct pollfd pfd = {lfd, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) continue;
+        int fd = accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(lfd);
+            sigaction(SIGINT, &old_int, nullptr);
+            sigaction(SIGTERM, &old_term, nullptr);
+            _exit(dist_serve(fd, fd));
+        }
+        close(fd);
+        if (pid > 0) active++;
+    }
+    
+    while (active > 0) reap(true);
+    sigaction(SIGINT, &old_int, nullptr);
+    sigaction(SIGTERM, &old_term, nullptr);
+    close(lfd);
+    unlink(path.c_str());
+    std::cout << "\n";
+    ok("Served " + std::to_string(served) + " compiles (" + std::to_string(failed) + " dropped connections)");
+    return 0;
 }
 
-static int cmd_status(int argc, char** argv) {
-    std::string name;
-    if (argc >= 2) name = argv[1];
-    else {
+static int cmd_perf(int argc, char** argv) {
+    std::string name, only;
+    size_t last = 10;
+    double threshold = -1;
+    
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--kind" && i + 1 < argc) only = argv[++i];
+        else if (arg == "--last" && i + 1 < argc) last = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--threshold" && i + 1 < argc) threshold = std::strtod(argv[++i], nullptr);
+        else if (name.empty()) name = arg;
+    }
+    if (name.empty()) {
         const char* env = getenv("WS_NAME");
         if (env) name = env;
     }
     
-    if (name.empty()) { cmd_list(0, nullptr); return 0; }
-    
-    auto ws = load_workspaces();
-    Workspace* w = find_ws(ws, name);
-    if (!w) { err("Not found: " + name); return 1; }
+    if (name.empty()) { std::cout << "Usage: ws-perf <name> [--kind build|run|test] [--last N] [--threshold PCT]\n"; return 1; }
     
-    std::cout << PINK << "╭─ " << w->display_name << RESET << "\n";
-    std::cout << "│\n";
-    
-    if (!w->description.empty())
-        std::cout << "│ " << w->description << "\n│\n";
-    
-    std::cout << "│ Path:     " << w->path << "\n";
-    std::cout << "│ Language: " << w->lang << "\n";
-    std::cout << "│ Author:   " << w->author << "\n";
-    std::cout << "│ Isolated: " << (w->isolated ? "yes" : "no") << "\n";
-    
-    if (!w->build_cmd.empty()) std::cout << "│ Build:    " << w->build_cmd << "\n";
-    if (!w->run_cmd.empty()) std::cout << "│ Run:      " << w->run_cmd << "\n";
-    if (!w->test_cmd.empty()) std::cout << "│ Test:     " << w->test_cmd << "\n";
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
+    if (threshold < 0) threshold = w.perf_threshold;
     
-    if (!w->env_vars.empty()) {
-        std::cout << "│\n│ Environment:\n";
-        for (auto& [k, v] : w->env_vars)
-            std::cout << "│   " << CYAN << k << RESET << "=" << v << "\n";
+    auto records = load_perf(w);
+    if (records.empty()) {
+        info("No runs recorded yet for " + name + " (ws-build, ws-run and ws-test record them)");
+        return 0;
     }
     
-    if (fs::exists(w->path)) {
-        size_t files = 0, size = 0;
-        for (auto& e : fs::recursive_directory_iterator(w->path)) {
-            if (e.is_regular_file()) { files++; size += e.file_size(); }
+    std::cout << "\n" << PINK << "Performance: " << w.display_name << RESET
+              << "  (regression threshold " << threshold << "%)\n";
+    
+    size_t regressions = 0;
+    for (const char* kind : {"build", "run", "test"}) {
+        if (!only.empty() && only != kind) continue;
+        std::vector<size_t> runs;
+        for (size_t i = 0; i < records.size(); i++)
+            if (records[i].kind == kind) runs.push_back(i);
+        if (runs.empty()) continue;
+        
+        std::vector<double> walls;
+        size_t failures = 0;
+        for (size_t i : runs) {
+            walls.push_back(records[i].wall);
+            if (records[i].exit_code != 0) failures++;
+        }
+        double base_wall = 0, base_rss = 0;
+        bool have_base = perf_baseline(records, records.size(), kind, base_wall, base_rss);
+        
+        std::cout << "\n" << CYAN << kind << RESET << "  " << runs.size() << " runs";
+        if (failures) std::cout << ", " << failures << " failed";
+        if (have_base) {
+            char base[64];
+            snprintf(base, sizeof(base), ", peak %.1f MB", base_rss / 1024);
+            std::cout << "  median " << fmt_secs(base_wall) << base;
+        }
+        std::cout << "\n";
+        std::vector<double> recent(walls.end() - std::min<size_t>(walls.size(), 40), walls.end());
+        std::cout << "  " << sparkline(recent) << "\n";
+        
+        char line[256];
+        for (size_t k = runs.size() - std::min(last, runs.size()); k < runs.size(); k++) {
+            const PerfRecord& r = records[runs[k]];
+            char when[32];
+            time_t t = r.when;
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&t));
+            snprintf(line, sizeof(line), "  %s  %-4s %9.3fs  user %8.3fs  sys %7.3fs  %7.1f MB  io %ld/%ld",
+                     when, r.exit_code == 0 ? "ok" : "FAIL", r.wall, r.user, r.sys, r.rss_kb / 1024.0,
+                     r.in_blocks, r.out_blocks);
+            std::cout << line;
+            std::string what = perf_regression(records, runs[k], threshold);
+            if (!what.empty()) {
+                std::cout << "  " << YELLOW << "▲ " << what << RESET;
+                regressions++;
+            }
+            std::cout << "\n";
         }
-        std::cout << "│\n";
-        std::cout << "│ Files:    " << files << "\n";
-        std::cout << "│ Size:     " << (size / 1024) << " KB\n";
     }
-    
-    std::cout << "╰─\n";
-    return 0;
+    std::cout << "\n";
+    return regressions ? 2 : 0;
 }
 
-static int cmd_config(int argc, char** argv) {
-    if (argc < 3) {
-        std::cout << "Usage: ws-config <name> <key> [value]\n\n";
-        std::cout << "Config keys:\n";
-        std::cout << "  display_name       Display name\n";
-        std::cout << "  description        Description\n";
-        std::cout << "  build_cmd          Build command\n";
-        std::cout << "  run_cmd            Run command\n";
-        std::cout << "  test_cmd           Test command\n";
-        std::cout << "  clean_cmd          Clean command\n";
-        std::cout << "  env.KEY            Environment variable\n";
-        std::cout << "  isolated           Enable/disable isolation (true/false)\n";
+// Ask a running agent to drop its warm entry, which holds the layers.
+// False while shells entered through the agent are still inside.
+static bool agent_release(const std::string& name) {
+    std::vector<std::string> reply;
+    return !agent_request("EVICT " + name, reply) || reply[0] == "OK";
+}
+
+static int cmd_snapshot(int argc, char** argv) {
+    if (argc < 2) { std::cout << "Usage: ws-snapshot <name> [label]\n"; return 1; }
+    
+    std::string name = argv[1];
+    std::string label;
+    for (int i = 2; i < argc; i++) label += (label.empty() ? "" : " ") + std::string(argv[i]);
+    
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
+    if (!hydrate(w)) return 1;
+    if (!w.isolated) {
+        err("Snapshots need an isolated workspace");
+        info("Enable with: ws-config " + name + " isolated true");
         return 1;
     }
     
-    std::string name = argv[1];
-    std::string key = argv[2];
+    auto start = std::chrono::steady_clock::now();
+    std::string dir = layers_dir(w);
+    fs::create_directories(dir);
+    if (!agent_release(name)) { err("Workspace has shells open through ws-agent; leave them first"); return 1; }
+    int lfd = lock_layers(w, false);
+    if (lfd < 0) { err("Workspace is in use; leave its sessions first"); return 1; }
     
-    auto ws = load_workspaces();
-    Workspace* w = find_ws(ws, name);
-    if (!w) { err("Not found: " + name); return 1; }
+    auto snaps = load_snapshots(w);
+    Snapshot snap;
+    snap.id = snaps.empty() ? 1 : snaps.back().id + 1;
+    snap.when = time(nullptr);
+    snap.layer = "-";
+    snap.label = label;
     
-    if (argc == 3) {
-        // Get value
-        std::string val;
-        if (key == "display_name") val = w->display_name;
-        else if (key == "description") val = w->description;
-        else if (key == "build_cmd") val = w->build_cmd;
-        else if (key == "run_cmd") val = w->run_cmd;
-        else if (key == "test_cmd") val = w->test_cmd;
-        else if (key == "clean_cmd") val = w->clean_cmd;
-        else if (key == "isolated") val = w->isolated ? "true" : "false";
-        else if (key.find("env.") == 0) {
-            std::string env_key = key.substr(4);
-            if (w->env_vars.count(env_key)) val = w->env_vars[env_key];
-            else { err("Environment variable not set: " + env_key); return 1; }
+    // The first snapshot is the workspace directory as it is; later ones
+    // freeze the changes made since
+    std::string error;
+    if (!snaps.empty()) {
+        snap.layer = "L" + std::to_string(snap.id);
+        std::string frozen = dir + "/" + snap.layer;
+        if (rename((dir + "/upper").c_str(), frozen.c_str()) != 0 && mkdir(frozen.c_str(), 0755) != 0) {
+            err("Cannot freeze changes: " + std::string(strerror(errno)));
+            close(lfd);
+            return 1;
         }
-        else { err("Unknown key: " + key); return 1; }
-        
-        std::cout << key << " = " << val << "\n";
-        return 0;
     }
+    remove_tree(dir + "/work");
+    fs::create_directories(dir + "/upper");
+    snaps.push_back(snap);
     
-    // Set value
-    std::string value = argv[3];
-    
-    if (key == "display_name") w->display_name = value;
-    else if (key == "description") w->description = value;
-    else if (key == "build_cmd") w->build_cmd = value;
-    else if (key == "run_cmd") w->run_cmd = value;
-    else if (key == "test_cmd") w->test_cmd = value;
-    else if (key == "clean_cmd") w->clean_cmd = value;
-    else if (key == "isolated") w->isolated = (value == "true" || value == "1");
-    else if (key.find("env.") == 0) {
-        std::string env_key = key.substr(4);
-        w->env_vars[env_key] = value;
+    // Fold the oldest layers into the workspace directory
+    size_t layers = std::count_if(snaps.begin(), snaps.end(), [](const Snapshot& s) { return s.layer != "-"; });
+    while (layers > w.snapshot_depth) {
+        size_t k = 0;
+        while (snaps[k].layer == "-") k++;
+        std::string layer = dir + "/" + snaps[k].layer;
+        if (!fold_layer(layer, w.path, error)) {
+            err("Compaction failed: " + error);
+            break;
+        }
+        remove_tree(layer);
+        snaps[k].layer = "-";
+        // Restore points below the new base are gone
+        snaps.erase(snaps.begin(), snaps.begin() + k);
+        layers--;
+        info("Merged snapshot " + std::to_string(snaps[0].id) + " into the workspace directory");
     }
-    else { err("Unknown key: " + key); return 1; }
     
-    w->save_config();
-    save_workspaces(ws);
-    ok("Updated " + key);
+    bool saved = save_snapshots(w, snaps);
+    close(lfd);
+    if (!saved) { err("Cannot write " + dir + "/snapshots"); return 1; }
     
+    ok("Snapshot " + std::to_string(snap.id) + " of " + name + (label.empty() ? "" : " (" + label + ")") +
+       " in " + fmt_secs(elapsed_s(start)));
+    if (snap.id == 1) info("Changes made in isolated sessions are now layered; ws-rollback discards them");
     return 0;
 }
 
-static int cmd_clean(int argc, char** argv) {
-    std::string name;
-    if (argc >= 2) name = argv[1];
-    else {
-        const char* env = getenv("WS_NAME");
-        if (env) name = env;
-    }
-    
-    if (name.empty()) { err("No workspace active"); return 1; }
+static int cmd_rollback(int argc, char** argv) {
+    if (argc < 2) { std::cout << "Usage: ws-rollback <name> [snapshot]\n"; return 1; }
     
-    auto ws = load_workspaces();
-    Workspace* w = find_ws(ws, name);
-    if (!w) { err("Not found: " + name); return 1; }
+    std::string name = argv[1];
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
+    if (!snapshots_enabled(w)) { err("No snapshots of " + name); return 1; }
     
-    status("Cleaning: " + w->display_name);
-    chdir(w->path.c_str());
+    auto start = std::chrono::steady_clock::now();
+    std::string dir = layers_dir(w);
+    if (!agent_release(name)) { err("Workspace has shells open through ws-agent; leave them first"); return 1; }
+    int lfd = lock_layers(w, false);
+    if (lfd < 0) { err("Workspace is in use; leave its sessions first"); return 1; }
     
-    if (!w->clean_cmd.empty()) {
-        return system(w->clean_cmd.c_str());
+    auto snaps = load_snapshots(w);
+    uint64_t target = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : (snaps.empty() ? 0 : snaps.back().id);
+    auto it = std::find_if(snaps.begin(), snaps.end(), [&](const Snapshot& s) { return s.id == target; });
+    if (it == snaps.end()) {
+        close(lfd);
+        err("No snapshot " + std::string(argc > 2 ? argv[2] : "") + " of " + name);
+        return 1;
     }
     
-    // Default clean
-    if (fs::exists("build")) {
-        fs::remove_all("build");
-        fs::create_directories("build");
-        ok("Cleaned build directory");
-        return 0;
+    // Discarding layers is all a rollback does
+    uint64_t files = 0;
+    uint64_t bytes = tree_bytes(dir + "/upper", &files);
+    remove_tree(dir + "/upper");
+    remove_tree(dir + "/work");
+    for (auto later = it + 1; later != snaps.end(); ++later) {
+        if (later->layer != "-") bytes += tree_bytes(dir + "/" + later->layer, &files);
+        if (later->layer != "-") remove_tree(dir + "/" + later->layer);
     }
+    size_t dropped = snaps.end() - (it + 1);
+    snaps.erase(it + 1, snaps.end());
+    fs::create_directories(dir + "/upper");
+    bool saved = save_snapshots(w, snaps);
+    close(lfd);
+    if (!saved) { err("Cannot write " + dir + "/snapshots"); return 1; }
     
-    err("No clean command configured");
-    return 1;
+    ok("Rolled " + name + " back to snapshot " + std::to_string(target) + " in " + fmt_secs(elapsed_s(start)));
+    info("Discarded " + std::to_string(files) + " changed files (" + fmt_mb(bytes) + ")" +
+         (dropped ? " and " + std::to_string(dropped) + " later snapshots" : ""));
+    return 0;
 }
 
-static int cmd_test(int argc, char** argv) {
-    std::string name;
-    if (argc >= 2) name = argv[1];
-    else {
-        const char* env = getenv("WS_NAME");
-        if (env) name = env;
-    }
+static int cmd_snapshots(int argc, char** argv) {
+    if (argc < 2) { std::cout << "Usage: ws-snapshots <name>\n"; return 1; }
     
-    if (name.empty()) { err("No workspace active"); return 1; }
+    std::string name = argv[1];
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
+    if (!snapshots_enabled(w)) {
+        info("No snapshots of " + name + ". Take one with: ws-snapshot " + name + " [label]");
+        return 0;
+    }
     
-    auto ws = load_workspaces();
-    Workspace* w = find_ws(ws, name);
-    if (!w) { err("Not found: " + name); return 1; }
+    std::string dir = layers_dir(w);
+    auto snaps = load_snapshots(w);
+    size_t layers = std::count_if(snaps.begin(), snaps.end(), [](const Snapshot& s) { return s.layer != "-"; });
+    std::cout << "\n" << PINK << "Snapshots: " << w.display_name << RESET << "  (" << layers << " layers, "
+              << "merged beyond " << w.snapshot_depth << ")\n\n";
     
-    if (w->test_cmd.empty()) {
-        err("No test command configured");
-        info("Set test command: ws-config " + name + " test_cmd \"your command\"");
-        return 1;
+    for (auto& s : snaps) {
+        char when[32];
+        time_t t = s.when;
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&t));
+        std::string size = "base";
+        if (s.layer != "-") {
+            uint64_t files = 0;
+            uint64_t bytes = tree_bytes(dir + "/" + s.layer, &files);
+            size = "+" + std::to_string(files) + " files, " + fmt_mb(bytes);
+        }
+        char line[128];
+        snprintf(line, sizeof(line), "  %s#%-4llu%s  %s  %-24s", CYAN, (unsigned long long)s.id, RESET, when, size.c_str());
+        std::cout << line << s.label << "\n";
     }
-    
-    status("Testing: " + w->display_name);
-    chdir(w->path.c_str());
-    return system(w->test_cmd.c_str());
+    uint64_t files = 0;
+    uint64_t bytes = tree_bytes(dir + "/upper", &files);
+    std::cout << "\n  Since last snapshot: " << files << " files, " << fmt_mb(bytes) << "\n\n";
+    return 0;
 }
 
 static int cmd_clone(int argc, char** argv) {
     if (argc < 3) {
-        std::cout << "Usage: ws-clone <source> <new_name>\n";
+        std::cout << "Usage: ws-clone <source> <new_name> [--skip-build]\n\n";
+        std::cout << "Options:\n";
+        std::cout << "  --skip-build         Don't copy build/ output\n";
         return 1;
     }
     
     std::string src_name = argv[1];
     std::string dst_name = argv[2];
+    bool skip_build = false;
+    
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--skip-build") skip_build = true;
+    }
     
-    auto ws = load_workspaces();
-    Workspace* src = find_ws(ws, src_name);
-    if (!src) { err("Source not found: " + src_name); return 1; }
-    if (find_ws(ws, dst_name)) { err("Destination exists: " + dst_name); return 1; }
+    auto t0 = std::chrono::steady_clock::now();
+    Workspace src, existing;
+    if (!open_ws(src_name, src)) { err("Source not found: " + src_name); return 1; }
+    if (resolve_ws(dst_name, existing)) { err("Destination exists: " + dst_name); return 1; }
+    double t_resolve = elapsed_s(t0);
+    if (!hydrate(src)) return 1;
     
     status("Cloning workspace: " + src_name + " → " + dst_name);
     
     std::string dst_path = ws_base() + "/" + dst_name;
+    if (fs::exists(dst_path)) { err("Destination path exists: " + dst_path); return 1; }
     
     // Copy directory
-    fs::copy(src->path, dst_path, fs::copy_options::recursive);
+    auto t1 = std::chrono::steady_clock::now();
+    std::string error;
+    CopyStats stats;
+    std::vector<std::string> skip;
+    if (skip_build) skip.push_back("build");
+    if (!copy_tree(src.path, dst_path, &error, &stats, skip)) {
+        err("Clone failed: " + error);
+        remove_tree(dst_path);
+        return 1;
+    }
+    double t_copy = elapsed_s(t1);
     
     // Create new workspace
-    Workspace w = *src;
+    auto t2 = std::chrono::steady_clock::now();
+    Workspace w = src;
     w.name = dst_name;
     w.path = dst_path;
     w.display_name = dst_name;
     w.created = std::to_string(time(nullptr));
     
     w.save_config();
-    ws.push_back(w);
-    save_workspaces(ws);
+    register_ws(w);
+    double t_register = elapsed_s(t2);
     
     ok("Cloned to: " + dst_path);
+    info("Copied " + std::to_string(stats.files.load()) + " files, " +
+         std::to_string(stats.bytes / 1024) + " KB (" +
+         std::to_string(stats.reflinked.load()) + " reflinked, " +
+         std::to_string(stats.holes / 1024) + " KB left sparse)" +
+         (skip_build ? ", build/ skipped" : ""));
+    info("Phases: resolve " + fmt_secs(t_resolve) + ", copy " + fmt_secs(t_copy) +
+         ", register " + fmt_secs(t_register));
+    return 0;
+}
+
+// Top-level directory name used inside archives
+static std::string archive_prefix(const Workspace& w) {
+    std::string base = fs::path(w.path).lexically_normal().filename().string();
+    return base.empty() ? w.name : base;
+}
+
+static int cmd_dedup(int argc, char** argv) {
+    std::vector<std::string> names;
+    bool dry_run = false;
+    uint64_t min_size = 4096;
+    
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--dry-run") dry_run = true;
+        else if (arg == "--min-size" && i + 1 < argc) min_size = std::max<uint64_t>(1, parse_size(argv[++i]));
+        else names.push_back(arg);
+    }
+    
+    std::vector<Workspace> all = read_registry(), targets;
+    if (names.empty()) targets = all;
+    for (auto& name : names) {
+        auto it = std::find_if(all.begin(), all.end(), [&](const Workspace& w) { return w.name == name; });
+        if (it == all.end()) { err("Not found: " + name); return 1; }
+        targets.push_back(*it);
+    }
+    if (targets.empty()) { info("No workspaces to scan"); return 0; }
+    
+    int lfd = lock_file(dedup_dir() + "/lock");
+    if (lfd < 0) { err("Cannot lock " + dedup_dir()); return 1; }
+    auto index = load_dedup_index();
+    auto start = std::chrono::steady_clock::now();
+    
+    std::vector<DedupFile> files;
+    std::mutex mu;
+    for (auto& w : targets) collect_files(w.path, min_size, files, mu);
+    uint64_t scanned_bytes = 0;
+    for (auto& f : files) scanned_bytes += f.size;
+    
+    // Only a size that several inodes on one device share can hide a
+    // duplicate; everything else is never read
+    std::map<std::pair<uint64_t, uint64_t>, std::set<uint64_t>> inodes;
+    for (auto& f : files) inodes[{f.dev, f.size}].insert(f.ino);
+    std::vector<DedupFile*> candidates;
+    for (auto& f : files)
+        if (inodes[{f.dev, f.size}].size() > 1) candidates.push_back(&f);
+    
+    std::atomic<uint64_t> hashed{0}, hashed_bytes{0};
+    size_t reused = 0;
+    {
+        ThreadPool pool(0, 1024);
+        for (DedupFile* f : candidates) {
+            auto it = index.find(f->path);
+            if (it != index.end() && same_file_state(it->second, *f)) {
+                f->digest = it->second.digest;
+                f->shared = it->second.shared;
+                reused++;
+                continue;
+            }
+            pool.submit([f, &hashed, &hashed_bytes] {
+                thread_local std::vector<char> buf(256 * 1024);
+                int fd = open(f->path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+                if (fd < 0) return;
+                if (hash_fd(fd, buf, f->digest)) {
+                    hashed++;
+                    hashed_bytes += f->size;
+                }
+                close(fd);
+            });
+        }
+        pool.wait();
+    }
+    
+    std::map<std::tuple<uint64_t, uint64_t, std::string>, std::vector<DedupFile*>> groups;
+    for (DedupFile* f : candidates)
+        if (!f->digest.empty()) groups[{f->dev, f->size, f->digest}].push_back(f);
+    
+    uint64_t dup_files = 0, dup_bytes = 0, reflinked = 0, linked = 0, already = 0, left = 0;
+    std::map<uint64_t, bool> no_reflink;    // per device, after the first refusal
+    for (auto& [key, group] : groups) {
+        std::sort(group.begin(), group.end(), [](const DedupFile* a, const DedupFile* b) { return a->path < b->path; });
+        DedupFile* leader = group[0];
+        std::set<uint64_t> seen = {leader->ino};
+        
+        for (DedupFile* f : group) {
+            if (!seen.insert(f->ino).second) continue;
+            dup_files++;
+            dup_bytes += f->size;
+            if (f->shared) { already += f->size; continue; }
+            if (dry_run) continue;
+            
+            bool done = false;
+            if (!no_reflink[f->dev]) {
+                int src = open(leader->path.c_str(), O_RDONLY | O_CLOEXEC);
+                int dst = open(f->path.c_str(), O_RDWR | O_CLOEXEC);
+                if (dst < 0) dst = open(f->path.c_str(), O_RDONLY | O_CLOEXEC);
+                int64_t n = src >= 0 && dst >= 0 ? dedupe_range(src, dst, f->size) : -1;
+                if (n < 0 && (errno == EOPNOTSUPP || errno == EINVAL || errno == ENOTTY || errno == EXDEV))
+                    no_reflink[f->dev] = true;
+                if (src >= 0) close(src);
+                if (dst >= 0) close(dst);
+                if (n == (int64_t)f->size) {
+                    reflinked += f->size;
+                    f->shared = leader->shared = done = true;
+                }
+            }
+            if (!done && no_reflink[f->dev]) {
+                bool read_only = !(f->mode & 0222) && f->mode == leader->mode &&
+                                 f->uid == leader->uid && f->gid == leader->gid;
+                if (read_only && hardlink_over(*leader, *f)) {
+                    if (f->nlink == 1) linked += f->size;
+                    f->ino = leader->ino;
+                    f->mtime = leader->mtime;
+                    f->shared = leader->shared = true;
+                } else {
+                    left += f->size;
+                }
+            }
+        }
+    }
+    
+    if (!dry_run) {
+        for (DedupFile* f : candidates)
+            if (!f->digest.empty()) index[f->path] = *f;
+        if (!save_dedup_index(index)) err("Could not write " + dedup_dir() + "/index");
+    }
+    close(lfd);
+    
+    std::cout << "\n" << PINK << "Dedup" << (dry_run ? " (dry run)" : "") << RESET << "\n";
+    std::cout << "  Scanned:   " << files.size() << " files, " << fmt_mb(scanned_bytes) << " in "
+              << targets.size() << " workspace" << (targets.size() == 1 ? "" : "s") << "\n";
+    std::cout << "  Hashed:    " << hashed << " files, " << fmt_mb(hashed_bytes) << " (" << reused
+              << " unchanged since the last run)\n";
+    std::cout << "  Duplicate: " << dup_files << " files, " << fmt_mb(dup_bytes) << "\n";
+    if (already) std::cout << "  Shared:    " << fmt_mb(already) << " already shared\n";
+    if (!dry_run) {
+        std::cout << "  Reclaimed: " << fmt_mb(reflinked + linked) << " (reflinked " << fmt_mb(reflinked)
+                  << ", hardlinked " << fmt_mb(linked) << ")\n";
+        if (left)
+            std::cout << "  Left:      " << fmt_mb(left)
+                      << " in writable files (no reflink support on this filesystem)\n";
+    }
+    std::cout << "  Took:      " << fmt_secs(elapsed_s(start)) << "\n";
+    return 0;
+}
+
+static int cmd_gc(int, char**) {
+    int lfd = lock_file(dedup_dir() + "/lock");
+    if (lfd < 0) { err("Cannot lock " + dedup_dir()); return 1; }
+    
+    auto index = load_dedup_index();
+    auto registry = read_registry();
+    size_t total = index.size(), missing = 0, changed = 0, orphaned = 0;
+    for (auto it = index.begin(); it != index.end(); ) {
+        bool registered = std::any_of(registry.begin(), registry.end(),
+                                      [&](const Workspace& w) { return path_under(it->first, w.path); });
+        struct stat st;
+        DedupFile now;
+        bool gone = !registered || stat(it->first.c_str(), &st) != 0;
+        if (!gone) stat_into(st, now);
+        
+        if (!registered) orphaned++;
+        else if (gone) missing++;
+        else if (!same_file_state(now, it->second)) changed++;
+        else { ++it; continue; }
+        it = index.erase(it);
+    }
+    
+    bool saved = save_dedup_index(index);
+    close(lfd);
+    if (!saved) { err("Could not write " + dedup_dir() + "/index"); return 1; }
+    ok("Pruned " + std::to_string(total - index.size()) + " of " + std::to_string(total) + " index entries (" +
+       std::to_string(missing) + " gone, " + std::to_string(changed) + " changed, " + std::to_string(orphaned) +
+       " outside registered workspaces)");
     return 0;
 }
 
+// ws-deps [list] | ws-deps clean <cache>... | --all
+static int cmd_deps(int argc, char** argv) {
+    std::string action = argc >= 2 ? argv[1] : "list";
+    
+    if (action == "list") {
+        std::map<std::string, size_t> users_by_cache;
+        for (auto& w : read_registry())
+            if (w.load_config())
+                for (auto* c : dep_caches(w)) users_by_cache[c->name]++;
+        
+        for (auto& c : DEP_CACHES) {
+            std::string dir = deps_dir() + "/" + c.name;
+            uint64_t files = 0, bytes = fs::exists(dir) ? tree_bytes(dir, &files) : 0;
+            size_t users = users_by_cache[c.name];
+            
+            // Busy if some build or shell holds the lock
+            int fd = lock_dep_cache(c, false);
+            bool busy = fd < 0;
+            if (fd >= 0) close(fd);
+            
+            std::cout << "  " << CYAN << c.name << RESET << " (" << c.lang << "): " << fmt_mb(bytes) << ", "
+                      << files << " files, " << users << " workspace" << (users == 1 ? "" : "s")
+                      << (busy ? ", in use" : "") << "\n";
+        }
+        info("Caches live in " + deps_dir());
+        return 0;
+    }
+    
+    if (action != "clean" || argc < 3) {
+        std::cout << "Usage: ws-deps [list]\n";
+        std::cout << "       ws-deps clean <cache>... | --all\n";
+        return 1;
+    }
+    
+    bool all = std::string(argv[2]) == "--all";
+    std::vector<const DepCache*> targets;
+    for (auto& c : DEP_CACHES)
+        if (all) targets.push_back(&c);
+    for (int i = 2; i < argc && !all; i++) {
+        auto it = std::find_if(std::begin(DEP_CACHES), std::end(DEP_CACHES),
+                               [&](const DepCache& c) { return argv[i] == std::string(c.name); });
+        if (it == std::end(DEP_CACHES)) { err(std::string("Unknown cache: ") + argv[i]); return 1; }
+        targets.push_back(&*it);
+    }
+    
+    int rc = 0;
+    for (auto* c : targets) {
+        std::string dir = deps_dir() + "/" + c->name;
+        int fd = lock_dep_cache(*c, false);
+        if (fd < 0) {
+            err(std::string(c->name) + " is in use by a build or an entered workspace, left alone");
+            rc = 1;
+            continue;
+        }
+        uint64_t bytes = tree_bytes(dir);
+        std::string error;
+        bool removed = remove_tree(dir, &error);
+        std::error_code ec;
+        fs::create_directories(dir, ec);
+        close(fd);
+        if (!removed) { err("Cleaning " + std::string(c->name) + " failed: " + error); rc = 1; continue; }
+        ok("Cleaned " + std::string(c->name) + " (" + fmt_mb(bytes) + ")");
+    }
+    return rc;
+}
+
 static int cmd_export(int argc, char** argv) {
-    if (argc < 3) {
-        std::cout << "Usage: ws-export <name> <output.tar.gz>\n";
+    std::vector<std::string> args;
+    std::string base_path;
+    bool seekable = false;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--base" && i + 1 < argc) base_path = argv[++i];
+        else if (a == "--seekable") seekable = true;
+        else args.push_back(a);
+    }
+    if (args.size() < 2) {
+        std::cout << "Usage: ws-export <name> <output.tar.gz> [--base <archive|manifest>] [--seekable]\n";
         return 1;
     }
     
-    std::string name = argv[1];
-    std::string output = argv[2];
+    std::string name = args[0];
+    std::string output = args[1];
+    
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
+    if (!hydrate(w)) return 1;
+    
+    // A delta needs the manifest of the archive it builds on
+    Manifest base;
+    std::string base_id, error;
+    if (!base_path.empty() && !load_manifest(base_path, base, base_id, error)) {
+        err(error);
+        return 1;
+    }
     
-    auto ws = load_workspaces();
-    Workspace* w = find_ws(ws, name);
-    if (!w) { err("Not found: " + name); return 1; }
+    status((base_path.empty() ? "Exporting workspace: " : "Exporting changes since " + base_path + ": ") + name);
+    auto t0 = std::chrono::steady_clock::now();
     
-    status("Exporting workspace: " + name);
+    int fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) { err("Cannot write " + output + ": " + strerror(errno)); return 1; }
+    struct stat out_st;
+    fstat(fd, &out_st);
     
-    std::string cmd = "tar czf " + output + " -C " + 
-                      fs::path(w->path).parent_path().string() + " " +
-                      fs::path(w->path).filename().string();
+    // Walk, tar and compress in one pass; the archive itself is skipped
+    // in case it is written inside the workspace
+    ParallelGzip gz(fd, 0, seekable);
+    TarWriter tar([&](const char* p, size_t n) { gz.write(p, n); });
+    std::unique_ptr<IndexWriter> index;
+    if (seekable) index.reset(new IndexWriter(tar, gz, archive_prefix(w)));
+    Manifest manifest;
+    DeltaStats delta;
+    bool good = export_tree(tar, w, archive_prefix(w), &out_st, base_path.empty() ? nullptr : &base, base_id,
+                            manifest, delta, error);
+    if (index) index->finish(out_st);
+    else tar.finish();
+    if (!gz.finish() && error.empty()) error = strerror(errno);
+    if (index && !index->trailer(fd) && error.empty()) error = strerror(errno);
+    if (close(fd) != 0 && error.empty()) error = strerror(errno);
+    
+    if (!good || !error.empty()) {
+        err("Export failed: " + error);
+        unlink(output.c_str());
+        return 1;
+    }
     
-    int ret = system(cmd.c_str());
-    if (ret == 0) ok("Exported to: " + output);
-    else err("Export failed");
+    // Kept beside the archive so the next delta needn't decompress it
+    if (!write_atomic(output + ".manifest", manifest_text(manifest)))
+        std::cerr << YELLOW << "[!] Cannot write " << output << ".manifest" << RESET << "\n";
     
-    return ret;
+    double secs = elapsed_s(t0);
+    ok("Exported to: " + output);
+    info(std::to_string(tar.files()) + " files, " + fmt_mb(gz.bytes_in()) + " → " +
+         fmt_mb(gz.bytes_out()) + " in " + fmt_secs(secs) + " (" + fmt_rate(gz.bytes_in(), secs) +
+         ", " + std::to_string(gz.threads()) + " threads)");
+    if (index) info("Seekable: " + std::to_string(index->members()) + " members, indexed");
+    if (!base_path.empty()) {
+        int saved = delta.tree_bytes ? (int)(100 - 100.0 * gz.bytes_out() / delta.tree_bytes) : 0;
+        info(std::to_string(delta.changed) + " changed (" + std::to_string(delta.patched) + " patched, " +
+             fmt_mb(delta.reused_bytes) + " reused), " + std::to_string(delta.removed) + " removed");
+        info("Sent " + fmt_mb(delta.sent_bytes) + " of " + fmt_mb(delta.tree_bytes) + ", archive " +
+             fmt_mb(gz.bytes_out()) + " (" + std::to_string(std::max(saved, 0)) + "% saved)");
+    }
+    return 0;
+}
+
+// ws-import --list: straight from the index of a seekable archive
+static int list_archive(const std::string& archive, const std::vector<std::string>& paths) {
+    ArchiveIndex idx;
+    if (!load_index(archive, idx)) {
+        err(archive + " has no index (write it with ws-export --seekable)");
+        return 1;
+    }
+    uint64_t files = 0, bytes = 0;
+    for (auto& e : idx.entries) {
+        std::string rel = idx.rel(e);
+        if (rel.empty() || (!paths.empty() && !under_any(rel, paths))) continue;
+        char line[64];
+        snprintf(line, sizeof(line), "%c %04o %12llu  ", e.type, (unsigned)e.mode, (unsigned long long)e.size);
+        std::cout << line << rel << (e.type == 'd' ? "/" : e.type == 'l' ? " -> " + e.link : "") << "\n";
+        if (e.type != 'd') files++;
+        bytes += e.size;
+    }
+    info(std::to_string(files) + " files, " + fmt_mb(bytes) + " in " + std::to_string(idx.members.size()) +
+         " members");
+    return 0;
 }
 
 static int cmd_import(int argc, char** argv) {
-    if (argc < 3) {
-        std::cout << "Usage: ws-import <archive.tar.gz> <name>\n";
+    std::vector<std::string> args, only;
+    bool list = false, lazy = false;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--list") list = true;
+        else if (a == "--lazy") lazy = true;
+        else if (a == "--only" && i + 1 < argc) only.push_back(fs::path(argv[++i]).lexically_normal().string());
+        else args.push_back(a);
+    }
+    if (list && !args.empty()) return list_archive(args[0], std::vector<std::string>(args.begin() + 1, args.end()));
+    if (args.size() < 2) {
+        std::cout << "Usage: ws-import <archive.tar.gz> [delta.tar.gz...] <name> [--only PATH]... [--lazy]\n"
+                  << "       ws-import --list <archive.tar.gz> [PATH...]\n";
         return 1;
     }
     
-    std::string archive = argv[1];
-    std::string name = argv[2];
+    std::string archive = args[0];
+    std::string name = args.back();
+    std::vector<std::string> deltas(args.begin() + 1, args.end() - 1);
+    for (auto& p : only)
+        while (!p.empty() && p.back() == '/') p.pop_back();
     
-    if (!fs::exists(archive)) { err("Archive not found: " + archive); return 1; }
+    for (size_t i = 0; i + 1 < args.size(); i++)
+        if (!fs::exists(args[i])) { err("Archive not found: " + args[i]); return 1; }
+    if (is_delta_archive(archive)) { err(archive + " is a delta; import the full archive it builds on first"); return 1; }
     
-    auto ws = load_workspaces();
-    if (find_ws(ws, name)) { err("Workspace exists: " + name); return 1; }
+    // Picking paths needs the index; a lazy tree can't take patches
+    ArchiveIndex idx;
+    bool indexed = load_index(archive, idx);
+    if ((lazy || !only.empty()) && !indexed) {
+        err(archive + " has no index; export it with ws-export --seekable to import selected paths");
+        return 1;
+    }
+    if ((lazy || !only.empty()) && !deltas.empty()) { err("Deltas need the whole tree: drop --only/--lazy"); return 1; }
     
-    status("Importing workspace: " + name);
+    Workspace existing;
+    if (resolve_ws(name, existing)) { err("Workspace exists: " + name); return 1; }
     
     std::string dst_path = ws_base() + "/" + name;
-    fs::create_directories(dst_path);
+    if (fs::exists(dst_path)) { err("Destination path exists: " + dst_path); return 1; }
     
-    std::string cmd = "tar xzf " + archive + " -C " + dst_path + " --strip-components=1";
-    int ret = system(cmd.c_str());
+    status("Importing workspace: " + name);
+    auto t0 = std::chrono::steady_clock::now();
+    fs::create_directories(dst_path);
+    std::string error;
     
-    if (ret != 0) {
-        err("Import failed");
-        fs::remove_all(dst_path);
-        return ret;
+    if (indexed) {
+        // The workspace's own settings always come along
+        if (!only.empty() || lazy) only.push_back(".ws");
+        std::vector<size_t> pick;
+        uint64_t left = 0, left_bytes = 0;
+        for (size_t i = 0; i < idx.entries.size(); i++) {
+            const IndexEntry& e = idx.entries[i];
+            std::string rel = idx.rel(e);
+            if (e.type == 'd' || rel.empty()) continue;
+            if (only.empty() || under_any(rel, only)) {
+                pick.push_back(i);
+            } else {
+                left++;
+                left_bytes += e.size;
+            }
+        }
+        
+        ExtractStats stats;
+        if (!index_dirs(idx, dst_path, false, error) ||
+            !extract_indexed(archive, idx, pick, dst_path, stats, error)) {
+            err("Import failed: " + error);
+            remove_tree(dst_path);
+            return 1;
+        }
+        index_dirs(idx, dst_path, true, error);
+        
+        double secs = elapsed_s(t0);
+        info(std::to_string(stats.files) + " files, " + fmt_mb(stats.inflated) + " → " + fmt_mb(stats.bytes) +
+             " in " + fmt_secs(secs) + " (" + fmt_rate(stats.bytes, secs) + ", " + std::to_string(stats.threads) +
+             " threads)");
+        if (lazy && left) {
+            Workspace lw;
+            lw.path = dst_path;
+            LazyState s{fs::absolute(archive).string(), only};
+            if (!write_lazy(lw, s)) {
+                err("Cannot record the lazy import in " + dst_path + "/.ws");
+                remove_tree(dst_path);
+                return 1;
+            }
+            info(std::to_string(left) + " files (" + fmt_mb(left_bytes) +
+                 ") left in the archive until first use (or ws-hydrate)");
+        } else if (left) {
+            info(std::to_string(left) + " files (" + fmt_mb(left_bytes) + ") not imported");
+        }
+    } else {
+        TarExtractor tar(dst_path, 1);
+        uint64_t archive_bytes = 0;
+        if (!extract_archive(archive, tar, archive_bytes, error)) {
+            err("Import failed: " + error);
+            remove_tree(dst_path);
+            return 1;
+        }
+        double secs = elapsed_s(t0);
+        info(std::to_string(tar.files()) + " files, " + fmt_mb(archive_bytes) + " → " +
+             fmt_mb(tar.bytes()) + " in " + fmt_secs(secs) + " (" + fmt_rate(tar.bytes(), secs) + ")");
     }
     
     // Load workspace config
@@ -932,13 +10251,58 @@ static int cmd_import(int argc, char** argv) {
     w.path = dst_path;
     w.load_config();
     
-    ws.push_back(w);
-    save_workspaces(ws);
+    // Then each delta on top, each checked against the manifest of what
+    // came before it
+    Manifest m;
+    std::string last_id;
+    if (!deltas.empty() && !load_manifest(archive, m, last_id, error)) {
+        err("Cannot apply deltas: " + error);
+        remove_tree(dst_path);
+        return 1;
+    }
+    for (auto& d : deltas) {
+        auto td = std::chrono::steady_clock::now();
+        DeltaResult res;
+        if (!apply_delta(w, d, m, last_id, res, error)) {
+            err("Applying " + d + " failed: " + error);
+            remove_tree(dst_path);
+            return 1;
+        }
+        
+        int saved = res.tree_bytes ? (int)(100 - 100.0 * res.archive_bytes / res.tree_bytes) : 0;
+        ok("Applied " + d + " in " + fmt_secs(elapsed_s(td)));
+        info(std::to_string(res.files) + " files, " + std::to_string(res.patched) + " patched (" +
+             fmt_mb(res.reused) + " reused), " + std::to_string(res.removed) + " removed");
+        info(fmt_mb(res.archive_bytes) + " for a " + fmt_mb(res.tree_bytes) + " tree (" +
+             std::to_string(std::max(saved, 0)) + "% saved)");
+    }
+    if (!deltas.empty()) w.load_config();
     
+    register_ws(w);
     ok("Imported: " + name);
     return 0;
 }
 
+static int cmd_hydrate(int argc, char** argv) {
+    if (argc < 2) {
+        std::cout << "Usage: ws-hydrate <name> [PATH...]\n";
+        return 1;
+    }
+    
+    std::string name = argv[1];
+    Workspace w;
+    if (!open_ws(name, w)) { err("Not found: " + name); return 1; }
+    
+    std::vector<std::string> paths;
+    for (int i = 2; i < argc; i++) {
+        std::string p = fs::path(argv[i]).lexically_normal().string();
+        while (!p.empty() && p.back() == '/') p.pop_back();
+        paths.push_back(p);
+    }
+    if (!fs::exists(w.path + "/.ws/lazy")) { ok(name + " is fully extracted"); return 0; }
+    return hydrate(w, paths) ? 0 : 1;
+}
+
 // ============================================
 // MODULE EXPORTS
 // ============================================
@@ -955,18 +10319,29 @@ static DreamlandModuleInfo module_info = {
 
 static DreamlandCommand commands[] = {
     {"ws-create", "Create a new workspace", "ws-create <name> [--lang <lang>] [--isolated]", cmd_create},
-    {"ws-list", "List all workspaces", "ws-list", cmd_list},
+    {"ws-list", "List workspaces", "ws-list [--tag T] [--lang L] [--isolated] [--sort name|size|created] [--limit N] [--offset N] [--json]", cmd_list},
     {"ws-enter", "Enter a workspace", "ws-enter <name>", cmd_enter},
+    {"ws-agent", "Keep workspaces warm for fast entry", "ws-agent start [--idle SECS] [--max N] | stop | status", cmd_agent},
     {"ws-delete", "Delete a workspace", "ws-delete <name> [--force]", cmd_delete},
-    {"ws-build", "Build workspace project", "ws-build [name]", cmd_build},
+    {"ws-build", "Build workspace project", "ws-build [name] [--no-cache] | --all | --tag <t> [-j N]", cmd_build},
     {"ws-run", "Run workspace project", "ws-run [name]", cmd_run},
-    {"ws-test", "Test workspace project", "ws-test [name]", cmd_test},
+    {"ws-test", "Test workspace project", "ws-test [name] [--shards N] [--split M]", cmd_test},
+    {"ws-watch", "Rebuild and test on every save", "ws-watch [name] [--debounce MS] [--no-test]", cmd_watch},
+    {"ws-worker", "Compile for other machines' distributed builds", "ws-worker [--socket PATH] [-j N]", cmd_worker},
+    {"ws-perf", "Show resource usage history", "ws-perf [name] [--kind K] [--last N] [--threshold PCT]", cmd_perf},
     {"ws-clean", "Clean workspace build", "ws-clean [name]", cmd_clean},
-    {"ws-status", "Show workspace status", "ws-status [name]", cmd_status},
+    {"ws-status", "Show workspace status", "ws-status [name] [--rescan] [--watch]", cmd_status},
     {"ws-config", "Get/set workspace config", "ws-config <name> <key> [value]", cmd_config},
-    {"ws-clone", "Clone a workspace", "ws-clone <source> <new_name>", cmd_clone},
-    {"ws-export", "Export workspace to archive", "ws-export <name> <output.tar.gz>", cmd_export},
-    {"ws-import", "Import workspace from archive", "ws-import <archive.tar.gz> <name>", cmd_import},
+    {"ws-snapshot", "Snapshot an isolated workspace", "ws-snapshot <name> [label]", cmd_snapshot},
+    {"ws-rollback", "Roll back to a snapshot", "ws-rollback <name> [snapshot]", cmd_rollback},
+    {"ws-snapshots", "List workspace snapshots", "ws-snapshots <name>", cmd_snapshots},
+    {"ws-clone", "Clone a workspace", "ws-clone <source> <new_name> [--skip-build]", cmd_clone},
+    {"ws-dedup", "Share storage of identical files across workspaces", "ws-dedup [name...] [--dry-run] [--min-size SIZE]", cmd_dedup},
+    {"ws-gc", "Prune stale entries from the dedup index", "ws-gc", cmd_gc},
+    {"ws-deps", "List or clean the shared dependency caches", "ws-deps [list] | ws-deps clean <cache>... | --all", cmd_deps},
+    {"ws-export", "Export workspace to archive", "ws-export <name> <output.tar.gz> [--base <archive|manifest>] [--seekable]", cmd_export},
+    {"ws-import", "Import workspace from archive", "ws-import <archive.tar.gz> [delta.tar.gz...] <name> [--only PATH]... [--lazy] | --list <archive>", cmd_import},
+    {"ws-hydrate", "Extract what a lazy import left in its archive", "ws-hydrate <name> [PATH...]", cmd_hydrate},
 };
 
 DREAMLAND_MODULE_EXPORT DreamlandModuleInfo* dreamland_module_info() {
@@ -986,3 +10361,8 @@ DREAMLAND_MODULE_EXPORT DreamlandCommand* dreamland_module_commands(int* count)
     *count = sizeof(commands) / sizeof(commands[0]);
     return commands;
 }
+
+// Called by the ws-cc launcher (see COMPILER CACHE)
+DREAMLAND_MODULE_EXPORT int ws_cc_main(int argc, char** argv) {
+    return compiler_cache_main(argc, argv);
+}
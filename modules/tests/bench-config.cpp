@@ -0,0 +1,162 @@
+// ConfigParser benchmark: load + get_list(mount./init./tag.) + get on
+// generated configs, against the std::map parser it replaced, counting
+// operator new calls. Also checks that both save byte-identical files and
+// that overwriting values doesn't grow the parser.
+//
+//   g++ -std=c++17 -O2 -pthread -I<dir with dreamland_module.h> \
+//       -o bench-config modules/tests/bench-config.cpp -ldl -lz
+//   ./bench-config [lines...]
+
+#include <new>
+#include <cstdlib>
+#include <atomic>
+
+static std::atomic<long> allocs{0};
+
+void* operator new(std::size_t n) {
+    allocs++;
+    void* p = std::malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+#include "../sources/workspace.cpp"
+
+// The parser ConfigParser replaced, as the baseline
+class MapConfigParser {
+public:
+    std::map<std::string, std::string> data;
+    
+    bool load(const std::string& path) {
+        if (!fs::exists(path)) return false;
+        std::ifstream f(path);
+        std::string line;
+        while (std::getline(f, line)) {
+            line = trim(line);
+            if (line.empty() || line[0] == '#') continue;
+            
+            size_t eq = line.find(':');
+            if (eq == std::string::npos) eq = line.find('=');
+            if (eq == std::string::npos) continue;
+            
+            std::string key = trim(line.substr(0, eq));
+            std::string val = trim(line.substr(eq + 1));
+            if (val.size() >= 2 && val[0] == '"' && val.back() == '"')
+                val = val.substr(1, val.size() - 2);
+            data[key] = val;
+        }
+        return true;
+    }
+    
+    void save(const std::string& path) {
+        std::ofstream f(path);
+        for (auto& [k, v] : data) f << k << ": " << v << "\n";
+    }
+    
+    std::string get(const std::string& key, const std::string& def = "") const {
+        auto it = data.find(key);
+        return it != data.end() ? it->second : def;
+    }
+    
+    std::vector<std::string> get_list(const std::string& prefix) const {
+        std::vector<std::string> result;
+        for (auto& [k, v] : data)
+            if (k.find(prefix) == 0) result.push_back(v);
+        return result;
+    }
+
+private:
+    static std::string trim(const std::string& s) {
+        size_t start = 0, end = s.size();
+        while (start < end && std::isspace(s[start])) start++;
+        while (end > start && std::isspace(s[end - 1])) end--;
+        return s.substr(start, end - start);
+    }
+};
+
+static void generate(const std::string& path, int lines) {
+    std::ofstream f(path);
+    f << "# generated\nname: big\nlang: cpp\n";
+    for (int i = 0; i < lines; i++) {
+        switch (i % 5) {
+        case 0: f << "env.VAR_" << i << " = \"value number " << i << "\"\n"; break;
+        case 1: f << "mount." << i << ": /srv/data/" << i << ":/mnt/" << i << "\n"; break;
+        case 2: f << "init." << i << ": echo step " << i << "\n"; break;
+        case 3: f << "tag." << i << ": tag-" << i << "\n"; break;
+        default: f << "  key_" << i << "   =   plain value " << i << "  \n"; break;
+        }
+    }
+}
+
+template <class Parser>
+static void bench(const char* label, const std::string& path, int lines) {
+    const int rounds = 20;
+    long before = allocs;
+    auto start = std::chrono::steady_clock::now();
+    size_t sink = 0;
+    for (int r = 0; r < rounds; r++) {
+        Parser p;
+        p.load(path);
+        sink += p.get_list("mount.").size() + p.get_list("init.").size() + p.get_list("tag.").size();
+        sink += p.get("lang").size();
+    }
+    double ms = elapsed_s(start) * 1000 / rounds;
+    printf("  %-6s %7d lines  %8.2f ms  %8ld allocs  (%zu)\n", label, lines, ms, (allocs - before) / rounds, sink);
+}
+
+static long max_rss_kb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> sizes;
+    for (int i = 1; i < argc; i++) sizes.push_back(std::atoi(argv[i]));
+    if (sizes.empty()) sizes = {30, 1000, 100000};
+    
+    char dir[] = "/tmp/bench-config.XXXXXX";
+    if (!mkdtemp(dir)) return 1;
+    std::string conf = std::string(dir) + "/config";
+    int rc = 0;
+    
+    // 2M overwrites of 50 keys: storage must be reused, not appended.
+    // Runs first, before the big configs raise the high-water mark.
+    long rss = max_rss_kb();
+    ConfigParser p;
+    for (int i = 0; i < 2000000; i++) {
+        p.set("key" + std::to_string(i % 50), std::string(100, 'a' + i % 2));
+        if (i % 1000 == 0) {
+            p.erase_prefix("mount.");
+            p.set("mount.0", "x");
+        }
+    }
+    long grew = max_rss_kb() - rss;
+    printf("2M overwrites: max RSS +%ld KB\n", grew);
+    if (grew > 64 * 1024) rc = 1;
+    
+    printf("load + get_list x3 + get, 20 rounds:\n");
+    for (int lines : sizes) {
+        generate(conf, lines);
+        bench<MapConfigParser>("map", conf, lines);
+        bench<ConfigParser>("sorted", conf, lines);
+        
+        MapConfigParser old;
+        old.load(conf);
+        old.save(conf + ".map");
+        ConfigParser cur;
+        cur.load(conf);
+        cur.save(conf + ".sorted");
+        std::ifstream a(conf + ".map"), b(conf + ".sorted");
+        std::string sa((std::istreambuf_iterator<char>(a)), {}), sb((std::istreambuf_iterator<char>(b)), {});
+        if (sa != sb) {
+            printf("  save() output differs at %d lines\n", lines);
+            rc = 1;
+        }
+    }
+    
+    remove_tree(dir);
+    return rc;
+}
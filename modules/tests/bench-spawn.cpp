@@ -0,0 +1,45 @@
+// Spawn latency of the modules' run_proc against system(): /bin/true run
+// straight from argv, through sh -c, and through system(), N times each.
+//
+//   g++ -std=c++17 -O2 -pthread -I<dir with dreamland_module.h> \
+//       -o bench-spawn modules/tests/bench-spawn.cpp -ldl -lz
+//   ./bench-spawn [runs]
+//
+// Benchmarks opsec.cpp's copy of the process layer; add
+// -DMODULE_SRC='"../sources/workspace.cpp"' for workspace.cpp's.
+
+#ifndef MODULE_SRC
+#define MODULE_SRC "../sources/opsec.cpp"
+#endif
+#include MODULE_SRC
+
+template <class F>
+static double us_per_call(int runs, F fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) fn();
+    std::chrono::duration<double, std::micro> took = std::chrono::steady_clock::now() - start;
+    return took.count() / runs;
+}
+
+int main(int argc, char** argv) {
+    int runs = argc > 1 ? std::atoi(argv[1]) : 2000;
+    
+    ProcSpec direct;
+    direct.argv = {"/bin/true"};
+    ProcSpec shell;
+    shell.argv = {"/bin/sh", "-c", "/bin/true"};
+    if (!run_proc(direct).ok() || !run_proc(shell).ok()) {
+        std::cerr << "run_proc failed\n";
+        return 1;
+    }
+    
+    double sys = us_per_call(runs, [] { return system("/bin/true"); });
+    double argv_us = us_per_call(runs, [&] { return run_proc(direct); });
+    double sh_us = us_per_call(runs, [&] { return run_proc(shell); });
+    
+    printf("%s, /bin/true, %d runs\n", MODULE_SRC, runs);
+    printf("  system():              %6.0f us/call\n", sys);
+    printf("  run_proc, argv:        %6.0f us/call\n", argv_us);
+    printf("  run_proc, sh -c:       %6.0f us/call\n", sh_us);
+    return 0;
+}
@@ -0,0 +1,160 @@
+#!/bin/sh
+# Regression test: ws-import must not follow symlinks laid down by the archive
+# being imported, by the base archive under a delta, or put in a lazily
+# imported tree before it is hydrated. Builds the module the way workspace.pkg does and drives it
+# through a small dlopen harness.
+#
+#   sh modules/tests/workspace-import-symlinks.sh [dir with dreamland_module.h]
+
+set -u
+HERE=$(cd "$(dirname "$0")" && pwd)
+SRC="${HERE}/../sources/workspace.cpp"
+T=$(mktemp -d /tmp/ws-symlinks.XXXXXX) || exit 1
+trap 'rm -rf "${T}"' EXIT
+
+if [ -n "${1:-}" ]; then
+    cp "$1/dreamland_module.h" "${T}/" || exit 1
+else
+    curl -sL -o "${T}/dreamland_module.h" \
+        https://raw.githubusercontent.com/LinkNavi/Galactica/main/Dreamland/include/dreamland_module.h || exit 1
+fi
+
+cat > "${T}/driver.cpp" <<'EOF'
+#include <dlfcn.h>
+#include <cstdio>
+#include <cstring>
+#include "dreamland_module.h"
+int main(int argc, char** argv) {
+    void* h = dlopen(argv[1], RTLD_NOW);
+    if (!h) { fprintf(stderr, "%s\n", dlerror()); return 2; }
+    auto init = (int(*)())dlsym(h, "dreamland_module_init");
+    auto cmds = (DreamlandCommand*(*)(int*))dlsym(h, "dreamland_module_commands");
+    init();
+    int n;
+    DreamlandCommand* c = cmds(&n);
+    for (int i = 0; i < n; i++)
+        if (!strcmp(c[i].name, argv[2])) return c[i].fn(argc - 2, argv + 2);
+    return 2;
+}
+EOF
+
+echo "Building workspace module..."
+g++ -std=c++17 -O2 -fPIC -shared -pthread -I"${T}" -o "${T}/workspace.so" "${SRC}" -ldl -lz || exit 1
+g++ -std=c++17 -I"${T}" -o "${T}/driver" "${T}/driver.cpp" -ldl || exit 1
+
+# top/p/, top/p/esc -> ${T}/outside, top/p/esc/pwned: the last entry lands
+# outside the workspace if the extractor resolves paths through the link.
+# top/q -> ${T}/outside/clobber followed by a regular file top/q must replace
+# the link, not write through it.
+#
+# base.tar.gz has top/esc -> ${T}/victim. Deltas on top of it remove
+# esc/secret (not in the base) or set a 0777 directory entry for esc; both
+# must be refused without touching the victim.
+#
+# dotdot.tar.gz is seekable, with a directory outside the workspace in its
+# index. lazy.tar.gz is seekable with directories esc and esc/sub (0777),
+# which the test swaps for a symlink to the victim before hydrating.
+mkdir -p "${T}/outside" "${T}/victim"
+echo secret > "${T}/victim/secret"
+mkdir -p "${T}/victim/sub"
+chmod 755 "${T}/victim" "${T}/victim/sub"
+python3 - "${T}" <<'EOF' || exit 1
+import hashlib, io, struct, sys, tarfile, zlib
+t = sys.argv[1]
+def entry(tar, name, kind, data=b"", link=""):
+    info = tarfile.TarInfo(name)
+    info.type, info.linkname, info.size, info.mode = kind, link, len(data), 0o755
+    tar.addfile(info, io.BytesIO(data) if data else None)
+with tarfile.open(t + "/escape.tar.gz", "w:gz") as tar:
+    entry(tar, "top/p", tarfile.DIRTYPE)
+    entry(tar, "top/p/esc", tarfile.SYMTYPE, link=t + "/outside")
+    entry(tar, "top/p/esc/pwned", tarfile.REGTYPE, b"pwned\n")
+with tarfile.open(t + "/replace.tar.gz", "w:gz") as tar:
+    entry(tar, "top/q", tarfile.SYMTYPE, link=t + "/outside/clobber")
+    entry(tar, "top/q", tarfile.REGTYPE, b"inside\n")
+
+def row(kind, mode, path, link=""):
+    return "%s\t%o\t0\t0\t\t0\t\t%s\t%s\n" % (kind, mode, link, path)
+base = "# wsmanifest 1\n" + row("l", 0o777, "esc", t + "/victim")
+with tarfile.open(t + "/base.tar.gz", "w:gz") as tar:
+    entry(tar, "top", tarfile.DIRTYPE)
+    entry(tar, "top/esc", tarfile.SYMTYPE, link=t + "/victim")
+open(t + "/base.tar.gz.manifest", "w").write(base)
+def delta(name, records, manifest):
+    text = "# wsmanifest 1\n" + manifest
+    control = "base %s\ntarget %s\nprefix top\n%s" % (
+        hashlib.sha256(base.encode()).hexdigest(), hashlib.sha256(text.encode()).hexdigest(), records)
+    with tarfile.open(t + "/" + name, "w:gz") as tar:
+        entry(tar, ".ws-delta", tarfile.DIRTYPE)
+        entry(tar, ".ws-delta/control", tarfile.REGTYPE, control.encode())
+        entry(tar, ".ws-manifest", tarfile.REGTYPE, text.encode())
+delta("remove.tar.gz", "-\tesc/secret\n", row("l", 0o777, "esc", t + "/victim"))
+delta("chmod.tar.gz", "", row("d", 0o777, "esc"))
+
+# Files in one gzip member, .ws-index in another, then the trailer pointing
+# at it (see SEEKABLE ARCHIVES in workspace.cpp). `dirs` are only indexed.
+def seekable(name, files, dirs):
+    def gz(data):
+        c = zlib.compressobj(9, zlib.DEFLATED, 31)
+        return c.compress(data) + c.flush()
+    buf, rows = io.BytesIO(), []
+    tar = tarfile.open(fileobj=buf, mode="w", format=tarfile.GNU_FORMAT)
+    for path, data in files:
+        start = tar.offset
+        entry(tar, path, tarfile.REGTYPE, data)
+        rows.append("f\t755\t0\t%d\t%d\t%d\t\t%s\n" % (len(data), start, tar.offset - start, path))
+    rows += ["d\t%o\t0\t0\t%d\t0\t\t%s/\n" % (mode, tar.offset, path) for path, mode in dirs]
+    body = gz(buf.getvalue())
+    text = ("# wsindex 1\nprefix top\nm\t0\t0\n" + "".join(rows)).encode()
+    buf = io.BytesIO()
+    tar = tarfile.open(fileobj=buf, mode="w", format=tarfile.GNU_FORMAT)
+    entry(tar, ".ws-index", tarfile.REGTYPE, text)
+    tar.close()
+    trailer = b"\x1f\x8b\x08\x04\0\0\0\0\0\xff\x14\0WS\x10\0" + struct.pack("<Q", len(body)) + \
+        b"wsindex1\x03" + b"\0" * 9
+    open(t + "/" + name, "wb").write(body + gz(buf.getvalue()) + trailer)
+seekable("dotdot.tar.gz", [("top/f", b"f\n")], [("top/a/" + "../" * 40 + t.lstrip("/") + "/outside/made", 0o755)])
+seekable("lazy.tar.gz", [("top/f", b"f\n"), ("top/g", b"g\n")],
+         [("top/.ws", 0o755), ("top/esc", 0o755), ("top/esc/sub", 0o777)])
+EOF
+
+FAILED=0
+check() {
+    if eval "$2"; then echo "ok   - $1"; else echo "FAIL - $1"; FAILED=1; fi
+}
+
+run() {
+    HOME="${T}/home" USER=tester "${T}/driver" "${T}/workspace.so" "$@" > "${T}/out" 2>&1
+}
+WS="${T}/home/.local/share/dreamland/workspaces"
+mkdir -p "${T}/home"
+
+run ws-import "${T}/escape.tar.gz" escape
+check "import through an archive symlink fails" "[ $? -ne 0 ]"
+check "nothing written outside the workspace" "[ ! -e '${T}/outside/pwned' ]"
+
+run ws-import "${T}/replace.tar.gz" replace
+check "file replacing an archive symlink imports" "[ $? -eq 0 ]"
+check "link target left untouched" "[ ! -e '${T}/outside/clobber' ]"
+check "file written in place of the link" "[ ! -L '${WS}/replace/q' ] && grep -q inside '${WS}/replace/q'"
+
+run ws-import "${T}/base.tar.gz" "${T}/remove.tar.gz" remove
+check "delta removing through a base symlink fails" "[ $? -ne 0 ]"
+check "file behind the symlink left alone" "[ -f '${T}/victim/secret' ]"
+
+run ws-import "${T}/base.tar.gz" "${T}/chmod.tar.gz" chmod
+check "delta directory entry over a base symlink fails" "[ $? -ne 0 ]"
+check "directory behind the symlink keeps its mode" "[ \"\$(stat -c %a '${T}/victim')\" = 755 ]"
+
+run ws-import "${T}/dotdot.tar.gz" --only f dotdot
+check "selective import of a directory outside the workspace fails" "[ $? -ne 0 ]"
+check "no directory made outside the workspace" "[ ! -e '${T}/outside/made' ]"
+
+run ws-import "${T}/lazy.tar.gz" --lazy --only f lazy
+check "lazy import succeeds" "[ $? -eq 0 ]"
+rm -rf "${WS}/lazy/esc" && ln -s "${T}/victim" "${WS}/lazy/esc"
+run ws-hydrate lazy
+check "hydrating past a symlinked directory succeeds" "[ $? -eq 0 ] && [ -f '${WS}/lazy/g' ]"
+check "directory behind the symlink keeps its mode after hydrating" "[ \"\$(stat -c %a '${T}/victim/sub')\" = 755 ]"
+
+exit ${FAILED}